@@ -11,6 +11,7 @@ Packager: 	Andy Loening <loening at alum dot mit dot edu>
 
 Requires:	xmedcon >= 0.10.0
 Requires:	gsl
+Requires:	fftw
 Requires:	volpack
 Requires:	ffmpeg-libs >= 0.4.9
 Requires:	dcmtk >= 3.6.0
@@ -25,6 +26,7 @@ BuildRequires:  gnome-doc-utils
 BuildRequires:  libgnomecanvas-devel 
 BuildRequires:  ffmpeg-devel >= 0.4.9
 BuildRequires:  gsl-devel
+BuildRequires:  fftw-devel
 BuildRequires:  dcmtk-devel
 BuildRequires:  perl-XML-Parser
 BuildRequires:  glib2-devel
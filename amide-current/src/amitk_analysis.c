@@ -0,0 +1,278 @@
+/* amitk_analysis.c
+ *
+ * Part of amide - Amide's a Medical Image Data Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#include "amide_config.h"
+
+#include "amitk_analysis.h"
+#include "amitk_marshal.h"
+
+enum {
+  ANALYSIS_CHANGED,
+  LAST_SIGNAL
+};
+
+/* the signals after which an roi's statistics are no longer good */
+static gchar * roi_signal_names[] = {
+  "roi_changed",
+  "space_changed",
+  "volume_changed",
+  NULL
+};
+
+/* same for data sets */
+static gchar * data_set_signal_names[] = {
+  "invalidate_slice_cache",
+  "space_changed",
+  "voxel_size_changed",
+  "time_changed",
+  NULL
+};
+
+static void analysis_class_init          (AmitkAnalysisClass *klass);
+static void analysis_init                (AmitkAnalysis      *analysis);
+static void analysis_finalize            (GObject            *object);
+static void analysis_watch               (AmitkAnalysis      *analysis,
+					  gpointer            object);
+static void analysis_unwatch             (gpointer            object,
+					  gpointer            value,
+					  gpointer            analysis);
+static void analysis_object_changed_cb   (gpointer            object,
+					  gpointer            analysis);
+static void analysis_object_weak_notify  (gpointer            analysis,
+					  GObject            *where_the_object_was);
+static GObjectClass * parent_class;
+static guint     analysis_signals[LAST_SIGNAL];
+
+
+
+GType amitk_analysis_get_type(void) {
+
+  static GType analysis_type = 0;
+
+  if (!analysis_type)
+    {
+      static const GTypeInfo analysis_info =
+      {
+	sizeof (AmitkAnalysisClass),
+	(GBaseInitFunc) NULL,
+	(GBaseFinalizeFunc) NULL,
+	(GClassInitFunc) analysis_class_init,
+	(GClassFinalizeFunc) NULL,
+	NULL,		/* class_data */
+	sizeof (AmitkAnalysis),
+	0,			/* n_preallocs */
+	(GInstanceInitFunc) analysis_init,
+	NULL /* value table */
+      };
+
+      analysis_type = g_type_register_static (G_TYPE_OBJECT, "AmitkAnalysis", &analysis_info, 0);
+    }
+
+  return analysis_type;
+}
+
+
+static void analysis_class_init (AmitkAnalysisClass * class) {
+
+  GObjectClass *gobject_class = G_OBJECT_CLASS (class);
+
+  parent_class = g_type_class_peek_parent(class);
+
+  gobject_class->finalize = analysis_finalize;
+
+  analysis_signals[ANALYSIS_CHANGED] =
+    g_signal_new ("analysis_changed",
+		  G_TYPE_FROM_CLASS(class),
+		  G_SIGNAL_RUN_LAST,
+		  G_STRUCT_OFFSET(AmitkAnalysisClass, analysis_changed),
+		  NULL, NULL, amitk_marshal_NONE__NONE,
+		  G_TYPE_NONE,0);
+
+}
+
+static void analysis_init (AmitkAnalysis * analysis) {
+
+  analysis->calculation_type = ALL_VOXELS;
+  analysis->accurate = FALSE;
+  analysis->subfraction = 0.0;
+  analysis->threshold_percentage = 0.0;
+  analysis->threshold_value = 0.0;
+
+  analysis->cache = analysis_cache_new();
+  analysis->watched = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  return;
+}
+
+
+static void analysis_finalize (GObject *object) {
+
+  AmitkAnalysis * analysis = AMITK_ANALYSIS(object);
+
+  if (analysis->watched != NULL) {
+    g_hash_table_foreach(analysis->watched, analysis_unwatch, analysis);
+    g_hash_table_destroy(analysis->watched);
+    analysis->watched = NULL;
+  }
+
+  if (analysis->cache != NULL) {
+    g_hash_table_destroy(analysis->cache);
+    analysis->cache = NULL;
+  }
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+
+/* hook up to an roi or data set, so we know when its statistics go bad */
+static void analysis_watch(AmitkAnalysis * analysis, gpointer object) {
+
+  gchar ** signal_names;
+  gint i;
+
+  if (g_hash_table_lookup_extended(analysis->watched, object, NULL, NULL))
+    return;
+
+  if (AMITK_IS_ROI(object))
+    signal_names = roi_signal_names;
+  else
+    signal_names = data_set_signal_names;
+
+  for (i=0; signal_names[i] != NULL; i++)
+    g_signal_connect(G_OBJECT(object), signal_names[i],
+		     G_CALLBACK(analysis_object_changed_cb), analysis);
+
+  /* the cache doesn't hold references, so we need to know when an object goes away */
+  g_object_weak_ref(G_OBJECT(object), analysis_object_weak_notify, analysis);
+  g_hash_table_insert(analysis->watched, object, NULL);
+
+  return;
+}
+
+static void analysis_unwatch(gpointer object, gpointer value, gpointer analysis) {
+
+  g_signal_handlers_disconnect_by_func(G_OBJECT(object),
+				       G_CALLBACK(analysis_object_changed_cb), analysis);
+  g_object_weak_unref(G_OBJECT(object), analysis_object_weak_notify, analysis);
+
+  return;
+}
+
+static void analysis_object_changed_cb(gpointer object, gpointer analysis) {
+
+  amitk_analysis_invalidate_object(AMITK_ANALYSIS(analysis), object);
+
+  return;
+}
+
+static void analysis_object_weak_notify(gpointer data, GObject * where_the_object_was) {
+
+  AmitkAnalysis * analysis = data;
+
+  g_hash_table_remove(analysis->watched, where_the_object_was);
+  amitk_analysis_invalidate_object(analysis, where_the_object_was);
+
+  return;
+}
+
+
+
+AmitkAnalysis * amitk_analysis_new (void) {
+
+  AmitkAnalysis * analysis;
+
+  analysis = g_object_new(amitk_analysis_get_type(), NULL);
+
+  return analysis;
+}
+
+
+/* returns a list of roi analyses, see analysis_roi_init.  Only the statistics
+   that aren't already cached get calculated.  If the calculation parameters
+   differ from the last call, everything gets recalculated.  Returns NULL if
+   canceled through update_func. */
+analysis_roi_t * amitk_analysis_get_roi_analyses(AmitkAnalysis * analysis,
+						 AmitkStudy * study,
+						 GList * rois,
+						 GList * data_sets,
+						 analysis_calculation_t calculation_type,
+						 gboolean accurate,
+						 gdouble subfraction,
+						 gdouble threshold_percentage,
+						 gdouble threshold_value,
+						 AmitkUpdateFunc update_func,
+						 gpointer update_data) {
+
+  GList * temp_objects;
+
+  g_return_val_if_fail(AMITK_IS_ANALYSIS(analysis), NULL);
+  g_return_val_if_fail(AMITK_IS_STUDY(study), NULL);
+
+  if ((analysis->calculation_type != calculation_type) ||
+      (analysis->accurate != accurate) ||
+      (analysis->subfraction != subfraction) ||
+      (analysis->threshold_percentage != threshold_percentage) ||
+      (analysis->threshold_value != threshold_value)) {
+    amitk_analysis_invalidate_all(analysis);
+    analysis->calculation_type = calculation_type;
+    analysis->accurate = accurate;
+    analysis->subfraction = subfraction;
+    analysis->threshold_percentage = threshold_percentage;
+    analysis->threshold_value = threshold_value;
+  }
+
+  for (temp_objects = rois; temp_objects != NULL; temp_objects = temp_objects->next)
+    analysis_watch(analysis, temp_objects->data);
+  for (temp_objects = data_sets; temp_objects != NULL; temp_objects = temp_objects->next)
+    analysis_watch(analysis, temp_objects->data);
+
+  return analysis_roi_init(study, rois, data_sets, calculation_type, accurate,
+			   subfraction, threshold_percentage, threshold_value,
+			   analysis->cache, update_func, update_data);
+}
+
+
+/* throws out the cached statistics that involve the given roi or data set */
+void amitk_analysis_invalidate_object(AmitkAnalysis * analysis, gpointer object) {
+
+  g_return_if_fail(AMITK_IS_ANALYSIS(analysis));
+
+  if (analysis_cache_remove_object(analysis->cache, object) > 0)
+    g_signal_emit(G_OBJECT(analysis), analysis_signals[ANALYSIS_CHANGED], 0);
+
+  return;
+}
+
+void amitk_analysis_invalidate_all(AmitkAnalysis * analysis) {
+
+  g_return_if_fail(AMITK_IS_ANALYSIS(analysis));
+
+  if (g_hash_table_size(analysis->cache) > 0) {
+    g_hash_table_remove_all(analysis->cache);
+    g_signal_emit(G_OBJECT(analysis), analysis_signals[ANALYSIS_CHANGED], 0);
+  }
+
+  return;
+}
@@ -0,0 +1,99 @@
+/* amitk_analysis.h
+ *
+ * Part of amide - Amide's a Medical Image Data Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#ifndef __AMITK_ANALYSIS_H__
+#define __AMITK_ANALYSIS_H__
+
+/* header files that are always needed with this file */
+#include <glib-object.h>
+#include "analysis.h"
+
+G_BEGIN_DECLS
+
+#define	AMITK_TYPE_ANALYSIS		   (amitk_analysis_get_type ())
+#define AMITK_ANALYSIS(object)		   (G_TYPE_CHECK_INSTANCE_CAST ((object), AMITK_TYPE_ANALYSIS, AmitkAnalysis))
+#define AMITK_ANALYSIS_CLASS(klass)	   (G_TYPE_CHECK_CLASS_CAST ((klass), AMITK_TYPE_ANALYSIS, AmitkAnalysisClass))
+#define AMITK_IS_ANALYSIS(object)	   (G_TYPE_CHECK_INSTANCE_TYPE ((object), AMITK_TYPE_ANALYSIS))
+#define AMITK_IS_ANALYSIS_CLASS(klass)	   (G_TYPE_CHECK_CLASS_TYPE ((klass), AMITK_TYPE_ANALYSIS))
+#define	AMITK_ANALYSIS_GET_CLASS(object)   (G_TYPE_CHECK_GET_CLASS ((object), AMITK_TYPE_ANALYSIS, AmitkAnalysisClass))
+
+#define AMITK_ANALYSIS_CALCULATION_TYPE(analysis)   (AMITK_ANALYSIS(analysis)->calculation_type)
+#define AMITK_ANALYSIS_ACCURATE(analysis)           (AMITK_ANALYSIS(analysis)->accurate)
+
+
+typedef struct _AmitkAnalysisClass AmitkAnalysisClass;
+typedef struct _AmitkAnalysis      AmitkAnalysis;
+
+
+/* holds on to roi statistics between requests.  Statistics are calculated as
+   they're asked for, and thrown out when the roi or data set they came from changes */
+struct _AmitkAnalysis {
+
+  GObject parent;
+
+  /* the calculation parameters the cached statistics were done with */
+  analysis_calculation_t calculation_type;
+  gboolean accurate;
+  gdouble subfraction;
+  gdouble threshold_percentage;
+  gdouble threshold_value;
+
+  GHashTable * cache; /* see analysis_cache_new */
+  GHashTable * watched; /* the rois and data sets we're connected to */
+
+};
+
+struct _AmitkAnalysisClass
+{
+  GObjectClass parent_class;
+
+  void (* analysis_changed) (AmitkAnalysis * analysis);
+
+};
+
+
+/* Application-level methods */
+
+GType	         amitk_analysis_get_type	   (void);
+AmitkAnalysis *  amitk_analysis_new                (void);
+analysis_roi_t * amitk_analysis_get_roi_analyses   (AmitkAnalysis * analysis,
+						    AmitkStudy * study,
+						    GList * rois,
+						    GList * data_sets,
+						    analysis_calculation_t calculation_type,
+						    gboolean accurate,
+						    gdouble subfraction,
+						    gdouble threshold_percentage,
+						    gdouble threshold_value,
+						    AmitkUpdateFunc update_func,
+						    gpointer update_data);
+void             amitk_analysis_invalidate_object  (AmitkAnalysis * analysis,
+						    gpointer object);
+void             amitk_analysis_invalidate_all     (AmitkAnalysis * analysis);
+
+G_END_DECLS
+
+#endif /* __AMITK_ANALYSIS_H__ */
+
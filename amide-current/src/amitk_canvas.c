@@ -54,6 +54,45 @@
 #define UPDATE_SUBJECT_ORIENTATION 0x200
 #define UPDATE_ALL 0x2FF
 
+#define PREFETCH_MAX_SLICES 8
+#define PREFETCH_RUN_TIMEOUT 1000000 /* in microseconds, pauses longer than this start a new run */
+
+/* what's needed for rendering the slices in the background.  The render 
+   works off of a copy of the view, and doesn't touch the canvas itself */
+typedef struct canvas_render_t {
+  AmitkCanvas * canvas; /* holds a reference */
+  GList * data_sets; /* snapshots, the data sets themselves can change while we're working */
+  AmitkDataSet * active_ds;
+  AmitkVolume * volume; /* copy of the canvas's volume when the render was requested */
+  amide_time_t start;
+  amide_time_t duration;
+  amide_real_t pixel_dim;
+  AmitkFuseType fuse_type;
+  AmitkViewMode view_mode;
+  gint cancelled; /* don't bother starting, only accessed atomically */
+  gboolean discard; /* data sets changed, results are no good */
+  GdkPixbuf * pixbuf;
+  GList * slices;
+  AmitkPoint prefetch_shift; /* how far the view moved since the last render */
+  amide_time_t prefetch_time_shift;
+  gint prefetch_num; /* how many renders ahead to prefetch, 0 for none */
+} canvas_render_t;
+
+/* generates the slices for where the view looks to be headed, so they're
+   sitting in the slice cache when the view gets there */
+typedef struct canvas_prefetch_t {
+  AmitkCanvas * canvas; /* holds a reference */
+  gint generation; /* the canvas's prefetch_generation when this was started */
+  GList * data_sets;
+  AmitkVolume * volume;
+  amide_time_t start;
+  amide_time_t duration;
+  AmitkCanvasPoint pixel_size;
+  AmitkPoint shift;
+  amide_time_t time_shift;
+  gint num;
+} canvas_prefetch_t;
+
 #define cp_2_p(canvas, canvas_cpoint) (canvas_point_2_point(AMITK_VOLUME_CORNER((canvas)->volume),\
 							    (canvas)->pixbuf_width, \
 							    (canvas)->pixbuf_height,\
@@ -156,6 +195,8 @@ static void canvas_class_init (AmitkCanvasClass *klass);
 static void canvas_init (AmitkCanvas *canvas);
 static void canvas_destroy(GtkObject * object);
 
+static AmitkDataSet * canvas_get_slice(AmitkCanvas * canvas, AmitkDataSet * ds);
+
 static GnomeCanvasItem * canvas_find_item(AmitkCanvas * canvas, AmitkObject * object);
 static GList * canvas_add_current_objects(AmitkCanvas * canvas, GList * objects);
 static void canvas_space_changed_cb(AmitkSpace * space, gpointer canvas);
@@ -195,6 +236,15 @@ static void canvas_update_arrows(AmitkCanvas * canvas);
 static void canvas_update_line_profile(AmitkCanvas * canvas);
 static void canvas_update_time_on_image(AmitkCanvas * canvas);
 static void canvas_update_subject_orientation(AmitkCanvas * canvas);
+static gboolean canvas_set_pixbuf(AmitkCanvas * canvas, GdkPixbuf * pixbuf);
+static void canvas_render_free(canvas_render_t * render);
+static void canvas_render_worker(gpointer data, gpointer pool_data);
+static gboolean canvas_render_done(gpointer data);
+static void canvas_render_cancel(AmitkCanvas * canvas, gboolean discard);
+static void canvas_prefetch_plan(AmitkCanvas * canvas, canvas_render_t * render);
+static void canvas_prefetch_start(AmitkCanvas * canvas, canvas_render_t * render);
+static void canvas_prefetch_worker(gpointer data, gpointer pool_data);
+static gboolean canvas_prefetch_free(gpointer data);
 static void canvas_update_pixbuf(AmitkCanvas * canvas);
 static void canvas_update_object(AmitkCanvas * canvas, AmitkObject * object);
 static void canvas_update_objects(AmitkCanvas * canvas, gboolean all);
@@ -208,6 +258,8 @@ static void canvas_remove_object(AmitkCanvas * canvas, AmitkObject * object);
 
 static GtkVBoxClass *canvas_parent_class;
 static guint canvas_signals[LAST_SIGNAL];
+static GThreadPool * render_pool = NULL;
+static GThreadPool * prefetch_pool = NULL;
 
 
 GType amitk_canvas_get_type (void) {
@@ -326,9 +378,8 @@ static void canvas_init (AmitkCanvas *canvas)
   canvas->active_object = NULL;
 
   canvas->canvas = NULL;
-  canvas->slice_cache = NULL;
-  canvas->max_slice_cache_size = 15;
   canvas->slices=NULL;
+  canvas->view_slices=NULL;
   canvas->image=NULL;
   canvas->pixbuf=NULL;
 
@@ -346,6 +397,16 @@ static void canvas_init (AmitkCanvas *canvas)
   canvas->idle_handler_id = 0;
   canvas->next_update_objects = NULL;
 
+  canvas->render = NULL;
+  canvas->render_again = FALSE;
+
+  canvas->prefetch_offset = zero_point;
+  canvas->prefetch_axis = zero_point;
+  canvas->prefetch_start = 0.0;
+  canvas->prefetch_direction = 0;
+  canvas->prefetch_run = 0;
+  canvas->prefetch_time = 0;
+  canvas->prefetch_generation = 0;
 }
 
 static void canvas_destroy (GtkObject * object) {
@@ -366,17 +427,24 @@ static void canvas_destroy (GtkObject * object) {
     canvas->next_update_objects = amitk_objects_unref(canvas->next_update_objects);
   }
 
+  /* a render that's still going holds its own references, and cleans up after itself */
+  if (canvas->render != NULL) {
+    canvas_render_cancel(canvas, TRUE);
+    canvas->render = NULL;
+    canvas->render_again = FALSE;
+  }
+
   if (canvas->volume != NULL) 
     canvas->volume = amitk_object_unref(canvas->volume);
 
-  if (canvas->slice_cache != NULL) {
-    canvas->slice_cache = amitk_objects_unref(canvas->slice_cache);
-  }
-
   if (canvas->slices != NULL) {
     canvas->slices = amitk_objects_unref(canvas->slices);
   }
 
+  if (canvas->view_slices != NULL) {
+    canvas->view_slices = amitk_objects_unref(canvas->view_slices);
+  }
+
   if (canvas->pixbuf != NULL) {
     g_object_unref(canvas->pixbuf);
     canvas->pixbuf = NULL;
@@ -397,6 +465,41 @@ static void canvas_destroy (GtkObject * object) {
 }
 
 
+/* the slice of the given data set for the current view, or NULL if the data set
+   isn't being shown.  canvas->slices lags behind the view while a render's in
+   progress, so in that case the slice gets generated here (usually straight out
+   of the slice cache).  The canvas holds onto it until the render's done */
+static AmitkDataSet * canvas_get_slice(AmitkCanvas * canvas, AmitkDataSet * ds) {
+
+  GList * objects;
+  GList * slices;
+  AmitkDataSet * slice;
+  AmitkCanvasPoint pixel_size;
+
+  if (canvas->render == NULL)
+    return amitk_data_sets_find_with_slice_parent(canvas->slices, ds);
+
+  if (!amitk_object_get_selected(AMITK_OBJECT(ds), canvas->view_mode))
+    return NULL;
+
+  pixel_size.x = pixel_size.y = (1/AMITK_STUDY_ZOOM(canvas->study))*AMITK_STUDY_VOXEL_DIM(canvas->study);
+  objects = g_list_append(NULL, ds);
+  slices = amitk_data_sets_get_slices(objects, 
+				      AMITK_STUDY_VIEW_START_TIME(canvas->study),
+				      AMITK_STUDY_VIEW_DURATION(canvas->study),
+				      -1, pixel_size, canvas->volume, TRUE);
+  g_list_free(objects);
+  if (slices == NULL) return NULL;
+
+  slice = AMITK_DATA_SET(slices->data);
+  if (g_list_find(canvas->view_slices, slice) == NULL) {
+    canvas->view_slices = g_list_prepend(canvas->view_slices, amitk_object_ref(slice));
+  }
+  amitk_objects_unref(slices);
+
+  return slice;
+}
+
 static GnomeCanvasItem * canvas_find_item(AmitkCanvas * canvas, AmitkObject * object) {
 
   GList * items=canvas->object_items;
@@ -665,7 +768,7 @@ static void canvas_data_set_invalidate_slice_cache(AmitkDataSet * ds, gpointer d
   g_return_if_fail(AMITK_IS_CANVAS(canvas));
   g_return_if_fail(AMITK_IS_DATA_SET(ds));
 
-  canvas->slice_cache = amitk_data_sets_remove_with_slice_parent(canvas->slice_cache, ds);
+  canvas_render_cancel(canvas, TRUE);
 
 }
 
@@ -851,8 +954,7 @@ static void canvas_create_isocontour_roi(AmitkCanvas * canvas, AmitkRoi * roi,
 
   if (AMITK_ROI_TYPE(roi) == AMITK_ROI_TYPE_ISOCONTOUR_2D) {
     if (parent_ds != NULL) {
-      draw_on_ds = amitk_data_sets_find_with_slice_parent(canvas->slices,
-							  AMITK_DATA_SET(parent_ds));
+      draw_on_ds = canvas_get_slice(canvas, AMITK_DATA_SET(parent_ds));
       if (draw_on_ds == NULL) {
 	g_warning(_("Parent of isocontour not currently displayed, can't draw isocontour"));
 	return;
@@ -1008,18 +1110,19 @@ static void canvas_create_isocontour_roi(AmitkCanvas * canvas, AmitkRoi * roi,
   }
 
 
-  /* run the dialog */
+  /* run the dialog, a render can finish and drop the slice in the meantime */
+  amitk_object_ref(draw_on_ds);
   gtk_widget_show_all(dialog);
   return_val = gtk_dialog_run(GTK_DIALOG(dialog)); /* let the user input */
   gtk_widget_destroy(dialog);
 
-  if (return_val != GTK_RESPONSE_OK)
-    return; /* cancel */
-
-  ui_common_place_cursor(UI_CURSOR_WAIT, GTK_WIDGET(canvas));
-  amitk_roi_set_isocontour(roi, AMITK_DATA_SET(draw_on_ds), temp_voxel, 
-			   isocontour_min_value,isocontour_max_value, isocontour_range);
-  ui_common_remove_wait_cursor(GTK_WIDGET(canvas));
+  if (return_val == GTK_RESPONSE_OK) {
+    ui_common_place_cursor(UI_CURSOR_WAIT, GTK_WIDGET(canvas));
+    amitk_roi_set_isocontour(roi, AMITK_DATA_SET(draw_on_ds), temp_voxel, 
+			     isocontour_min_value,isocontour_max_value, isocontour_range);
+    ui_common_remove_wait_cursor(GTK_WIDGET(canvas));
+  }
+  amitk_object_unref(draw_on_ds);
 
   return;
 }
@@ -1056,8 +1159,7 @@ static gboolean canvas_create_freehand_roi(AmitkCanvas * canvas, AmitkRoi * roi,
 
   if (AMITK_ROI_TYPE(roi) == AMITK_ROI_TYPE_FREEHAND_2D) {
     if (parent_ds != NULL) {
-      draw_on_ds = amitk_data_sets_find_with_slice_parent(canvas->slices,
-							  AMITK_DATA_SET(parent_ds));
+      draw_on_ds = canvas_get_slice(canvas, AMITK_DATA_SET(parent_ds));
       if (draw_on_ds == NULL) {
 	g_warning(_("Parent of roi not currently displayed, can't draw freehand roi"));
 	return FALSE;
@@ -1557,7 +1659,7 @@ static gboolean canvas_event_cb(GtkWidget* widget,  GdkEvent * event, gpointer d
   g_return_val_if_fail(canvas->slices != NULL, FALSE);
   active_slice = NULL;
   if (AMITK_IS_DATA_SET(canvas->active_object)) 
-    active_slice = amitk_data_sets_find_with_slice_parent(canvas->slices,  AMITK_DATA_SET(canvas->active_object));
+    active_slice = canvas_get_slice(canvas, AMITK_DATA_SET(canvas->active_object));
 
   if (active_slice != NULL) {
     temp_point[0] = amitk_space_b2s(AMITK_SPACE(active_slice), base_point);
@@ -3223,30 +3325,292 @@ static void canvas_update_subject_orientation(AmitkCanvas * canvas) {
 
 
 
-static void canvas_update_pixbuf(AmitkCanvas * canvas) {
+/* puts the given pixbuf up on the canvas, taking over the reference.
+   Returns TRUE if the size of the image changed */
+static gboolean canvas_set_pixbuf(AmitkCanvas * canvas, GdkPixbuf * pixbuf) {
 
   gint old_width, old_height;
+
+  old_width = canvas->pixbuf_width;
+  old_height = canvas->pixbuf_height;
+
+  /* free the previous pixbuf if possible */
+  if (canvas->pixbuf != NULL) {
+    g_object_unref(canvas->pixbuf);
+    canvas->pixbuf = NULL;
+  }
+
+  canvas->pixbuf = pixbuf;
+  if (canvas->pixbuf == NULL) return FALSE;
+
+  /* record the width and height for future use*/
+  canvas->pixbuf_width = gdk_pixbuf_get_width(canvas->pixbuf);
+  canvas->pixbuf_height = gdk_pixbuf_get_height(canvas->pixbuf);
+
+  /* reset the min size of the widget and set the scroll region */
+  if ((old_width != canvas->pixbuf_width) || 
+      (old_height != canvas->pixbuf_height) || (canvas->image == NULL)) {
+    gtk_widget_set_size_request(canvas->canvas, 
+				canvas->pixbuf_width + 2 * canvas->border_width, 
+				canvas->pixbuf_height + 2 * canvas->border_width);
+    gnome_canvas_set_scroll_region(GNOME_CANVAS(canvas->canvas), 0.0, 0.0, 
+				   canvas->pixbuf_width + 2 * canvas->border_width,
+				   canvas->pixbuf_height + 2 * canvas->border_width);
+  }
+
+  /* put the canvas rgb image on the canvas_image */
+  if (canvas->image == NULL) {/* time to make a new image */
+    canvas->image = gnome_canvas_item_new(gnome_canvas_root(GNOME_CANVAS(canvas->canvas)),
+					  gnome_canvas_pixbuf_get_type(),
+					  "pixbuf", canvas->pixbuf,
+					  "x", (double) canvas->border_width,
+					  "y", (double) canvas->border_width,
+					  NULL);
+    g_signal_connect(G_OBJECT(canvas->image), "event", G_CALLBACK(canvas_event_cb), canvas);
+    /* objects may have been drawn while the first image was rendering */
+    gnome_canvas_item_lower_to_bottom(canvas->image);
+  } else {
+    gnome_canvas_item_set(canvas->image, "pixbuf", canvas->pixbuf, NULL);
+  }
+
+  return ((old_width != canvas->pixbuf_width) || (old_height != canvas->pixbuf_height));
+}
+
+
+static void canvas_render_free(canvas_render_t * render) {
+
+  amitk_objects_unref(render->data_sets);
+  amitk_object_unref(render->volume);
+  amitk_objects_unref(render->slices);
+  if (render->pixbuf != NULL)
+    g_object_unref(render->pixbuf);
+  g_object_unref(render->canvas);
+  g_free(render);
+
+  return;
+}
+
+/* runs in a worker thread, don't touch the canvas from here */
+static void canvas_render_worker(gpointer data, gpointer pool_data) {
+
+  canvas_render_t * render = data;
+
+  if (!g_atomic_int_get(&(render->cancelled)))
+    render->pixbuf = image_from_data_sets(&(render->slices),
+					  render->data_sets,
+					  render->active_ds,
+					  render->start,
+					  render->duration,
+					  -1,
+					  render->pixel_dim,
+					  render->volume,
+					  render->fuse_type,
+					  render->view_mode);
+
+  /* hand the results back to the main loop */
+  g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, canvas_render_done, render, NULL);
+
+  return;
+}
+
+/* called from the main loop when a render finishes */
+static gboolean canvas_render_done(gpointer data) {
+
+  canvas_render_t * render = data;
+  AmitkCanvas * canvas = render->canvas;
+
+  /* the canvas has been destroyed in the meantime */
+  if (canvas->render != render) {
+    canvas_render_free(render);
+    return FALSE;
+  }
+  canvas->render = NULL;
+  canvas->view_slices = amitk_objects_unref(canvas->view_slices);
+
+  if (!render->discard) {
+    /* even if a newer view's been asked for, this is still newer than what's up */
+    if (render->pixbuf != NULL) {
+      amitk_objects_unref(canvas->slices);
+      canvas->slices = render->slices;
+      render->slices = NULL;
+
+      /* objects get drawn relative to the image size */
+      if (canvas_set_pixbuf(canvas, render->pixbuf))
+	canvas_add_update(canvas, UPDATE_ALL & ~UPDATE_DATA_SETS);
+      render->pixbuf = NULL;
+    }
+  }
+
+  if (canvas->render_again) {
+    canvas->render_again = FALSE;
+    canvas_add_update(canvas, UPDATE_DATA_SETS);
+  } else {
+    ui_common_remove_wait_cursor(GTK_WIDGET(canvas));
+
+    /* caught up with the view, look ahead to where it's going */
+    if (!render->discard && (render->prefetch_num > 0))
+      canvas_prefetch_start(canvas, render);
+  }
+
+  canvas_render_free(render);
+
+  return FALSE;
+}
+
+/* the render in progress is out of date, if discard is set its
+   results won't get used */
+static void canvas_render_cancel(AmitkCanvas * canvas, gboolean discard) {
+
+  canvas_render_t * render = canvas->render;
+
+  g_atomic_int_inc(&(canvas->prefetch_generation));
+
+  if (render == NULL) return;
+
+  g_atomic_int_set(&(render->cancelled), TRUE);
+  if (discard)
+    render->discard = TRUE;
+  canvas->render_again = TRUE;
+
+  return;
+}
+
+/* figures out which way the view's been moving (through the volume or 
+   through time), and how far ahead of it we should be generating slices.
+   The longer the view keeps moving the same way, the further ahead we look, 
+   and the faster it moves, the bigger the steps */
+static void canvas_prefetch_plan(AmitkCanvas * canvas, canvas_render_t * render) {
+
+  AmitkPoint offset;
+  AmitkPoint axis;
+  AmitkPoint shift;
+  amide_real_t depth;
+  amide_time_t time_shift;
+  gint direction=0;
+  gint64 now;
+
+  /* whatever was being prefetched isn't what we're after anymore */
+  g_atomic_int_inc(&(canvas->prefetch_generation));
+
+  offset = AMITK_SPACE_OFFSET(render->volume);
+  axis = AMITK_SPACE_AXES(render->volume)[AMITK_AXIS_Z];
+  shift = point_sub(offset, canvas->prefetch_offset);
+  depth = point_dot_product(shift, axis);
+  time_shift = render->start - canvas->prefetch_start;
+  now = g_get_monotonic_time();
+
+  if (POINT_EQUAL(axis, canvas->prefetch_axis) && (fabs(depth) > EPSILON*render->pixel_dim)) {
+    direction = (depth > 0.0) ? 1 : -1; /* scrolling through the volume */
+    render->prefetch_shift = shift;
+  } else if (POINT_EQUAL(offset, canvas->prefetch_offset) && (time_shift != 0.0)) {
+    direction = (time_shift > 0.0) ? 2 : -2; /* stepping through the frames */
+    render->prefetch_time_shift = time_shift;
+  }
+
+  if ((direction != 0) && (direction == canvas->prefetch_direction) &&
+      ((now - canvas->prefetch_time) < PREFETCH_RUN_TIMEOUT))
+    canvas->prefetch_run++;
+  else
+    canvas->prefetch_run = (direction != 0) ? 1 : 0;
+  render->prefetch_num = MIN(2*canvas->prefetch_run, PREFETCH_MAX_SLICES);
+
+  canvas->prefetch_offset = offset;
+  canvas->prefetch_axis = axis;
+  canvas->prefetch_start = render->start;
+  canvas->prefetch_direction = direction;
+  canvas->prefetch_time = now;
+
+  return;
+}
+
+/* hands the prefetching for a finished render off to the background */
+static void canvas_prefetch_start(AmitkCanvas * canvas, canvas_render_t * render) {
+
+  canvas_prefetch_t * prefetch;
+
+  if (prefetch_pool == NULL) /* only one thread, this is low priority work */
+    prefetch_pool = g_thread_pool_new(canvas_prefetch_worker, NULL, 1, FALSE, NULL);
+  if (prefetch_pool == NULL) return;
+
+  prefetch = g_new0(canvas_prefetch_t, 1);
+  prefetch->canvas = g_object_ref(canvas);
+  prefetch->generation = g_atomic_int_get(&(canvas->prefetch_generation));
+  prefetch->data_sets = amitk_objects_ref(render->data_sets);
+  prefetch->volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(render->volume)));
+  prefetch->start = render->start;
+  prefetch->duration = render->duration;
+  prefetch->pixel_size.x = prefetch->pixel_size.y = render->pixel_dim;
+  prefetch->shift = render->prefetch_shift;
+  prefetch->time_shift = render->prefetch_time_shift;
+  prefetch->num = render->prefetch_num;
+
+  g_thread_pool_push(prefetch_pool, prefetch, NULL);
+
+  return;
+}
+
+/* runs in a worker thread, the slices generated just get left in the slice cache */
+static void canvas_prefetch_worker(gpointer data, gpointer pool_data) {
+
+  canvas_prefetch_t * prefetch = data;
+  AmitkPoint offset;
+  GList * slices;
+  gint i;
+
+  /* stay out of the way of the renders */
+  amitk_parallel_set_serial(TRUE);
+
+  offset = AMITK_SPACE_OFFSET(prefetch->volume);
+  for (i=1; i <= prefetch->num; i++) {
+    if (g_atomic_int_get(&(prefetch->canvas->prefetch_generation)) != prefetch->generation)
+      break; /* the view's moved on */
+
+    amitk_space_set_offset(AMITK_SPACE(prefetch->volume), 
+			   point_add(offset, point_cmult(i, prefetch->shift)));
+    slices = amitk_data_sets_get_slices(prefetch->data_sets,
+					prefetch->start + i*prefetch->time_shift,
+					prefetch->duration, -1, 
+					prefetch->pixel_size, prefetch->volume, TRUE);
+    amitk_objects_unref(slices);
+  }
+
+  /* non-exclusive pools share their threads, so this one may well go on
+     to run a render or someone else's work next */
+  amitk_parallel_set_serial(FALSE);
+
+  /* the canvas reference needs to be dropped from the main loop */
+  g_idle_add_full(G_PRIORITY_LOW, canvas_prefetch_free, prefetch, NULL);
+
+  return;
+}
+
+static gboolean canvas_prefetch_free(gpointer data) {
+
+  canvas_prefetch_t * prefetch = data;
+
+  amitk_objects_unref(prefetch->data_sets);
+  amitk_object_unref(prefetch->volume);
+  g_object_unref(prefetch->canvas);
+  g_free(prefetch);
+
+  return FALSE;
+}
+
+static void canvas_update_pixbuf(AmitkCanvas * canvas) {
+
   rgba_t blank_rgba;
   GtkStyle * widget_style;
   amide_real_t pixel_dim;
   AmitkPoint corner;
   gint width,height;
   GList * data_sets;
-  AmitkDataSet * active_ds;
+  GList * temp_list;
+  canvas_render_t * render;
 
 
   /* sanity checks */
   g_return_if_fail(canvas->study != NULL);
 
-  old_width = canvas->pixbuf_width;
-  old_height = canvas->pixbuf_height;
-
-  /* free the previous pixbuf if possible */
-  if (canvas->pixbuf != NULL) {
-    g_object_unref(canvas->pixbuf);
-    canvas->pixbuf = NULL;
-  }
-
   /* compensate for zoom */
   pixel_dim = (1/AMITK_STUDY_ZOOM(canvas->study))*AMITK_STUDY_VOXEL_DIM(canvas->study); 
 
@@ -3257,6 +3621,8 @@ static void canvas_update_pixbuf(AmitkCanvas * canvas) {
 
   if (data_sets == NULL) {
     /* just use a blank image */
+    canvas_render_cancel(canvas, TRUE);
+    canvas->render_again = FALSE;
 
     /* figure out what color to use */
     widget_style = gtk_widget_get_style(GTK_WIDGET(canvas));
@@ -3277,58 +3643,52 @@ static void canvas_update_pixbuf(AmitkCanvas * canvas) {
     height =  ceil(corner.y/pixel_dim);
     if (height < 1) height = 1;
 				 
-    canvas->pixbuf = image_blank(width, height,blank_rgba);
+    canvas_set_pixbuf(canvas, image_blank(width, height,blank_rgba));
     amitk_objects_unref(canvas->slices);
     canvas->slices = NULL;
 
+  } else if (canvas->render != NULL) {
+    /* still working on an earlier view, we'll get to this one when that's done.
+       Views asked for in the meantime just replace this one */
+    canvas_render_cancel(canvas, FALSE);
+    amitk_objects_unref(data_sets);
+    canvas->view_slices = amitk_objects_unref(canvas->view_slices);
+
   } else {
+    /* take a snapshot of what needs to be rendered, and hand it off */
+    render = g_new0(canvas_render_t, 1);
+    render->canvas = g_object_ref(canvas);
     if (AMITK_IS_DATA_SET(canvas->active_object))
-      active_ds = AMITK_DATA_SET(canvas->active_object);
+      render->active_ds = AMITK_DATA_SET(canvas->active_object);
     else
-      active_ds = NULL;
-    canvas->pixbuf = image_from_data_sets(&(canvas->slices),
-					  &(canvas->slice_cache),
-					  canvas->max_slice_cache_size,
-					  data_sets,
-					  active_ds,
-					  AMITK_STUDY_VIEW_START_TIME(canvas->study),
-					  AMITK_STUDY_VIEW_DURATION(canvas->study),
-					  -1,
-					  pixel_dim,
-					  canvas->volume,
-					  AMITK_STUDY_FUSE_TYPE(canvas->study),
-					  AMITK_CANVAS_VIEW_MODE(canvas));
+      render->active_ds = NULL;
+    render->volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(canvas->volume)));
+    render->start = AMITK_STUDY_VIEW_START_TIME(canvas->study);
+    render->duration = AMITK_STUDY_VIEW_DURATION(canvas->study);
+    render->pixel_dim = pixel_dim;
+    render->fuse_type = AMITK_STUDY_FUSE_TYPE(canvas->study);
+    render->view_mode = AMITK_CANVAS_VIEW_MODE(canvas);
+    canvas->render = render;
+    canvas_prefetch_plan(canvas, render);
+
+    /* get the max/min values calculated here, so the thresholding that the
+       worker does just reads them instead of working them out off the main loop.
+       The worker gets snapshots of the data sets, so that thresholds, color 
+       tables, the data sets' spaces, etc. don't change out from under it */
+    for (temp_list = data_sets; temp_list != NULL; temp_list = temp_list->next) {
+      amitk_data_set_calc_min_max_if_needed(AMITK_DATA_SET(temp_list->data), NULL, NULL);
+      render->data_sets = g_list_append(render->data_sets, 
+					amitk_data_set_get_snapshot(AMITK_DATA_SET(temp_list->data)));
+    }
     amitk_objects_unref(data_sets);
-  }
 
-  if (canvas->pixbuf != NULL) {
-    /* record the width and height for future use*/
-    canvas->pixbuf_width = gdk_pixbuf_get_width(canvas->pixbuf);
-    canvas->pixbuf_height = gdk_pixbuf_get_height(canvas->pixbuf);
-
-    /* reset the min size of the widget and set the scroll region */
-    if ((old_width != canvas->pixbuf_width) || 
-	(old_height != canvas->pixbuf_height) || (canvas->image == NULL)) {
-      gtk_widget_set_size_request(canvas->canvas, 
-				  canvas->pixbuf_width + 2 * canvas->border_width, 
-				  canvas->pixbuf_height + 2 * canvas->border_width);
-      gnome_canvas_set_scroll_region(GNOME_CANVAS(canvas->canvas), 0.0, 0.0, 
-				     canvas->pixbuf_width + 2 * canvas->border_width,
-				     canvas->pixbuf_height + 2 * canvas->border_width);
-    }
-    /* put the canvas rgb image on the canvas_image */
-    if (canvas->image == NULL) {/* time to make a new image */
-      canvas->image = gnome_canvas_item_new(gnome_canvas_root(GNOME_CANVAS(canvas->canvas)),
-					    gnome_canvas_pixbuf_get_type(),
-					    "pixbuf", canvas->pixbuf,
-					    "x", (double) canvas->border_width,
-					    "y", (double) canvas->border_width,
-					    NULL);
-      g_signal_connect(G_OBJECT(canvas->image), "event", G_CALLBACK(canvas_event_cb), canvas);
-    } else {
-      gnome_canvas_item_set(canvas->image, "pixbuf", canvas->pixbuf, NULL);
-    }
-    
+    if (render_pool == NULL)
+      render_pool = g_thread_pool_new(canvas_render_worker, NULL, -1, FALSE, NULL);
+
+    if (render_pool != NULL)
+      g_thread_pool_push(render_pool, render, NULL);
+    else
+      canvas_render_worker(render, NULL);
   }
 
   return;
@@ -3563,7 +3923,8 @@ static gboolean canvas_update_while_idle(gpointer data) {
 
   canvas->idle_handler_id=0;
 
-  if (canvas->next_update & UPDATE_DATA_SETS) /* remove the cursor on slow updates */
+  /* remove the cursor on slow updates, unless the slices are still rendering */
+  if ((canvas->next_update & UPDATE_DATA_SETS) && (canvas->render == NULL))
     ui_common_remove_wait_cursor(GTK_WIDGET(canvas));
   canvas->next_update = UPDATE_NONE;
 
@@ -3708,7 +4069,7 @@ static void canvas_remove_object(AmitkCanvas * canvas, AmitkObject * object) {
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_thresholding_changed_cb, canvas);
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_color_table_changed_cb, canvas);
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_subject_orientation_changed_cb, canvas);
-    canvas->slice_cache = amitk_data_sets_remove_with_slice_parent(canvas->slice_cache, AMITK_DATA_SET(object));
+    canvas_render_cancel(canvas, TRUE);
   }
   
   /* find corresponding CanvasItem and destroy */
@@ -43,6 +43,8 @@ G_BEGIN_DECLS
 
 #define AMITK_CANVAS_VIEW(obj)       (AMITK_CANVAS(obj)->view)
 #define AMITK_CANVAS_VIEW_MODE(obj)  (AMITK_CANVAS(obj)->view_mode)
+#define AMITK_CANVAS_UPDATE_PENDING(obj) ((AMITK_CANVAS(obj)->next_update != 0) || \
+					  (AMITK_CANVAS(obj)->render != NULL))
 
 typedef enum {
   AMITK_CANVAS_TYPE_NORMAL,
@@ -80,8 +82,7 @@ struct _AmitkCanvas
   AmitkObject * active_object;
 
   GList * slices;
-  GList * slice_cache;
-  gint max_slice_cache_size;
+  GList * view_slices; /* slices of the current view, while a render catches up */
   gint pixbuf_width, pixbuf_height;
   gdouble border_width;
   GnomeCanvasItem * image;
@@ -98,6 +99,19 @@ struct _AmitkCanvas
   guint idle_handler_id;
   GList * next_update_objects;
 
+  /* slices get rendered in the background */
+  gpointer render; /* the render in progress, NULL if none */
+  gboolean render_again; /* the view changed while rendering */
+
+  /* and the slices we're likely to want next get generated ahead of time */
+  AmitkPoint prefetch_offset; /* view offset and orientation of the last render */
+  AmitkPoint prefetch_axis;
+  amide_time_t prefetch_start;
+  gint prefetch_direction; /* which way the view's been moving, 0 if it hasn't */
+  gint prefetch_run; /* renders in a row that moved the same way */
+  gint64 prefetch_time; /* when the last render was asked for */
+  gint prefetch_generation; /* bumped to call off prefetching, accessed atomically */
+
   /* profile stuff */
   GnomeCanvasItem * line_profile_item;
 
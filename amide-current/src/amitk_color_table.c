@@ -60,8 +60,18 @@ gchar * color_table_menu_names[] = {
   N_("inverse NIH")
 };
 
+/* how many color lookup tables we keep around for reuse */
+#define LUT_CACHE_SIZE 16
+
 /* internal functions */
 static rgb_t hsv_to_rgb(hsv_t * hsv);
+static AmitkColorTableLut * lut_new(const AmitkColorTable which,
+				    const amide_data_t min, 
+				    const amide_data_t max);
+
+/* most recently used first, each entry holds a reference */
+static GList * lut_cache = NULL;
+G_LOCK_DEFINE_STATIC(lut_cache);
 
 
 
@@ -548,6 +558,166 @@ rgba_t amitk_color_table_outline_color(AmitkColorTable which, gboolean highlight
   return rgba;
 }
 
+static AmitkColorTableLut * lut_new(const AmitkColorTable which,
+				    const amide_data_t min, 
+				    const amide_data_t max) {
+
+  AmitkColorTableLut * lut;
+  gint j;
+  amide_data_t step;
+
+  lut = g_new(AmitkColorTableLut, 1);
+  lut->which = which;
+  lut->min = min;
+  lut->max = max;
+  lut->ref_count = 1;
+  lut->direct = !(max > min);
+  lut->clamps = FALSE;
+  lut->not_a_number = amitk_color_table_lookup(NAN, which, min, max);
+  if (lut->direct) return lut;
+
+  /* entries are sampled at the center of the range of data they cover */
+  lut->scale = AMITK_COLOR_TABLE_LUT_SIZE/(max-min);
+  step = (max-min)/AMITK_COLOR_TABLE_LUT_SIZE;
+  for (j=0; j < AMITK_COLOR_TABLE_LUT_SIZE; j++)
+    lut->entries[j] = amitk_color_table_lookup(min+(j+0.5)*step, which, min, max);
+
+  /* these tables fold back on themselves outside of [min, max] */
+  switch(which) {
+  case AMITK_COLOR_TABLE_BWB_LINEAR:
+  case AMITK_COLOR_TABLE_WBW_LINEAR:
+  case AMITK_COLOR_TABLE_HOT_METAL_CONTOUR:
+  case AMITK_COLOR_TABLE_INV_HOT_METAL_CONTOUR:
+    break;
+  default:
+    lut->clamps = TRUE;
+    lut->below = amitk_color_table_lookup(min-(max-min), which, min, max);
+    lut->above = amitk_color_table_lookup(max+(max-min), which, min, max);
+    break;
+  }
+
+  return lut;
+}
+
+/* returns a reference to the lookup table for the given color table and 
+   thresholds, building it if it isn't in the cache.  Thread safe. */
+AmitkColorTableLut * amitk_color_table_lut_get(const AmitkColorTable which,
+					       const amide_data_t min, 
+					       const amide_data_t max) {
+
+  GList * link;
+  AmitkColorTableLut * lut=NULL;
+
+  G_LOCK(lut_cache);
+
+  for (link = lut_cache; link != NULL; link = link->next) {
+    lut = link->data;
+    if ((lut->which == which) && (lut->min == min) && (lut->max == max))
+      break;
+  }
+
+  if (link != NULL) {
+    lut_cache = g_list_remove_link(lut_cache, link);
+    lut_cache = g_list_concat(link, lut_cache);
+  } else {
+    lut = lut_new(which, min, max);
+    lut_cache = g_list_prepend(lut_cache, lut);
+
+    if (g_list_length(lut_cache) > LUT_CACHE_SIZE) {
+      link = g_list_last(lut_cache);
+      lut_cache = g_list_remove_link(lut_cache, link);
+      amitk_color_table_lut_unref(link->data);
+      g_list_free_1(link);
+    }
+  }
+
+  g_atomic_int_inc(&(lut->ref_count));
+
+  G_UNLOCK(lut_cache);
+
+  return lut;
+}
+
+void amitk_color_table_lut_unref(AmitkColorTableLut * lut) {
+
+  g_return_if_fail(lut != NULL);
+
+  if (g_atomic_int_dec_and_test(&(lut->ref_count)))
+    g_free(lut);
+
+  return;
+}
+
+rgba_t amitk_color_table_lut_lookup(const AmitkColorTableLut * lut, 
+				    const amide_data_t datum) {
+
+  gint index;
+
+  if (isnan(datum))
+    return lut->not_a_number;
+  else if (lut->direct)
+    return amitk_color_table_lookup(datum, lut->which, lut->min, lut->max);
+  else if (datum < lut->min)
+    return lut->clamps ? lut->below : 
+      amitk_color_table_lookup(datum, lut->which, lut->min, lut->max);
+  else if (datum > lut->max)
+    return lut->clamps ? lut->above : 
+      amitk_color_table_lookup(datum, lut->which, lut->min, lut->max);
+
+  index = (datum-lut->min)*lut->scale;
+  if (index >= AMITK_COLOR_TABLE_LUT_SIZE) index = AMITK_COLOR_TABLE_LUT_SIZE-1;
+
+  return lut->entries[index];
+}
+
+/* maps num data values to colors */
+void amitk_color_table_lut_lookup_row(const AmitkColorTableLut * lut,
+				      const amide_data_t * data,
+				      const gint num,
+				      rgba_t * rgba) {
+
+  gint i;
+  gint index;
+  amide_data_t datum;
+
+  if (lut->direct) {
+    for (i=0; i < num; i++)
+      rgba[i] = amitk_color_table_lookup(data[i], lut->which, lut->min, lut->max);
+    return;
+  }
+
+  for (i=0; i < num; i++) {
+    datum = data[i];
+    if ((datum >= lut->min) && (datum <= lut->max)) {
+      index = (datum-lut->min)*lut->scale;
+      if (index >= AMITK_COLOR_TABLE_LUT_SIZE) index = AMITK_COLOR_TABLE_LUT_SIZE-1;
+      rgba[i] = lut->entries[index];
+    } else {
+      rgba[i] = amitk_color_table_lut_lookup(lut, datum);
+    }
+  }
+
+  return;
+}
+
+/* convenience function, same as amitk_color_table_lookup for a row of data */
+void amitk_color_table_lookup_row(const amide_data_t * data,
+				  const gint num,
+				  const AmitkColorTable which,
+				  const amide_data_t min, 
+				  const amide_data_t max,
+				  rgba_t * rgba) {
+
+  AmitkColorTableLut * lut;
+
+  lut = amitk_color_table_lut_get(which, min, max);
+  amitk_color_table_lut_lookup_row(lut, data, num, rgba);
+  amitk_color_table_lut_unref(lut);
+
+  return;
+}
+
+
 const gchar * amitk_color_table_get_name(const AmitkColorTable which) {
 
   GEnumClass * enum_class;
@@ -94,6 +94,26 @@ typedef struct hsv_t {
 } hsv_t;
 
 
+/* a color table precomputed over [min, max], so that mapping data to 
+   colors doesn't need to go through amitk_color_table_lookup for every pixel.
+   Get these with amitk_color_table_lut_get, they're shared and read only */
+#define AMITK_COLOR_TABLE_LUT_SIZE 4096
+
+typedef struct AmitkColorTableLut {
+  AmitkColorTable which;
+  amide_data_t min;
+  amide_data_t max;
+  amide_data_t scale; /* AMITK_COLOR_TABLE_LUT_SIZE/(max-min) */
+  gboolean direct; /* degenerate thresholds, do the lookups directly */
+  gboolean clamps; /* values outside [min, max] all look like below/above */
+  rgba_t below;
+  rgba_t above;
+  rgba_t not_a_number;
+  rgba_t entries[AMITK_COLOR_TABLE_LUT_SIZE];
+  gint ref_count;
+} AmitkColorTableLut;
+
+
 /* defines */
 #define amitk_color_table_rgba_to_uint32(rgba) (((rgba).r<<24) | ((rgba).g<<16) | ((rgba).b<<8) | ((rgba).a<<0))
 
@@ -102,6 +122,22 @@ rgba_t amitk_color_table_uint32_to_rgba(guint32 color_uint32);
 rgba_t amitk_color_table_outline_color(AmitkColorTable which, gboolean highlight);
 rgba_t amitk_color_table_lookup(amide_data_t datum, AmitkColorTable which,
 				amide_data_t min, amide_data_t max);
+AmitkColorTableLut * amitk_color_table_lut_get(const AmitkColorTable which,
+					       const amide_data_t min, 
+					       const amide_data_t max);
+void   amitk_color_table_lut_unref(AmitkColorTableLut * lut);
+rgba_t amitk_color_table_lut_lookup(const AmitkColorTableLut * lut, 
+				    const amide_data_t datum);
+void   amitk_color_table_lut_lookup_row(const AmitkColorTableLut * lut,
+					const amide_data_t * data,
+					const gint num,
+					rgba_t * rgba);
+void   amitk_color_table_lookup_row(const amide_data_t * data,
+				    const gint num,
+				    const AmitkColorTable which,
+				    const amide_data_t min, 
+				    const amide_data_t max,
+				    rgba_t * rgba);
 const gchar * amitk_color_table_get_name(const AmitkColorTable which);
 /* external variables */
 extern gchar * color_table_menu_names[];
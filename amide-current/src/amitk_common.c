@@ -243,6 +243,167 @@ GdkPixbuf * amitk_get_pixbuf_from_canvas(GnomeCanvas * canvas, gint xoffset, gin
 
 
 
+/* worker pool used for splitting up the computationally intensive loops */
+typedef struct parallel_job_t {
+  AmitkParallelFunc func;
+  gpointer data;
+  gint start;
+  gint end;
+  GMutex * mutex;
+  GCond * cond;
+  gint * remaining;
+} parallel_job_t;
+
+static GThreadPool * parallel_pool = NULL;
+static gint parallel_num_threads = 0; /* 0 means use all processors */
+static GPrivate parallel_in_worker = G_PRIVATE_INIT(NULL);
+G_LOCK_DEFINE_STATIC(parallel_pool);
+
+static void parallel_worker(gpointer job_data, gpointer pool_data) {
+
+  parallel_job_t * job = job_data;
+  gpointer was_in_worker;
+
+  /* mark this thread, so nested calls to amitk_parallel_for run serially.  
+     Pool threads can get reused by other pools, so put the mark back afterwards */
+  was_in_worker = g_private_get(&parallel_in_worker);
+  g_private_set(&parallel_in_worker, GINT_TO_POINTER(TRUE));
+
+  (*job->func)(job->start, job->end, job->data);
+
+  g_private_set(&parallel_in_worker, was_in_worker);
+
+  g_mutex_lock(job->mutex);
+  (*job->remaining)--;
+  g_cond_signal(job->cond);
+  g_mutex_unlock(job->mutex);
+
+  return;
+}
+
+/* sets the number of threads used for the computationally intensive loops,
+   0 means use as many threads as there are processors */
+void amitk_set_num_threads(const gint num_threads) {
+
+  g_return_if_fail(num_threads >= 0);
+
+  G_LOCK(parallel_pool);
+  parallel_num_threads = MIN(num_threads, AMITK_MAX_THREADS);
+  if (parallel_pool != NULL)
+    g_thread_pool_set_max_threads(parallel_pool, MAX(amitk_get_num_threads()-1, 1), NULL);
+  G_UNLOCK(parallel_pool);
+
+  return;
+}
+
+gint amitk_get_num_threads(void) {
+
+  if (parallel_num_threads > 0)
+    return parallel_num_threads;
+  else
+    return CLAMP(g_get_num_processors(), 1, AMITK_MAX_THREADS);
+}
+
+/* background work that shouldn't compete with the rest of the program can
+   call this, so its calls to amitk_parallel_for stay on the calling thread */
+void amitk_parallel_set_serial(const gboolean serial) {
+
+  g_private_set(&parallel_in_worker, GINT_TO_POINTER(serial));
+
+  return;
+}
+
+/* calls func over the items [0, num_items), splitting the items into
+   contiguous chunks that get handed out to the worker pool.  The calling
+   thread does the first chunk itself, and the function returns when all
+   chunks are done.  func needs to be safe to call from multiple threads
+   at once on non-overlapping ranges. */
+void amitk_parallel_for(const gint num_items, AmitkParallelFunc func, gpointer data) {
+
+  gint num_chunks;
+  gint i_chunk;
+  gint remaining;
+  GMutex mutex;
+  GCond cond;
+  parallel_job_t * jobs;
+
+  if (num_items <= 0) return;
+
+  num_chunks = MIN(amitk_get_num_threads(), num_items);
+
+  /* run serially if we've only got one thread, or if we're already within a worker */
+  if ((num_chunks <= 1) || (g_private_get(&parallel_in_worker) != NULL)) {
+    (*func)(0, num_items, data);
+    return;
+  }
+
+  G_LOCK(parallel_pool);
+  if (parallel_pool == NULL)
+    parallel_pool = g_thread_pool_new(parallel_worker, NULL, 
+				      MAX(amitk_get_num_threads()-1, 1), FALSE, NULL);
+  G_UNLOCK(parallel_pool);
+
+  if (parallel_pool == NULL) {
+    (*func)(0, num_items, data);
+    return;
+  }
+
+  g_mutex_init(&mutex);
+  g_cond_init(&cond);
+  jobs = g_new(parallel_job_t, num_chunks);
+  remaining = num_chunks-1;
+
+  for (i_chunk=0; i_chunk < num_chunks; i_chunk++) {
+    jobs[i_chunk].func = func;
+    jobs[i_chunk].data = data;
+    jobs[i_chunk].start = (((gint64) num_items)*i_chunk)/num_chunks;
+    jobs[i_chunk].end = (((gint64) num_items)*(i_chunk+1))/num_chunks;
+    jobs[i_chunk].mutex = &mutex;
+    jobs[i_chunk].cond = &cond;
+    jobs[i_chunk].remaining = &remaining;
+  }
+
+  for (i_chunk=1; i_chunk < num_chunks; i_chunk++)
+    g_thread_pool_push(parallel_pool, &(jobs[i_chunk]), NULL);
+
+  /* the calling thread does the first chunk */
+  (*func)(jobs[0].start, jobs[0].end, data);
+
+  g_mutex_lock(&mutex);
+  while (remaining > 0)
+    g_cond_wait(&cond, &mutex);
+  g_mutex_unlock(&mutex);
+
+  g_free(jobs);
+  g_cond_clear(&cond);
+  g_mutex_clear(&mutex);
+
+  return;
+}
+
+/* returns the best vector instruction set this processor supports that we have
+   kernels for.  This is checked once, and the answer cached */
+AmitkSimd amitk_get_simd(void) {
+
+  static gsize simd = 0; /* stored off by one, as g_once_init_leave needs non-zero */
+  AmitkSimd found;
+
+  if (g_once_init_enter(&simd)) {
+    found = AMITK_SIMD_NONE;
+#ifdef AMIDE_SIMD_SUPPORT
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      found = AMITK_SIMD_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+      found = AMITK_SIMD_SSE2;
+#endif
+    g_once_init_leave(&simd, found+1);
+  }
+
+  return simd-1;
+}
+
+
 gboolean amitk_is_xif_directory(const gchar * filename, gboolean * plegacy1, gchar ** pxml_filename) {
 
   struct stat file_info;
@@ -41,11 +41,25 @@ G_BEGIN_DECLS
 /* defines how many times we want the progress bar to be updated over the course of an action */
 #define AMITK_UPDATE_DIVIDER 40.0 /* must be float point */
 
+/* maximum number of worker threads we'll allow the user to ask for */
+#define AMITK_MAX_THREADS 64
+
 /* file info.  magic string needs to be < 64 bytes */
 #define AMITK_FILE_VERSION (xmlChar *) "2.0"
 #define AMITK_FLAT_FILE_MAGIC_STRING "AMIDE XML Image Format Flat File"
 
 /* typedef's */
+/* function called on the items [start, end) by amitk_parallel_for */
+typedef void (*AmitkParallelFunc) (gint start, gint end, gpointer data);
+
+/* vector instruction sets we have kernels for, in increasing order of preference */
+typedef enum {
+  AMITK_SIMD_NONE,
+  AMITK_SIMD_SSE2,
+  AMITK_SIMD_AVX2,
+  AMITK_SIMD_NUM
+} AmitkSimd;
+
 /* layout of the three views in a canvas */
 typedef enum {
   AMITK_LAYOUT_LINEAR, 
@@ -151,6 +165,12 @@ gint amitk_spin_button_discard_double_or_triple_click(GtkWidget *widget, GdkEven
 GdkPixbuf * amitk_get_pixbuf_from_canvas(GnomeCanvas * canvas, gint xoffset, gint yoffset,
 					 gint width, gint height);
 
+void amitk_set_num_threads(const gint num_threads);
+gint amitk_get_num_threads(void);
+void amitk_parallel_for(const gint num_items, AmitkParallelFunc func, gpointer data);
+void amitk_parallel_set_serial(const gboolean serial);
+AmitkSimd amitk_get_simd(void);
+
 gboolean amitk_is_xif_directory(const gchar * filename, gboolean * plegacy, gchar ** pxml_filename);
 gboolean amitk_is_xif_flat_file(const gchar * filename, guint64 * plocation_le, guint64 *psize_le);
 
@@ -29,6 +29,7 @@
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
 #include "amitk_line_profile.h"
+#include "amitk_expression.h"
 
 /* variable type function declarations */
 #include "amitk_data_set_UBYTE_0D_SCALING.h"
@@ -250,13 +251,79 @@ static void          data_set_set_voxel_size         (AmitkDataSet * ds,
 						      const AmitkPoint voxel_size);
 static void           data_set_drop_intercept        (AmitkDataSet * ds);
 static void           data_set_reduce_scaling_dimension       (AmitkDataSet * ds);
+static void           data_set_set_slice_parent      (AmitkDataSet * slice,
+						      AmitkDataSet * slice_parent);
 static AmitkVolumeClass * parent_class;
 static guint         data_set_signals[LAST_SIGNAL];
 
 
 static amide_data_t calculate_scale_factor(AmitkDataSet * ds);
-GList * slice_cache_trim(GList * slice_cache, gint max_size);
-#define MIN_LOCAL_CACHE_SIZE 3
+
+/* slices, cache entries and pyramid levels of a snapshot belong to the data set it was taken from */
+#define DATA_SET_ORIGINAL(ds) (((ds)->snapshot_of != NULL) ? (ds)->snapshot_of : (ds))
+
+/* slices get kept in a cache shared by all data sets, and looked up by 
+   everything that goes into generating them.  The cache is bounded by
+   memory, slices that nobody else is using get stored as floats, and 
+   go back to doubles when they're asked for again */
+typedef struct slice_key_t {
+  AmitkDataSet * parent;
+  AmitkPoint offset; /* the view volume's space */
+  AmitkAxes axes;
+  amide_real_t thickness;
+  AmitkCanvasPoint pixel_size;
+  AmitkVoxel dim;
+  amide_time_t start;
+  amide_time_t duration;
+  amide_intpoint_t start_gate;
+  amide_intpoint_t end_gate;
+  AmitkInterpolation interpolation;
+  AmitkRendering rendering;
+  gboolean use_pyramid;
+} slice_key_t;
+
+typedef struct slice_cache_entry_t {
+  slice_key_t key;
+  AmitkDataSet * slice; /* holds a toggle reference */
+  gsize size; /* bytes of voxel data */
+  GList * link; /* in slice_cache_queue */
+} slice_cache_entry_t;
+
+G_LOCK_DEFINE_STATIC(slice_cache);
+static GHashTable * slice_cache_table = NULL; /* slice_key_t -> slice_cache_entry_t */
+static GQueue slice_cache_queue = G_QUEUE_INIT; /* most recently used at the head */
+static gsize slice_cache_used = 0;
+static gsize slice_cache_budget = ((gsize) 256) << 20; /* until the preferences say otherwise */
+static guint64 slice_cache_hits = 0;
+static guint64 slice_cache_misses = 0;
+
+static void slice_cache_remove_parent(AmitkDataSet * parent_ds);
+static void slice_cache_demote_parent(AmitkDataSet * parent_ds);
+
+/* guards the data sets' pyramid arrays, and the build states of the levels */
+G_LOCK_DEFINE_STATIC(pyramid);
+static GCond pyramid_built_cond; /* broadcast when a frame/gate of a level is done */
+static void data_set_drop_pyramid(AmitkDataSet * data_set);
+
+/* the pyramid levels of all the data sets, most recently used at the head.  The
+   levels get their own memory budget, the same size as the slice cache's */
+typedef struct pyramid_entry_t {
+  AmitkDataSet * ds; /* no reference, the entries go when the data set drops its pyramid */
+  AmitkRendering rendering;
+  gint level;
+  gsize size; /* bytes of voxel data */
+} pyramid_entry_t;
+
+static GQueue pyramid_queue = G_QUEUE_INIT;
+static gsize pyramid_used = 0;
+static gsize pyramid_budget = ((gsize) 256) << 20; /* until the preferences say otherwise */
+
+/* the frames/gates of a level get filled in as they're needed */
+typedef enum {
+  PYRAMID_EMPTY,
+  PYRAMID_BUILDING,
+  PYRAMID_BUILT
+} pyramid_state_t;
 
 GType amitk_data_set_get_type(void) {
 
@@ -444,8 +511,12 @@ static void data_set_init (AmitkDataSet * data_set) {
   AmitkWindow i_window;
   AmitkLimit i_limit;
   AmitkViewMode i_view_mode;
+  AmitkRendering i_rendering;
+  gint i_level;
 
   /* put in some sensable values */
+  g_mutex_init(&(data_set->min_max_mutex));
+  g_rw_lock_init(&(data_set->scaling_lock));
   data_set->raw_data = NULL;
   data_set->current_scaling_factor = NULL;
   data_set->gate_time = NULL;
@@ -484,6 +555,14 @@ static void data_set_init (AmitkDataSet * data_set) {
   data_set->view_start_gate = 0;
   data_set->view_end_gate = 0;
   data_set->num_view_gates= 1;
+
+  for (i_rendering=0; i_rendering < AMITK_RENDERING_NUM; i_rendering++)
+    for (i_level=0; i_level < AMITK_DATA_SET_PYRAMID_LEVELS; i_level++)
+      data_set->pyramid[i_rendering][i_level] = NULL;
+  data_set->pyramid_generation = 0;
+  data_set->pyramid_built = NULL;
+  data_set->slice_cache_entries = 0;
+  data_set->slice_cache_shared = FALSE;
   
   data_set->scan_start = 0.0;
 
@@ -495,8 +574,8 @@ static void data_set_init (AmitkDataSet * data_set) {
   data_set->rendering = AMITK_RENDERING_MPR;
   data_set->subject_orientation = AMITK_SUBJECT_ORIENTATION_UNKNOWN;
   data_set->subject_sex = AMITK_SUBJECT_SEX_UNKNOWN;
-  data_set->slice_cache = NULL;
   data_set->slice_parent = NULL;
+  data_set->snapshot_of = NULL;
 
   for (i_window=0; i_window < AMITK_WINDOW_NUM; i_window++)
     for (i_limit=0; i_limit < AMITK_LIMIT_NUM; i_limit++)
@@ -551,6 +630,14 @@ static void data_set_finalize (GObject *object)
     data_set->current_scaling_factor = NULL;
   }
 
+  g_mutex_clear(&(data_set->min_max_mutex));
+  g_rw_lock_clear(&(data_set->scaling_lock));
+
+  if (data_set->pyramid_built != NULL) {
+    g_free(data_set->pyramid_built);
+    data_set->pyramid_built = NULL;
+  }
+
   if (data_set->distribution != NULL) {
     g_object_unref(data_set->distribution);
     data_set->distribution = NULL;
@@ -601,10 +688,9 @@ static void data_set_finalize (GObject *object)
     data_set->dicom_image_type = NULL;
   }
 
-  if (data_set->slice_cache != NULL) {
-    amitk_objects_unref(data_set->slice_cache);
-    data_set->slice_cache = NULL;
-  }
+  /* the slice cache doesn't hold references to the parents */
+  slice_cache_remove_parent(data_set);
+  data_set_drop_pyramid(data_set);
 
   if (data_set->slice_parent != NULL) {
     g_object_remove_weak_pointer(G_OBJECT(data_set->slice_parent),
@@ -612,6 +698,11 @@ static void data_set_finalize (GObject *object)
     data_set->slice_parent = NULL;
   }
 
+  if (data_set->snapshot_of != NULL) {
+    amitk_object_unref(data_set->snapshot_of);
+    data_set->snapshot_of = NULL;
+  }
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -659,10 +750,9 @@ static void data_set_selection_changed(AmitkObject * object) {
   data_set = AMITK_DATA_SET(object);
 
 
-  if (!amitk_object_get_selected(object, AMITK_SELECTION_ANY)) {
-    data_set->slice_cache = 
-      slice_cache_trim(data_set->slice_cache, MIN_LOCAL_CACHE_SIZE);
-  }
+  /* slices of data sets that aren't being shown are the first to go */
+  if (!amitk_object_get_selected(object, AMITK_SELECTION_ANY)) 
+    slice_cache_demote_parent(data_set);
 
   return;
 }
@@ -1284,11 +1374,10 @@ static gchar * data_set_read_xml(AmitkObject * object, xmlNodePtr nodes,
 
 static void data_set_invalidate_slice_cache(AmitkDataSet * data_set) {
 
-  /* invalidate cache */
-  if (data_set->slice_cache != NULL) {
-    amitk_objects_unref(data_set->slice_cache);
-    data_set->slice_cache = NULL;
-  }
+  /* invalidate cache.  The pyramid goes first, as bumping its generation is
+     what keeps slices from snapshots taken before now out of the cache */
+  data_set_drop_pyramid(data_set);
+  slice_cache_remove_parent(data_set);
 
 
   return;
@@ -2118,12 +2207,13 @@ gboolean amitk_data_sets_export_to_file(GList * data_sets,
 	/* advance the requested slice volume */
 	amitk_space_set_offset(AMITK_SPACE(volume), amitk_space_s2b(AMITK_SPACE(export_ds), new_offset));
 
-	slices = amitk_data_sets_get_slices(data_sets, NULL, 0,
+	slices = amitk_data_sets_get_slices(data_sets,
 					    amitk_data_set_get_start_time(export_ds, i_voxel.t)+EPSILON,
 					    amitk_data_set_get_frame_duration(export_ds, i_voxel.t)-EPSILON,
 					    i_voxel.g,
 					    pixel_size,
-					    volume);
+					    volume,
+					    FALSE);
 
 	temp_slices = slices;
 	while (temp_slices != NULL) {
@@ -2724,6 +2814,7 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
     else
       scaling = new_scale_factor/ds->scale_factor;
 
+    g_rw_lock_writer_lock(&(ds->scaling_lock));
     ds->scale_factor = new_scale_factor;
     if (ds->current_scaling_factor != NULL)
       if ((ds->current_scaling_factor->dim.x != ds->internal_scaling_factor->dim.x) ||
@@ -2739,7 +2830,10 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
       ds->current_scaling_factor = amitk_raw_data_new_with_data(ds->internal_scaling_factor->format,
 							 ds->internal_scaling_factor->dim);
 							 
-      g_return_if_fail(ds->current_scaling_factor != NULL);
+      if (ds->current_scaling_factor == NULL) {
+	g_rw_lock_writer_unlock(&(ds->scaling_lock));
+	g_return_if_reached();
+      }
     }
     
     for(i.t = 0; i.t < ds->current_scaling_factor->dim.t; i.t++) 
@@ -2750,9 +2844,11 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
 	      AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->current_scaling_factor, i) = 
 		ds->scale_factor *
 		AMITK_RAW_DATA_DOUBLE_CONTENT(ds->internal_scaling_factor, i);
+    g_rw_lock_writer_unlock(&(ds->scaling_lock));
     
     /* adjust all thresholds and other variables so they remain constant 
        relative the change in scale factors */
+    g_mutex_lock(&(ds->min_max_mutex));
     for (j=0; j<2; j++) {
       ds->threshold_max[j] *= scaling;
       ds->threshold_min[j] *= scaling;
@@ -2764,6 +2860,7 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
 	ds->frame_max[j] *= scaling;
 	ds->frame_min[j] *= scaling;
       }
+    g_mutex_unlock(&(ds->min_max_mutex));
 
     /* and emit the signal */
     g_signal_emit (G_OBJECT (ds), data_set_signals[SCALE_FACTOR_CHANGED], 0);
@@ -3038,6 +3135,49 @@ guint amitk_data_set_get_frame(const AmitkDataSet * ds, const amide_time_t time)
   return AMITK_DATA_SET_NUM_FRAMES(ds)-1;
 }
 
+/* lets the raw data paging know we're about to read the given frame.
+   If gate is negative, requests all the gates we're currently viewing */
+static void data_set_frame_request(const AmitkDataSet * ds, const gint frame, 
+				   const gint gate, const gboolean prefetch) {
+
+  gint i_gate, num_gates, which_gate;
+
+  if (gate < 0) 
+    num_gates = AMITK_DATA_SET_NUM_VIEW_GATES(ds);
+  else 
+    num_gates = 1;
+
+  for (i_gate=0; i_gate < num_gates; i_gate++) {
+    which_gate = i_gate + ((gate < 0) ? AMITK_DATA_SET_VIEW_START_GATE(ds) : gate);
+    if (which_gate >= AMITK_DATA_SET_NUM_GATES(ds))
+      which_gate -= AMITK_DATA_SET_NUM_GATES(ds);
+
+    if (prefetch)
+      amitk_raw_data_prefetch_frame(ds->raw_data, frame, which_gate);
+    else
+      amitk_raw_data_request_frame(ds->raw_data, frame, which_gate);
+  }
+
+  return;
+}
+
+void amitk_data_set_request_frame(const AmitkDataSet * ds, const gint frame, const gint gate) {
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_return_if_fail(ds->raw_data != NULL);
+
+  data_set_frame_request(ds, frame, gate, FALSE);
+}
+
+/* same as amitk_data_set_request_frame, but for frames we'll probably want soon */
+void amitk_data_set_prefetch_frame(const AmitkDataSet * ds, const gint frame, const gint gate) {
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_return_if_fail(ds->raw_data != NULL);
+
+  data_set_frame_request(ds, frame, gate, TRUE);
+}
+
 amide_time_t amitk_data_set_get_frame_duration (const AmitkDataSet * ds, guint frame) {
 
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds), 1.0);
@@ -3081,7 +3221,7 @@ void amitk_data_set_calc_far_corner(AmitkDataSet * ds) {
 }
 
 
-static void (*calc_slice_min_max_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, const amide_intpoint_t, const amide_intpoint_t, const amide_intpoint_t, amitk_format_DOUBLE_t *, amitk_format_DOUBLE_t *) = {
+static void (*calc_slice_min_max_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, const amide_intpoint_t, const amide_intpoint_t, const amide_intpoint_t, amitk_format_DOUBLE_t *, amitk_format_DOUBLE_t *, guint64 *) = {
   {amitk_data_set_UBYTE_0D_SCALING_calc_slice_min_max, amitk_data_set_UBYTE_1D_SCALING_calc_slice_min_max,  amitk_data_set_UBYTE_2D_SCALING_calc_slice_min_max, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_calc_slice_min_max, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_calc_slice_min_max,  amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_calc_slice_min_max  },
   {amitk_data_set_SBYTE_0D_SCALING_calc_slice_min_max, amitk_data_set_SBYTE_1D_SCALING_calc_slice_min_max,  amitk_data_set_SBYTE_2D_SCALING_calc_slice_min_max, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_calc_slice_min_max, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_calc_slice_min_max,  amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_calc_slice_min_max  },
   {amitk_data_set_USHORT_0D_SCALING_calc_slice_min_max,amitk_data_set_USHORT_1D_SCALING_calc_slice_min_max, amitk_data_set_USHORT_2D_SCALING_calc_slice_min_max,amitk_data_set_USHORT_0D_SCALING_INTERCEPT_calc_slice_min_max,amitk_data_set_USHORT_1D_SCALING_INTERCEPT_calc_slice_min_max, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_calc_slice_min_max },
@@ -3099,23 +3239,142 @@ void amitk_data_set_slice_calc_min_max (AmitkDataSet * ds,
 					const amide_intpoint_t z,
 					amitk_format_DOUBLE_t * pmin,
 					amitk_format_DOUBLE_t * pmax) {
-  (*calc_slice_min_max_func[ds->raw_data->format][ds->scaling_type])(ds, frame, gate, z, pmin, pmax);
+  (*calc_slice_min_max_func[ds->raw_data->format][ds->scaling_type])(ds, frame, gate, z, pmin, pmax, NULL);
 }
 
-/* function to calculate the max and min over the data frames */
-void amitk_data_set_calc_min_max(AmitkDataSet * ds,
-				 AmitkUpdateFunc update_func,
-				 gpointer update_data) {
+typedef struct calc_min_max_t {
+  AmitkDataSet * ds;
+  amide_intpoint_t frame;
+  amitk_format_DOUBLE_t * plane_min;
+  amitk_format_DOUBLE_t * plane_max;
+  guint64 * raw_histogram; /* NULL if we're not binning the raw values */
+  gint raw_histogram_size;
+  GMutex * mutex;
+} calc_min_max_t;
+
+/* the number of bins needed to histogram every possible raw value of the data set,
+   or 0 if that's not practical or if the bins can't be turned into the distribution
+   directly (the scaling has to be the same for the whole data set) */
+static gint raw_histogram_size(const AmitkDataSet * ds) {
+
+  if ((ds->scaling_type != AMITK_SCALING_TYPE_0D) &&
+      (ds->scaling_type != AMITK_SCALING_TYPE_0D_WITH_INTERCEPT))
+    return 0;
+
+  switch(ds->raw_data->format) {
+  case AMITK_FORMAT_UBYTE:
+  case AMITK_FORMAT_SBYTE:
+    return 1 << 8;
+  case AMITK_FORMAT_USHORT:
+  case AMITK_FORMAT_SSHORT:
+    return 1 << 16;
+  default:
+    return 0;
+  }
+}
+
+/* does the planes [start, end) of a frame, the planes being numbered gate by gate */
+static void calc_min_max_planes(gint start, gint end, gpointer data) {
+
+  calc_min_max_t * mm = data;
+  guint64 * raw_histogram = NULL;
+  gint i_plane;
+  gint i_bin;
+  amide_intpoint_t dim_z;
+
+  if (mm->raw_histogram != NULL)
+    raw_histogram = g_new0(guint64, mm->raw_histogram_size);
+
+  dim_z = AMITK_DATA_SET_DIM_Z(mm->ds);
+  for (i_plane = start; i_plane < end; i_plane++) 
+    (*calc_slice_min_max_func[mm->ds->raw_data->format][mm->ds->scaling_type])
+      (mm->ds, mm->frame, i_plane / dim_z, i_plane % dim_z, 
+       &(mm->plane_min[i_plane]), &(mm->plane_max[i_plane]), raw_histogram);
+
+  if (raw_histogram != NULL) {
+    g_mutex_lock(mm->mutex);
+    for (i_bin = 0; i_bin < mm->raw_histogram_size; i_bin++)
+      mm->raw_histogram[i_bin] += raw_histogram[i_bin];
+    g_mutex_unlock(mm->mutex);
+    g_free(raw_histogram);
+  }
+
+  return;
+}
+
+/* turns a histogram of the raw values into the data set's distribution, giving the
+   same result as calc_distribution would on the data */
+static void distribution_from_raw_histogram(AmitkDataSet * ds, const guint64 * raw_histogram,
+					    const gint histogram_size) {
+
+  AmitkRawData * distribution;
+  AmitkVoxel dim, i, j;
+  amide_data_t scale, intercept=0.0;
+  amide_data_t bin_scale, diff;
+  amide_data_t value;
+  gint i_bin, offset, bin;
+
+  dim.x = AMITK_DATA_SET_DISTRIBUTION_SIZE;
+  dim.y = dim.z = dim.g = dim.t = 1;
+  distribution = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, dim);
+  if (distribution == NULL) {
+    g_warning(_("couldn't allocate memory space for the data set structure to hold distribution data"));
+    return;
+  }
+  amitk_raw_data_DOUBLE_initialize_data(distribution, 0.0);
+
+  diff = ds->global_max - ds->global_min;
+  if (diff == 0.0)
+    bin_scale = 0.0;
+  else
+    bin_scale = (AMITK_DATA_SET_DISTRIBUTION_SIZE-1)/diff;
+
+  i = zero_voxel;
+  scale = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(ds->current_scaling_factor, i);
+  if (ds->scaling_type == AMITK_SCALING_TYPE_0D_WITH_INTERCEPT)
+    intercept = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(ds->internal_scaling_intercept, i);
+  offset = ((ds->raw_data->format == AMITK_FORMAT_SBYTE) || 
+	    (ds->raw_data->format == AMITK_FORMAT_SSHORT)) ? histogram_size/2 : 0;
+
+  j = zero_voxel;
+  for (i_bin = 0; i_bin < histogram_size; i_bin++) {
+    if (raw_histogram[i_bin] == 0) continue;
+    value = scale*(((amide_data_t) (i_bin-offset)) + intercept);
+    if (!finite(value)) continue;
+    bin = bin_scale*(value-ds->global_min);
+    j.x = CLAMP(bin, 0, AMITK_DATA_SET_DISTRIBUTION_SIZE-1);
+    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) += raw_histogram[i_bin];
+  }
+
+  /* same log scaling as calc_distribution */
+  for (j.x = 0; j.x < dim.x ; j.x++) 
+    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) = 
+      log10(AMITK_RAW_DATA_DOUBLE_CONTENT(distribution,j)+1.0);
+
+  if (ds->distribution != NULL)
+    g_object_unref(ds->distribution);
+  ds->distribution = distribution;
+
+  return;
+}
+
+/* function to calculate the max and min over the data frames.  The planes of
+   each frame are split between threads.  For 8 and 16 bit data with a single
+   scale factor, the raw values are also binned on the way through, so the
+   distribution comes out of the same pass instead of needing another one.
+   Called with the data set's min_max_mutex held */
+static void data_set_calc_min_max(AmitkDataSet * ds,
+				  AmitkUpdateFunc update_func,
+				  gpointer update_data) {
 
   AmitkVoxel i;
-  amide_data_t max, min, temp;
-  amide_data_t slice_max, slice_min;
-  div_t x;
-  gint divider;
-  gint total_planes;
+  amide_data_t max, min;
+  gint frame_planes;
   gint i_plane;
   gchar * temp_string;
   AmitkVoxel dim;
+  calc_min_max_t mm;
+  GMutex mutex;
 
   g_return_if_fail(AMITK_IS_DATA_SET(ds));
   g_return_if_fail(ds->raw_data != NULL);
@@ -3130,6 +3389,24 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
   g_return_if_fail(ds->frame_max != NULL);
   g_return_if_fail(ds->frame_min != NULL);
 
+  frame_planes = dim.g*dim.z;
+  mm.ds = ds;
+  mm.plane_min = g_try_new(amitk_format_DOUBLE_t, frame_planes);
+  mm.plane_max = g_try_new(amitk_format_DOUBLE_t, frame_planes);
+  if ((mm.plane_min == NULL) || (mm.plane_max == NULL)) {
+    g_warning(_("couldn't allocate memory space for the max/min calculation"));
+    g_free(mm.plane_min);
+    g_free(mm.plane_max);
+    return;
+  }
+  mm.raw_histogram_size = raw_histogram_size(ds);
+  if (mm.raw_histogram_size > 0)
+    mm.raw_histogram = g_try_new0(guint64, mm.raw_histogram_size);
+  else
+    mm.raw_histogram = NULL;
+  g_mutex_init(&mutex);
+  mm.mutex = &mutex;
+
   /* note, we can't cancel this */
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Calculating Max/Min Values for:\n   %s"), 
@@ -3139,32 +3416,29 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
     g_free(temp_string);
   }
 
-  total_planes = AMITK_DATA_SET_TOTAL_PLANES(ds);
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
-
-  i_plane=0;
   for (i.t = 0; i.t < dim.t; i.t++) {
+    if (update_func != NULL) 
+      (*update_func)(update_data, NULL, ((gdouble) i.t)/((gdouble) dim.t));
+
+    for (i.g = 0; i.g < dim.g; i.g++)
+      amitk_raw_data_request_frame(ds->raw_data, i.t, i.g);
+
+    mm.frame = i.t;
+    amitk_parallel_for(frame_planes, calc_min_max_planes, &mm);
+
+    /* reduce in plane order, so the result doesn't depend on the threading */
     i.x = i.y = i.z = i.g = 0;
-    temp = amitk_data_set_get_value(ds,i);
-    if (finite(temp)) max = min = temp;   
+    max = amitk_data_set_get_value(ds,i);
+    if (finite(max)) min = max;   
     else max = min = 0.0; /* just throw in zero */
-
-    for (i.g = 0; i.g < dim.g; i.g++) {
-      for (i.z = 0; i.z < dim.z; i.z++, i_plane++) {
-	if (update_func != NULL) {
-	  x = div(i_plane, divider);
-	  if (x.rem == 0) 
-	    (*update_func)(update_data, NULL, ((gdouble) i_plane)/((gdouble)total_planes));
-	}
-	amitk_data_set_slice_calc_min_max(ds, i.t, i.g, i.z, &slice_min, &slice_max);
-	if (finite(slice_min))
-	  if (slice_min < min)
-	    min = slice_min;
-	if (finite(slice_max))
-	  if (slice_max > max)
-	    max = slice_max;
-      }
-    }    
+    for (i_plane = 0; i_plane < frame_planes; i_plane++) {
+      if (finite(mm.plane_min[i_plane]))
+	if (mm.plane_min[i_plane] < min)
+	  min = mm.plane_min[i_plane];
+      if (finite(mm.plane_max[i_plane]))
+	if (mm.plane_max[i_plane] > max)
+	  max = mm.plane_max[i_plane];
+    }
     ds->frame_max[i.t] = max;
     ds->frame_min[i.t] = min;
     
@@ -3177,6 +3451,10 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
   if (update_func != NULL)
     (*update_func)(update_data, NULL, (gdouble) 2.0); /* remove progress bar */
 
+  g_mutex_clear(&mutex);
+  g_free(mm.plane_min);
+  g_free(mm.plane_max);
+
   /* calc the global max/min */
   ds->global_max = ds->frame_max[0];
   ds->global_min = ds->frame_min[0];
@@ -3188,7 +3466,13 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
   }
 
   /* note that we've calculated the max and mins */
-  ds->min_max_calculated = TRUE;
+  g_atomic_int_set(&(ds->min_max_calculated), TRUE);
+
+  /* the raw value histogram gives us the distribution for free */
+  if (mm.raw_histogram != NULL) {
+    distribution_from_raw_histogram(ds, mm.raw_histogram, mm.raw_histogram_size);
+    g_free(mm.raw_histogram);
+  }
 
 #ifdef AMIDE_DEBUG
   if (AMITK_DATA_SET_DIM_Z(ds) > 1) /* don't print for slices */
@@ -3198,11 +3482,35 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
   return;
 }
 
+void amitk_data_set_calc_min_max(AmitkDataSet * ds,
+				 AmitkUpdateFunc update_func,
+				 gpointer update_data) {
+
+  g_mutex_lock(&(ds->min_max_mutex));
+  g_rw_lock_reader_lock(&(ds->scaling_lock));
+  data_set_calc_min_max(ds, update_func, update_data);
+  g_rw_lock_reader_unlock(&(ds->scaling_lock));
+  g_mutex_unlock(&(ds->min_max_mutex));
+
+  return;
+}
+
+/* can get called from the canvas' render thread, so check again once we
+   have the lock in case another thread got to it first */
 void amitk_data_set_calc_min_max_if_needed(AmitkDataSet * ds,
 					   AmitkUpdateFunc update_func,
 					   gpointer update_data) {
-  if (!ds->min_max_calculated)
-    amitk_data_set_calc_min_max(ds, update_func, update_data);
+
+  if (g_atomic_int_get(&(ds->min_max_calculated))) return;
+
+  g_mutex_lock(&(ds->min_max_mutex));
+  if (!ds->min_max_calculated) {
+    g_rw_lock_reader_lock(&(ds->scaling_lock));
+    data_set_calc_min_max(ds, update_func, update_data);
+    g_rw_lock_reader_unlock(&(ds->scaling_lock));
+  }
+  g_mutex_unlock(&(ds->min_max_mutex));
+
   return;
 }
 
@@ -3875,6 +4183,85 @@ amide_data_t amitk_data_set_get_value(const AmitkDataSet * ds, const AmitkVoxel
   }
 }
 
+static amide_data_t (*get_value_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(const AmitkDataSet *, const AmitkVoxel) = {
+  {amitk_data_set_UBYTE_0D_SCALING_get_value, amitk_data_set_UBYTE_1D_SCALING_get_value, amitk_data_set_UBYTE_2D_SCALING_get_value, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_get_value, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_get_value, amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_SBYTE_0D_SCALING_get_value, amitk_data_set_SBYTE_1D_SCALING_get_value, amitk_data_set_SBYTE_2D_SCALING_get_value, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_get_value, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_get_value, amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_USHORT_0D_SCALING_get_value, amitk_data_set_USHORT_1D_SCALING_get_value, amitk_data_set_USHORT_2D_SCALING_get_value, amitk_data_set_USHORT_0D_SCALING_INTERCEPT_get_value, amitk_data_set_USHORT_1D_SCALING_INTERCEPT_get_value, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_SSHORT_0D_SCALING_get_value, amitk_data_set_SSHORT_1D_SCALING_get_value, amitk_data_set_SSHORT_2D_SCALING_get_value, amitk_data_set_SSHORT_0D_SCALING_INTERCEPT_get_value, amitk_data_set_SSHORT_1D_SCALING_INTERCEPT_get_value, amitk_data_set_SSHORT_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_UINT_0D_SCALING_get_value, amitk_data_set_UINT_1D_SCALING_get_value, amitk_data_set_UINT_2D_SCALING_get_value, amitk_data_set_UINT_0D_SCALING_INTERCEPT_get_value, amitk_data_set_UINT_1D_SCALING_INTERCEPT_get_value, amitk_data_set_UINT_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_SINT_0D_SCALING_get_value, amitk_data_set_SINT_1D_SCALING_get_value, amitk_data_set_SINT_2D_SCALING_get_value, amitk_data_set_SINT_0D_SCALING_INTERCEPT_get_value, amitk_data_set_SINT_1D_SCALING_INTERCEPT_get_value, amitk_data_set_SINT_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_FLOAT_0D_SCALING_get_value, amitk_data_set_FLOAT_1D_SCALING_get_value, amitk_data_set_FLOAT_2D_SCALING_get_value, amitk_data_set_FLOAT_0D_SCALING_INTERCEPT_get_value, amitk_data_set_FLOAT_1D_SCALING_INTERCEPT_get_value, amitk_data_set_FLOAT_2D_SCALING_INTERCEPT_get_value},
+  {amitk_data_set_DOUBLE_0D_SCALING_get_value, amitk_data_set_DOUBLE_1D_SCALING_get_value, amitk_data_set_DOUBLE_2D_SCALING_get_value, amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_get_value, amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_get_value, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_get_value}
+};
+
+/* returns a function that gets the value of a voxel, specialized for this data set's format
+   and scaling type.  Unlike amitk_data_set_get_value, the returned function does no
+   checking of any sort, so the caller needs to make sure the voxel is in the data set. 
+   Useful for loops that jump around the data set, use amitk_data_set_get_row otherwise */
+AmitkDataSetValueFunc amitk_data_set_get_value_func(const AmitkDataSet * ds) {
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+
+  return get_value_func[ds->raw_data->format][ds->scaling_type];
+}
+
+static void (*get_row_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(const AmitkDataSet *, const AmitkVoxel, const gboolean, amide_data_t *) = {
+  {amitk_data_set_UBYTE_0D_SCALING_get_row, amitk_data_set_UBYTE_1D_SCALING_get_row, amitk_data_set_UBYTE_2D_SCALING_get_row, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_get_row, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_get_row, amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_SBYTE_0D_SCALING_get_row, amitk_data_set_SBYTE_1D_SCALING_get_row, amitk_data_set_SBYTE_2D_SCALING_get_row, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_get_row, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_get_row, amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_USHORT_0D_SCALING_get_row, amitk_data_set_USHORT_1D_SCALING_get_row, amitk_data_set_USHORT_2D_SCALING_get_row, amitk_data_set_USHORT_0D_SCALING_INTERCEPT_get_row, amitk_data_set_USHORT_1D_SCALING_INTERCEPT_get_row, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_SSHORT_0D_SCALING_get_row, amitk_data_set_SSHORT_1D_SCALING_get_row, amitk_data_set_SSHORT_2D_SCALING_get_row, amitk_data_set_SSHORT_0D_SCALING_INTERCEPT_get_row, amitk_data_set_SSHORT_1D_SCALING_INTERCEPT_get_row, amitk_data_set_SSHORT_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_UINT_0D_SCALING_get_row, amitk_data_set_UINT_1D_SCALING_get_row, amitk_data_set_UINT_2D_SCALING_get_row, amitk_data_set_UINT_0D_SCALING_INTERCEPT_get_row, amitk_data_set_UINT_1D_SCALING_INTERCEPT_get_row, amitk_data_set_UINT_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_SINT_0D_SCALING_get_row, amitk_data_set_SINT_1D_SCALING_get_row, amitk_data_set_SINT_2D_SCALING_get_row, amitk_data_set_SINT_0D_SCALING_INTERCEPT_get_row, amitk_data_set_SINT_1D_SCALING_INTERCEPT_get_row, amitk_data_set_SINT_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_FLOAT_0D_SCALING_get_row, amitk_data_set_FLOAT_1D_SCALING_get_row, amitk_data_set_FLOAT_2D_SCALING_get_row, amitk_data_set_FLOAT_0D_SCALING_INTERCEPT_get_row, amitk_data_set_FLOAT_1D_SCALING_INTERCEPT_get_row, amitk_data_set_FLOAT_2D_SCALING_INTERCEPT_get_row},
+  {amitk_data_set_DOUBLE_0D_SCALING_get_row, amitk_data_set_DOUBLE_1D_SCALING_get_row, amitk_data_set_DOUBLE_2D_SCALING_get_row, amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_get_row, amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_get_row, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_get_row}
+};
+
+/* fills in row (which needs to hold dim.x values) with the values of the row of the
+   data set at (i.t, i.g, i.z, i.y), i.x is ignored */
+void amitk_data_set_get_row(const AmitkDataSet * ds, const AmitkVoxel i, amide_data_t * row) {
+
+  AmitkVoxel j;
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  j = i;
+  j.x = 0;
+  g_return_if_fail(amitk_raw_data_includes_voxel(ds->raw_data, j));
+
+  (*get_row_func[ds->raw_data->format][ds->scaling_type])(ds, j, FALSE, row);
+}
+
+/* same as amitk_data_set_get_row, except only the internal scale factor is applied,
+   see amitk_data_set_get_internal_value */
+void amitk_data_set_get_internal_row(const AmitkDataSet * ds, const AmitkVoxel i, amide_data_t * row) {
+
+  AmitkVoxel j;
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  j = i;
+  j.x = 0;
+  g_return_if_fail(amitk_raw_data_includes_voxel(ds->raw_data, j));
+
+  (*get_row_func[ds->raw_data->format][ds->scaling_type])(ds, j, TRUE, row);
+}
+
+/* fills in plane (which needs to hold dim.x*dim.y values) with the values of the
+   plane of the data set at (i.t, i.g, i.z), i.x and i.y are ignored */
+void amitk_data_set_get_plane(const AmitkDataSet * ds, const AmitkVoxel i, amide_data_t * plane) {
+
+  AmitkVoxel j;
+  void (* row_func)(const AmitkDataSet *, const AmitkVoxel, const gboolean, amide_data_t *);
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  j = i;
+  j.x = j.y = 0;
+  g_return_if_fail(amitk_raw_data_includes_voxel(ds->raw_data, j));
+
+  row_func = get_row_func[ds->raw_data->format][ds->scaling_type];
+  for (j.y = 0; j.y < AMITK_DATA_SET_DIM_Y(ds); j.y++)
+    (*row_func)(ds, j, FALSE, plane + j.y*AMITK_DATA_SET_DIM_X(ds));
+}
+
+
 amide_data_t amitk_data_set_get_internal_scaling_factor(const AmitkDataSet * ds, const AmitkVoxel i) {
 
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds), EMPTY);
@@ -4128,7 +4515,7 @@ void amitk_data_set_set_internal_value(AmitkDataSet * ds,
 
 
 
-static AmitkDataSet * (*get_slice_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, const amide_time_t, const amide_time_t, const amide_intpoint_t, const AmitkCanvasPoint, const AmitkVolume *) = {
+static AmitkDataSet * (*get_slice_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, const amide_time_t, const amide_time_t, const amide_intpoint_t, const AmitkInterpolation, const amide_intpoint_t, const amide_intpoint_t, const AmitkCanvasPoint, const AmitkVolume *) = {
   {amitk_data_set_UBYTE_0D_SCALING_get_slice, amitk_data_set_UBYTE_1D_SCALING_get_slice,  amitk_data_set_UBYTE_2D_SCALING_get_slice, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_get_slice, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_get_slice,  amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_get_slice  },
   {amitk_data_set_SBYTE_0D_SCALING_get_slice, amitk_data_set_SBYTE_1D_SCALING_get_slice,  amitk_data_set_SBYTE_2D_SCALING_get_slice, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_get_slice, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_get_slice,  amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_get_slice  },
   {amitk_data_set_USHORT_0D_SCALING_get_slice,amitk_data_set_USHORT_1D_SCALING_get_slice, amitk_data_set_USHORT_2D_SCALING_get_slice,amitk_data_set_USHORT_0D_SCALING_INTERCEPT_get_slice,amitk_data_set_USHORT_1D_SCALING_INTERCEPT_get_slice, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_get_slice },
@@ -4139,6 +4526,44 @@ static AmitkDataSet * (*get_slice_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM]
   {amitk_data_set_DOUBLE_0D_SCALING_get_slice,amitk_data_set_DOUBLE_1D_SCALING_get_slice, amitk_data_set_DOUBLE_2D_SCALING_get_slice,amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_get_slice,amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_get_slice, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_get_slice }
 };
 
+/* makes the slice look like it came from the given data set */
+static void data_set_set_slice_parent(AmitkDataSet * slice, AmitkDataSet * slice_parent) {
+
+  if (slice->slice_parent != NULL)
+    g_object_remove_weak_pointer(G_OBJECT(slice->slice_parent), (gpointer *) &(slice->slice_parent));
+  slice->slice_parent = slice_parent;
+  g_object_add_weak_pointer(G_OBJECT(slice_parent), (gpointer *) &(slice->slice_parent));
+
+  return;
+}
+
+/* the interpolation and view gates are passed in separately, so that slices
+   taken through a pyramid level can use the settings of the data set it came from */
+static AmitkDataSet * data_set_get_slice(AmitkDataSet * ds,
+					 const amide_time_t start,
+					 const amide_time_t duration,
+					 const amide_intpoint_t gate,
+					 const AmitkInterpolation interpolation,
+					 const amide_intpoint_t view_start_gate,
+					 const amide_intpoint_t view_end_gate,
+					 const AmitkCanvasPoint pixel_size,
+					 const AmitkVolume * slice_volume) {
+
+  AmitkDataSet * slice;
+
+  /* hand everything off to the data type specific function */
+  g_rw_lock_reader_lock(&(ds->scaling_lock));
+  slice = (*get_slice_func[ds->raw_data->format][ds->scaling_type])(ds, start, duration, gate, 
+								     interpolation, view_start_gate, view_end_gate,
+								     pixel_size, slice_volume);
+  g_rw_lock_reader_unlock(&(ds->scaling_lock));
+
+  if ((slice != NULL) && (ds->snapshot_of != NULL))
+    data_set_set_slice_parent(slice, ds->snapshot_of);
+
+  return slice;
+}
+
 /* returns a "2D" slice from a data set */
 AmitkDataSet *amitk_data_set_get_slice(AmitkDataSet * ds,
 				       const amide_time_t start,
@@ -4147,118 +4572,604 @@ AmitkDataSet *amitk_data_set_get_slice(AmitkDataSet * ds,
 				       const AmitkCanvasPoint pixel_size,
 				       const AmitkVolume * slice_volume) {
 
-  AmitkDataSet * slice;
-
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
   g_return_val_if_fail(ds->raw_data != NULL, NULL);
 
-  /* hand everything off to the data type specific function */
-  slice = (*get_slice_func[ds->raw_data->format][ds->scaling_type])(ds, start, duration, gate, pixel_size, slice_volume);
-  return slice;
+  return data_set_get_slice(ds, start, duration, gate, AMITK_DATA_SET_INTERPOLATION(ds),
+			    AMITK_DATA_SET_VIEW_START_GATE(ds), AMITK_DATA_SET_VIEW_END_GATE(ds),
+			    pixel_size, slice_volume);
 }
 
-/* start_point and end_point should be in the base coordinate frame */
-void  amitk_data_set_get_line_profile(AmitkDataSet * ds,
-				      const amide_time_t start,
-				      const amide_time_t duration,
-				      const AmitkPoint base_start_point,
-				      const AmitkPoint base_end_point,
-				      GPtrArray ** preturn_data) {
 
-  AmitkPoint start_point, end_point;
-  AmitkPoint candidate_point, current_point;
-  AmitkPoint step;
-  AmitkPoint direction;
-  AmitkVoxel current_voxel, last_voxel, candidate_voxel;
-  amide_real_t min_size;
-  amide_real_t length;
-  amide_intpoint_t i_gate;
-  gint start_frame, end_frame;
-  amide_time_t used_start, used_end, used_duration;
-  amide_time_t ds_start, ds_end;
-  amide_data_t value, gate_value, time_weight;
-  AmitkLineProfileDataElement * element;
-  AmitkPoint voxel_point;
-  gdouble m;
+/* throws out the reduced resolution copies of the data set */
+static void data_set_drop_pyramid(AmitkDataSet * data_set) {
 
-  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  AmitkRendering i_rendering;
+  gint i_level;
+  GList * levels=NULL;
+  GList * link;
+  GList * next;
+  pyramid_entry_t * entry;
+
+  G_LOCK(pyramid);
+  data_set->pyramid_generation++;
+  for (i_rendering=0; i_rendering < AMITK_RENDERING_NUM; i_rendering++)
+    for (i_level=0; i_level < AMITK_DATA_SET_PYRAMID_LEVELS; i_level++)
+      if (data_set->pyramid[i_rendering][i_level] != NULL) {
+	levels = g_list_prepend(levels, data_set->pyramid[i_rendering][i_level]);
+	data_set->pyramid[i_rendering][i_level] = NULL;
+      }
 
-  *preturn_data = g_ptr_array_new();
-  g_return_if_fail(*preturn_data != NULL);
+  /* a data set without levels doesn't have any entries either */
+  if (levels != NULL) 
+    for (link = pyramid_queue.head; link != NULL; link = next) {
+      next = link->next;
+      entry = link->data;
+      if (entry->ds == data_set) {
+	pyramid_used -= entry->size;
+	g_queue_delete_link(&pyramid_queue, link);
+	g_free(entry);
+      }
+    }
+  G_UNLOCK(pyramid);
 
-  /* figure out what frames of this data set to use */
-  used_start = start;
-  start_frame = amitk_data_set_get_frame(ds, used_start);
-  ds_start = amitk_data_set_get_start_time(ds, start_frame);
+  amitk_objects_unref(levels);
 
-  used_end = start+duration;
-  end_frame = amitk_data_set_get_frame(ds, used_end);
-  ds_end = amitk_data_set_get_end_time(ds, end_frame);
+  return;
+}
 
-  if (ds_end < used_end) used_end = ds_end;
-  if (ds_start > used_start) used_start = ds_start;
-  used_duration = used_end-used_start;
+/* drops the least recently used levels until we're back under budget.  The 
+   most recently used level always stays.  Needs to be called with the lock 
+   held, returns the levels to unref */
+static GList * pyramid_trim_to_budget(void) {
 
-  /* translate the start and end into the data set's coordinate frame */
-  start_point = amitk_space_b2s(AMITK_SPACE(ds), base_start_point);
-  end_point = amitk_space_b2s(AMITK_SPACE(ds), base_end_point);
+  GList * to_unref=NULL;
+  pyramid_entry_t * entry;
 
-  /* figure out the direction we want to go */
-  direction = point_sub(end_point, start_point);
-  length = point_mag(direction);
+  while ((pyramid_queue.tail != pyramid_queue.head) && (pyramid_used > pyramid_budget)) {
+    entry = g_queue_pop_tail(&pyramid_queue);
+    pyramid_used -= entry->size;
+    to_unref = g_list_prepend(to_unref, entry->ds->pyramid[entry->rendering][entry->level-1]);
+    entry->ds->pyramid[entry->rendering][entry->level-1] = NULL;
+    g_free(entry);
+  }
 
-  /* figure out what our "step" size will be (1/4 a voxel size) */
-  min_size = point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(ds));
-  step = point_cmult((1.0/4.0)*min_size*(1.0/length), direction);
+  return to_unref;
+}
 
-  /* initialize starting values */
-  current_point = start_point;
-  POINT_TO_VOXEL(current_point, AMITK_DATA_SET_VOXEL_SIZE(ds), start_frame, AMITK_DATA_SET_VIEW_START_GATE(ds), current_voxel);
+/* moves the level to the front of the line.  Needs to be called with the lock held */
+static void pyramid_touch(const AmitkDataSet * ds, const AmitkRendering rendering, const gint level) {
 
-  while (point_mag(point_sub(current_point, start_point)) < length) {
+  GList * link;
+  pyramid_entry_t * entry;
 
-    /* this next snippet of code advances us along the line so that we're at the point
-       on the line closest to the center of the voxel */
-    VOXEL_TO_POINT(current_voxel, AMITK_DATA_SET_VOXEL_SIZE(ds), voxel_point);
-    m = ((voxel_point.x-start_point.x)*direction.x + 
-	 (voxel_point.y-start_point.y)*direction.y + 
-	 (voxel_point.z-start_point.z)*direction.z) / (length*length);
-    candidate_point = point_add(start_point, point_cmult(m, direction));
-    /* note, we may get a voxel out that's not the current voxel... we'll skip the voxel
-       in that case */
-    POINT_TO_VOXEL(candidate_point, AMITK_DATA_SET_VOXEL_SIZE(ds), current_voxel.t, current_voxel.g,candidate_voxel);
+  for (link = pyramid_queue.head; link != NULL; link = link->next) {
+    entry = link->data;
+    if ((entry->ds == ds) && (entry->rendering == rendering) && (entry->level == level)) {
+      g_queue_unlink(&pyramid_queue, link);
+      g_queue_push_head_link(&pyramid_queue, link);
+      return;
+    }
+  }
 
-    /* record the value if it's in the data set */
-    if ((amitk_raw_data_includes_voxel(AMITK_DATA_SET_RAW_DATA(ds), current_voxel)) &&
-	(VOXEL_EQUAL(candidate_voxel, current_voxel))) {
+  return;
+}
 
-      /* need to average over frames */
-      value = 0;
-      for (current_voxel.t=start_frame; current_voxel.t<=end_frame;current_voxel.t++) {
+typedef struct pyramid_build_t {
+  const AmitkDataSet * source;
+  AmitkDataSet * level;
+  AmitkRendering rendering;
+  amide_intpoint_t frame;
+  amide_intpoint_t gate;
+} pyramid_build_t;
 
-	if (start_frame == end_frame)
-	  time_weight = 1.0;
-	else if (current_voxel.t == start_frame)
-	  time_weight = (amitk_data_set_get_end_time(ds, start_frame)-used_start)/used_duration;
-	else if (current_voxel.t == end_frame)
-	  time_weight = (used_end-amitk_data_set_get_start_time(ds, end_frame))/used_duration;
-	else
-	  time_weight = amitk_data_set_get_frame_duration(ds, current_voxel.t)/used_duration;
+/* fills in planes [start, end) of a frame/gate of the level, each voxel
+   being the mean/max/min of the 2x2x2 block of source voxels under it */
+static void pyramid_build_planes(gint start, gint end, gpointer data) {
 
-	/* need to average over gates */
-	gate_value = 0.0;
-	for (i_gate=0; i_gate < AMITK_DATA_SET_NUM_VIEW_GATES(ds); i_gate++) {
-	  current_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(ds);
-	  if (current_voxel.g >= AMITK_DATA_SET_NUM_GATES(ds))
-	    current_voxel.g -= AMITK_DATA_SET_NUM_GATES(ds);
-	  
-	  gate_value += amitk_data_set_get_value(ds, current_voxel);
-	}
-	value += time_weight*gate_value/((gdouble) AMITK_DATA_SET_NUM_VIEW_GATES(ds));
+  pyramid_build_t * pb = data;
+  AmitkVoxel source_dim, level_dim;
+  AmitkVoxel i_voxel, j_voxel;
+  amide_data_t * row;
+  amide_data_t * value;
+  guint * count;
+  amide_intpoint_t dy, dz, x;
+  amide_data_t datum;
+
+  source_dim = AMITK_DATA_SET_DIM(pb->source);
+  level_dim = AMITK_DATA_SET_DIM(pb->level);
+  row = g_new(amide_data_t, source_dim.x);
+  value = g_new(amide_data_t, level_dim.x);
+  count = g_new(guint, level_dim.x);
+
+  i_voxel.t = j_voxel.t = pb->frame;
+  i_voxel.g = j_voxel.g = pb->gate;
+  i_voxel.x = j_voxel.x = 0;
+
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++) {
+    for (i_voxel.y = 0; i_voxel.y < level_dim.y; i_voxel.y++) {
+      for (x=0; x < level_dim.x; x++) {
+	value[x] = (pb->rendering == AMITK_RENDERING_MPR) ? 0.0 : NAN;
+	count[x] = 0;
       }
 
-      /* record value in array */
-      element = g_malloc(sizeof(AmitkLineProfileDataElement));
+      /* an axis that's not getting downsampled just has the one source voxel */
+      for (dz=0; dz < ((source_dim.z > 1) ? 2 : 1); dz++) {
+	j_voxel.z = (source_dim.z > 1) ? 2*i_voxel.z+dz : i_voxel.z;
+	if (j_voxel.z >= source_dim.z) continue;
+	for (dy=0; dy < ((source_dim.y > 1) ? 2 : 1); dy++) {
+	  j_voxel.y = (source_dim.y > 1) ? 2*i_voxel.y+dy : i_voxel.y;
+	  if (j_voxel.y >= source_dim.y) continue;
+
+	  amitk_data_set_get_row(pb->source, j_voxel, row);
+	  for (j_voxel.x = 0; j_voxel.x < source_dim.x; j_voxel.x++) {
+	    datum = row[j_voxel.x];
+	    if (isnan(datum)) continue;
+	    x = (source_dim.x > 1) ? j_voxel.x/2 : j_voxel.x;
+	    switch(pb->rendering) {
+	    case AMITK_RENDERING_MIP:
+	      if ((count[x] == 0) || (datum > value[x])) value[x] = datum;
+	      break;
+	    case AMITK_RENDERING_MINIP:
+	      if ((count[x] == 0) || (datum < value[x])) value[x] = datum;
+	      break;
+	    case AMITK_RENDERING_MPR:
+	    default:
+	      value[x] += datum;
+	      break;
+	    }
+	    count[x]++;
+	  }
+	}
+      }
+
+      for (i_voxel.x = 0; i_voxel.x < level_dim.x; i_voxel.x++) {
+	if (count[i_voxel.x] == 0)
+	  datum = NAN;
+	else if (pb->rendering == AMITK_RENDERING_MPR)
+	  datum = value[i_voxel.x]/count[i_voxel.x];
+	else
+	  datum = value[i_voxel.x];
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(pb->level->raw_data, i_voxel) = datum;
+      }
+    }
+  }
+
+  g_free(row);
+  g_free(value);
+  g_free(count);
+
+  return;
+}
+
+/* returns a reference to the given level of the data set's pyramid (level 0
+   being the data set itself).  A new level starts out empty, its frames/gates
+   get filled in by data_set_build_pyramid_frame */
+static AmitkDataSet * data_set_get_pyramid_level(AmitkDataSet * ds, 
+						 const AmitkRendering rendering,
+						 const gint level) {
+
+  AmitkDataSet * original;
+  AmitkDataSet * new_level;
+  AmitkDataSet * old_level=NULL;
+  AmitkVoxel dim;
+  AmitkPoint voxel_size;
+  pyramid_entry_t * entry;
+  GList * to_unref=NULL;
+  guint generation;
+  gint i;
+
+  if (level <= 0) 
+    return amitk_object_ref(ds);
+
+  /* a snapshot shares its data set's pyramid, as long as it's still current */
+  original = DATA_SET_ORIGINAL(ds);
+
+  G_LOCK(pyramid);
+  generation = original->pyramid_generation;
+  if (ds->pyramid_generation != generation) {
+    G_UNLOCK(pyramid);
+    return NULL;
+  }
+  new_level = original->pyramid[rendering][level-1];
+  if (new_level != NULL) {
+    amitk_object_ref(new_level);
+    pyramid_touch(original, rendering, level);
+  }
+  G_UNLOCK(pyramid);
+  if (new_level != NULL) 
+    return new_level;
+
+  /* each level halves the axes that are more than a voxel across */
+  dim = AMITK_DATA_SET_DIM(ds);
+  voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+  for (i=0; i < level; i++) {
+    if (dim.x > 1) { dim.x = (dim.x+1)/2; voxel_size.x *= 2.0; }
+    if (dim.y > 1) { dim.y = (dim.y+1)/2; voxel_size.y *= 2.0; }
+    if (dim.z > 1) { dim.z = (dim.z+1)/2; voxel_size.z *= 2.0; }
+  }
+
+  new_level = amitk_data_set_new_with_data(NULL, AMITK_DATA_SET_MODALITY(ds),
+					   AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+  if (new_level == NULL) {
+    g_warning(_("couldn't allocate memory space for a reduced resolution copy of the data set, wanted %dx%dx%dx%dx%d elements"),
+	      dim.x, dim.y, dim.z, dim.g, dim.t);
+    return NULL;
+  }
+
+  new_level->voxel_size = voxel_size;
+  amitk_space_copy_in_place(AMITK_SPACE(new_level), AMITK_SPACE(ds));
+  new_level->scan_start = AMITK_DATA_SET_SCAN_START(ds);
+  for (i=0; i < dim.t; i++)
+    new_level->frame_duration[i] = amitk_data_set_get_frame_duration(ds, i);
+  for (i=0; i < dim.g; i++)
+    new_level->gate_time[i] = amitk_data_set_get_gate_time(ds, i);
+  new_level->rendering = rendering;
+  new_level->pyramid_built = g_new0(guint8, dim.t*dim.g); /* all PYRAMID_EMPTY */
+  amitk_data_set_calc_far_corner(new_level);
+
+  /* hang on to it, unless the data set changed in the meantime.  If another
+     thread got here first, use theirs so the frames only get built once */
+  G_LOCK(pyramid);
+  if (original->pyramid_generation == generation) {
+    if (original->pyramid[rendering][level-1] != NULL) {
+      old_level = new_level;
+      new_level = amitk_object_ref(original->pyramid[rendering][level-1]);
+      pyramid_touch(original, rendering, level);
+    } else {
+      original->pyramid[rendering][level-1] = amitk_object_ref(new_level);
+      entry = g_new(pyramid_entry_t, 1);
+      entry->ds = original;
+      entry->rendering = rendering;
+      entry->level = level;
+      entry->size = amitk_raw_data_size_data_mem(new_level->raw_data);
+      g_queue_push_head(&pyramid_queue, entry);
+      pyramid_used += entry->size;
+      to_unref = pyramid_trim_to_budget();
+    }
+  }
+  G_UNLOCK(pyramid);
+
+  if (old_level != NULL) amitk_object_unref(old_level);
+  amitk_objects_unref(to_unref);
+
+  return new_level;
+}
+
+/* makes sure the given frame/gate of a level of the data set's pyramid has
+   been filled in, building it (and the same frame/gate of the levels above
+   it) if needed.  Returns FALSE if it couldn't be built */
+static gboolean data_set_build_pyramid_frame(AmitkDataSet * ds,
+					     AmitkDataSet * level_ds,
+					     const gint level,
+					     const amide_intpoint_t frame,
+					     const amide_intpoint_t gate) {
+
+  AmitkDataSet * source;
+  pyramid_build_t pb;
+  gboolean built;
+  gint i;
+
+  i = frame*AMITK_DATA_SET_NUM_GATES(level_ds) + gate;
+
+  /* another thread may already be working on it */
+  G_LOCK(pyramid);
+  while (level_ds->pyramid_built[i] == PYRAMID_BUILDING)
+    g_cond_wait(&pyramid_built_cond, &G_LOCK_NAME(pyramid));
+  built = (level_ds->pyramid_built[i] == PYRAMID_BUILT);
+  if (!built)
+    level_ds->pyramid_built[i] = PYRAMID_BUILDING;
+  G_UNLOCK(pyramid);
+  if (built) 
+    return TRUE;
+
+  /* build it from the level above */
+  source = data_set_get_pyramid_level(ds, AMITK_DATA_SET_RENDERING(level_ds), level-1);
+  if (source != NULL) {
+    if (level > 1)
+      built = data_set_build_pyramid_frame(ds, source, level-1, frame, gate);
+    else
+      built = TRUE;
+  }
+
+  if (built) {
+    pb.source = source;
+    pb.level = level_ds;
+    pb.rendering = AMITK_DATA_SET_RENDERING(level_ds);
+    pb.frame = frame;
+    pb.gate = gate;
+    amitk_data_set_request_frame(source, frame, gate);
+    g_rw_lock_reader_lock(&(source->scaling_lock));
+    amitk_parallel_for(AMITK_DATA_SET_DIM_Z(level_ds), pyramid_build_planes, &pb);
+    g_rw_lock_reader_unlock(&(source->scaling_lock));
+  }
+  if (source != NULL)
+    amitk_object_unref(source);
+
+  G_LOCK(pyramid);
+  level_ds->pyramid_built[i] = built ? PYRAMID_BUILT : PYRAMID_EMPTY;
+  g_cond_broadcast(&pyramid_built_cond);
+  G_UNLOCK(pyramid);
+
+  return built;
+}
+
+/* same as amitk_data_set_get_slice, but for displaying.  If the slice's pixels
+   and thickness span several voxels, the slice is taken from a reduced resolution
+   copy of the data set (storing the mean, or the max/min for MIP/MINIP), which
+   is a lot faster when zoomed out or looking at a thick slab */
+AmitkDataSet * amitk_data_set_get_pyramid_slice(AmitkDataSet * ds,
+						const amide_time_t start,
+						const amide_time_t duration,
+						const amide_intpoint_t gate,
+						const AmitkCanvasPoint pixel_size,
+						const AmitkVolume * slice_volume) {
+
+  AmitkDataSet * level_ds;
+  AmitkDataSet * slice;
+  AmitkVoxel dim;
+  amide_real_t voxel_size, target;
+  gint level;
+  amide_intpoint_t start_frame, end_frame, i_frame;
+  amide_intpoint_t first_gate, i_gate;
+  gint num_gates;
+  gboolean built;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+  g_return_val_if_fail(ds->raw_data != NULL, NULL);
+
+  /* the largest voxel dimension along the axes that get downsampled */
+  dim = AMITK_DATA_SET_DIM(ds);
+  voxel_size = 0.0;
+  if (dim.x > 1) voxel_size = MAX(voxel_size, AMITK_DATA_SET_VOXEL_SIZE_X(ds));
+  if (dim.y > 1) voxel_size = MAX(voxel_size, AMITK_DATA_SET_VOXEL_SIZE_Y(ds));
+  if (dim.z > 1) voxel_size = MAX(voxel_size, AMITK_DATA_SET_VOXEL_SIZE_Z(ds));
+
+  /* go down levels as long as a level voxel still fits within a pixel and the slab */
+  target = MIN(MIN(pixel_size.x, pixel_size.y), AMITK_VOLUME_Z_CORNER(slice_volume));
+  level = 0;
+  if (voxel_size > 0.0) 
+    while ((level < AMITK_DATA_SET_PYRAMID_LEVELS) && 
+	   (((amide_real_t) (2 << level))*voxel_size <= target) &&
+	   ((dim.x > 1) || (dim.y > 1) || (dim.z > 1))) {
+      level++;
+      dim.x = (dim.x+1)/2;
+      dim.y = (dim.y+1)/2;
+      dim.z = (dim.z+1)/2;
+    }
+
+  if (level == 0)
+    return amitk_data_set_get_slice(ds, start, duration, gate, pixel_size, slice_volume);
+
+  level_ds = data_set_get_pyramid_level(ds, AMITK_DATA_SET_RENDERING(ds), level);
+  if (level_ds == NULL) /* couldn't build it, fall back to the full resolution data */
+    return amitk_data_set_get_slice(ds, start, duration, gate, pixel_size, slice_volume);
+
+  /* only fill in the frames and gates this slice takes in */
+  start_frame = amitk_data_set_get_frame(ds, start+EPSILON);
+  end_frame = amitk_data_set_get_frame(ds, start+duration-EPSILON);
+  if (gate >= 0) {
+    first_gate = gate;
+    num_gates = 1;
+  } else {
+    first_gate = AMITK_DATA_SET_VIEW_START_GATE(ds);
+    num_gates = AMITK_DATA_SET_NUM_VIEW_GATES(ds);
+  }
+  built = TRUE;
+  for (i_frame = start_frame; (i_frame <= end_frame) && built; i_frame++)
+    for (i_gate = 0; (i_gate < num_gates) && built; i_gate++)
+      built = data_set_build_pyramid_frame(ds, level_ds, level, i_frame, 
+					   (first_gate+i_gate) % AMITK_DATA_SET_NUM_GATES(ds));
+  if (!built) {
+    amitk_object_unref(level_ds);
+    return amitk_data_set_get_slice(ds, start, duration, gate, pixel_size, slice_volume);
+  }
+
+  slice = data_set_get_slice(level_ds, start, duration, gate, AMITK_DATA_SET_INTERPOLATION(ds),
+			     AMITK_DATA_SET_VIEW_START_GATE(ds), AMITK_DATA_SET_VIEW_END_GATE(ds),
+			     pixel_size, slice_volume);
+
+  /* and make it look like it came from the data set itself */
+  if (slice != NULL) {
+    data_set_set_slice_parent(slice, DATA_SET_ORIGINAL(ds));
+    slice->thresholding = ds->thresholding;
+  }
+  amitk_object_unref(level_ds);
+
+  return slice;
+}
+
+/* returns a copy of what goes into displaying the data set (space, thresholds,
+   color tables, view gates, ...), sharing its data.  This is for taking slices off 
+   of the main loop, as the data set itself can keep on changing in the meantime.  
+   Slices of the snapshot look like, and get cached as, slices of the data set,
+   unless the data set's been invalidated since the snapshot was taken.  Needs to 
+   be called from the main loop */
+AmitkDataSet * amitk_data_set_get_snapshot(AmitkDataSet * ds) {
+
+  AmitkDataSet * snapshot;
+  AmitkViewMode i_view_mode;
+  guint i;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+  g_return_val_if_fail(ds->raw_data != NULL, NULL);
+
+  /* a snapshot doesn't change */
+  if (ds->snapshot_of != NULL) 
+    return amitk_object_ref(ds);
+
+  snapshot = amitk_data_set_new(NULL, AMITK_DATA_SET_MODALITY(ds));
+  amitk_space_copy_in_place(AMITK_SPACE(snapshot), AMITK_SPACE(ds));
+  amitk_object_set_name(AMITK_OBJECT(snapshot), AMITK_OBJECT_NAME(ds));
+
+  snapshot->voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+  snapshot->raw_data = g_object_ref(ds->raw_data);
+  snapshot->scaling_type = ds->scaling_type;
+  if (snapshot->internal_scaling_factor != NULL)
+    g_object_unref(snapshot->internal_scaling_factor);
+  snapshot->internal_scaling_factor = g_object_ref(ds->internal_scaling_factor);
+  if (ds->internal_scaling_intercept != NULL) {
+    if (snapshot->internal_scaling_intercept != NULL)
+      g_object_unref(snapshot->internal_scaling_intercept);
+    snapshot->internal_scaling_intercept = g_object_ref(ds->internal_scaling_intercept);
+  }
+  amitk_data_set_set_scale_factor(snapshot, AMITK_DATA_SET_SCALE_FACTOR(ds));
+  snapshot->scan_start = AMITK_DATA_SET_SCAN_START(ds);
+  amitk_data_set_calc_far_corner(snapshot);
+
+  for (i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) {
+    snapshot->color_table[i_view_mode] = AMITK_DATA_SET_COLOR_TABLE(ds, i_view_mode);
+    snapshot->color_table_independent[i_view_mode] = AMITK_DATA_SET_COLOR_TABLE_INDEPENDENT(ds, i_view_mode);
+  }
+  snapshot->interpolation = AMITK_DATA_SET_INTERPOLATION(ds);
+  snapshot->rendering = AMITK_DATA_SET_RENDERING(ds);
+  snapshot->thresholding = AMITK_DATA_SET_THRESHOLDING(ds);
+  snapshot->threshold_style = AMITK_DATA_SET_THRESHOLD_STYLE(ds);
+  for (i=0; i<2; i++) {
+    snapshot->threshold_max[i] = AMITK_DATA_SET_THRESHOLD_MAX(ds, i);
+    snapshot->threshold_min[i] = AMITK_DATA_SET_THRESHOLD_MIN(ds, i);
+    snapshot->threshold_ref_frame[i] = AMITK_DATA_SET_THRESHOLD_REF_FRAME(ds, i);
+  }
+  snapshot->view_start_gate = AMITK_DATA_SET_VIEW_START_GATE(ds);
+  snapshot->view_end_gate = AMITK_DATA_SET_VIEW_END_GATE(ds);
+  snapshot->num_view_gates = AMITK_DATA_SET_NUM_VIEW_GATES(ds);
+
+  snapshot->gate_time = amitk_data_set_get_gate_time_mem(snapshot);
+  for (i=0; i<AMITK_DATA_SET_NUM_GATES(snapshot); i++)
+    snapshot->gate_time[i] = amitk_data_set_get_gate_time(ds, i);
+  snapshot->frame_duration = amitk_data_set_get_frame_duration_mem(snapshot);
+  for (i=0; i<AMITK_DATA_SET_NUM_FRAMES(snapshot); i++)
+    snapshot->frame_duration[i] = amitk_data_set_get_frame_duration(ds, i);
+
+  /* the max/min values, if they're around yet */
+  g_mutex_lock(&(ds->min_max_mutex));
+  if (ds->min_max_calculated) {
+    snapshot->global_max = ds->global_max;
+    snapshot->global_min = ds->global_min;
+    snapshot->frame_max = amitk_data_set_get_frame_min_max_mem(snapshot);
+    snapshot->frame_min = amitk_data_set_get_frame_min_max_mem(snapshot);
+    for (i=0; i<AMITK_DATA_SET_NUM_FRAMES(snapshot); i++) {
+      snapshot->frame_max[i] = ds->frame_max[i];
+      snapshot->frame_min[i] = ds->frame_min[i];
+    }
+    snapshot->min_max_calculated = TRUE;
+  }
+  g_mutex_unlock(&(ds->min_max_mutex));
+
+  snapshot->snapshot_of = amitk_object_ref(ds);
+  G_LOCK(pyramid);
+  snapshot->pyramid_generation = ds->pyramid_generation;
+  G_UNLOCK(pyramid);
+
+  return snapshot;
+}
+
+/* start_point and end_point should be in the base coordinate frame */
+void  amitk_data_set_get_line_profile(AmitkDataSet * ds,
+				      const amide_time_t start,
+				      const amide_time_t duration,
+				      const AmitkPoint base_start_point,
+				      const AmitkPoint base_end_point,
+				      GPtrArray ** preturn_data) {
+
+  AmitkPoint start_point, end_point;
+  AmitkPoint candidate_point, current_point;
+  AmitkPoint step;
+  AmitkPoint direction;
+  AmitkVoxel current_voxel, last_voxel, candidate_voxel;
+  amide_real_t min_size;
+  amide_real_t length;
+  amide_intpoint_t i_gate;
+  gint start_frame, end_frame;
+  amide_time_t used_start, used_end, used_duration;
+  amide_time_t ds_start, ds_end;
+  amide_data_t value, gate_value, time_weight;
+  AmitkLineProfileDataElement * element;
+  AmitkPoint voxel_point;
+  gdouble m;
+  AmitkDataSetValueFunc value_func;
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+
+  *preturn_data = g_ptr_array_new();
+  g_return_if_fail(*preturn_data != NULL);
+
+  /* voxels are already range checked below */
+  value_func = amitk_data_set_get_value_func(ds);
+
+  /* figure out what frames of this data set to use */
+  used_start = start;
+  start_frame = amitk_data_set_get_frame(ds, used_start);
+  ds_start = amitk_data_set_get_start_time(ds, start_frame);
+
+  used_end = start+duration;
+  end_frame = amitk_data_set_get_frame(ds, used_end);
+  ds_end = amitk_data_set_get_end_time(ds, end_frame);
+
+  if (ds_end < used_end) used_end = ds_end;
+  if (ds_start > used_start) used_start = ds_start;
+  used_duration = used_end-used_start;
+
+  /* translate the start and end into the data set's coordinate frame */
+  start_point = amitk_space_b2s(AMITK_SPACE(ds), base_start_point);
+  end_point = amitk_space_b2s(AMITK_SPACE(ds), base_end_point);
+
+  /* figure out the direction we want to go */
+  direction = point_sub(end_point, start_point);
+  length = point_mag(direction);
+
+  /* figure out what our "step" size will be (1/4 a voxel size) */
+  min_size = point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(ds));
+  step = point_cmult((1.0/4.0)*min_size*(1.0/length), direction);
+
+  /* initialize starting values */
+  current_point = start_point;
+  POINT_TO_VOXEL(current_point, AMITK_DATA_SET_VOXEL_SIZE(ds), start_frame, AMITK_DATA_SET_VIEW_START_GATE(ds), current_voxel);
+
+  while (point_mag(point_sub(current_point, start_point)) < length) {
+
+    /* this next snippet of code advances us along the line so that we're at the point
+       on the line closest to the center of the voxel */
+    VOXEL_TO_POINT(current_voxel, AMITK_DATA_SET_VOXEL_SIZE(ds), voxel_point);
+    m = ((voxel_point.x-start_point.x)*direction.x + 
+	 (voxel_point.y-start_point.y)*direction.y + 
+	 (voxel_point.z-start_point.z)*direction.z) / (length*length);
+    candidate_point = point_add(start_point, point_cmult(m, direction));
+    /* note, we may get a voxel out that's not the current voxel... we'll skip the voxel
+       in that case */
+    POINT_TO_VOXEL(candidate_point, AMITK_DATA_SET_VOXEL_SIZE(ds), current_voxel.t, current_voxel.g,candidate_voxel);
+
+    /* record the value if it's in the data set */
+    if ((amitk_raw_data_includes_voxel(AMITK_DATA_SET_RAW_DATA(ds), current_voxel)) &&
+	(VOXEL_EQUAL(candidate_voxel, current_voxel))) {
+
+      /* need to average over frames */
+      value = 0;
+      for (current_voxel.t=start_frame; current_voxel.t<=end_frame;current_voxel.t++) {
+
+	if (start_frame == end_frame)
+	  time_weight = 1.0;
+	else if (current_voxel.t == start_frame)
+	  time_weight = (amitk_data_set_get_end_time(ds, start_frame)-used_start)/used_duration;
+	else if (current_voxel.t == end_frame)
+	  time_weight = (used_end-amitk_data_set_get_start_time(ds, end_frame))/used_duration;
+	else
+	  time_weight = amitk_data_set_get_frame_duration(ds, current_voxel.t)/used_duration;
+
+	/* need to average over gates */
+	gate_value = 0.0;
+	for (i_gate=0; i_gate < AMITK_DATA_SET_NUM_VIEW_GATES(ds); i_gate++) {
+	  current_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(ds);
+	  if (current_voxel.g >= AMITK_DATA_SET_NUM_GATES(ds))
+	    current_voxel.g -= AMITK_DATA_SET_NUM_GATES(ds);
+	  
+	  gate_value += (*value_func)(ds, current_voxel);
+	}
+	value += time_weight*gate_value/((gdouble) AMITK_DATA_SET_NUM_VIEW_GATES(ds));
+      }
+
+      /* record value in array */
+      element = g_malloc(sizeof(AmitkLineProfileDataElement));
       g_return_if_fail(element != NULL);
       element->value = value;
       element->location = point_mag(point_sub(candidate_point, start_point));
@@ -4300,6 +5211,7 @@ void amitk_data_set_get_projections(AmitkDataSet * ds,
   gchar * temp_string;
   AmitkView i_view;
   amide_data_t value;
+  amide_data_t * row;
 
   g_return_if_fail(AMITK_IS_DATA_SET(ds));
   g_return_if_fail(ds->raw_data != NULL);
@@ -4309,6 +5221,11 @@ void amitk_data_set_get_projections(AmitkDataSet * ds,
   dim = AMITK_DATA_SET_DIM(ds);
   voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
 
+  if ((row = g_try_new(amide_data_t, dim.x)) == NULL) {
+    g_warning(_("couldn't allocate memory space for the projection row"));
+    return;
+  }
+
   /* setup the wait dialog */
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Generating projections of:\n   %s"), AMITK_OBJECT_NAME(ds));
@@ -4344,6 +5261,7 @@ void amitk_data_set_get_projections(AmitkDataSet * ds,
     if (projections[i_view] == NULL) {
       g_warning(_("couldn't allocate memory space for the projection, wanted %dx%dx%dx%dx%d elements"), 
 		planar_dim.x, planar_dim.y, planar_dim.z, planar_dim.g, planar_dim.t);
+      g_free(row);
       return;
     }
 
@@ -4397,8 +5315,10 @@ void amitk_data_set_get_projections(AmitkDataSet * ds,
     }
 
     for (i.y = 0; i.y < dim.y; i.y++) {
+      i.x = 0;
+      amitk_data_set_get_row(ds, i, row);
       for (i.x = 0; i.x < dim.x; i.x++) {
-	value = amitk_data_set_get_value(ds, i);
+	value = row[i.x];
 	AMITK_RAW_DATA_DOUBLE_2D_SET_CONTENT(projections[AMITK_VIEW_TRANSVERSE]->raw_data,i.y, i.x) += value;
 	AMITK_RAW_DATA_DOUBLE_2D_SET_CONTENT(projections[AMITK_VIEW_CORONAL]->raw_data,dim.z-i.z-1, i.x) += value;
 	AMITK_RAW_DATA_DOUBLE_2D_SET_CONTENT(projections[AMITK_VIEW_SAGITTAL]->raw_data,dim.z-i.z-1, i.y) += value;
@@ -4406,6 +5326,8 @@ void amitk_data_set_get_projections(AmitkDataSet * ds,
     }
   }
 
+  g_free(row);
+
   if (update_func != NULL) /* remove progress bar */
     continue_work = (*update_func)(update_data, NULL, (gdouble) 2.0);
 
@@ -4458,6 +5380,7 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
   gboolean unsigned_type;
   gboolean float_type;
   amide_data_t max, min, value;
+  amide_data_t * row=NULL;
   div_t x;
   gint divider;
   gint total_planes;
@@ -4595,6 +5518,14 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
     }
   }
 
+  /* buffer for reading rows out of the original data set */
+  if (!same_format_and_scaling) {
+    if ((row = g_try_new(amide_data_t, AMITK_DATA_SET_DIM_X(ds))) == NULL) {
+      g_warning(_("couldn't allocate memory space for the cropped row buffer"));
+      goto error;
+    }
+  }
+
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Generating cropped version of:\n   %s"), AMITK_OBJECT_NAME(ds));
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
@@ -4668,8 +5599,9 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
 	      continue_work = (*update_func)(update_data, NULL, ((gdouble) i_progress)/((gdouble) total_progress));
 	  }
 	  for (i.y=0, j.y=start.y; j.y <= end.y; i.y++, j.y++) {
-	    for (i.x=0, j.x=start.x; j.x <= end.x; i.x++, j.x++) {
-	      value = amitk_data_set_get_internal_value(ds, i);
+	    amitk_data_set_get_internal_row(ds, j, row);
+	    for (j.x=start.x; j.x <= end.x; j.x++) {
+	      value = row[j.x];
 	      if (value > max) max = value;
 	      else if (value < min) min = value;
 	    }
@@ -4799,8 +5731,9 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
 		   amitk_raw_data_get_pointer(ds->raw_data, j),
 		   amitk_format_sizes[format]*dim.x);
 	  } else {
+	    amitk_data_set_get_internal_row(ds, j, row);
 	    for (i.x=0, j.x=start.x; j.x <= end.x; i.x++, j.x++) {
-	      value = amitk_data_set_get_internal_value(ds, j);
+	      value = row[j.x];
 	      amitk_data_set_set_internal_value(cropped, i, value, FALSE);
 	    }
 	  }
@@ -4862,29 +5795,137 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
   /* see if we can drop the intercept (if present)/reducing scaling dimensionality  */
   data_set_drop_intercept(cropped);
   data_set_reduce_scaling_dimension(cropped);
+  if (row != NULL) g_free(row);
   return cropped; 
 
 error:
+  if (row != NULL) g_free(row);
   amitk_object_unref(cropped);
 
   return NULL;
 }
 
 
-#ifdef AMIDE_LIBGSL_SUPPORT
+#if defined(AMIDE_LIBGSL_SUPPORT) || defined(AMIDE_FFTW_SUPPORT)
+
+
+typedef struct filter_fir_t {
+  const AmitkDataSet * data_set;
+  AmitkDataSet * filtered_ds;
+  AmitkVoxel frame; /* only t and g are used */
+  AmitkVoxel fft_size;
+  AmitkVoxel subset_size; /* the part of each tile that gets filled with data */
+  AmitkVoxel half;
+  gint first_slab; /* we do every other slab of tiles along z at a time */
+  const gdouble * kernel_spectrum;
+  GSList * ffts; /* unused AmitkFilterFFT's, guarded by mutex */
+  GMutex * mutex;
+  gboolean failed;
+} filter_fir_t;
+
+/* filters the slabs first_slab+2*[start,end) of tiles.  Neighboring slabs
+   add into overlapping output planes, so these never run at the same time */
+static void filter_fir_slabs(gint start, gint end, gpointer data) {
+
+  filter_fir_t * ff = data;
+  AmitkFilterFFT * fft;
+  amide_real_t * tile;
+  amide_data_t * row = NULL;
+  AmitkVoxel ds_dim;
+  AmitkVoxel i_outer, i_voxel, j_voxel;
+  gint i_slab;
+  gsize tile_row;
+
+  ds_dim = AMITK_DATA_SET_DIM(ff->data_set);
+
+  /* grab an FFT to use */
+  g_mutex_lock(ff->mutex);
+  if (ff->ffts != NULL) {
+    fft = ff->ffts->data;
+    ff->ffts = g_slist_remove(ff->ffts, fft);
+  } else
+    fft = NULL;
+  g_mutex_unlock(ff->mutex);
+  if (fft == NULL) 
+    fft = amitk_filter_fft_new(ff->fft_size);
+  row = g_try_new(amide_data_t, ds_dim.x);
+  if ((fft == NULL) || (row == NULL)) {
+    ff->failed = TRUE;
+    goto exit_strategy;
+  }
+  tile = amitk_filter_fft_get_data(fft);
+
+  i_outer.t = i_voxel.t = ff->frame.t;
+  i_outer.g = i_voxel.g = ff->frame.g;
+  for (i_slab = start; i_slab < end; i_slab++) {
+    i_outer.z = (ff->first_slab+2*i_slab)*ff->subset_size.z;
+    for (i_outer.y = 0; i_outer.y < ds_dim.y; i_outer.y += ff->subset_size.y) {
+      for (i_outer.x = 0; i_outer.x < ds_dim.x; i_outer.x += ff->subset_size.x) {
+
+	/* copy the data over into the tile, zero padded */
+	memset(tile, 0, sizeof(amide_real_t)*ff->fft_size.z*ff->fft_size.y*ff->fft_size.x);
+	for (j_voxel.z = 0, i_voxel.z = i_outer.z;
+	     (j_voxel.z < ff->subset_size.z) && (i_voxel.z < ds_dim.z);
+	     j_voxel.z++, i_voxel.z++)
+	  for (j_voxel.y = 0, i_voxel.y = i_outer.y;
+	       (j_voxel.y < ff->subset_size.y) && (i_voxel.y < ds_dim.y);
+	       j_voxel.y++, i_voxel.y++) {
+	    amitk_data_set_get_internal_row(ff->data_set, i_voxel, row);
+	    tile_row = (j_voxel.z*ff->fft_size.y+j_voxel.y)*ff->fft_size.x;
+	    for (j_voxel.x = 0, i_voxel.x = i_outer.x;
+		 (j_voxel.x < ff->subset_size.x) && (i_voxel.x < ds_dim.x);
+		 j_voxel.x++, i_voxel.x++)
+	      tile[tile_row+j_voxel.x] = row[i_voxel.x];
+	  }
+
+	amitk_filter_fft_forward(fft);
+	amitk_filter_fft_multiply_spectrum(fft, ff->kernel_spectrum);
+	amitk_filter_fft_inverse(fft);
+
+	/* and add in, at the same time shifting over by half the kernel size */
+	for (j_voxel.z = 0; j_voxel.z < ff->fft_size.z; j_voxel.z++) {
+	  i_voxel.z = i_outer.z+j_voxel.z-ff->half.z;
+	  if ((i_voxel.z < 0) || (i_voxel.z >= ds_dim.z)) continue;
+	  for (j_voxel.y = 0; j_voxel.y < ff->fft_size.y; j_voxel.y++) {
+	    i_voxel.y = i_outer.y+j_voxel.y-ff->half.y;
+	    if ((i_voxel.y < 0) || (i_voxel.y >= ds_dim.y)) continue;
+	    tile_row = (j_voxel.z*ff->fft_size.y+j_voxel.y)*ff->fft_size.x;
+	    for (j_voxel.x = 0; j_voxel.x < ff->fft_size.x; j_voxel.x++) {
+	      i_voxel.x = i_outer.x+j_voxel.x-ff->half.x;
+	      if ((i_voxel.x < 0) || (i_voxel.x >= ds_dim.x)) continue;
+	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(ff->filtered_ds->raw_data, i_voxel) += tile[tile_row+j_voxel.x];
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+ exit_strategy:
+  if (row != NULL) g_free(row);
+
+  /* hand the FFT back for the next set of slabs */
+  if (fft != NULL) {
+    g_mutex_lock(ff->mutex);
+    ff->ffts = g_slist_prepend(ff->ffts, fft);
+    g_mutex_unlock(ff->mutex);
+  }
 
+  return;
+}
 
 /* fills the data set "filtered_ds", with the results of the kernel convolved to data_set */
 /* assumptions:
-   1- filtered_ds is of type FLOAT, 0D scaling
+   1- filtered_ds is of type FLOAT, 0D scaling, and zero filled
    2- scale of filtered_ds is 1.0
-   3- kernel is of type DOUBLE, is in complex packed format, and has odd dimensions in x,y,z,
-      and dimension 1 in t
+   3- kernel is of type DOUBLE, has odd dimensions in x,y,z, and dimension 1 in t and g
 
    notes:
-   1. kernel is modified (FFT'd) 
+   1. we use overlap and add, with the FFT tile size picked from the kernel and 
+   data set dimensions (see amitk_filter_fft_choose_size).  The slabs of tiles along
+   z are split between threads, doing every other slab at a time.
    2. don't have a separate function for each data type, as getting the data_set data,
-   is a tiny fraction of the computational time, use amitk_data_set_get_internal_value instead
+   is a tiny fraction of the computational time, use amitk_data_set_get_internal_row instead
  */
 static gboolean filter_fir(const AmitkDataSet * data_set,
 			   AmitkDataSet * filtered_ds,
@@ -4893,18 +5934,18 @@ static gboolean filter_fir(const AmitkDataSet * data_set,
 			   AmitkUpdateFunc update_func, 
 			   gpointer update_data) {
   
-  AmitkVoxel subset_size;
-  AmitkVoxel i_outer;
-  AmitkVoxel i_inner;
-  AmitkVoxel j_inner;
-  AmitkVoxel half;
+  filter_fir_t ff;
   AmitkVoxel ds_dim;
-  AmitkRawData * subset=NULL;
-  gsl_fft_complex_wavetable * wavetable=NULL;
-  gsl_fft_complex_workspace * workspace = NULL;
+  AmitkVoxel i_voxel;
+  AmitkFilterFFT * fft=NULL;
+  amide_real_t * tile;
+  gdouble * kernel_spectrum=NULL;
+  GMutex mutex;
+  GSList * ffts;
   gchar * temp_string;
+  gint num_slabs;
   gint image_num;
-  gint total_planes;
+  gint total_images;
   gboolean continue_work=TRUE;
 
   g_return_val_if_fail(kernel_size.t == 1, FALSE);
@@ -4912,160 +5953,538 @@ static gboolean filter_fir(const AmitkDataSet * data_set,
   g_return_val_if_fail((kernel_size.z & 0x1), FALSE); /* needs to be odd */
   g_return_val_if_fail((kernel_size.y & 0x1), FALSE); 
   g_return_val_if_fail((kernel_size.x & 0x1), FALSE); 
-  g_return_val_if_fail(2*kernel_size.z < AMITK_FILTER_FFT_SIZE, FALSE);
-  g_return_val_if_fail(2*kernel_size.y < AMITK_FILTER_FFT_SIZE, FALSE);
-  g_return_val_if_fail(2*kernel_size.x < AMITK_FILTER_FFT_SIZE, FALSE);
+  g_return_val_if_fail(kernel_size.z <= AMITK_FILTER_FFT_MAX_SIZE, FALSE);
+  g_return_val_if_fail(kernel_size.y <= AMITK_FILTER_FFT_MAX_SIZE, FALSE);
+  g_return_val_if_fail(kernel_size.x <= AMITK_FILTER_FFT_MAX_SIZE, FALSE);
 
   ds_dim = AMITK_DATA_SET_DIM(data_set);
 
-  /* initialize gsl's FFT stuff */
-  wavetable = gsl_fft_complex_wavetable_alloc(AMITK_FILTER_FFT_SIZE);
-  workspace = gsl_fft_complex_workspace_alloc (AMITK_FILTER_FFT_SIZE);
-  if ((wavetable == NULL) || (workspace == NULL)) {
-    g_warning(_("Filtering: Failed to allocate wavetable and workspace"));
-    continue_work=FALSE;
-    goto exit_strategy;
-  }
-
-  /* get space for our data subset*/
-  if ((subset = amitk_raw_data_new()) == NULL) {
-    g_warning(_("couldn't allocate memory space for the subset structure"));
-    continue_work=FALSE;
-    goto exit_strategy;
-  }
-  subset->format = AMITK_FORMAT_DOUBLE;
-  subset->dim.t = subset->dim.g = 1;
-  subset->dim.z = subset->dim.y = AMITK_FILTER_FFT_SIZE;
-  subset->dim.x = 2*AMITK_FILTER_FFT_SIZE; /* real and complex parts */
-
-  subset_size.t = subset_size.g = 1;
-  subset_size.z = AMITK_FILTER_FFT_SIZE-kernel_size.z+1;
-  subset_size.y = AMITK_FILTER_FFT_SIZE-kernel_size.y+1;
-  subset_size.x = AMITK_FILTER_FFT_SIZE-kernel_size.x+1;
-
-  half.t = half.g = 0;
-  half.z = kernel_size.z>>1;
-  half.y = kernel_size.y>>1;
-  half.x = kernel_size.x>>1;
-
-  if ((subset->data = amitk_raw_data_get_data_mem(subset)) == NULL) {
-    g_warning(_("Couldn't allocate memory space for the subset data"));
+  ff.data_set = data_set;
+  ff.filtered_ds = filtered_ds;
+  ff.fft_size = amitk_filter_fft_choose_size(kernel_size, ds_dim, NULL);
+  g_return_val_if_fail(ff.fft_size.z > 0, FALSE); /* kernel too big for any tile */
+  ff.subset_size.t = ff.subset_size.g = 1;
+  ff.subset_size.z = ff.fft_size.z-kernel_size.z+1;
+  ff.subset_size.y = ff.fft_size.y-kernel_size.y+1;
+  ff.subset_size.x = ff.fft_size.x-kernel_size.x+1;
+  ff.half.t = ff.half.g = 0;
+  ff.half.z = kernel_size.z>>1;
+  ff.half.y = kernel_size.y>>1;
+  ff.half.x = kernel_size.x>>1;
+  ff.ffts = NULL;
+  ff.failed = FALSE;
+  g_mutex_init(&mutex);
+  ff.mutex = &mutex;
+
+  /* FFT the kernel, it sits at the origin of an otherwise empty tile */
+  if ((fft = amitk_filter_fft_new(ff.fft_size)) == NULL) {
     continue_work=FALSE;
     goto exit_strategy;
   }
+  tile = amitk_filter_fft_get_data(fft);
+  memset(tile, 0, sizeof(amide_real_t)*ff.fft_size.z*ff.fft_size.y*ff.fft_size.x);
+  i_voxel = zero_voxel;
+  for (i_voxel.z = 0; i_voxel.z < kernel_size.z; i_voxel.z++)
+    for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++)
+      for (i_voxel.x = 0; i_voxel.x < kernel_size.x; i_voxel.x++)
+	tile[(i_voxel.z*ff.fft_size.y+i_voxel.y)*ff.fft_size.x+i_voxel.x] = 
+	  AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, i_voxel);
+  amitk_filter_fft_forward(fft);
+  kernel_spectrum = amitk_filter_fft_copy_spectrum(fft);
+  ff.kernel_spectrum = kernel_spectrum;
+  ff.ffts = g_slist_prepend(ff.ffts, fft); /* reuse it for the data */
 
-  /* FFT the kernel */
-  amitk_filter_3D_FFT(kernel, wavetable, workspace);
+#if AMIDE_DEBUG
+  g_print("Filtering with %s FFT, tile size %dx%dx%d\n", amitk_filter_fft_get_backend_name(fft),
+	  ff.fft_size.x, ff.fft_size.y, ff.fft_size.z);
+#endif
 
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = ds_dim.z*ds_dim.t*ds_dim.g;
+  num_slabs = (ds_dim.z+ff.subset_size.z-1)/ff.subset_size.z;
+  total_images = 2*ds_dim.t*ds_dim.g;
 
   /* start the overlap and add FFT method */
-  i_outer.t = i_inner.t = j_inner.t = 0;
-  i_outer.g = i_inner.g = j_inner.g = 0;
-  for (i_outer.t = 0; (i_outer.t < ds_dim.t) && continue_work; i_outer.t++) {
-    for (i_outer.g = 0; (i_outer.g < ds_dim.g) && continue_work; i_outer.g++) {
+  image_num = 0;
+  for (ff.frame.t = 0; (ff.frame.t < ds_dim.t) && continue_work; ff.frame.t++) {
+    for (ff.frame.g = 0; (ff.frame.g < ds_dim.g) && continue_work; ff.frame.g++) {
 #if AMIDE_DEBUG
-      g_print("Filtering Frame %d/Gate %d\n", i_outer.t, i_outer.g);
+      g_print("Filtering Frame %d/Gate %d\n", ff.frame.t, ff.frame.g);
 #endif
-      for (i_outer.z = 0; (i_outer.z < ds_dim.z) && continue_work; i_outer.z+= subset_size.z) {
+      amitk_raw_data_request_frame(data_set->raw_data, ff.frame.t, ff.frame.g);
+      for (ff.first_slab = 0; (ff.first_slab < 2) && continue_work && !ff.failed; ff.first_slab++, image_num++) {
+	if (update_func != NULL) 
+	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_images));
+	amitk_parallel_for((num_slabs-ff.first_slab+1)/2, filter_fir_slabs, &ff);
+      }
+    }
+  } /* ff.frame.t */
 
-	if (update_func != NULL) {
-	  image_num = i_outer.z+i_outer.t*ds_dim.z+i_outer.g*ds_dim.z*ds_dim.t;
-	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
+  if (ff.failed) {
+    g_warning(_("couldn't allocate memory space for the FFT"));
+    continue_work = FALSE;
+  }
 
-	for (i_outer.y = 0; i_outer.y < ds_dim.y; i_outer.y+= subset_size.y) {
-	  for (i_outer.x = 0; i_outer.x < ds_dim.x; i_outer.x+= subset_size.x) {
-  
-	    /* initialize the subset */
-	    for (j_inner.z = 0; j_inner.z < subset->dim.z; j_inner.z++) 
-	      for (j_inner.y = 0; j_inner.y < subset->dim.y; j_inner.y++) 
-		for (j_inner.x = 0; j_inner.x < subset->dim.x; j_inner.x++) 
-		  AMITK_RAW_DATA_DOUBLE_SET_CONTENT(subset, j_inner) = 0.0;
-	  
-	    /* copy data over from the actual data set */
-	    for (i_inner.z = 0, j_inner.z=0; 
-		 ((i_inner.z < subset_size.z) && (i_inner.z+i_outer.z) < ds_dim.z);
-		 i_inner.z++, j_inner.z++) 
-	      for (i_inner.y = 0, j_inner.y=0; 
-		   ((i_inner.y < subset_size.y) && (i_inner.y+i_outer.y) < ds_dim.y);
-		   i_inner.y++, j_inner.y++) 
-		for (i_inner.x = 0, j_inner.x=0; 
-		     ((i_inner.x < subset_size.x) && (i_inner.x+i_outer.x) < ds_dim.x);
-		     i_inner.x++, j_inner.x+=2) 
-		  AMITK_RAW_DATA_DOUBLE_SET_CONTENT(subset, j_inner) = 
-		    amitk_data_set_get_internal_value(data_set, voxel_add(i_outer, i_inner)); /* should be zero for out of range */
-	  
-	  
-	    /* FFT the data */
-	    amitk_filter_3D_FFT(subset, wavetable, workspace);
-	  
-	    /* multiple the data by the filter */
-	    amitk_filter_complex_mult(subset, kernel);
-	  
-	    /* and inverse FFT */
-	    amitk_filter_inverse_3D_FFT(subset, wavetable, workspace);
-	  
-	    /* and add in, at the same time we're shifting the data set over by half the
-	       kernel size */
-	    for (((i_inner.z = (i_outer.z == 0) ? 0 : -half.z),
-		  (j_inner.z = (i_outer.z == 0) ? half.z : 0)); 
-		 ((j_inner.z < AMITK_FILTER_FFT_SIZE) && 
-		  ((i_inner.z+i_outer.z) < AMITK_DATA_SET_DIM_Z(filtered_ds))); 
-		 i_inner.z++, j_inner.z++)
-	      for (((i_inner.y = (i_outer.y == 0) ? 0 : -half.y),
-		    (j_inner.y = (i_outer.y == 0) ? half.y : 0)); 
-		   ((j_inner.y < AMITK_FILTER_FFT_SIZE) && ((i_inner.y+i_outer.y) < AMITK_DATA_SET_DIM_Y(filtered_ds))); 
-		   i_inner.y++, j_inner.y++) 
-		for (((i_inner.x = (i_outer.x == 0) ? 0 : -half.x),
-		      (j_inner.x = (i_outer.x == 0) ? 2*half.x : 0)); 
-		     ((j_inner.x < 2*AMITK_FILTER_FFT_SIZE) && ((i_inner.x+i_outer.x) < AMITK_DATA_SET_DIM_X(filtered_ds))); 
-		     i_inner.x++, j_inner.x+=2) 
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(filtered_ds->raw_data, voxel_add(i_outer,i_inner)) +=
-		    AMITK_RAW_DATA_DOUBLE_CONTENT(subset, j_inner);
+ exit_strategy:
 
+  for (ffts = ff.ffts; ffts != NULL; ffts = ffts->next)
+    amitk_filter_fft_free(ffts->data);
+  g_slist_free(ff.ffts);
+  g_mutex_clear(&mutex);
 
-	  }
-	}
-      }
-    }
-  } /* i_outer.t */
+  if (kernel_spectrum != NULL) 
+    g_free(kernel_spectrum);
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
 
+  return continue_work;
+
+}
+
+#endif
+
+typedef struct filter_separable_t {
+  const AmitkDataSet * data_set;
+  AmitkDataSet * filtered_ds;
+  AmitkVoxel frame; /* only t and g are used */
+  AmitkFilterGaussian1D * gaussian[AMITK_AXIS_NUM];
+  gboolean failed;
+} filter_separable_t;
+
+/* filters along x the planes [start, end) of the frame, going from data_set into filtered_ds */
+static void filter_separable_x(gint start, gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i_voxel;
+  amide_data_t * in=NULL;
+  gdouble * out=NULL;
+  gdouble * workspace=NULL;
+  amitk_format_FLOAT_t * filtered_row;
+
+  dim = AMITK_DATA_SET_DIM(fs->data_set);
+  in = g_try_new(amide_data_t, dim.x);
+  out = g_try_new(gdouble, dim.x);
+  workspace = g_try_new(gdouble, amitk_filter_gaussian_1D_get_workspace_size(fs->gaussian[AMITK_AXIS_X], dim.x, 1));
+  if ((in == NULL) || (out == NULL) || (workspace == NULL)) {
+    fs->failed = TRUE;
+    goto exit_strategy;
+  }
 
+  i_voxel.t = fs->frame.t;
+  i_voxel.g = fs->frame.g;
+  i_voxel.x = 0;
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++)
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+      amitk_data_set_get_internal_row(fs->data_set, i_voxel, in);
+      amitk_filter_gaussian_1D_apply(fs->gaussian[AMITK_AXIS_X], in, out, dim.x, 1, workspace);
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered_ds->raw_data, i_voxel);
+      for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++)
+	filtered_row[i_voxel.x] = out[i_voxel.x];
+      i_voxel.x = 0;
+    }
 
+ exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(workspace);
+  return;
+}
 
+/* filters along y the planes [start, end) of the frame in filtered_ds, 
+   doing all the columns of a plane at once */
+static void filter_separable_y(gint start, gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i_voxel;
+  gdouble * in=NULL;
+  gdouble * out=NULL;
+  gdouble * workspace=NULL;
+  amitk_format_FLOAT_t * filtered_plane;
+  gsize j, plane_size;
+
+  dim = AMITK_DATA_SET_DIM(fs->data_set);
+  plane_size = ((gsize) dim.y)*dim.x;
+  in = g_try_new(gdouble, plane_size);
+  out = g_try_new(gdouble, plane_size);
+  workspace = g_try_new(gdouble, amitk_filter_gaussian_1D_get_workspace_size(fs->gaussian[AMITK_AXIS_Y], dim.y, dim.x));
+  if ((in == NULL) || (out == NULL) || (workspace == NULL)) {
+    fs->failed = TRUE;
+    goto exit_strategy;
+  }
 
+  i_voxel.t = fs->frame.t;
+  i_voxel.g = fs->frame.g;
+  i_voxel.y = i_voxel.x = 0;
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++) {
+    filtered_plane = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered_ds->raw_data, i_voxel);
+    for (j = 0; j < plane_size; j++) in[j] = filtered_plane[j];
+    amitk_filter_gaussian_1D_apply(fs->gaussian[AMITK_AXIS_Y], in, out, dim.y, dim.x, workspace);
+    for (j = 0; j < plane_size; j++) filtered_plane[j] = out[j];
+  }
 
  exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(workspace);
+  return;
+}
 
-  if (wavetable != NULL) {
-    gsl_fft_complex_wavetable_free(wavetable);
-    wavetable = NULL;
+/* filters along z the rows [start, end) of the frame in filtered_ds, doing an 
+   xz slice at a time */
+static void filter_separable_z(gint start, gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i_voxel;
+  gdouble * in=NULL;
+  gdouble * out=NULL;
+  gdouble * workspace=NULL;
+  amitk_format_FLOAT_t * filtered_row;
+  gint x;
+
+  dim = AMITK_DATA_SET_DIM(fs->data_set);
+  in = g_try_new(gdouble, ((gsize) dim.z)*dim.x);
+  out = g_try_new(gdouble, ((gsize) dim.z)*dim.x);
+  workspace = g_try_new(gdouble, amitk_filter_gaussian_1D_get_workspace_size(fs->gaussian[AMITK_AXIS_Z], dim.z, dim.x));
+  if ((in == NULL) || (out == NULL) || (workspace == NULL)) {
+    fs->failed = TRUE;
+    goto exit_strategy;
   }
 
-  if (workspace != NULL) {
-    gsl_fft_complex_workspace_free(workspace);
-    workspace = NULL;
+  i_voxel.t = fs->frame.t;
+  i_voxel.g = fs->frame.g;
+  i_voxel.x = 0;
+  for (i_voxel.y = start; i_voxel.y < end; i_voxel.y++) {
+    for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++) {
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered_ds->raw_data, i_voxel);
+      for (x = 0; x < dim.x; x++) in[i_voxel.z*dim.x+x] = filtered_row[x];
+    }
+    amitk_filter_gaussian_1D_apply(fs->gaussian[AMITK_AXIS_Z], in, out, dim.z, dim.x, workspace);
+    for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++) {
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered_ds->raw_data, i_voxel);
+      for (x = 0; x < dim.x; x++) filtered_row[x] = out[i_voxel.z*dim.x+x];
+    }
   }
-  
-  if (subset != NULL) {
-    g_object_unref(subset);
-    subset = NULL;
+
+ exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(workspace);
+  return;
+}
+
+/* fills the data set "filtered_ds" with the results of a separable gaussian applied 
+   to data_set, doing a 1D gaussian along x, y, and then z.  Each 1D gaussian is 
+   either a direct convolution or recursive, see amitk_filter_gaussian_1D_new.
+   The passes are split across threads by plane (x and y) or by row (z).
+
+   assumptions:
+   1- filtered_ds is of type FLOAT, 0D scaling
+   2- scale of filtered_ds is 1.0
+   3- the gaussians have been setup for the data set's voxel sizes
+*/
+static gboolean filter_gaussian_separable(const AmitkDataSet * data_set,
+					  AmitkDataSet * filtered_ds,
+					  AmitkFilterGaussian1D * gaussian[AMITK_AXIS_NUM],
+					  AmitkUpdateFunc update_func, 
+					  gpointer update_data) {
+  filter_separable_t fs;
+  AmitkVoxel ds_dim;
+  AmitkAxis i_axis;
+  gchar * temp_string;
+  gint image_num;
+  gint total_images;
+  gboolean continue_work=TRUE;
+
+  ds_dim = AMITK_DATA_SET_DIM(data_set);
+  fs.data_set = data_set;
+  fs.filtered_ds = filtered_ds;
+  for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+    fs.gaussian[i_axis] = gaussian[i_axis];
+  fs.failed = FALSE;
+
+#if AMIDE_DEBUG
+  g_print("Separable gaussian filtering, recursive in x/y/z: %d/%d/%d\n",
+	  amitk_filter_gaussian_1D_is_recursive(gaussian[AMITK_AXIS_X]),
+	  amitk_filter_gaussian_1D_is_recursive(gaussian[AMITK_AXIS_Y]),
+	  amitk_filter_gaussian_1D_is_recursive(gaussian[AMITK_AXIS_Z]));
+#endif
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+  total_images = AMITK_AXIS_NUM*ds_dim.t*ds_dim.g;
+
+  image_num = 0;
+  for (fs.frame.t = 0; (fs.frame.t < ds_dim.t) && continue_work; fs.frame.t++) {
+    for (fs.frame.g = 0; (fs.frame.g < ds_dim.g) && continue_work; fs.frame.g++) {
+      amitk_raw_data_request_frame(data_set->raw_data, fs.frame.t, fs.frame.g);
+      for (i_axis=0; (i_axis<AMITK_AXIS_NUM) && continue_work && !fs.failed; i_axis++, image_num++) {
+	if (update_func != NULL) 
+	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_images));
+	switch(i_axis) {
+	case AMITK_AXIS_X:
+	  amitk_parallel_for(ds_dim.z, filter_separable_x, &fs);
+	  break;
+	case AMITK_AXIS_Y:
+	  amitk_parallel_for(ds_dim.z, filter_separable_y, &fs);
+	  break;
+	case AMITK_AXIS_Z:
+	default:
+	  amitk_parallel_for(ds_dim.y, filter_separable_z, &fs);
+	  break;
+	}
+      }
+    }
+  }
+
+  if (fs.failed) {
+    g_warning(_("couldn't allocate memory space for filtering"));
+    continue_work = FALSE;
   }
 
   if (update_func != NULL) /* remove progress bar */
     (*update_func)(update_data, NULL, (gdouble) 2.0); 
 
   return continue_work;
+}
 
+/* NaN's are sorted as the largest values by the median filters, above any real
+   infinities.  As they're stored as infinity in the windows, the number of NaN's
+   in a window is counted separately, and the median is a NaN if it falls among them */
+#define MEDIAN_FROM_VALUE(value) (isnan(value) ? INFINITY : (value))
+#define MEDIAN_TO_VALUE(median, point, size, num_nans) (((point) >= ((size)-(num_nans))) ? NAN : (median))
+
+static int median_compare(const void * a, const void * b) {
+  const amide_data_t * va = a;
+  const amide_data_t * vb = b;
+
+  if (*va < *vb) return -1;
+  else if (*va > *vb) return 1;
+  else return 0;
 }
 
-#endif
+typedef struct filter_median_t {
+  const AmitkDataSet * data_set;
+  AmitkRawData * output_data; /* one frame's worth */
+  AmitkVoxel frame; /* only t and g are used */
+  AmitkVoxel kernel_dim;
+  AmitkVoxel mid_dim;
+  gint num_bins; /* 0 if we're not using the histogram */
+  gint raw_offset;
+  amide_data_t scale;
+  amide_data_t intercept;
+  gboolean failed;
+} filter_median_t;
+
+/* loads plane z of the frame into a zero padded plane, converting the values 
+   to histogram bins if we're using the histogram */
+static void filter_median_load_plane(const filter_median_t * fm, const gint z,
+				     gdouble * plane, amide_data_t * row) {
+
+  AmitkVoxel dim, i_voxel;
+  gint padded_x, x;
+  gsize j, plane_size;
+  gdouble padding;
+  gdouble * plane_row;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  padded_x = dim.x + 2*fm->mid_dim.x;
+  plane_size = ((gsize) (dim.y + 2*fm->mid_dim.y))*padded_x;
+
+  if (fm->num_bins > 0)
+    padding = fm->raw_offset - fm->intercept;
+  else
+    padding = 0.0;
+  for (j=0; j < plane_size; j++) plane[j] = padding;
+
+  if ((z < 0) || (z >= dim.z)) return;
+
+  i_voxel.t = fm->frame.t;
+  i_voxel.g = fm->frame.g;
+  i_voxel.z = z;
+  i_voxel.x = 0;
+  for (i_voxel.y=0; i_voxel.y < dim.y; i_voxel.y++) {
+    amitk_data_set_get_internal_row(fm->data_set, i_voxel, row);
+    plane_row = plane + (i_voxel.y+fm->mid_dim.y)*padded_x + fm->mid_dim.x;
+    if (fm->num_bins > 0) 
+      for (x=0; x < dim.x; x++)
+	plane_row[x] = lround(row[x]/fm->scale - fm->intercept) + fm->raw_offset;
+    else /* NaN's are left as is, so they can be counted */
+      for (x=0; x < dim.x; x++)
+	plane_row[x] = row[x];
+  }
+
+  return;
+}
+
+/* does the output planes [start, end) of the frame.  The kernel_dim.z input planes 
+   needed by a plane are kept in a ring, so each input plane is only loaded once 
+   as we step through z.  Within a row, the window slides along x a slab (the 
+   kernel_dim.z x kernel_dim.y values at one x) at a time, either updating a 
+   histogram of the raw values (integer data), or merging the slab into a sorted 
+   window (everything else).  */
+static void filter_median_planes(gint start, gint end, gpointer data) {
+
+  filter_median_t * fm = data;
+  AmitkVoxel dim, kernel_dim;
+  gint padded_x;
+  gsize plane_size;
+  gint slab_size, median_size, median_point;
+  gdouble * planes=NULL;
+  gint * plane_z=NULL;
+  const gdouble ** slab_rows=NULL;
+  amide_data_t * row=NULL;
+  AmitkFilterMedianHistogram * histogram=NULL;
+  amide_data_t * window=NULL;
+  amide_data_t * new_window=NULL;
+  amide_data_t * slabs=NULL;
+  amide_data_t * added=NULL;
+  amide_data_t * temp;
+  gint * slab_nans=NULL;
+  gint num_nans, added_nans;
+  amitk_format_FLOAT_t * out;
+  gint z, y, x, dz, dy, s, in_z, slot;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  kernel_dim = fm->kernel_dim;
+  padded_x = dim.x + 2*fm->mid_dim.x;
+  plane_size = ((gsize) (dim.y + 2*fm->mid_dim.y))*padded_x;
+  slab_size = kernel_dim.z*kernel_dim.y;
+  median_size = slab_size*kernel_dim.x;
+  median_point = (median_size-1) >> 1;
+
+  planes = g_try_new(gdouble, kernel_dim.z*plane_size);
+  plane_z = g_try_new(gint, kernel_dim.z);
+  slab_rows = g_try_new(const gdouble *, slab_size);
+  row = g_try_new(amide_data_t, dim.x);
+  if (fm->num_bins > 0) {
+    histogram = amitk_filter_median_histogram_new(fm->num_bins);
+  } else {
+    window = g_try_new(amide_data_t, median_size);
+    new_window = g_try_new(amide_data_t, median_size);
+    slabs = g_try_new(amide_data_t, median_size);
+    added = g_try_new(amide_data_t, slab_size);
+    slab_nans = g_try_new(gint, kernel_dim.x);
+  }
+  if ((planes == NULL) || (plane_z == NULL) || (slab_rows == NULL) || (row == NULL) ||
+      ((fm->num_bins > 0) && (histogram == NULL)) ||
+      ((fm->num_bins == 0) && ((window == NULL) || (new_window == NULL) || 
+			       (slabs == NULL) || (added == NULL) || (slab_nans == NULL)))) {
+    fm->failed = TRUE;
+    goto exit_strategy;
+  }
+  for (dz=0; dz < kernel_dim.z; dz++) plane_z[dz] = G_MININT;
+
+  for (z=start; z < end; z++) {
+
+    /* make sure the ring holds the input planes we need */
+    for (dz=0; dz < kernel_dim.z; dz++) {
+      in_z = z-fm->mid_dim.z+dz;
+      slot = (in_z+fm->mid_dim.z) % kernel_dim.z;
+      if (plane_z[slot] != in_z) {
+	filter_median_load_plane(fm, in_z, planes+slot*plane_size, row);
+	plane_z[slot] = in_z;
+      }
+    }
+
+    for (y=0; y < dim.y; y++) {
+      out = AMITK_RAW_DATA_FLOAT_3D_POINTER(fm->output_data, z, y, 0);
+
+      /* slab_rows[s][x] is element s of the slab at padded x position x */
+      for (dz=0; dz < kernel_dim.z; dz++) {
+	slot = (z+dz) % kernel_dim.z;
+	for (dy=0; dy < kernel_dim.y; dy++)
+	  slab_rows[dz*kernel_dim.y+dy] = planes + slot*plane_size + (y+dy)*padded_x;
+      }
+
+      if (histogram != NULL) {
+	for (x=0; x < kernel_dim.x; x++)
+	  for (s=0; s < slab_size; s++)
+	    amitk_filter_median_histogram_add(histogram, (gint) slab_rows[s][x]);
+
+	for (x=0; x < dim.x; x++) {
+	  if (x > 0)
+	    for (s=0; s < slab_size; s++) {
+	      amitk_filter_median_histogram_remove(histogram, (gint) slab_rows[s][x-1]);
+	      amitk_filter_median_histogram_add(histogram, (gint) slab_rows[s][x+kernel_dim.x-1]);
+	    }
+	  out[x] = fm->scale*(((amide_data_t) (amitk_filter_median_histogram_get_median(histogram)-fm->raw_offset))
+			      + fm->intercept);
+	}
+
+	/* empty the histogram for the next row */
+	for (x=dim.x-1; x < dim.x+kernel_dim.x-1; x++)
+	  for (s=0; s < slab_size; s++)
+	    amitk_filter_median_histogram_remove(histogram, (gint) slab_rows[s][x]);
+
+      } else if (kernel_dim.x == 1) { /* nothing to slide, just do each voxel */
+	for (x=0; x < dim.x; x++) {
+	  num_nans = 0;
+	  for (s=0; s < slab_size; s++) {
+	    num_nans += isnan(slab_rows[s][x]) ? 1 : 0;
+	    window[s] = MEDIAN_FROM_VALUE(slab_rows[s][x]);
+	  }
+	  out[x] = MEDIAN_TO_VALUE(amitk_filter_find_median_by_partial_sort(window, median_size),
+				   median_point, median_size, num_nans);
+	}
+
+      } else {
+	/* slab for padded x position x is kept sorted in slot x % kernel_dim.x */
+	num_nans = 0;
+	for (x=0; x < kernel_dim.x; x++) {
+	  slab_nans[x] = 0;
+	  for (s=0; s < slab_size; s++) {
+	    slab_nans[x] += isnan(slab_rows[s][x]) ? 1 : 0;
+	    slabs[x*slab_size+s] = MEDIAN_FROM_VALUE(slab_rows[s][x]);
+	  }
+	  num_nans += slab_nans[x];
+	  qsort(slabs+x*slab_size, slab_size, sizeof(amide_data_t), median_compare);
+	}
+	memcpy(window, slabs, median_size*sizeof(amide_data_t));
+	qsort(window, median_size, sizeof(amide_data_t), median_compare);
+	out[0] = MEDIAN_TO_VALUE(window[median_point], median_point, median_size, num_nans);
+
+	for (x=1; x < dim.x; x++) {
+	  added_nans = 0;
+	  for (s=0; s < slab_size; s++) {
+	    added_nans += isnan(slab_rows[s][x+kernel_dim.x-1]) ? 1 : 0;
+	    added[s] = MEDIAN_FROM_VALUE(slab_rows[s][x+kernel_dim.x-1]);
+	  }
+	  qsort(added, slab_size, sizeof(amide_data_t), median_compare);
+	  slot = (x-1) % kernel_dim.x;
+	  amitk_filter_sorted_window_update(window, median_size, slabs+slot*slab_size,
+					    added, slab_size, new_window);
+	  memcpy(slabs+slot*slab_size, added, slab_size*sizeof(amide_data_t));
+	  num_nans += added_nans - slab_nans[slot];
+	  slab_nans[slot] = added_nans;
+	  temp = window;
+	  window = new_window;
+	  new_window = temp;
+	  out[x] = MEDIAN_TO_VALUE(window[median_point], median_point, median_size, num_nans);
+	}
+      }
+    } /* y */
+  } /* z */
+
+ exit_strategy:
+  g_free(planes);
+  g_free(plane_z);
+  g_free(slab_rows);
+  g_free(row);
+  amitk_filter_median_histogram_free(histogram);
+  g_free(window);
+  g_free(new_window);
+  g_free(slabs);
+  g_free(added);
+  g_free(slab_nans);
+  return;
+}
 
 /* assumptions:
    1- filtered_ds is of type FLOAT, 0D scaling
@@ -5074,22 +6493,23 @@ static gboolean filter_fir(const AmitkDataSet * data_set,
 
    notes:
    1. don't have a separate function for each data type, as getting the data_set data,
-   is a tiny fraction of the computational time, use amitk_data_set_get_internal_value instead
+   is a tiny fraction of the computational time, use amitk_data_set_get_internal_row instead
    2. data set can be the same as filtered_ds
+   3. byte and short data with a single scale factor are done exactly off of a histogram 
+   of the raw values, which takes kernel_dim.z*kernel_dim.y operations per voxel 
+   instead of a partial sort of the whole neighborhood.  Other data is done by 
+   merging slabs in and out of a sorted window.
  */
 static gboolean filter_median_3D(const AmitkDataSet * data_set, AmitkDataSet * filtered_ds,
 				 AmitkVoxel kernel_dim, AmitkUpdateFunc update_func, gpointer update_data) {
 
-  amide_data_t * partial_sort_data;
-  AmitkVoxel i,j, mid_dim, output_dim;
-  gint loc, median_size;
-  AmitkRawData * output_data;
+  filter_median_t fm;
+  AmitkVoxel output_dim, i_voxel;
   AmitkVoxel ds_dim;
+  amide_data_t padding;
   gchar * temp_string;
   gint image_num;
-  gint total_planes;
-  div_t x;
-  gint divider;
+  gint total_images;
   gboolean continue_work=TRUE;
 
 
@@ -5122,142 +6542,326 @@ static gboolean filter_median_3D(const AmitkDataSet * data_set, AmitkDataSet * f
     g_warning(_("data set x dimension to small for kernel, setting kernel dimension to 1"));
   }
 
-  mid_dim.t = mid_dim.g = 0;
-  mid_dim.z = kernel_dim.z >> 1;
-  mid_dim.y = kernel_dim.y >> 1;
-  mid_dim.x = kernel_dim.x >> 1;
+  fm.data_set = data_set;
+  fm.kernel_dim = kernel_dim;
+  fm.mid_dim.t = fm.mid_dim.g = 0;
+  fm.mid_dim.z = kernel_dim.z >> 1;
+  fm.mid_dim.y = kernel_dim.y >> 1;
+  fm.mid_dim.x = kernel_dim.x >> 1;
+  fm.failed = FALSE;
 
-  median_size = kernel_dim.z*kernel_dim.y*kernel_dim.x;
+  /* figure out if we can work off a histogram of the raw values, the zero padding
+     needs to land on a raw value, and the scale needs to keep the ordering */
+  i_voxel = zero_voxel;
+  fm.num_bins = raw_histogram_size(data_set);
+  fm.scale = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(data_set->internal_scaling_factor, i_voxel);
+  fm.intercept = 0.0;
+  if (data_set->scaling_type == AMITK_SCALING_TYPE_0D_WITH_INTERCEPT)
+    fm.intercept = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(data_set->internal_scaling_intercept, i_voxel);
+  fm.raw_offset = ((data_set->raw_data->format == AMITK_FORMAT_SBYTE) || 
+		   (data_set->raw_data->format == AMITK_FORMAT_SSHORT)) ? fm.num_bins/2 : 0;
+  padding = fm.raw_offset - fm.intercept;
+  if ((fm.scale <= 0.0) || (padding != floor(padding)) || (padding < 0) || (padding >= fm.num_bins))
+    fm.num_bins = 0;
 
   output_dim = ds_dim;
   output_dim.t = output_dim.g = 1;
-  if ((output_data = amitk_raw_data_new_with_data(AMITK_FORMAT_FLOAT, output_dim)) == NULL) {
+  if ((fm.output_data = amitk_raw_data_new_with_data(AMITK_FORMAT_FLOAT, output_dim)) == NULL) {
     g_warning(_("couldn't allocate memory space for the internal raw data"));
     return FALSE;
   }
-  amitk_raw_data_FLOAT_initialize_data(output_data, 0.0);
-  partial_sort_data = g_try_new(amide_data_t, median_size);
-  g_return_val_if_fail(partial_sort_data != NULL, FALSE);
 
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = ds_dim.z*ds_dim.t*ds_dim.g;
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
-
+  total_images = ds_dim.t*ds_dim.g;
 
-  /* iterate over all the voxels in the data_set */
-  i.t = i.g = 0;
-  for (j.t=0; (j.t < AMITK_DATA_SET_NUM_FRAMES(data_set)) && continue_work; j.t++) {
-    for (j.g=0; (j.g < AMITK_DATA_SET_NUM_GATES(data_set)) && continue_work; j.g++) {
-      for (i.z=0; (i.z < output_dim.z) && continue_work; i.z++) {
+  image_num = 0;
+  for (fm.frame.t=0; (fm.frame.t < ds_dim.t) && continue_work; fm.frame.t++) {
+    for (fm.frame.g=0; (fm.frame.g < ds_dim.g) && continue_work && !fm.failed; fm.frame.g++, image_num++) {
 
-	if (update_func != NULL) {
-	  image_num = i.z+j.t*ds_dim.z+j.g*ds_dim.z*ds_dim.t;
-	  x = div(image_num,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
-
-	for (i.y=0; i.y < output_dim.y; i.y++) {
-	  for (i.x=0; i.x < output_dim.x; i.x++) {
-	    
-	    /* initialize the data for the iteration */
-	    loc = 0;
-	    for (j.z = i.z-mid_dim.z; j.z <= i.z+mid_dim.z; j.z++) {
-	      if ((j.z < 0) || (j.z >= ds_dim.z)) {
-		for (j.y=0; j.y < kernel_dim.y; j.y++) {
-		  for (j.x=0; j.x < kernel_dim.x; j.x++) {
-		    partial_sort_data[loc] = 0.0;
-		    loc++;
-		  }
-		}
-	      } else {
-		for (j.y = i.y-mid_dim.y; j.y <= i.y+mid_dim.y; j.y++) {
-		  if ((j.y < 0) || (j.y >= ds_dim.y)) {
-		    for (j.x=0; j.x < kernel_dim.x; j.x++) {
-		      partial_sort_data[loc] = 0.0;
-		      loc++;
-		    }
-		  } else {
-		    for (j.x = i.x-mid_dim.x; j.x <= i.x+mid_dim.x; j.x++) {
-		      if ((j.x < 0) || (j.x >= ds_dim.x)) {
-			partial_sort_data[loc] = 0.0;
-			loc++;
-		      } else {
-			partial_sort_data[loc] = amitk_data_set_get_internal_value(data_set, j);
-			loc++;
-		      }
-		    }
-		  }
-		}
-	      }
-	    } /* end initializing data */
-	    
-	    /* and store median value */
-	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_data, i) = 
-	      amitk_filter_find_median_by_partial_sort(partial_sort_data, median_size);
-	    
-	  } /* i.x */
-	} /* i.y */
-      } /* i.z */
+      if (update_func != NULL) 
+	continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_images));
+      if (!continue_work) break;
 
+      amitk_raw_data_request_frame(data_set->raw_data, fm.frame.t, fm.frame.g);
+      amitk_parallel_for(ds_dim.z, filter_median_planes, &fm);
+      if (fm.failed) break;
 
       /* copy the output_data over into the filtered_ds */
-      for (i.z=0, j.z=0; i.z < output_dim.z; i.z++, j.z++)
-	for (i.y=0, j.y=0; i.y < output_dim.y; i.y++, j.y++)
-	  for (i.x=0, j.x=0; i.x < output_dim.x; i.x++, j.x++)
-	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(filtered_ds->raw_data, j) = 
-	      AMITK_RAW_DATA_FLOAT_CONTENT(output_data, i);
-    } /* j.g */
-  } /* j.t */
+      i_voxel = zero_voxel;
+      i_voxel.t = fm.frame.t;
+      i_voxel.g = fm.frame.g;
+      memcpy(AMITK_RAW_DATA_FLOAT_POINTER(filtered_ds->raw_data, i_voxel),
+	     AMITK_RAW_DATA_FLOAT_POINTER(fm.output_data, zero_voxel),
+	     ((gsize) output_dim.z)*output_dim.y*output_dim.x*sizeof(amitk_format_FLOAT_t));
+    } /* fm.frame.g */
+  } /* fm.frame.t */
+
+  if (fm.failed) {
+    g_warning(_("couldn't allocate memory space for filtering"));
+    continue_work = FALSE;
+  }
 
   /* garbage collection */
-  g_object_unref(output_data); 
-  g_free(partial_sort_data);
+  g_object_unref(fm.output_data); 
 
   if (update_func != NULL) /* remove progress bar */
     (*update_func)(update_data, NULL, (gdouble) 2.0); 
 
   return continue_work;
 }
-  
-/* see notes for filter_median_3D */
+
+typedef struct filter_median_linear_t {
+  const AmitkDataSet * data_set;
+  AmitkDataSet * filtered_ds;
+  AmitkVoxel frame; /* only t and g are used */
+  gint kernel_size[AMITK_AXIS_NUM];
+  gboolean failed;
+} filter_median_linear_t;
+
+/* median filters the length values of in (spaced stride apart) into out, 
+   treating values off the ends as zero.  The window is kept sorted, and 
+   updated one value at a time as it slides.  window needs kernel_size entries */
+static void filter_median_1D(const gdouble * in, gdouble * out, 
+			     const gint length, const gint stride,
+			     const gint kernel_size, amide_data_t * window) {
+
+  gint i, mid, num_nans;
+  amide_data_t old_value, new_value;
+
+  mid = kernel_size >> 1;
+
+  num_nans = 0;
+  for (i=-mid; i <= mid; i++) {
+    window[i+mid] = ((i < 0) || (i >= length)) ? 0.0 : MEDIAN_FROM_VALUE(in[i*stride]);
+    if ((i >= 0) && (i < length) && isnan(in[i*stride])) num_nans++;
+  }
+  qsort(window, kernel_size, sizeof(amide_data_t), median_compare);
+  out[0] = MEDIAN_TO_VALUE(window[mid], mid, kernel_size, num_nans);
+
+  for (i=1; i < length; i++) {
+    old_value = (i-1-mid < 0) ? 0.0 : in[(i-1-mid)*stride];
+    new_value = (i+mid >= length) ? 0.0 : in[(i+mid)*stride];
+    if (isnan(old_value)) num_nans--;
+    if (isnan(new_value)) num_nans++;
+    old_value = MEDIAN_FROM_VALUE(old_value);
+    new_value = MEDIAN_FROM_VALUE(new_value);
+    if (old_value != new_value)
+      amitk_filter_sorted_window_replace(window, kernel_size, old_value, new_value);
+    out[i*stride] = MEDIAN_TO_VALUE(window[mid], mid, kernel_size, num_nans);
+  }
+
+  return;
+}
+
+/* filters along x the planes [start, end) of the frame, going from data_set into filtered_ds */
+static void filter_median_linear_x(gint start, gint end, gpointer data) {
+
+  filter_median_linear_t * fm = data;
+  AmitkVoxel dim, i_voxel;
+  amide_data_t * in=NULL;
+  gdouble * out=NULL;
+  amide_data_t * window=NULL;
+  amitk_format_FLOAT_t * filtered_row;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  in = g_try_new(amide_data_t, dim.x);
+  out = g_try_new(gdouble, dim.x);
+  window = g_try_new(amide_data_t, fm->kernel_size[AMITK_AXIS_X]);
+  if ((in == NULL) || (out == NULL) || (window == NULL)) {
+    fm->failed = TRUE;
+    goto exit_strategy;
+  }
+
+  i_voxel.t = fm->frame.t;
+  i_voxel.g = fm->frame.g;
+  i_voxel.x = 0;
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++)
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+      amitk_data_set_get_internal_row(fm->data_set, i_voxel, in);
+      filter_median_1D(in, out, dim.x, 1, fm->kernel_size[AMITK_AXIS_X], window);
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fm->filtered_ds->raw_data, i_voxel);
+      for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++)
+	filtered_row[i_voxel.x] = out[i_voxel.x];
+      i_voxel.x = 0;
+    }
+
+ exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(window);
+  return;
+}
+
+/* filters along y the planes [start, end) of the frame in filtered_ds */
+static void filter_median_linear_y(gint start, gint end, gpointer data) {
+
+  filter_median_linear_t * fm = data;
+  AmitkVoxel dim, i_voxel;
+  gdouble * in=NULL;
+  gdouble * out=NULL;
+  amide_data_t * window=NULL;
+  amitk_format_FLOAT_t * filtered_plane;
+  gsize j, plane_size;
+  gint x;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  plane_size = ((gsize) dim.y)*dim.x;
+  in = g_try_new(gdouble, plane_size);
+  out = g_try_new(gdouble, plane_size);
+  window = g_try_new(amide_data_t, fm->kernel_size[AMITK_AXIS_Y]);
+  if ((in == NULL) || (out == NULL) || (window == NULL)) {
+    fm->failed = TRUE;
+    goto exit_strategy;
+  }
+
+  i_voxel.t = fm->frame.t;
+  i_voxel.g = fm->frame.g;
+  i_voxel.y = i_voxel.x = 0;
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++) {
+    filtered_plane = AMITK_RAW_DATA_FLOAT_POINTER(fm->filtered_ds->raw_data, i_voxel);
+    for (j = 0; j < plane_size; j++) in[j] = filtered_plane[j];
+    for (x = 0; x < dim.x; x++)
+      filter_median_1D(in+x, out+x, dim.y, dim.x, fm->kernel_size[AMITK_AXIS_Y], window);
+    for (j = 0; j < plane_size; j++) filtered_plane[j] = out[j];
+  }
+
+ exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(window);
+  return;
+}
+
+/* filters along z the rows [start, end) of the frame in filtered_ds, doing an 
+   xz slice at a time */
+static void filter_median_linear_z(gint start, gint end, gpointer data) {
+
+  filter_median_linear_t * fm = data;
+  AmitkVoxel dim, i_voxel;
+  gdouble * in=NULL;
+  gdouble * out=NULL;
+  amide_data_t * window=NULL;
+  amitk_format_FLOAT_t * filtered_row;
+  gint x;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  in = g_try_new(gdouble, ((gsize) dim.z)*dim.x);
+  out = g_try_new(gdouble, ((gsize) dim.z)*dim.x);
+  window = g_try_new(amide_data_t, fm->kernel_size[AMITK_AXIS_Z]);
+  if ((in == NULL) || (out == NULL) || (window == NULL)) {
+    fm->failed = TRUE;
+    goto exit_strategy;
+  }
+
+  i_voxel.t = fm->frame.t;
+  i_voxel.g = fm->frame.g;
+  i_voxel.x = 0;
+  for (i_voxel.y = start; i_voxel.y < end; i_voxel.y++) {
+    for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++) {
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fm->filtered_ds->raw_data, i_voxel);
+      for (x = 0; x < dim.x; x++) in[i_voxel.z*dim.x+x] = filtered_row[x];
+    }
+    for (x = 0; x < dim.x; x++)
+      filter_median_1D(in+x, out+x, dim.z, dim.x, fm->kernel_size[AMITK_AXIS_Z], window);
+    for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++) {
+      filtered_row = AMITK_RAW_DATA_FLOAT_POINTER(fm->filtered_ds->raw_data, i_voxel);
+      for (x = 0; x < dim.x; x++) filtered_row[x] = out[i_voxel.z*dim.x+x];
+    }
+  }
+
+ exit_strategy:
+  g_free(in);
+  g_free(out);
+  g_free(window);
+  return;
+}
+
+/* does a 1D median along x, y, and then z.  Each pass slides a sorted window 
+   along the lines, and is split across threads by plane (x and y) or by row (z).
+   See the assumptions for filter_median_3D */
 static gboolean filter_median_linear(const AmitkDataSet * data_set,
 				     AmitkDataSet * filtered_ds,
 				     const gint kernel_size,
 				     AmitkUpdateFunc update_func, 
 				     gpointer update_data) {
 
-  AmitkVoxel kernel_dim;
+  filter_median_linear_t fm;
+  AmitkVoxel ds_dim;
+  AmitkAxis i_axis;
+  gchar * temp_string;
+  gint image_num;
+  gint total_images;
+  gboolean continue_work=TRUE;
 
-  kernel_dim.x = kernel_size;
-  kernel_dim.y = 1;
-  kernel_dim.z = 1;
-  kernel_dim.g = 1;
-  kernel_dim.t = 1;
-  if (!filter_median_3D(data_set, filtered_ds, kernel_dim, update_func, update_data))
-    return FALSE;
-  
-  kernel_dim.x = 1;
-  kernel_dim.y = kernel_size;
-  kernel_dim.z = 1;
-  kernel_dim.g = 1;
-  kernel_dim.t = 1;
-  if (!filter_median_3D(filtered_ds,filtered_ds,kernel_dim, update_func, update_data))
-    return FALSE;
-  
-  kernel_dim.x = 1;
-  kernel_dim.y = 1;
-  kernel_dim.z = kernel_size;
-  kernel_dim.g = 1;
-  kernel_dim.t = 1;
-  if (!filter_median_3D(filtered_ds,filtered_ds,kernel_dim, update_func, update_data))
-    return FALSE;
+  g_return_val_if_fail(AMITK_IS_DATA_SET(data_set), FALSE);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(filtered_ds), FALSE);
+  g_return_val_if_fail(VOXEL_EQUAL(AMITK_DATA_SET_DIM(data_set), AMITK_DATA_SET_DIM(filtered_ds)), FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(AMITK_DATA_SET_RAW_DATA(filtered_ds)) == AMITK_FORMAT_FLOAT, FALSE);
+  g_return_val_if_fail(REAL_EQUAL(AMITK_DATA_SET_SCALE_FACTOR(filtered_ds), 1.0), FALSE);
+  g_return_val_if_fail(kernel_size & 0x1, FALSE);
 
-  return TRUE;
+  ds_dim = AMITK_DATA_SET_DIM(data_set);
+  fm.data_set = data_set;
+  fm.filtered_ds = filtered_ds;
+  fm.failed = FALSE;
+  for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+    fm.kernel_size[i_axis] = kernel_size;
+  if (ds_dim.z < kernel_size) {
+    fm.kernel_size[AMITK_AXIS_Z] = 1;
+    g_warning(_("data set z dimension to small for kernel, setting kernel dimension to 1"));
+  }
+  if (ds_dim.y < kernel_size) {
+    fm.kernel_size[AMITK_AXIS_Y] = 1;
+    g_warning(_("data set y dimension to small for kernel, setting kernel dimension to 1"));
+  }
+  if (ds_dim.x < kernel_size) {
+    fm.kernel_size[AMITK_AXIS_X] = 1;
+    g_warning(_("data set x dimension to small for kernel, setting kernel dimension to 1"));
+  }
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+  total_images = AMITK_AXIS_NUM*ds_dim.t*ds_dim.g;
+
+  image_num = 0;
+  for (fm.frame.t = 0; (fm.frame.t < ds_dim.t) && continue_work; fm.frame.t++) {
+    for (fm.frame.g = 0; (fm.frame.g < ds_dim.g) && continue_work; fm.frame.g++) {
+      amitk_raw_data_request_frame(data_set->raw_data, fm.frame.t, fm.frame.g);
+      for (i_axis=0; (i_axis<AMITK_AXIS_NUM) && continue_work && !fm.failed; i_axis++, image_num++) {
+	if (update_func != NULL) 
+	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_images));
+	switch(i_axis) {
+	case AMITK_AXIS_X:
+	  amitk_parallel_for(ds_dim.z, filter_median_linear_x, &fm);
+	  break;
+	case AMITK_AXIS_Y:
+	  amitk_parallel_for(ds_dim.z, filter_median_linear_y, &fm);
+	  break;
+	case AMITK_AXIS_Z:
+	default:
+	  amitk_parallel_for(ds_dim.y, filter_median_linear_z, &fm);
+	  break;
+	}
+      }
+    }
+  }
+
+  if (fm.failed) {
+    g_warning(_("couldn't allocate memory space for filtering"));
+    continue_work = FALSE;
+  }
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  return continue_work;
 }
 
 
@@ -5325,7 +6929,7 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
   g_free(temp_string);
 
   /* start the new building process */
-  filtered->raw_data = amitk_raw_data_new_with_data(AMITK_FORMAT_FLOAT, AMITK_DATA_SET_DIM(ds));
+  filtered->raw_data = amitk_raw_data_new_with_data0(AMITK_FORMAT_FLOAT, AMITK_DATA_SET_DIM(ds));
   if (filtered->raw_data == NULL) {
     g_warning(_("couldn't allocate memory space for the filtered raw data set structure"));
     goto error;
@@ -5341,27 +6945,57 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
 
   switch(filter_type) {
 
-#ifdef AMIDE_LIBGSL_SUPPORT
   case AMITK_FILTER_GAUSSIAN:
     {
+      AmitkFilterGaussian1D * gaussian[AMITK_AXIS_NUM];
+      AmitkAxis i_axis;
+      amide_real_t separable_work=0.0;
+#if defined(AMIDE_LIBGSL_SUPPORT) || defined(AMIDE_FFTW_SUPPORT)
       AmitkRawData * kernel;
       AmitkVoxel kernel_size_3D;
+      amide_real_t fft_work;
+#endif
 
-      kernel_size_3D.t=kernel_size_3D.g=1;
-      kernel_size_3D.z=kernel_size_3D.y=kernel_size_3D.x=kernel_size;
-
-      kernel = amitk_filter_calculate_gaussian_kernel_complex(kernel_size_3D, 
-							      AMITK_DATA_SET_VOXEL_SIZE(ds),
-							      fwhm);
-      if (kernel == NULL) {
+      /* the gaussian is separable, so we filter along each axis in turn, 
+	 unless going through the FFT works out to be less work */
+      for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++) {
+	gaussian[i_axis] = amitk_filter_gaussian_1D_new(kernel_size, 
+							point_get_component(AMITK_DATA_SET_VOXEL_SIZE(ds), i_axis),
+							fwhm);
+	if (gaussian[i_axis] != NULL) 
+	  separable_work += amitk_filter_gaussian_1D_get_work(gaussian[i_axis]);
+      }
+      if ((gaussian[AMITK_AXIS_X] == NULL) || (gaussian[AMITK_AXIS_Y] == NULL) || (gaussian[AMITK_AXIS_Z] == NULL)) {
+	for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+	  amitk_filter_gaussian_1D_free(gaussian[i_axis]);
 	g_warning(_("failed to calculate 3D gaussian kernel"));
 	goto error;
       }
-      good = filter_fir(ds, filtered, kernel, kernel_size_3D, update_func, update_data);
-      g_object_unref(kernel);
+
+#if defined(AMIDE_LIBGSL_SUPPORT) || defined(AMIDE_FFTW_SUPPORT)
+      kernel_size_3D.t=kernel_size_3D.g=1;
+      kernel_size_3D.z=kernel_size_3D.y=kernel_size_3D.x=kernel_size;
+      amitk_filter_fft_choose_size(kernel_size_3D, AMITK_DATA_SET_DIM(ds), &fft_work);
+
+      if (fft_work < separable_work) {
+	kernel = amitk_filter_calculate_gaussian_kernel(kernel_size_3D, 
+							AMITK_DATA_SET_VOXEL_SIZE(ds),
+							fwhm);
+	if (kernel == NULL) {
+	  g_warning(_("failed to calculate 3D gaussian kernel"));
+	  good = FALSE;
+	} else {
+	  good = filter_fir(ds, filtered, kernel, kernel_size_3D, update_func, update_data);
+	  g_object_unref(kernel);
+	}
+      } else
+#endif
+	good = filter_gaussian_separable(ds, filtered, gaussian, update_func, update_data);
+
+      for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+	amitk_filter_gaussian_1D_free(gaussian[i_axis]);
     }
     break;
-#endif
 
   case AMITK_FILTER_MEDIAN_LINEAR:
     good = filter_median_linear(ds, filtered, kernel_size, update_func, update_data);
@@ -5548,20 +7182,6 @@ GList * amitk_data_sets_remove_with_slice_parent(GList * slices,const AmitkDataS
   return slices;
 }
 
-/* trim cache slice size down to max_size, removes from end */
-GList * slice_cache_trim(GList * slice_cache, gint max_size) {
-
-  GList * last;
-
-  while (g_list_length(slice_cache) > max_size) {
-    last = g_list_last(slice_cache);
-    slice_cache = g_list_remove_link(slice_cache, last);
-    amitk_objects_unref(last);
-  }
-
-  return slice_cache;
-}
-
 /* several things cause slice caches to get invalidated, so they don't need to be
    explicitly checked here
 
@@ -5571,144 +7191,796 @@ GList * slice_cache_trim(GList * slice_cache, gint max_size) {
    4. Any change to the raw data
 
 */
-static AmitkDataSet * slice_cache_find (GList * slice_cache, AmitkDataSet * parent_ds, 
-					const amide_time_t start, const amide_time_t duration,
-					const amide_intpoint_t gate,
-					const AmitkCanvasPoint pixel_size, const AmitkVolume * view_volume) {
+/* the key gets matched exactly, so round off the last few bits that 
+   differ depending on how the view got to where it is */
+#define SLICE_KEY_SNAP(x) (rint((x)*1.0e6)+0.0)
 
-  AmitkDataSet * slice;
-  AmitkVoxel dim;
-  amide_intpoint_t start_gate, end_gate;
+static AmitkPoint slice_key_snap_point(const AmitkPoint point) {
 
-  if (slice_cache == NULL) {
-    return NULL;
+  AmitkPoint snapped;
+
+  snapped.x = SLICE_KEY_SNAP(point.x);
+  snapped.y = SLICE_KEY_SNAP(point.y);
+  snapped.z = SLICE_KEY_SNAP(point.z);
+
+  return snapped;
+}
+
+static void slice_key_init(slice_key_t * key, AmitkDataSet * parent_ds, 
+			   const amide_time_t start, const amide_time_t duration,
+			   const amide_intpoint_t gate,
+			   const AmitkCanvasPoint pixel_size, const AmitkVolume * view_volume,
+			   const gboolean use_pyramid) {
+
+  AmitkAxis i_axis;
+
+  /* the whole key gets hashed and compared, padding included */
+  memset(key, 0, sizeof(slice_key_t));
+
+  key->parent = DATA_SET_ORIGINAL(parent_ds);
+  key->offset = slice_key_snap_point(AMITK_SPACE_OFFSET(view_volume));
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    key->axes[i_axis] = slice_key_snap_point(AMITK_SPACE_AXES(view_volume)[i_axis]);
+  key->thickness = SLICE_KEY_SNAP(AMITK_VOLUME_Z_CORNER(view_volume));
+  key->pixel_size.x = SLICE_KEY_SNAP(pixel_size.x);
+  key->pixel_size.y = SLICE_KEY_SNAP(pixel_size.y);
+  key->dim.x = ceil(fabs(AMITK_VOLUME_X_CORNER(view_volume))/pixel_size.x);
+  key->dim.y = ceil(fabs(AMITK_VOLUME_Y_CORNER(view_volume))/pixel_size.y);
+  key->dim.z = key->dim.g = key->dim.t = 1;
+  key->start = SLICE_KEY_SNAP(start);
+  key->duration = SLICE_KEY_SNAP(duration);
+  if (gate < 0) {
+    key->start_gate = AMITK_DATA_SET_VIEW_START_GATE(parent_ds);
+    key->end_gate = AMITK_DATA_SET_VIEW_END_GATE(parent_ds);
   } else {
-    slice = slice_cache->data;
-    if (AMITK_DATA_SET_SLICE_PARENT(slice) == parent_ds) 
-      if (amitk_space_equal(AMITK_SPACE(slice), AMITK_SPACE(view_volume))) 
-	if (REAL_EQUAL(slice->scan_start, start)) 
-	  if (REAL_EQUAL(amitk_data_set_get_frame_duration(slice,0), duration)) {
-	    if (gate < 0) {
-	      start_gate = AMITK_DATA_SET_VIEW_START_GATE(AMITK_DATA_SET_SLICE_PARENT(slice));
-	      end_gate = AMITK_DATA_SET_VIEW_END_GATE(AMITK_DATA_SET_SLICE_PARENT(slice));
-	    } else {
-	      start_gate = gate;
-	      end_gate = gate;
-	    }
-	    if (AMITK_DATA_SET_VIEW_START_GATE(slice) == start_gate)
-	      if (AMITK_DATA_SET_VIEW_END_GATE(slice) == end_gate)
-		if (REAL_EQUAL(slice->voxel_size.z,AMITK_VOLUME_Z_CORNER(view_volume))) {
-		  dim.x = ceil(fabs(AMITK_VOLUME_X_CORNER(view_volume))/pixel_size.x);
-		  dim.y = ceil(fabs(AMITK_VOLUME_Y_CORNER(view_volume))/pixel_size.y);
-		  dim.z = dim.t = dim.g = 1;
-		  if (VOXEL_EQUAL(dim, AMITK_DATA_SET_DIM(slice))) 
-		    if (AMITK_DATA_SET_INTERPOLATION(slice) == AMITK_DATA_SET_INTERPOLATION(parent_ds)) 
-		      if (AMITK_DATA_SET_RENDERING(slice) == AMITK_DATA_SET_RENDERING(parent_ds)) 
-			return slice;
-		}
-	  }
+    key->start_gate = gate;
+    key->end_gate = gate;
   }
-  
+  key->interpolation = AMITK_DATA_SET_INTERPOLATION(parent_ds);
+  key->rendering = AMITK_DATA_SET_RENDERING(parent_ds);
+  key->use_pyramid = use_pyramid;
 
-  /* this one's not it, keep looking */
-  return slice_cache_find(slice_cache->next, parent_ds, start, duration, gate, pixel_size, view_volume);
+  return;
 }
 
+static guint slice_key_hash(gconstpointer key) {
 
+  const guchar * bytes = key;
+  guint hash = 2166136261U;
+  guint i;
 
-/* give a list of data_sets, returns a list of slices of equal size and orientation
-   intersecting these data_sets.  The slice_cache is a list of already generated slices,
-   if an appropriate slice is found in there, it'll be used */
-/* notes
-   - in real practice, the parent data set's local cache is rarely used,
-     as most slices, if there in the local cache, will also be in the passed in cache
-   - the "gate" parameter should ordinarily by -1 (ignored).  Only use it to override the
-     the data set's view_start_gate/view_end_gate parameters 
- */
-GList * amitk_data_sets_get_slices(GList * objects,
-				   GList ** pslice_cache,
-				   const gint max_slice_cache_size,
-				   const amide_time_t start,
-				   const amide_time_t duration,
-				   const amide_intpoint_t gate,
-				   const AmitkCanvasPoint pixel_size,
-				   const AmitkVolume * view_volume) {
+  for (i=0; i < sizeof(slice_key_t); i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
 
+  return hash;
+}
 
-  GList * slices=NULL;
-  AmitkDataSet * local_slice;
-  AmitkDataSet * canvas_slice=NULL;
-  AmitkDataSet * slice;
-  AmitkDataSet * parent_ds;
-  gint num_data_sets=0;
+static gboolean slice_key_equal(gconstpointer key1, gconstpointer key2) {
+  return (memcmp(key1, key2, sizeof(slice_key_t)) == 0);
+}
 
-#ifdef SLICE_TIMING
-  struct timeval tv1;
-  struct timeval tv2;
-  gdouble time1;
-  gdouble time2;
+/* makes a new slice with the same geometry as the given one, holding a copy of its
+   voxel data as AMITK_FORMAT_DOUBLE or AMITK_FORMAT_FLOAT.  The given slice is left
+   alone, as whoever else has a reference to it may be reading it */
+static AmitkDataSet * slice_copy_with_format(AmitkDataSet * slice, const AmitkFormat format) {
 
-  /* let's do some timing */
-  gettimeofday(&tv1, NULL);
-#endif
+  AmitkDataSet * copy;
+  AmitkRawData * old_data;
+  AmitkRawData * new_data;
+  amitk_format_DOUBLE_t * double_data;
+  amitk_format_FLOAT_t * float_data;
+  gsize i, num_voxels;
+
+  old_data = slice->raw_data;
+  new_data = amitk_raw_data_new_with_data(format, AMITK_RAW_DATA_DIM(old_data));
+  if (new_data == NULL) return NULL;
+
+  num_voxels = amitk_raw_data_num_voxels(old_data);
+  if (old_data->format == format) {
+    memcpy(new_data->data, old_data->data, amitk_raw_data_size_data_mem(old_data));
+  } else if (format == AMITK_FORMAT_FLOAT) {
+    double_data = old_data->data;
+    float_data = new_data->data;
+    for (i=0; i < num_voxels; i++)
+      float_data[i] = double_data[i];
+  } else {
+    float_data = old_data->data;
+    double_data = new_data->data;
+    for (i=0; i < num_voxels; i++)
+      double_data[i] = float_data[i];
+  }
 
-  g_return_val_if_fail(objects != NULL, NULL);
+  copy = AMITK_DATA_SET(amitk_object_copy(AMITK_OBJECT(slice)));
+  g_object_unref(copy->raw_data);
+  copy->raw_data = new_data;
 
-  /* and get the slices */
-  while (objects != NULL) {
-    if (AMITK_IS_DATA_SET(objects->data)) {
-      num_data_sets++;
-      parent_ds = AMITK_DATA_SET(objects->data);
+  copy->slice_parent = slice->slice_parent;
+  if (copy->slice_parent != NULL)
+    g_object_add_weak_pointer(G_OBJECT(copy->slice_parent), (gpointer *) &(copy->slice_parent));
 
-      /* try to find it in the caches first */
-      if (pslice_cache != NULL)
-	canvas_slice = slice_cache_find(*pslice_cache, parent_ds, start, duration, 
-					gate, pixel_size, view_volume);
+  return copy;
+}
 
-      local_slice = slice_cache_find(parent_ds->slice_cache, parent_ds, start, duration, 
-				     gate, pixel_size, view_volume);
+/* the cache holds toggle references to its slices, so it gets told when it's
+   the only one left holding on to a slice, and when that stops being the case */
+static void slice_cache_toggle_notify(gpointer data, GObject * object, gboolean is_last_ref) {
 
-      if (canvas_slice != NULL) {
-	slice = amitk_object_ref(canvas_slice);
-      } else if (local_slice != NULL) {
-	slice = amitk_object_ref(local_slice);
-      } else {/* generate a new one */
-	slice = amitk_data_set_get_slice(parent_ds, start, duration, gate, pixel_size, view_volume);
-      }
+  g_atomic_int_set(&(AMITK_DATA_SET(object)->slice_cache_shared), !is_last_ref);
 
-      g_return_val_if_fail(slice != NULL, slices);
+  return;
+}
 
-      slices = g_list_prepend(slices, slice);
+/* swaps the entry's slice for the given one, which the cache takes over the caller's
+   reference to.  The old slice is added to the list of slices to unref.  Needs to be
+   called with the lock held */
+static GList * slice_cache_replace_slice(slice_cache_entry_t * entry, AmitkDataSet * slice, 
+					 GList * to_unref) {
+
+  to_unref = g_list_prepend(to_unref, entry->slice);
+  entry->slice = slice;
+  g_atomic_int_set(&(slice->slice_cache_shared), TRUE);
+  g_object_add_toggle_ref(G_OBJECT(slice), slice_cache_toggle_notify, NULL);
+  g_object_unref(slice); /* toggles shared back off if the cache is all that's left */
+
+  slice_cache_used -= entry->size;
+  entry->size = amitk_raw_data_size_data_mem(slice->raw_data);
+  slice_cache_used += entry->size;
+
+  return to_unref;
+}
+
+/* unlinks the entry from the cache, and adds its slice to the list of slices
+   to unref. The unref'ing needs to wait until the lock is released, as slices
+   going away call back into the cache.  Needs to be called with the lock held */
+static GList * slice_cache_remove_entry(slice_cache_entry_t * entry, GList * to_unref) {
+
+  g_hash_table_remove(slice_cache_table, &(entry->key));
+  g_queue_delete_link(&slice_cache_queue, entry->link);
+  slice_cache_used -= entry->size;
+  entry->key.parent->slice_cache_entries--;
+  to_unref = g_list_prepend(to_unref, entry->slice);
+  g_free(entry);
+
+  return to_unref;
+}
+
+/* drops the cache's references to a list of slices, and frees the list */
+static void slice_cache_unref(GList * slices) {
+
+  GList * temp_slices;
+
+  for (temp_slices = slices; temp_slices != NULL; temp_slices = temp_slices->next)
+    g_object_remove_toggle_ref(G_OBJECT(temp_slices->data), slice_cache_toggle_notify, NULL);
+  g_list_free(slices);
+
+  return;
+}
+
+/* a slice picked out for storing as floats, see slice_cache_trim_to_budget */
+typedef struct slice_compaction_t {
+  slice_key_t key;
+  AmitkDataSet * slice;
+  AmitkDataSet * compact;
+} slice_compaction_t;
+
+/* gets back under budget, first by swapping the least recently used slices that
+   nobody else is holding on to for copies stored as floats, and then by dropping 
+   the least recently used slices.  The most recently used slice always stays.  
+   Called without the lock held, as making the copies goes through the data set
+   code, which calls back into the cache.
+
+   note, whether a slice is shared can be out of date by the time we look at it,
+   so cached slices never have their data changed, only swapped for a copy.  At 
+   worst, a slice someone still has stays around until they're done with it */
+static void slice_cache_trim_to_budget(void) {
+
+  GList * link;
+  GList * prev;
+  GList * compactions=NULL;
+  GList * temp_compactions;
+  GList * to_unref=NULL;
+  slice_cache_entry_t * entry;
+  slice_compaction_t * compaction;
+  gsize excess;
+
+  /* pick out the slices to compact, figuring each will end up taking half the space */
+  G_LOCK(slice_cache);
+  excess = (slice_cache_used > slice_cache_budget) ? slice_cache_used-slice_cache_budget : 0;
+  if (excess == 0) { /* the usual case */
+    G_UNLOCK(slice_cache);
+    return;
+  }
+  for (link = slice_cache_queue.tail; (link != NULL) && (excess > 0); link = link->prev) {
+    entry = link->data;
+    if (!g_atomic_int_get(&(entry->slice->slice_cache_shared)) &&
+	(AMITK_RAW_DATA_FORMAT(entry->slice->raw_data) == AMITK_FORMAT_DOUBLE)) {
+      compaction = g_new(slice_compaction_t, 1);
+      memcpy(&(compaction->key), &(entry->key), sizeof(slice_key_t));
+      compaction->slice = amitk_object_ref(entry->slice);
+      compaction->compact = NULL;
+      compactions = g_list_prepend(compactions, compaction);
+      excess -= MIN(excess, entry->size/2);
+    }
+  }
+  G_UNLOCK(slice_cache);
+
+  for (temp_compactions = compactions; temp_compactions != NULL; temp_compactions = temp_compactions->next) {
+    compaction = temp_compactions->data;
+    compaction->compact = slice_copy_with_format(compaction->slice, AMITK_FORMAT_FLOAT);
+  }
+
+  G_LOCK(slice_cache);
+  /* swap in the copies for the slices that are still in the cache */
+  for (temp_compactions = compactions; temp_compactions != NULL; temp_compactions = temp_compactions->next) {
+    compaction = temp_compactions->data;
+    if (compaction->compact == NULL) continue;
+    entry = g_hash_table_lookup(slice_cache_table, &(compaction->key));
+    if ((entry != NULL) && (entry->slice == compaction->slice)) {
+      to_unref = slice_cache_replace_slice(entry, compaction->compact, to_unref);
+      compaction->compact = NULL;
+    }
+  }
+
+  link = slice_cache_queue.tail;
+  while ((link != NULL) && (link != slice_cache_queue.head) && 
+	 (slice_cache_used > slice_cache_budget)) {
+    prev = link->prev;
+    to_unref = slice_cache_remove_entry(link->data, to_unref);
+    link = prev;
+  }
+  G_UNLOCK(slice_cache);
+
+  slice_cache_unref(to_unref);
+  for (temp_compactions = compactions; temp_compactions != NULL; temp_compactions = temp_compactions->next) {
+    compaction = temp_compactions->data;
+    amitk_object_unref(compaction->slice);
+    if (compaction->compact != NULL)
+      amitk_object_unref(compaction->compact);
+    g_free(compaction);
+  }
+  g_list_free(compactions);
+
+  return;
+}
+
+/* returns a reference to the cached slice, or NULL if there's not one */
+static AmitkDataSet * slice_cache_lookup(const slice_key_t * key) {
+
+  slice_cache_entry_t * entry;
+  AmitkDataSet * slice = NULL;
+  AmitkDataSet * stored = NULL;
+  GList * to_unref=NULL;
+
+  G_LOCK(slice_cache);
+  if (slice_cache_table != NULL) {
+    entry = g_hash_table_lookup(slice_cache_table, key);
+    if (entry != NULL) {
+      g_queue_unlink(&slice_cache_queue, entry->link);
+      g_queue_push_head_link(&slice_cache_queue, entry->link);
+      if (AMITK_RAW_DATA_FORMAT(entry->slice->raw_data) == AMITK_FORMAT_DOUBLE)
+	slice = amitk_object_ref(entry->slice);
+      else
+	stored = amitk_object_ref(entry->slice);
+      slice_cache_hits++;
+    } else {
+      slice_cache_misses++;
+    }
+  }
+  G_UNLOCK(slice_cache);
+
+  /* everyone else expects slices to be doubles, so the cache's float copy 
+     gets swapped for a new double one */
+  if (stored != NULL) {
+    slice = slice_copy_with_format(stored, AMITK_FORMAT_DOUBLE);
+
+    G_LOCK(slice_cache);
+    entry = g_hash_table_lookup(slice_cache_table, key);
+    if ((slice != NULL) && (entry != NULL) && (entry->slice == stored))
+      to_unref = slice_cache_replace_slice(entry, amitk_object_ref(slice), to_unref);
+    G_UNLOCK(slice_cache);
+
+    slice_cache_unref(to_unref);
+    amitk_object_unref(stored);
+  }
+
+  return slice;
+}
+
+/* generation is the parent's pyramid generation as of when the slice was 
+   generated, if the parent's been invalidated since the slice doesn't get kept */
+static void slice_cache_insert(const slice_key_t * key, AmitkDataSet * slice,
+			       const guint generation) {
+
+  slice_cache_entry_t * entry;
+  gboolean inserted=FALSE;
+  gboolean current;
+
+  G_LOCK(slice_cache);
+  if (slice_cache_table == NULL)
+    slice_cache_table = g_hash_table_new(slice_key_hash, slice_key_equal);
+
+  G_LOCK(pyramid);
+  current = (key->parent->pyramid_generation == generation);
+  G_UNLOCK(pyramid);
+
+  /* another thread may have beaten us to it */
+  if (current && (g_hash_table_lookup(slice_cache_table, key) == NULL)) {
+    entry = g_new(slice_cache_entry_t, 1);
+    memcpy(&(entry->key), key, sizeof(slice_key_t)); /* padding included */
+    entry->slice = slice;
+    g_atomic_int_set(&(slice->slice_cache_shared), TRUE); /* the caller has a reference */
+    g_object_add_toggle_ref(G_OBJECT(slice), slice_cache_toggle_notify, NULL);
+    entry->size = amitk_raw_data_size_data_mem(slice->raw_data);
+    g_queue_push_head(&slice_cache_queue, entry);
+    entry->link = slice_cache_queue.head;
+    g_hash_table_insert(slice_cache_table, &(entry->key), entry);
+    slice_cache_used += entry->size;
+    key->parent->slice_cache_entries++;
+    inserted = TRUE;
+  }
+  G_UNLOCK(slice_cache);
+
+  if (inserted)
+    slice_cache_trim_to_budget();
+
+  return;
+}
+
+/* throws out all the slices that came from the given data set */
+static void slice_cache_remove_parent(AmitkDataSet * parent_ds) {
+
+  GList * link;
+  GList * next;
+  GList * to_unref=NULL;
+  slice_cache_entry_t * entry;
+
+  G_LOCK(slice_cache);
+  /* most data sets going away, slices included, never had anything cached */
+  for (link = slice_cache_queue.head; 
+       (link != NULL) && (parent_ds->slice_cache_entries > 0); link = next) {
+    next = link->next;
+    entry = link->data;
+    if (entry->key.parent == parent_ds)
+      to_unref = slice_cache_remove_entry(entry, to_unref);
+  }
+  G_UNLOCK(slice_cache);
 
-      if ((canvas_slice == NULL) && (pslice_cache != NULL))
-	*pslice_cache = g_list_prepend(*pslice_cache, amitk_object_ref(slice)); /* most recently used first */
-      if (local_slice == NULL) {
-	parent_ds->slice_cache = g_list_prepend(parent_ds->slice_cache, amitk_object_ref(slice));
+  slice_cache_unref(to_unref);
 
-	/* regulate the size of the local per dataset cache */
-	parent_ds->slice_cache = 
-	  slice_cache_trim(parent_ds->slice_cache, 
-			   3 * MAX(AMITK_DATA_SET_NUM_FRAMES(parent_ds), AMITK_DATA_SET_NUM_GATES(parent_ds)));
+  return;
+}
+
+/* moves the slices that came from the given data set to the back of the line */
+static void slice_cache_demote_parent(AmitkDataSet * parent_ds) {
+
+  GList * link;
+  GList * next;
+  GList * demoted=NULL;
+  slice_cache_entry_t * entry;
+
+  G_LOCK(slice_cache);
+  for (link = slice_cache_queue.head; 
+       (link != NULL) && (parent_ds->slice_cache_entries > 0); link = next) {
+    next = link->next;
+    entry = link->data;
+    if (entry->key.parent == parent_ds) {
+      g_queue_unlink(&slice_cache_queue, link);
+      demoted = g_list_concat(link, demoted);
+    }
+  }
+  while (demoted != NULL) {
+    link = demoted;
+    demoted = g_list_remove_link(demoted, link);
+    g_queue_push_tail_link(&slice_cache_queue, link);
+  }
+  G_UNLOCK(slice_cache);
+
+  return;
+}
+
+/* sets how many bytes worth of slices get cached.  The reduced resolution
+   copies of the data sets get a budget of the same size */
+void amitk_data_set_set_slice_cache_budget(const gsize budget) {
+
+  GList * levels;
+
+  G_LOCK(slice_cache);
+  slice_cache_budget = budget;
+  G_UNLOCK(slice_cache);
+
+  slice_cache_trim_to_budget();
+
+  G_LOCK(pyramid);
+  pyramid_budget = budget;
+  levels = pyramid_trim_to_budget();
+  G_UNLOCK(pyramid);
+
+  amitk_objects_unref(levels);
+
+  return;
+}
+
+/* how the slice cache has been doing, any of the arguments can be NULL */
+void amitk_data_set_get_slice_cache_stats(guint64 * hits, guint64 * misses, gsize * used) {
+
+  G_LOCK(slice_cache);
+  if (hits != NULL) *hits = slice_cache_hits;
+  if (misses != NULL) *misses = slice_cache_misses;
+  if (used != NULL) *used = slice_cache_used;
+  G_UNLOCK(slice_cache);
+
+  return;
+}
+
+/* give a list of data_sets, returns a list of slices of equal size and orientation
+   intersecting these data_sets. */
+/* notes
+   - slices are kept in a cache shared by all data sets, see slice_cache_lookup
+   - the "gate" parameter should ordinarily by -1 (ignored).  Only use it to override the
+     the data set's view_start_gate/view_end_gate parameters 
+   - use_pyramid should only be set for slices that are just getting displayed,
+     see amitk_data_set_get_pyramid_slice
+ */
+GList * amitk_data_sets_get_slices(GList * objects,
+				   const amide_time_t start,
+				   const amide_time_t duration,
+				   const amide_intpoint_t gate,
+				   const AmitkCanvasPoint pixel_size,
+				   const AmitkVolume * view_volume,
+				   const gboolean use_pyramid) {
+
+
+  GList * slices=NULL;
+  AmitkDataSet * slice;
+  AmitkDataSet * parent_ds;
+  slice_key_t key;
+  guint generation;
+  gint num_data_sets=0;
+#ifdef SLICE_TIMING
+  guint64 hits, misses;
+  gsize used;
+#endif
+
+#ifdef SLICE_TIMING
+  struct timeval tv1;
+  struct timeval tv2;
+  gdouble time1;
+  gdouble time2;
+
+  /* let's do some timing */
+  gettimeofday(&tv1, NULL);
+#endif
+
+  g_return_val_if_fail(objects != NULL, NULL);
+
+  /* and get the slices */
+  while (objects != NULL) {
+    if (AMITK_IS_DATA_SET(objects->data)) {
+      num_data_sets++;
+      parent_ds = AMITK_DATA_SET(objects->data);
+
+      slice_key_init(&key, parent_ds, start, duration, gate, pixel_size, view_volume, use_pyramid);
+      G_LOCK(pyramid);
+      generation = parent_ds->pyramid_generation; /* a snapshot's stays put */
+      G_UNLOCK(pyramid);
+
+      /* try to find it in the cache first */
+      slice = slice_cache_lookup(&key);
+      if (slice == NULL) { /* generate a new one */
+	if (use_pyramid)
+	  slice = amitk_data_set_get_pyramid_slice(parent_ds, start, duration, gate, pixel_size, view_volume);
+	else
+	  slice = amitk_data_set_get_slice(parent_ds, start, duration, gate, pixel_size, view_volume);
+	g_return_val_if_fail(slice != NULL, slices);
+	slice_cache_insert(&key, slice, generation);
       }
+
+      slices = g_list_prepend(slices, slice);
     }
     objects = objects->next;
   }
 
-  /* regulate the size of the global cache */
-  if (pslice_cache != NULL) 
-    *pslice_cache = slice_cache_trim(*pslice_cache, max_slice_cache_size);
-
 #ifdef SLICE_TIMING
   /* and wrapup our timing */
   gettimeofday(&tv2, NULL);
   time1 = ((double) tv1.tv_sec) + ((double) tv1.tv_usec)/1000000.0;
   time2 = ((double) tv2.tv_sec) + ((double) tv2.tv_usec)/1000000.0;
   g_print("######## Slice Generating Took %5.3f (s) #########\n",time2-time1);
+  amitk_data_set_get_slice_cache_stats(&hits, &misses, &used);
+  g_print("######## Slice Cache %" G_GUINT64_FORMAT " hits %" G_GUINT64_FORMAT 
+	  " misses %" G_GSIZE_FORMAT " bytes #########\n", hits, misses, used);
 #endif
 
   return slices;
 }
 
+/* the parameters needed by the workers that do a range of planes of a math operation */
+typedef struct math_planes_t {
+  AmitkDataSet * ds1;
+  AmitkDataSet * ds2;
+  AmitkDataSet * output_ds;
+  gint operation; /* AmitkOperationUnary or AmitkOperationBinary */
+  amide_data_t parameter0;
+  amide_data_t parameter1;
+  AmitkVoxel i_voxel; /* frame and gate of ds1 and output_ds, and the first plane */
+  AmitkVoxel j_voxel; /* frame and gate of ds2 */
+} math_planes_t;
+
+/* does planes [start, end) (relative to i_voxel.z) of a unary operation, a row at a time */
+static void math_unary_planes(gint start, gint end, gpointer data) {
+
+  math_planes_t * mp = data;
+  AmitkVoxel dim;
+  AmitkVoxel i_voxel;
+  amide_data_t * row;
+  amitk_format_UBYTE_t * ubyte_out;
+  amitk_format_FLOAT_t * float_out;
+  amide_intpoint_t x;
+
+  dim = AMITK_DATA_SET_DIM(mp->ds1);
+  row = g_new(amide_data_t, dim.x);
+  i_voxel = mp->i_voxel;
+  i_voxel.x = 0;
+
+  for (i_voxel.z = mp->i_voxel.z+start; i_voxel.z < mp->i_voxel.z+end; i_voxel.z++) {
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+      amitk_data_set_get_row(mp->ds1, i_voxel, row);
+
+      switch(mp->operation) {
+      case AMITK_OPERATION_UNARY_RESCALE:
+	if (mp->parameter0 >= mp->parameter1) {
+	  ubyte_out = AMITK_RAW_DATA_UBYTE_POINTER(mp->output_ds->raw_data, i_voxel);
+	  for (x=0; x < dim.x; x++)
+	    ubyte_out[x] = (row[x] >= mp->parameter0);
+	} else {
+	  float_out = AMITK_RAW_DATA_FLOAT_POINTER(mp->output_ds->raw_data, i_voxel);
+	  for (x=0; x < dim.x; x++) {
+	    if (row[x] <= mp->parameter0)
+	      float_out[x] = 0.0;
+	    else if (row[x] >= mp->parameter1)
+	      float_out[x] = 1.0;
+	    else
+	      float_out[x] = (row[x] - mp->parameter0)/(mp->parameter1-mp->parameter0);
+	  }
+	}
+	break;
+      case AMITK_OPERATION_UNARY_REMOVE_NEGATIVES:
+	float_out = AMITK_RAW_DATA_FLOAT_POINTER(mp->output_ds->raw_data, i_voxel);
+	for (x=0; x < dim.x; x++)
+	  float_out[x] = (row[x] < 0.0) ? 0.0 : row[x];
+	break;
+      default:
+	break;
+      }
+    }
+  }
+
+  g_free(row);
+
+  return;
+}
+
+/* the binary operations on a pair of values, parameter1 is the difference
+   in echo times for AMITK_OPERATION_BINARY_T2STAR */
+static inline amitk_format_FLOAT_t math_binary_value(const AmitkOperationBinary operation,
+						      const amide_data_t datum1,
+						      const amide_data_t datum2,
+						      const amide_data_t parameter0,
+						      const amide_data_t parameter1) {
+
+  amitk_format_FLOAT_t value0;
+  amitk_format_FLOAT_t value1;
+
+  switch(operation) {
+  case AMITK_OPERATION_BINARY_ADD:
+    value0 = datum1 + datum2;
+    break;
+  case AMITK_OPERATION_BINARY_SUB:
+    value0 = datum1 - datum2;
+    break;
+  case AMITK_OPERATION_BINARY_MULTIPLY:
+    value0 = datum1 * datum2;
+    break;
+  case AMITK_OPERATION_BINARY_DIVISION:
+    value0 = datum2;
+    if (value0 > parameter0)
+      value0 = datum1 / value0;
+    else
+      value0 = 0.0;
+    break;
+  case AMITK_OPERATION_BINARY_T2STAR:
+    /* we actually compute the relaxation rate, that way we don't run into issues with infinity */
+    value0 = datum1;
+    value1 = datum2;
+    if ((value0 <= 0) || (value1 <= 0))
+      value0 = 0; /* don't have signal, can't assess */
+    if (value0 <= value1) /* no decay between two time points */
+      value0 = 0; /* no relaxation */
+    else /* compute in units of 1/s */
+      value0 = 1000.0 * (log(value0)-log(value1)) / (parameter1);
+    break;
+  default:
+    value0 = NAN;
+    break;
+  }
+
+  return value0;
+}
+
+/* does planes [start, end) (relative to i_voxel.z) of a binary operation between
+   two data sets on the same grid, a row at a time */
+static void math_binary_planes(gint start, gint end, gpointer data) {
+
+  math_planes_t * mp = data;
+  AmitkVoxel dim;
+  AmitkVoxel i_voxel, j_voxel;
+  amide_data_t * row1;
+  amide_data_t * row2;
+  amitk_format_FLOAT_t * out;
+  amide_intpoint_t x;
+
+  dim = AMITK_DATA_SET_DIM(mp->output_ds);
+  row1 = g_new(amide_data_t, dim.x);
+  row2 = g_new(amide_data_t, dim.x);
+  i_voxel = mp->i_voxel;
+  j_voxel = mp->j_voxel;
+  i_voxel.x = j_voxel.x = 0;
+
+  for (i_voxel.z = mp->i_voxel.z+start; i_voxel.z < mp->i_voxel.z+end; i_voxel.z++) {
+    j_voxel.z = i_voxel.z;
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+      j_voxel.y = i_voxel.y;
+      amitk_data_set_get_row(mp->ds1, i_voxel, row1);
+      amitk_data_set_get_row(mp->ds2, j_voxel, row2);
+      out = AMITK_RAW_DATA_FLOAT_POINTER(mp->output_ds->raw_data, i_voxel);
+
+      /* the common cases get their own loops, so the compiler can vectorize them */
+      switch(mp->operation) {
+      case AMITK_OPERATION_BINARY_ADD:
+	for (x=0; x < dim.x; x++) out[x] = row1[x] + row2[x];
+	break;
+      case AMITK_OPERATION_BINARY_SUB:
+	for (x=0; x < dim.x; x++) out[x] = row1[x] - row2[x];
+	break;
+      case AMITK_OPERATION_BINARY_MULTIPLY:
+	for (x=0; x < dim.x; x++) out[x] = row1[x] * row2[x];
+	break;
+      default:
+	for (x=0; x < dim.x; x++) 
+	  out[x] = math_binary_value(mp->operation, row1[x], row2[x], mp->parameter0, mp->parameter1);
+	break;
+      }
+    }
+  }
+
+  g_free(row1);
+  g_free(row2);
+
+  return;
+}
+
+/* true if the two data sets' voxels line up exactly */
+static gboolean data_sets_same_grid(const AmitkDataSet * ds1, const AmitkDataSet * ds2) {
+
+  AmitkVoxel dim1, dim2;
+
+  dim1 = AMITK_DATA_SET_DIM(ds1);
+  dim2 = AMITK_DATA_SET_DIM(ds2);
+
+  return ((dim1.x == dim2.x) && (dim1.y == dim2.y) && (dim1.z == dim2.z) &&
+	  POINT_EQUAL(AMITK_DATA_SET_VOXEL_SIZE(ds1), AMITK_DATA_SET_VOXEL_SIZE(ds2)) &&
+	  amitk_space_equal(AMITK_SPACE(ds1), AMITK_SPACE(ds2)));
+}
+
+/* true if the frames of the two data sets cover the same times */
+static gboolean data_sets_same_frames(AmitkDataSet * ds1, AmitkDataSet * ds2) {
+
+  amide_intpoint_t i_frame;
+
+  if (AMITK_DATA_SET_NUM_FRAMES(ds1) != AMITK_DATA_SET_NUM_FRAMES(ds2))
+    return FALSE;
+
+  for (i_frame=0; i_frame < AMITK_DATA_SET_NUM_FRAMES(ds1); i_frame++) {
+    if (!REAL_EQUAL(amitk_data_set_get_start_time(ds1, i_frame), 
+		    amitk_data_set_get_start_time(ds2, i_frame)))
+      return FALSE;
+    if (!REAL_EQUAL(amitk_data_set_get_frame_duration(ds1, i_frame), 
+		    amitk_data_set_get_frame_duration(ds2, i_frame)))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* works out the volume, voxel size and dimensions of the output of a math
+   operation.  The output either lines up with ds1, or covers all of the data
+   sets at the smallest of their voxel sizes.  The frames and gates are ds1's.
+   Returns a volume to unref */
+static AmitkVolume * math_output_volume(AmitkDataSet * ds1,
+					GList * data_sets,
+					const gboolean maintain_ds1_dim,
+					AmitkPoint * pvoxel_size,
+					AmitkCanvasPoint * ppixel_size,
+					AmitkVoxel * pdim) {
+
+  AmitkVolume * volume;
+  AmitkCorners corner;
+  AmitkPoint voxel_size;
+
+  if (maintain_ds1_dim) {
+    volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(ds1)));
+    voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds1);
+  } else {
+    /* create a volume that's a superset of the volumes of the data sets */
+    volume = amitk_volume_new();
+    amitk_volumes_get_enclosing_corners(data_sets, AMITK_SPACE(volume), corner);
+    amitk_space_set_offset(AMITK_SPACE(volume), corner[0]);
+    amitk_volume_set_corner(volume, amitk_space_b2s(AMITK_SPACE(volume), corner[1]));
+
+    voxel_size.x = voxel_size.y = voxel_size.z = amitk_data_sets_get_min_voxel_size(data_sets);
+  }
+
+  pdim->x = ceil(fabs(AMITK_VOLUME_X_CORNER(volume) ) / voxel_size.x );
+  pdim->y = ceil(fabs(AMITK_VOLUME_Y_CORNER(volume) ) / voxel_size.y );
+  pdim->z = ceil(fabs(AMITK_VOLUME_Z_CORNER(volume) ) / voxel_size.z );
+  pdim->t = AMITK_DATA_SET_DIM_T(ds1);
+  pdim->g = AMITK_DATA_SET_DIM_G(ds1);
+
+  *pvoxel_size = voxel_size;
+  ppixel_size->x = voxel_size.x;
+  ppixel_size->y = voxel_size.y;
+
+  return volume;
+}
+
+/* allocates the output data set of a math operation, and sets it up in the
+   given space with ds1's modality and color tables */
+static AmitkDataSet * math_output_new(AmitkDataSet * ds1,
+				      const AmitkFormat format,
+				      const AmitkVoxel dim,
+				      AmitkSpace * space,
+				      const AmitkPoint voxel_size) {
+
+  AmitkDataSet * output_ds;
+  AmitkViewMode i_view_mode;
+
+  output_ds = amitk_data_set_new_with_data(NULL, AMITK_DATA_SET_MODALITY(ds1), 
+					   format, dim, AMITK_SCALING_TYPE_0D);
+  if (output_ds == NULL) {
+    g_warning(_("couldn't allocate %d MB for the output_ds data set structure"),
+	      amitk_raw_format_calc_num_bytes(dim, format)/(1024*1024));
+    return NULL;
+  }
+
+  amitk_space_copy_in_place( AMITK_SPACE(output_ds), space);
+  amitk_data_set_set_scale_factor(output_ds, 1.0);
+  amitk_data_set_set_voxel_size(output_ds, voxel_size);
+  amitk_data_set_calc_far_corner(output_ds);
+
+  for (i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
+    amitk_data_set_set_color_table(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE(ds1, i_view_mode));
+  for (i_view_mode=AMITK_VIEW_MODE_LINKED_2WAY; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++)
+    amitk_data_set_set_color_table_independent(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE_INDEPENDENT(ds1, i_view_mode));
+
+  return output_ds;
+}
+
+/* works out the max/min of a math operation's output, and thresholds it over its full range */
+static void math_output_finish(AmitkDataSet * output_ds) {
+
+  /* recalc the temporary parameters */
+  amitk_data_set_calc_min_max(output_ds, NULL, NULL);
+
+  /* set some sensible thresholds */
+  output_ds->threshold_max[0] = output_ds->threshold_max[1] = 
+    amitk_data_set_get_global_max(output_ds);
+  output_ds->threshold_min[0] = output_ds->threshold_min[1] =
+    amitk_data_set_get_global_min(output_ds);
+  output_ds->threshold_ref_frame[1] = AMITK_DATA_SET_NUM_FRAMES(output_ds)-1;
+
+  return;
+}
+
 /* function to perform the given operation on a single data set
    parameter0 and parameter1 are used by some operations, for instance for the
    threshold operation, values below parameter0 are set to 0, values above
@@ -5723,13 +7995,11 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
   AmitkVoxel i_dim;
   AmitkDataSet * output_ds;
   AmitkVoxel i_voxel;
-  amide_data_t value;
   gchar * temp_string;
-  AmitkViewMode i_view_mode;
-  div_t x;
   gint divider, total_planes,image_num;
   gboolean continue_work=TRUE;
   AmitkFormat format;
+  math_planes_t mp;
 
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds1), NULL);
   i_dim = AMITK_DATA_SET_DIM (ds1);
@@ -5749,26 +8019,10 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
     goto error;
   }
 
-  output_ds = amitk_data_set_new_with_data(NULL, AMITK_DATA_SET_MODALITY(ds1), 
-					   format, i_dim, AMITK_SCALING_TYPE_0D);
-  if (output_ds == NULL) {
-    g_warning(_("couldn't allocate %d MB for the output_ds data set structure"),
-	      amitk_raw_format_calc_num_bytes(i_dim, format)/(1024*1024));
-    goto error;
-  }
-
-  /* Start setting up the new dataset */
-  amitk_space_copy_in_place( AMITK_SPACE(output_ds), AMITK_SPACE(ds1));
-  amitk_data_set_set_scale_factor(output_ds, 1.0);
-  amitk_data_set_set_voxel_size(output_ds, AMITK_DATA_SET_VOXEL_SIZE(ds1));
-  amitk_data_set_calc_far_corner(output_ds);
+  output_ds = math_output_new(ds1, format, i_dim, AMITK_SPACE(ds1), AMITK_DATA_SET_VOXEL_SIZE(ds1));
+  if (output_ds == NULL) goto error;
   amitk_data_set_set_scan_start(output_ds, amitk_data_set_get_start_time(ds1, i_voxel.t));
 
-  for (i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
-    amitk_data_set_set_color_table(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE(ds1, i_view_mode));
-  for (i_view_mode=AMITK_VIEW_MODE_LINKED_2WAY; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++)
-    amitk_data_set_set_color_table_independent(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE_INDEPENDENT(ds1, i_view_mode));
-
   /* set a new name for this guy */
   switch(operation) {
   case AMITK_OPERATION_UNARY_RESCALE:
@@ -5799,47 +8053,33 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
   divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
 
 
-  /* fill in output_ds by performing the operation on the data set */
+  /* fill in output_ds by performing the operation on the data set, the planes
+     get split up over the worker threads a block at a time between progress updates */
+  divider = MAX(divider, amitk_get_num_threads());
+  mp.ds1 = ds1;
+  mp.ds2 = NULL;
+  mp.output_ds = output_ds;
+  mp.operation = operation;
+  mp.parameter0 = parameter0;
+  mp.parameter1 = parameter1;
+  i_voxel = zero_voxel;
+
   for (i_voxel.g = 0; (i_voxel.g < i_dim.g) && continue_work; i_voxel.g++) {
     amitk_data_set_set_gate_time(output_ds, i_voxel.g, 
 				 amitk_data_set_get_gate_time(ds1, i_voxel.g));
 
     for (i_voxel.t = 0; (i_voxel.t < i_dim.t) && continue_work; i_voxel.t++) {
       amitk_data_set_set_frame_duration(output_ds, i_voxel.t, amitk_data_set_get_frame_duration(ds1, i_voxel.t));
+      amitk_data_set_request_frame(ds1, i_voxel.t, i_voxel.g);
 
-
-      for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z++) {
+      for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z += divider) {
 	if (update_func != NULL) {
 	  image_num = i_voxel.z+i_voxel.t*i_dim.z+i_voxel.g*i_dim.z*i_dim.t;
-	  x = div(image_num,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
+	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
 	}
 
-	for (i_voxel.y = 0; i_voxel.y < i_dim.y; i_voxel.y++) {
-	  for (i_voxel.x = 0; i_voxel.x < i_dim.x; i_voxel.x++) {
-	    value = amitk_data_set_get_value(ds1, i_voxel);
-	    switch(operation) {
-	    case AMITK_OPERATION_UNARY_RESCALE:
-	      if (parameter0 > parameter1) {
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(output_ds->raw_data, i_voxel) = (value >= parameter0);
-	      } else {
-		if (value <= parameter0)
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 0.0;
-		else if (value >= parameter1)
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 1.0;
-		else
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 
-		    (value - parameter0)/(parameter1-parameter0);
-	      }
-	    case AMITK_OPERATION_UNARY_REMOVE_NEGATIVES:
-	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = (value < 0.0) ? 0.0 : value;
-	      break;
-	    default:
-	      goto error;
-	    }
-	  }
-	}
+	mp.i_voxel = i_voxel;
+	amitk_parallel_for(MIN(divider, i_dim.z-i_voxel.z), math_unary_planes, &mp);
       }
     }
   }
@@ -5847,15 +8087,7 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
   if (!continue_work)
     goto error;
 
-  /* recalc the temporary parameters */
-  amitk_data_set_calc_min_max(output_ds, NULL, NULL);
-
-  /* set some sensible thresholds */
-  output_ds->threshold_max[0] = output_ds->threshold_max[1] = 
-    amitk_data_set_get_global_max(output_ds);
-  output_ds->threshold_min[0] = output_ds->threshold_min[1] =
-    amitk_data_set_get_global_min(output_ds);
-  output_ds->threshold_ref_frame[1] = AMITK_DATA_SET_NUM_FRAMES(output_ds)-1;
+  math_output_finish(output_ds);
 
   goto exit;
 
@@ -5902,13 +8134,12 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
   AmitkDataSet * slice1=NULL;
   AmitkDataSet * slice2=NULL;
   amitk_format_FLOAT_t value0;
-  amitk_format_FLOAT_t value1;
   gchar * temp_string;
-  AmitkViewMode i_view_mode;
   div_t x;
   gint divider, total_planes,image_num;
   gboolean continue_work=TRUE;
   amide_data_t delta_echo=1.0;
+  math_planes_t mp;
 
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds1), NULL);
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds2), NULL);
@@ -5946,27 +8177,8 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
   data_sets = g_list_append(data_sets, ds2);
   
   /* Set up the voxel dimensions for the output data set */
-  if (maintain_ds1_dim) {
-    volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(ds1)));
-    voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds1);
-    pixel_size.x = voxel_size.x;
-    pixel_size.y = voxel_size.y;
-  } else {
-    /* create a volume that's a superset of the volumes of the two data sets */
-    volume = amitk_volume_new();
-    amitk_volumes_get_enclosing_corners(data_sets, AMITK_SPACE(volume), corner);
-    amitk_space_set_offset(AMITK_SPACE(volume), corner[0]);
-    amitk_volume_set_corner(volume, amitk_space_b2s(AMITK_SPACE(volume), corner[1]));
-
-    voxel_size.x = voxel_size.y = voxel_size.z = amitk_data_sets_get_min_voxel_size(data_sets);
-    pixel_size.x = pixel_size.y = voxel_size.x;
-  }
-
-  i_dim.x = j_dim.x = ceil(fabs(AMITK_VOLUME_X_CORNER(volume) ) / voxel_size.x );
-  i_dim.y = j_dim.y = ceil(fabs(AMITK_VOLUME_Y_CORNER(volume) ) / voxel_size.y );
-  i_dim.z = j_dim.z = ceil(fabs(AMITK_VOLUME_Z_CORNER(volume) ) / voxel_size.z );
-  
-  i_dim.t = j_dim.t = AMITK_DATA_SET_DIM_T(ds1);
+  volume = math_output_volume(ds1, data_sets, maintain_ds1_dim, &voxel_size, &pixel_size, &i_dim);
+  j_dim = i_dim;
   
   if (AMITK_DATA_SET_DIM_T(ds1) != AMITK_DATA_SET_DIM_T(ds2)) {
     if (by_frames) {
@@ -5980,30 +8192,15 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
   }
       
   /* figure out what muti-gate studies we can handle */
-  i_dim.g = j_dim.g = AMITK_DATA_SET_DIM_G(ds1);
   if (AMITK_DATA_SET_DIM_G(ds1) != AMITK_DATA_SET_DIM_G(ds2)) {
     g_warning(_("Can't handle studies with different numbers of gates, will use all gates of \"%s\" and the first gate of \"%s\"."),
 	      AMITK_OBJECT_NAME(ds1), AMITK_OBJECT_NAME(ds2));
     j_dim.g = 1;
   }
 
-  output_ds = amitk_data_set_new_with_data(NULL, AMITK_DATA_SET_MODALITY(ds1), 
-					   AMITK_FORMAT_FLOAT, i_dim, AMITK_SCALING_TYPE_0D);
-  if (output_ds == NULL) {
-    g_warning(_("couldn't allocate %d MB for the output_ds data set structure"),
-	      amitk_raw_format_calc_num_bytes(i_dim, AMITK_FORMAT_FLOAT)/(1024*1024));
-    goto error;
-  }
-
-  /* Start setting up the new dataset */
-  amitk_space_copy_in_place( AMITK_SPACE(output_ds), AMITK_SPACE(volume));
-  amitk_data_set_set_scale_factor(output_ds, 1.0);
-  amitk_data_set_set_voxel_size(output_ds, voxel_size);
+  output_ds = math_output_new(ds1, AMITK_FORMAT_FLOAT, i_dim, AMITK_SPACE(volume), voxel_size);
+  if (output_ds == NULL) goto error;
   amitk_raw_data_FLOAT_initialize_data(AMITK_DATA_SET_RAW_DATA(output_ds),NAN);
-  for (i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
-    amitk_data_set_set_color_table(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE(ds1, i_view_mode));
-  for (i_view_mode=AMITK_VIEW_MODE_LINKED_2WAY; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++)
-    amitk_data_set_set_color_table_independent(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE_INDEPENDENT(ds1, i_view_mode));
 
   /* set a new name for this guy */
   switch(operation) {
@@ -6028,6 +8225,53 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
   total_planes = i_dim.z*i_dim.t*i_dim.g;
   divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
 
+  /* if the data sets and the output are all on the same grid, there's no need
+     to resample, and the operation can work straight off the voxels */
+  if (data_sets_same_grid(ds1, ds2) && data_sets_same_grid(ds1, output_ds) &&
+      (by_frames || (AMITK_DATA_SET_DIM_T(ds2) == 1) || data_sets_same_frames(ds1, ds2))) {
+    divider = MAX(divider, amitk_get_num_threads());
+    mp.ds1 = ds1;
+    mp.ds2 = ds2;
+    mp.output_ds = output_ds;
+    mp.operation = operation;
+    mp.parameter0 = parameter0;
+    mp.parameter1 = delta_echo;
+    i_voxel = j_voxel = zero_voxel;
+
+    for (i_voxel.t = 0; (i_voxel.t < i_dim.t) && continue_work; i_voxel.t++) {
+      if (AMITK_DATA_SET_DIM_T(ds2) == 1)
+	j_voxel.t = 0;
+      else
+	j_voxel.t = (i_voxel.t >= j_dim.t) ? 0 : i_voxel.t;
+
+      if (i_voxel.t == 0)
+	amitk_data_set_set_scan_start(output_ds, amitk_data_set_get_start_time(ds1, i_voxel.t));
+      amitk_data_set_set_frame_duration(output_ds, i_voxel.t, 
+					amitk_data_set_get_frame_duration(ds1, i_voxel.t));
+
+      for (i_voxel.g = 0; (i_voxel.g < i_dim.g) && continue_work; i_voxel.g++) {
+	j_voxel.g = (i_voxel.g >= j_dim.g) ? 0 : i_voxel.g;
+
+	amitk_data_set_set_gate_time(output_ds, i_voxel.g, 
+				     amitk_data_set_get_gate_time(ds1, i_voxel.g));
+	amitk_data_set_request_frame(ds1, i_voxel.t, i_voxel.g);
+	amitk_data_set_request_frame(ds2, j_voxel.t, j_voxel.g);
+
+	for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z += divider) {
+	  if (update_func != NULL) {
+	    image_num = i_voxel.z+i_voxel.t*i_dim.z+i_voxel.g*i_dim.z*i_dim.t;
+	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
+	  }
+
+	  mp.i_voxel = i_voxel;
+	  mp.j_voxel = j_voxel;
+	  amitk_parallel_for(MIN(divider, i_dim.z-i_voxel.z), math_binary_planes, &mp);
+	}
+      }
+    }
+    goto finish;
+  }
+
   /* fill in output_ds by performing the operation on the data sets */
   corner[0] = AMITK_VOLUME_CORNER(volume);
   corner[0].z = voxel_size.z;
@@ -6084,43 +8328,10 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
 
 	for (i_voxel.y = 0, k_voxel.y = 0; i_voxel.y < i_dim.y; i_voxel.y++, k_voxel.y++) {
 	  for (i_voxel.x = 0, k_voxel.x = 0; i_voxel.x < i_dim.x; i_voxel.x++, k_voxel.x++) {
-	    switch(operation) {
-	    case AMITK_OPERATION_BINARY_ADD:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		+ AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_SUB:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		- AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_MULTIPLY:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		* AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_DIVISION:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      if (value0 > parameter0)
-		value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		  / value0;
-	      else
-		value0 = 0.0;
-	      break;
-	    case AMITK_OPERATION_BINARY_T2STAR:
-	      /* we actually compute the relaxation rate, that way we don't run into issues with infinity */
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel);
-	      value1 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice2), k_voxel);
-	     
-	      if ((value0 <= 0) || (value1 <= 0))
-		value0 = 0; /* don't have signal, can't assess */
-	      if (value0 <= value1) /* no decay between two time points */
-		value0 = 0; /* no relaxation */
-	      else /* compute in units of 1/s */
-		value0 = 1000.0 * (log(value0)-log(value1)) / (delta_echo);
-	      break;
-	    default:
-	      goto error;
-	    }
-
+	    value0 = math_binary_value(operation, 
+				       AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel),
+				       AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice2), k_voxel),
+				       parameter0, delta_echo);
 	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = value0;
 	  }
 	}
@@ -6132,18 +8343,11 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
     }
   }
 
+ finish:
   if (!continue_work)
     goto error;
 
-  /* recalc the temporary parameters */
-  amitk_data_set_calc_min_max(output_ds, NULL, NULL);
-
-  /* set some sensible thresholds */
-  output_ds->threshold_max[0] = output_ds->threshold_max[1] = 
-    amitk_data_set_get_global_max(output_ds);
-  output_ds->threshold_min[0] = output_ds->threshold_min[1] =
-    amitk_data_set_get_global_min(output_ds);
-  output_ds->threshold_ref_frame[1] = AMITK_DATA_SET_NUM_FRAMES(output_ds)-1;
+  math_output_finish(output_ds);
 
   goto exit;
 
@@ -6166,6 +8370,302 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
 }
 
 
+/* the parameters needed by the workers that evaluate an expression over rows of the output */
+typedef struct math_expression_t {
+  const AmitkExpression * expression;
+  AmitkDataSet * inputs[AMITK_EXPRESSION_MAX_VARIABLES]; /* data sets or their slices, NULL if not used */
+  AmitkVoxel input_voxels[AMITK_EXPRESSION_MAX_VARIABLES]; /* frame, gate, and first plane to read */
+  AmitkDataSet * output_ds;
+  AmitkVoxel i_voxel; /* frame and gate of output_ds, and the first plane */
+} math_expression_t;
+
+/* does rows [start, end) of an expression, counting from the first row of plane
+   i_voxel.z on through the following planes */
+static void math_expression_rows(gint start, gint end, gpointer data) {
+
+  math_expression_t * me = data;
+  AmitkVoxel dim;
+  AmitkVoxel i_voxel, j_voxel;
+  amide_data_t * rows[AMITK_EXPRESSION_MAX_VARIABLES];
+  amide_data_t * workspace;
+  gint i_row, i_input, plane;
+
+  dim = AMITK_DATA_SET_DIM(me->output_ds);
+  for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++)
+    rows[i_input] = (me->inputs[i_input] != NULL) ? g_new(amide_data_t, dim.x) : NULL;
+  workspace = g_new(amide_data_t, amitk_expression_get_workspace_size(me->expression, dim.x));
+  i_voxel = me->i_voxel;
+  i_voxel.x = 0;
+
+  for (i_row = start; i_row < end; i_row++) {
+    plane = i_row / dim.y;
+    i_voxel.z = me->i_voxel.z + plane;
+    i_voxel.y = i_row % dim.y;
+
+    for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++) {
+      if (me->inputs[i_input] == NULL) continue;
+      j_voxel = me->input_voxels[i_input];
+      j_voxel.z += plane;
+      j_voxel.y = i_voxel.y;
+      amitk_data_set_get_row(me->inputs[i_input], j_voxel, rows[i_input]);
+    }
+
+    amitk_expression_apply(me->expression, rows, 
+			   AMITK_RAW_DATA_FLOAT_POINTER(me->output_ds->raw_data, i_voxel),
+			   dim.x, workspace);
+  }
+
+  for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++)
+    g_free(rows[i_input]);
+  g_free(workspace);
+
+  return;
+}
+
+/* function to evaluate an expression such as "(A - B) / max(C, 1e-3) * 100" over a
+   list of data sets, A being the first data set in the list, B the second, etc.  
+   The whole expression is done in a single pass over the output, so no intermediate
+   data sets get made.  Geometry is handled as in amitk_data_sets_math_binary, with
+   the first data set used in the expression taking the place of ds1.  Data sets that
+   already line up with the output are read directly, the rest get resampled a plane
+   at a time.  Supported are + - * / ^, and abs, sqrt, exp, log, log10, pow, min, max */
+AmitkDataSet * amitk_data_sets_math_expression(GList * data_sets,
+					       const gchar * expression_text,
+					       gboolean by_frames,
+					       gboolean maintain_ds1_dim,
+					       AmitkUpdateFunc update_func,
+					       gpointer update_data) {
+
+  AmitkExpression * expression=NULL;
+  GList * used_data_sets=NULL;
+  AmitkDataSet * ds1=NULL;
+  AmitkDataSet * input;
+  AmitkCorners corner;
+  AmitkVolume * volume=NULL;
+  AmitkPoint voxel_size;
+  AmitkCanvasPoint pixel_size;
+  AmitkVoxel i_dim;
+  amide_time_t frame_start, frame_duration;
+  AmitkDataSet * output_ds=NULL;
+  AmitkVoxel i_voxel, j_voxel;
+  AmitkVoxel input_voxels[AMITK_EXPRESSION_MAX_VARIABLES];
+  AmitkPoint new_offset;
+  AmitkDataSet * slices[AMITK_EXPRESSION_MAX_VARIABLES];
+  gboolean direct[AMITK_EXPRESSION_MAX_VARIABLES];
+  gboolean all_direct;
+  gchar * temp_string;
+  gchar * error_string=NULL;
+  gint i_input, num_inputs;
+  gint divider, total_planes,image_num;
+  gboolean continue_work=TRUE;
+  math_expression_t me;
+
+  g_return_val_if_fail(data_sets != NULL, NULL);
+  g_return_val_if_fail(expression_text != NULL, NULL);
+
+  for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++) {
+    slices[i_input] = NULL;
+    me.inputs[i_input] = NULL;
+  }
+
+  expression = amitk_expression_new(expression_text, &error_string);
+  if (expression == NULL) {
+    g_warning(_("Couldn't parse expression: %s"), error_string);
+    g_free(error_string);
+    goto error;
+  }
+
+  num_inputs = amitk_expression_get_num_variables(expression);
+  if (num_inputs > (gint) g_list_length(data_sets)) {
+    g_warning(_("Expression uses data set %c, but only %d data sets are available"),
+	      'A'+num_inputs-1, g_list_length(data_sets));
+    goto error;
+  }
+
+  /* figure out which data sets we need, the first of these sets the frames and gates */
+  for (i_input=0; i_input < num_inputs; i_input++) {
+    if (!amitk_expression_uses_variable(expression, i_input)) continue;
+    input = g_list_nth_data(data_sets, i_input);
+    if (!AMITK_IS_DATA_SET(input)) {
+      g_warning(_("Expression uses %c, which isn't a data set"), 'A'+i_input);
+      goto error;
+    }
+    if (ds1 == NULL) ds1 = input;
+    if (g_list_find(used_data_sets, input) == NULL)
+      used_data_sets = g_list_append(used_data_sets, input);
+  }
+  if (ds1 == NULL) { /* a constant expression, use the first data set for the geometry */
+    ds1 = data_sets->data;
+    if (!AMITK_IS_DATA_SET(ds1)) {
+      g_warning(_("Expression needs at least one data set"));
+      goto error;
+    }
+    used_data_sets = g_list_append(used_data_sets, ds1);
+  }
+
+  /* Set up the voxel dimensions for the output data set */
+  volume = math_output_volume(ds1, used_data_sets, maintain_ds1_dim, &voxel_size, &pixel_size, &i_dim);
+
+  for (i_input=0; i_input < num_inputs; i_input++) {
+    if (!amitk_expression_uses_variable(expression, i_input)) continue;
+    input = g_list_nth_data(data_sets, i_input);
+    if ((AMITK_DATA_SET_DIM_T(input) != i_dim.t) && by_frames)
+      g_warning(_("Can't handle 'by frame' operations with data sets with unequal frame numbers, will use all frames of \"%s\" and the first frame of \"%s\"."),
+		AMITK_OBJECT_NAME(ds1), AMITK_OBJECT_NAME(input));
+    if (AMITK_DATA_SET_DIM_G(input) != i_dim.g)
+      g_warning(_("Can't handle studies with different numbers of gates, will use all gates of \"%s\" and the first gate of \"%s\"."),
+		AMITK_OBJECT_NAME(ds1), AMITK_OBJECT_NAME(input));
+  }
+
+  output_ds = math_output_new(ds1, AMITK_FORMAT_FLOAT, i_dim, AMITK_SPACE(volume), voxel_size);
+  if (output_ds == NULL) goto error;
+  amitk_raw_data_FLOAT_initialize_data(AMITK_DATA_SET_RAW_DATA(output_ds),NAN);
+
+  temp_string = g_strdup_printf(_("Result: %s"), expression_text);
+  amitk_object_set_name(AMITK_OBJECT(output_ds), temp_string);
+  g_free(temp_string);
+
+  /* the data sets already on the output's grid, with frames that line up, get read directly */
+  all_direct = TRUE;
+  for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++) {
+    direct[i_input] = FALSE;
+    if ((i_input >= num_inputs) || !amitk_expression_uses_variable(expression, i_input)) continue;
+    input = g_list_nth_data(data_sets, i_input);
+    direct[i_input] = (data_sets_same_grid(input, output_ds) &&
+		       (by_frames || (AMITK_DATA_SET_DIM_T(input) == 1) || data_sets_same_frames(ds1, input)));
+    all_direct = all_direct && direct[i_input];
+  }
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Performing math operation"));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+  total_planes = i_dim.z*i_dim.t*i_dim.g;
+  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
+  if (all_direct) divider = MAX(divider, amitk_get_num_threads());
+
+  me.expression = expression;
+  me.output_ds = output_ds;
+  corner[0] = AMITK_VOLUME_CORNER(volume);
+  corner[0].z = voxel_size.z;
+  amitk_volume_set_corner(volume, corner[0]); /* set the z dim of the slices */
+  new_offset = zero_point;
+  i_voxel = zero_voxel;
+
+  for (i_voxel.t = 0; (i_voxel.t < i_dim.t) && continue_work; i_voxel.t++) {
+    frame_start = amitk_data_set_get_start_time(ds1, i_voxel.t);
+    frame_duration = amitk_data_set_get_frame_duration(ds1, i_voxel.t);
+
+    if (i_voxel.t == 0)
+      amitk_data_set_set_scan_start(output_ds, frame_start);
+    amitk_data_set_set_frame_duration(output_ds, i_voxel.t, frame_duration);
+
+    for (i_voxel.g = 0; (i_voxel.g < i_dim.g) && continue_work; i_voxel.g++) {
+      amitk_data_set_set_gate_time(output_ds, i_voxel.g, 
+				   amitk_data_set_get_gate_time(ds1, i_voxel.g));
+
+      /* the frame and gate to use from each of the data sets */
+      for (i_input=0; i_input < num_inputs; i_input++) {
+	if (!amitk_expression_uses_variable(expression, i_input)) continue;
+	input = g_list_nth_data(data_sets, i_input);
+	j_voxel = zero_voxel;
+	j_voxel.t = (AMITK_DATA_SET_DIM_T(input) == i_dim.t) ? i_voxel.t : 0;
+	j_voxel.g = (AMITK_DATA_SET_DIM_G(input) == i_dim.g) ? i_voxel.g : 0;
+	input_voxels[i_input] = j_voxel;
+	if (direct[i_input]) {
+	  me.inputs[i_input] = input;
+	  amitk_data_set_request_frame(input, j_voxel.t, j_voxel.g);
+	}
+      }
+
+      for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z += divider) {
+	if (update_func != NULL) {
+	  image_num = i_voxel.z+i_voxel.t*i_dim.z+i_voxel.g*i_dim.z*i_dim.t;
+	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
+	}
+	me.i_voxel = i_voxel;
+
+	if (all_direct) {
+	  for (i_input=0; i_input < num_inputs; i_input++) {
+	    me.input_voxels[i_input] = input_voxels[i_input];
+	    me.input_voxels[i_input].z = i_voxel.z;
+	  }
+	  amitk_parallel_for(MIN(divider, i_dim.z-i_voxel.z)*i_dim.y, math_expression_rows, &me);
+	  continue;
+	}
+
+	/* resample the data sets that don't line up, a plane at a time */
+	for (me.i_voxel.z = i_voxel.z; 
+	     (me.i_voxel.z < MIN(i_voxel.z+divider, i_dim.z)) && continue_work; 
+	     me.i_voxel.z++) {
+	  new_offset.z = me.i_voxel.z * voxel_size.z;
+	  amitk_space_set_offset( AMITK_SPACE(volume), amitk_space_s2b(AMITK_SPACE(output_ds), new_offset));
+
+	  for (i_input=0; i_input < num_inputs; i_input++) {
+	    if (!amitk_expression_uses_variable(expression, i_input)) continue;
+	    me.input_voxels[i_input] = input_voxels[i_input];
+	    if (direct[i_input]) {
+	      me.input_voxels[i_input].z = me.i_voxel.z;
+	      continue;
+	    }
+	    me.input_voxels[i_input] = zero_voxel; /* the slice is a single plane */
+	    input = g_list_nth_data(data_sets, i_input);
+	    j_voxel = input_voxels[i_input];
+	    slices[i_input] = amitk_data_set_get_slice(input,
+						       by_frames ? amitk_data_set_get_start_time(input, j_voxel.t) : frame_start,
+						       by_frames ? amitk_data_set_get_frame_duration(input, j_voxel.t) : frame_duration,
+						       j_voxel.g,
+						       pixel_size,
+						       volume);
+	    if (slices[i_input] == NULL) {
+	      g_warning(_("couldn't generate slices from the data set..."));
+	      goto error;
+	    }
+	    me.inputs[i_input] = slices[i_input];
+	  }
+
+	  amitk_parallel_for(i_dim.y, math_expression_rows, &me);
+
+	  for (i_input=0; i_input < num_inputs; i_input++) {
+	    if (slices[i_input] != NULL) {
+	      amitk_object_unref(slices[i_input]);
+	      slices[i_input] = NULL;
+	      me.inputs[i_input] = NULL;
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  if (!continue_work)
+    goto error;
+
+  math_output_finish(output_ds);
+
+  goto exit;
+
+ error:
+  if (output_ds != NULL) {
+    amitk_object_unref(output_ds);
+    output_ds = NULL;
+  }
+
+ exit:
+  for (i_input=0; i_input < AMITK_EXPRESSION_MAX_VARIABLES; i_input++)
+    if (slices[i_input] != NULL) amitk_object_unref(slices[i_input]);
+  if (volume != NULL) amitk_object_unref(volume);
+  g_list_free(used_data_sets);
+  amitk_expression_free(expression);
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  return output_ds;
+}
+
+
 
 const gchar * amitk_scaling_type_get_name(const AmitkScalingType scaling_type) {
 
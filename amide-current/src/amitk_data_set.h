@@ -69,6 +69,7 @@ G_BEGIN_DECLS
 #define AMITK_DATA_SET_THRESHOLDING(ds)            (AMITK_DATA_SET(ds)->thresholding)
 #define AMITK_DATA_SET_THRESHOLD_STYLE(ds)         (AMITK_DATA_SET(ds)->threshold_style)
 #define AMITK_DATA_SET_SLICE_PARENT(ds)            (AMITK_DATA_SET(ds)->slice_parent)
+#define AMITK_DATA_SET_SNAPSHOT_OF(ds)             (AMITK_DATA_SET(ds)->snapshot_of)
 #define AMITK_DATA_SET_SCAN_DATE(ds)               (AMITK_DATA_SET(ds)->scan_date)
 #define AMITK_DATA_SET_SUBJECT_NAME(ds)            (AMITK_DATA_SET(ds)->subject_name)
 #define AMITK_DATA_SET_SUBJECT_ID(ds)              (AMITK_DATA_SET(ds)->subject_id)
@@ -102,6 +103,7 @@ G_BEGIN_DECLS
 #define AMITK_DATA_SET_NUM_VIEW_GATES(ds)          (AMITK_DATA_SET(ds)->num_view_gates)
 
 #define AMITK_DATA_SET_DISTRIBUTION_SIZE 256
+#define AMITK_DATA_SET_PYRAMID_LEVELS 6
 
 typedef enum {
   AMITK_OPERATION_UNARY_RESCALE,
@@ -242,6 +244,9 @@ typedef enum { /*< skip >*/
 typedef struct _AmitkDataSetClass AmitkDataSetClass;
 typedef struct _AmitkDataSet AmitkDataSet;
 
+/* format/scaling specialized voxel accessor, see amitk_data_set_get_value_func */
+typedef amide_data_t (*AmitkDataSetValueFunc) (const AmitkDataSet * ds, const AmitkVoxel i);
+
 
 struct _AmitkDataSet
 {
@@ -308,12 +313,31 @@ struct _AmitkDataSet
   AmitkRawData * current_scaling_factor; /* external_scaling * internal_scaling_factor[] */
   amide_intpoint_t num_view_gates;
 
-  GList * slice_cache;
+  /* slices and max/mins get taken from the canvases' render thread while the 
+     main loop can be changing the scale factor */
+  GMutex min_max_mutex; /* guards calculating the max/min values */
+  GRWLock scaling_lock; /* held for writing while current_scaling_factor changes */
+
+  /* successively 2x downsampled copies of the data, built as needed for displaying
+     zoomed out views and thick slabs.  One set for each rendering type,
+     storing the mean (MPR), the max (MIP), or the min (MINIP) */
+  AmitkDataSet * pyramid[AMITK_RENDERING_NUM][AMITK_DATA_SET_PYRAMID_LEVELS];
+  guint pyramid_generation; /* bumped when the pyramid (and the slices) get thrown out.
+			       For a snapshot, the data set's when the snapshot was taken */
+  guint8 * pyramid_built; /* for a pyramid level, which of its frames/gates have been filled in */
+
+  /* for the shared slice cache */
+  guint slice_cache_entries; /* number of cached slices taken from this data set */
+  gint slice_cache_shared; /* for a cached slice, whether anyone besides the cache holds on to it */
+
 
   /* only used by derived data sets (slices and projections)  */
   /* this is a weak pointer, it should be NULL'ed automatically by gtk on the parent's destruction */
   AmitkDataSet * slice_parent; 
 
+  /* only used by snapshots, the data set this was taken from.  Holds a reference */
+  AmitkDataSet * snapshot_of;
+
   /* misc data items - not saved in .xif file */
   gint instance_number; /* used by dcmtk_interface.cc occasionally for sorting */
   gint gate_num; /* used by dcmtk_interface.cc occasionally for sorting */
@@ -495,6 +519,12 @@ amide_time_t   amitk_data_set_get_midpt_time     (const AmitkDataSet *ds,
 						  const guint frame);
 guint          amitk_data_set_get_frame          (const AmitkDataSet * ds, 
 						  const amide_time_t time);
+void           amitk_data_set_request_frame      (const AmitkDataSet * ds,
+						  const gint frame,
+						  const gint gate);
+void           amitk_data_set_prefetch_frame     (const AmitkDataSet * ds,
+						  const gint frame,
+						  const gint gate);
 amide_time_t   amitk_data_set_get_frame_duration (const AmitkDataSet * ds,
 						  guint frame);
 amide_time_t   amitk_data_set_get_min_frame_duration (const AmitkDataSet * ds);
@@ -534,6 +564,16 @@ amide_data_t   amitk_data_set_get_internal_value  (const AmitkDataSet * ds,
 						   const AmitkVoxel i);
 amide_data_t   amitk_data_set_get_value           (const AmitkDataSet * ds, 
 						   const AmitkVoxel i);
+AmitkDataSetValueFunc amitk_data_set_get_value_func(const AmitkDataSet * ds);
+void           amitk_data_set_get_row             (const AmitkDataSet * ds,
+						   const AmitkVoxel i,
+						   amide_data_t * row);
+void           amitk_data_set_get_internal_row    (const AmitkDataSet * ds,
+						   const AmitkVoxel i,
+						   amide_data_t * row);
+void           amitk_data_set_get_plane           (const AmitkDataSet * ds,
+						   const AmitkVoxel i,
+						   amide_data_t * plane);
 amide_data_t   amitk_data_set_get_internal_scaling_factor(const AmitkDataSet * ds, 
 							  const AmitkVoxel i);
 amide_data_t   amitk_data_set_get_scaling_factor  (const AmitkDataSet * ds,
@@ -573,6 +613,13 @@ AmitkDataSet * amitk_data_set_get_slice           (AmitkDataSet * ds,
 						   const amide_intpoint_t gate,
 						   const AmitkCanvasPoint pixel_size,
 						   const AmitkVolume * slice_volume);
+AmitkDataSet * amitk_data_set_get_pyramid_slice   (AmitkDataSet * ds,
+						   const amide_time_t start,
+						   const amide_time_t duration,
+						   const amide_intpoint_t gate,
+						   const AmitkCanvasPoint pixel_size,
+						   const AmitkVolume * slice_volume);
+AmitkDataSet * amitk_data_set_get_snapshot        (AmitkDataSet * ds);
 void           amitk_data_set_get_line_profile    (AmitkDataSet * ds,
 						   const amide_time_t start,
 						   const amide_time_t duration,
@@ -588,13 +635,16 @@ amide_time_t   amitk_data_sets_get_min_frame_duration(GList * objects);
 amide_real_t   amitk_data_sets_get_min_voxel_size    (GList * objects);
 amide_real_t   amitk_data_sets_get_max_min_voxel_size(GList * objects);
 GList *        amitk_data_sets_get_slices            (GList * objects,
-						      GList ** pslice_cache,
-						      const gint max_slice_cache_size,
 						      const amide_time_t start,
 						      const amide_time_t duration,
 						      const amide_intpoint_t gate,
 						      const AmitkCanvasPoint pixel_size,
-						      const AmitkVolume * view_volume);
+						      const AmitkVolume * view_volume,
+						      const gboolean use_pyramid);
+void           amitk_data_set_set_slice_cache_budget (const gsize budget);
+void           amitk_data_set_get_slice_cache_stats  (guint64 * hits,
+						      guint64 * misses,
+						      gsize * used);
 AmitkDataSet * amitk_data_sets_find_with_slice_parent(GList * slices, 
 						      const AmitkDataSet * slice_parent);
 GList *        amitk_data_sets_remove_with_slice_parent(GList * slices,
@@ -614,6 +664,12 @@ AmitkDataSet * amitk_data_sets_math_binary           (AmitkDataSet * ds1,
 						      gboolean maintain_ds1_dim,
 						      AmitkUpdateFunc update_func,
 						      gpointer update_data);
+AmitkDataSet * amitk_data_sets_math_expression       (GList * data_sets,
+						      const gchar * expression,
+						      gboolean by_frames,
+						      gboolean maintain_ds1_dim,
+						      AmitkUpdateFunc update_func,
+						      gpointer update_data);
 
 
 
@@ -26,26 +26,49 @@
 #include "amide_config.h"
 #include "amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'.h"
 #include "amitk_data_set_FLOAT_0D_SCALING.h"
+#include <string.h>
 
 #ifdef AMIDE_DEBUG
 #include <stdlib.h>
 #endif
+#ifdef AMIDE_SIMD_SUPPORT
+#include <immintrin.h>
+#endif
 
 #define DIM_TYPE_`'m4_Scale_Dim`'
 #define DATA_TYPE_`'m4_Variable_Type`'
 
+/* SCALING_TYPE or SCALING_INTERCEPT_TYPE */
+#define SCALING_`'m4_Intercept`'TYPE
+
+/* for the 8 and 16 bit types, the offset that maps the smallest raw value to bin 0
+   of a raw value histogram */
+#if defined(DATA_TYPE_UBYTE) || defined(DATA_TYPE_USHORT)
+#define RAW_HISTOGRAM_OFFSET 0
+#elif defined(DATA_TYPE_SBYTE)
+#define RAW_HISTOGRAM_OFFSET 128
+#elif defined(DATA_TYPE_SSHORT)
+#define RAW_HISTOGRAM_OFFSET 32768
+#endif
 
-/* function to calculate the max/min values of a slice within a data set */
+/* function to calculate the max/min values of a slice within a data set.
+   For the 8 and 16 bit types, if raw_histogram is not NULL, the raw values of the
+   slice are also added into it, which needs 2^(8*format size) bins */
 void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_slice_min_max(AmitkDataSet * data_set,
 											     const amide_intpoint_t frame,
 											     const amide_intpoint_t gate,
 											     const amide_intpoint_t z,
 											     amitk_format_DOUBLE_t * pmin,
-											     amitk_format_DOUBLE_t * pmax) {
+											     amitk_format_DOUBLE_t * pmax,
+											     guint64 * raw_histogram) {
 
   AmitkVoxel i;
   amide_data_t max, min, temp;
   AmitkVoxel dim;
+  const amitk_format_`'m4_Variable_Type`'_t * raw;
+  amide_data_t scale;
+  amide_data_t intercept=0.0;
+  glong k, plane_size;
   
   dim = AMITK_DATA_SET_DIM(data_set);
 
@@ -54,18 +77,37 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_s
   i.z = z;
   i.y = i.x = 0;
 
-  temp = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, i);
+  /* the scaling is the same over the whole plane, so we can just walk the raw data */
+  raw = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, i);
+  scale = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->current_scaling_factor, i);
+#ifdef SCALING_INTERCEPT_TYPE
+  intercept = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, i);
+#endif
+  plane_size = dim.x*dim.y;
+
+  temp = scale*(((amide_data_t) raw[0]) + intercept);
   if (finite(temp)) max = min = temp;   
   else max = min = 0.0; /* just throw in zero */
 
-  for (i.y = 0; i.y < dim.y; i.y++) 
-    for (i.x = 0; i.x < dim.x; i.x++) {
-      temp = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, i);
+#ifdef RAW_HISTOGRAM_OFFSET
+  if (raw_histogram != NULL) {
+    for (k = 0; k < plane_size; k++) {
+      raw_histogram[((gint) raw[k]) + RAW_HISTOGRAM_OFFSET]++;
+      temp = scale*(((amide_data_t) raw[k]) + intercept);
       if (finite(temp)) {
 	if (temp > max) max = temp;
 	else if (temp < min) min = temp;
       }
     }
+  } else
+#endif
+  for (k = 0; k < plane_size; k++) {
+    temp = scale*(((amide_data_t) raw[k]) + intercept);
+    if (finite(temp)) {
+      if (temp > max) max = temp;
+      else if (temp < min) min = temp;
+    }
+  }
 
   if (pmin != NULL)
     *pmin = min;
@@ -76,32 +118,133 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_s
   return;
 }
 
+/* returns the value of a voxel, without any of the checks amitk_data_set_get_value does */
+amide_data_t amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'get_value(const AmitkDataSet * data_set,
+											    const AmitkVoxel i) {
+  return AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, i);
+}
+
+/* fills in row with the dim.x values of the data set's row at (i.t, i.g, i.z, i.y),
+   with either the full or only the internal scale factor applied */
+void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'get_row(const AmitkDataSet * data_set,
+										  const AmitkVoxel i,
+										  const gboolean internal,
+										  amide_data_t * row) {
+
+  AmitkVoxel j;
+  const amitk_format_`'m4_Variable_Type`'_t * raw;
+  amide_data_t scale;
+  amide_intpoint_t x, dim_x;
+
+  j = i;
+  j.x = 0;
+  dim_x = AMITK_DATA_SET_DIM_X(data_set);
+
+  /* the scaling is the same across the whole row */
+  raw = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, j);
+  if (internal)
+    scale = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_factor, j);
+  else
+    scale = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->current_scaling_factor, j);
+
+#ifdef SCALING_INTERCEPT_TYPE
+  {
+    amide_data_t intercept;
+    intercept = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, j);
+    for (x = 0; x < dim_x; x++)
+      row[x] = scale*(((amide_data_t) raw[x]) + intercept);
+  }
+#else
+  for (x = 0; x < dim_x; x++)
+    row[x] = scale*((amide_data_t) raw[x]);
+#endif
+
+  return;
+}
+
+typedef struct calc_distribution_t {
+  AmitkDataSet * data_set;
+  amide_intpoint_t frame;
+  amide_data_t min;
+  amide_data_t scale;
+  guint64 * counts;
+  GMutex * mutex;
+} calc_distribution_t;
+
+/* bins the planes [start, end) of a frame, the planes being numbered gate by gate.
+   Each call keeps its own counts, and only takes the lock to add them in at the end */
+static void calc_distribution_planes(gint start, gint end, gpointer data) {
+
+  calc_distribution_t * cd = data;
+  guint64 counts[AMITK_DATA_SET_DISTRIBUTION_SIZE];
+  const amitk_format_`'m4_Variable_Type`'_t * raw;
+  AmitkVoxel i;
+  amide_data_t scale;
+  amide_data_t intercept=0.0;
+  amide_data_t temp;
+  gint i_plane, bin;
+  glong k, plane_size;
+
+  memset(counts, 0, sizeof(counts));
+  plane_size = AMITK_DATA_SET_DIM_X(cd->data_set)*AMITK_DATA_SET_DIM_Y(cd->data_set);
+
+  i.t = cd->frame;
+  i.y = i.x = 0;
+  for (i_plane = start; i_plane < end; i_plane++) {
+    i.g = i_plane / AMITK_DATA_SET_DIM_Z(cd->data_set);
+    i.z = i_plane % AMITK_DATA_SET_DIM_Z(cd->data_set);
+
+    /* the scaling is the same over the whole plane, so we can just walk the raw data */
+    raw = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(cd->data_set->raw_data, i);
+    scale = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(cd->data_set->current_scaling_factor, i);
+#ifdef SCALING_INTERCEPT_TYPE
+    intercept = *AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(cd->data_set->internal_scaling_intercept, i);
+#endif
+
+    for (k = 0; k < plane_size; k++) {
+      temp = scale*(((amide_data_t) raw[k]) + intercept);
+      if (finite(temp)) {
+	bin = cd->scale*(temp-cd->min);
+	counts[CLAMP(bin, 0, AMITK_DATA_SET_DISTRIBUTION_SIZE-1)]++;
+      }
+    }
+  }
+
+  g_mutex_lock(cd->mutex);
+  for (bin = 0; bin < AMITK_DATA_SET_DISTRIBUTION_SIZE; bin++)
+    cd->counts[bin] += counts[bin];
+  g_mutex_unlock(cd->mutex);
+
+  return;
+}
+
 /* generate the distribution array for a data_set */
 void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_distribution(AmitkDataSet * data_set,
 									    AmitkUpdateFunc update_func,
 									    gpointer update_data) {
 
-  AmitkVoxel i,j;
-  amide_data_t scale, diff;
+  AmitkVoxel j;
+  amide_data_t diff;
   AmitkVoxel distribution_dim;
   AmitkVoxel data_set_dim;
   gchar * temp_string;
-  div_t x;
-  gint divider;
-  gint total_planes;
-  gint i_plane;
   gboolean continue_work=TRUE;
   AmitkRawData * distribution;
+  calc_distribution_t cd;
+  guint64 counts[AMITK_DATA_SET_DISTRIBUTION_SIZE];
+  GMutex mutex;
 
   if (data_set->distribution != NULL)
     return;
 
   data_set_dim = AMITK_DATA_SET_DIM(data_set);
   diff = amitk_data_set_get_global_max(data_set) - amitk_data_set_get_global_min(data_set);
+  cd.data_set = data_set;
+  cd.min = amitk_data_set_get_global_min(data_set);
   if (diff == 0.0)
-    scale = 0.0;
+    cd.scale = 0.0;
   else
-    scale = (AMITK_DATA_SET_DISTRIBUTION_SIZE-1)/diff;
+    cd.scale = (AMITK_DATA_SET_DISTRIBUTION_SIZE-1)/diff;
   
   distribution_dim.x = AMITK_DATA_SET_DISTRIBUTION_SIZE;
   distribution_dim.y = distribution_dim.z = distribution_dim.g = distribution_dim.t = 1;
@@ -111,37 +254,27 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_d
     return;
   }
 
-  /* initialize the distribution array */
-  amitk_raw_data_DOUBLE_initialize_data(distribution, 0.0);
-  
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Generating distribution data for:\n   %s"), AMITK_OBJECT_NAME(data_set));
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = AMITK_DATA_SET_TOTAL_PLANES(data_set);
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
 
-  /* now "bin" the data */
-  j = zero_voxel;
-  i_plane=0;
-  for (i.t = 0; (i.t < data_set_dim.t) && continue_work; i.t++) {
-    for (i.g = 0; (i.g < data_set_dim.g) && continue_work; i.g++) {
-      for ( i.z = 0; (i.z < data_set_dim.z) && continue_work; i.z++, i_plane++) {
-	if (update_func != NULL) {
-	  x = div(i_plane,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) i_plane)/((gdouble) total_planes));
-	}
-
-	for (i.y = 0; i.y < data_set_dim.y; i.y++) 
-	  for (i.x = 0; i.x < data_set_dim.x; i.x++) {
-	    j.x = scale*(AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,i)-amitk_data_set_get_global_min(data_set));
-	    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) += 1.0;
-	  }
-      }
-    }
+  /* now "bin" the data, a frame at a time with the planes of the frame split between threads */
+  memset(counts, 0, sizeof(counts));
+  cd.counts = counts;
+  g_mutex_init(&mutex);
+  cd.mutex = &mutex;
+  for (cd.frame = 0; (cd.frame < data_set_dim.t) && continue_work; cd.frame++) {
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) cd.frame)/((gdouble) data_set_dim.t));
+    if (!continue_work) break;
+
+    for (j.g = 0; j.g < data_set_dim.g; j.g++)
+      amitk_raw_data_request_frame(data_set->raw_data, cd.frame, j.g);
+    amitk_parallel_for(data_set_dim.g*data_set_dim.z, calc_distribution_planes, &cd);
   }
+  g_mutex_clear(&mutex);
 
   if (update_func != NULL) /* remove progress bar */
     continue_work = (*update_func)(update_data, NULL, (gdouble) 2.0); 
@@ -153,9 +286,9 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_d
   
   /* do some log scaling so the distribution is more meaningful, and doesn't get
      swamped by outlyers */
+  j = zero_voxel;
   for (j.x = 0; j.x < distribution_dim.x ; j.x++) 
-    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) = 
-      log10(AMITK_RAW_DATA_DOUBLE_CONTENT(distribution,j)+1.0);
+    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) = log10(((gdouble) counts[j.x])+1.0);
 
   /* and store the distribution with the data set */
   data_set->distribution = distribution;
@@ -165,11 +298,729 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_d
 
 
 
+/* linearly interpolates between the values of two neighboring voxels, frac
+   being the fractional distance from the first.  If one of the voxels is
+   empty (outside of the data set), we use the other if it's the closer one */
+static inline amide_data_t interpolate_with_empties(const amide_data_t value0,
+						    const amide_data_t value1,
+						    const amide_real_t frac) {
+  if (isnan(value0))
+    return (frac >= 0.5) ? value1 : NAN;
+  else if (isnan(value1))
+    return (frac <= 0.5) ? value0 : NAN;
+  else
+    return value0*(1.0-frac) + value1*frac;
+}
+
+/* whether a point (in voxel center coordinates) is no more then half a voxel outside
+   the outer voxel centers, i.e. interpolating at it won't come up with an empty */
+static inline gboolean coord_interior(const AmitkPoint coord, const AmitkVoxel dim) {
+  return ((coord.x >= -0.5) && (coord.x <= dim.x-0.5) &&
+	  (coord.y >= -0.5) && (coord.y <= dim.y-0.5) &&
+	  (coord.z >= -0.5) && (coord.z <= dim.z-0.5));
+}
+
+/* the lower corner of the interpolation box along one axis, for a coordinate that's 
+   passed coord_interior.  The corner is clamped so the box stays inside the data set,
+   and the fractional weight is clamped to match, which gives the same answer as
+   interpolate_with_empties would have */
+static inline amide_intpoint_t interior_corner(const amide_real_t coord,
+					       const amide_intpoint_t max_corner,
+					       amide_real_t * frac) {
+  amide_intpoint_t corner;
+
+  corner = floor(coord);
+  if (corner < 0) corner = 0;
+  else if (corner > max_corner) corner = max_corner;
+
+  *frac = coord - corner;
+  if (*frac < 0.0) *frac = 0.0;
+  else if (*frac > 1.0) *frac = 1.0;
+
+  return corner;
+}
+
+/* everything the interior kernels need to fill in a row of the slice that's known to
+   lie entirely within the data set.  Coordinates are in voxel center units, see
+   get_slice_trilinear_rows */
+typedef struct interior_row_t {
+  const amitk_format_`'m4_Variable_Type`'_t * data; /* start of the current frame/gate */
+  const amide_data_t * scale; /* scale factor of plane 0 of the current frame/gate */
+#ifdef SCALING_INTERCEPT_TYPE
+  const amide_data_t * intercept; /* intercept of plane 0 of the current frame/gate */
+#endif
+  gint scale_step; /* 1 if each plane has it's own scale factor, 0 otherwise */
+  gint top_plane; /* 1, or 0 if the data set is only one plane thick */
+  AmitkPoint coord; /* the row's first pixel */
+  AmitkPoint stride; /* from one pixel in the row to the next */
+  AmitkVoxel max_corner; /* largest allowed lower corner of the interpolation box */
+  glong step_x, step_y, step_z; /* offsets from the lower corner to the other corners */
+  glong row_size, plane_size;
+  AmitkRendering rendering;
+  gboolean first_plane; /* MIP/MINIP get initialized from the first plane */
+  amide_data_t weight;
+} interior_row_t;
+
+typedef void (*interior_row_func_t) (const interior_row_t * row, const guint num,
+				     amide_data_t * intermediate_data, amide_data_t * weights);
+
+/* the interpolated value at a coordinate that's passed coord_interior */
+static inline amide_data_t interior_value(const interior_row_t * row, const AmitkPoint coord) {
+
+  amide_intpoint_t x, y, z;
+  amide_real_t fx, fy, fz;
+  const amitk_format_`'m4_Variable_Type`'_t * bottom;
+  const amitk_format_`'m4_Variable_Type`'_t * top;
+  amide_data_t bottom_value, top_value;
+
+  x = interior_corner(coord.x, row->max_corner.x, &fx);
+  y = interior_corner(coord.y, row->max_corner.y, &fy);
+  z = interior_corner(coord.z, row->max_corner.z, &fz);
+
+  /* bilinear interpolation of the raw values within the bottom and top planes,
+     the scaling is constant within a plane so it can be applied afterwards */
+  bottom = row->data + z*row->plane_size + y*row->row_size + x;
+  top = bottom+row->step_z;
+  bottom_value = 
+    (1.0-fy)*((1.0-fx)*((amide_data_t) bottom[0]) + fx*((amide_data_t) bottom[row->step_x])) +
+    fy*((1.0-fx)*((amide_data_t) bottom[row->step_y]) + fx*((amide_data_t) bottom[row->step_y+row->step_x]));
+  top_value = 
+    (1.0-fy)*((1.0-fx)*((amide_data_t) top[0]) + fx*((amide_data_t) top[row->step_x])) +
+    fy*((1.0-fx)*((amide_data_t) top[row->step_y]) + fx*((amide_data_t) top[row->step_y+row->step_x]));
+#ifdef SCALING_INTERCEPT_TYPE
+  bottom_value += row->intercept[z*row->scale_step];
+  top_value += row->intercept[(z+row->top_plane)*row->scale_step];
+#endif
+  bottom_value *= row->scale[z*row->scale_step];
+  top_value *= row->scale[(z+row->top_plane)*row->scale_step];
+
+  /* and the z direction */
+  return (1.0-fz)*bottom_value + fz*top_value;
+}
+
+/* adds a value into pixel i of the row, as per the rendering method */
+static inline void interior_accumulate(const interior_row_t * row, const amide_data_t value,
+				       amide_data_t * intermediate_data, amide_data_t * weights,
+				       const guint i) {
+  if (row->rendering == AMITK_RENDERING_MPR) {
+    intermediate_data[i] += row->weight*value;
+    weights[i] += row->weight;
+  } else if (row->first_plane)
+    intermediate_data[i] = value;
+  else if (row->rendering == AMITK_RENDERING_MIP)
+    intermediate_data[i] = MAX(intermediate_data[i], value);
+  else /* MINIP */
+    intermediate_data[i] = MIN(intermediate_data[i], value);
+}
+
+/* the plain C interior kernel, used when we don't have anything better */
+static void interior_row_scalar(const interior_row_t * row, const guint num,
+				amide_data_t * intermediate_data, amide_data_t * weights) {
+  guint i;
+  AmitkPoint coord;
+
+  for (i=0; i<num; i++) {
+    POINT_MADD(1.0, row->coord, (amide_real_t) i, row->stride, coord);
+    interior_accumulate(row, interior_value(row, coord), intermediate_data, weights, i);
+  }
+
+  return;
+}
+
+#ifdef AMIDE_SIMD_SUPPORT
+
+/* the vector kernels below do the same thing as interior_row_scalar, on 2 (SSE2) 
+   or 4 (AVX2) pixels at a time, with the leftovers at the end of the row done by 
+   the scalar code.  As the coordinates are clamped to be non-negative before 
+   converting them to integers, truncation is the same as floor. */
+
+/* pulls in two voxels, converting them to doubles */
+static inline __attribute__((target("sse2"))) __m128d gather_sse2(const amitk_format_`'m4_Variable_Type`'_t * data,
+								  const __m128i index) {
+  gint i[4];
+
+  _mm_storeu_si128((__m128i *) i, index);
+  return _mm_set_pd((amide_data_t) data[i[1]], (amide_data_t) data[i[0]]);
+}
+
+/* the scale factors or intercepts for the planes two voxels are in */
+static inline __attribute__((target("sse2"))) __m128d plane_factor_sse2(const amide_data_t * factor, 
+									const gint scale_step,
+									const __m128i plane) {
+  gint i[4];
+
+  if (scale_step == 0) return _mm_set1_pd(factor[0]);
+  _mm_storeu_si128((__m128i *) i, plane);
+  return _mm_set_pd(factor[i[1]], factor[i[0]]);
+}
+
+/* bilinear interpolation within a plane, index pointing at the lower corners */
+static inline __attribute__((target("sse2"))) __m128d bilinear_sse2(const interior_row_t * row,
+								    const __m128i index,
+								    const __m128d fx, const __m128d fy) {
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128i step_x = _mm_set1_epi32(row->step_x);
+  const __m128i index_y = _mm_add_epi32(index, _mm_set1_epi32(row->step_y));
+  __m128d gx, lower, upper;
+
+  gx = _mm_sub_pd(one, fx);
+  lower = _mm_add_pd(_mm_mul_pd(gx, gather_sse2(row->data, index)),
+		     _mm_mul_pd(fx, gather_sse2(row->data, _mm_add_epi32(index, step_x))));
+  upper = _mm_add_pd(_mm_mul_pd(gx, gather_sse2(row->data, index_y)),
+		     _mm_mul_pd(fx, gather_sse2(row->data, _mm_add_epi32(index_y, step_x))));
+  return _mm_add_pd(_mm_mul_pd(_mm_sub_pd(one, fy), lower), _mm_mul_pd(fy, upper));
+}
+
+static __attribute__((target("sse2"))) void interior_row_sse2(const interior_row_t * row, const guint num,
+							      amide_data_t * intermediate_data, 
+							      amide_data_t * weights) {
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d lanes = _mm_set_pd(1.0, 0.0);
+  const __m128d max_x = _mm_set1_pd(row->max_corner.x);
+  const __m128d max_y = _mm_set1_pd(row->max_corner.y);
+  const __m128d max_z = _mm_set1_pd(row->max_corner.z);
+  const __m128d row_size = _mm_set1_pd(row->row_size);
+  const __m128d plane_size = _mm_set1_pd(row->plane_size);
+  const __m128d weight = _mm_set1_pd(row->weight);
+  const __m128i step_z = _mm_set1_epi32(row->step_z);
+  const __m128i top_plane = _mm_set1_epi32(row->top_plane);
+  __m128d n, x, y, z, fx, fy, fz, bottom, top, value;
+  __m128i index, plane;
+  AmitkPoint coord;
+  guint i;
+
+  for (i=0; i+2 <= num; i+=2) {
+    n = _mm_add_pd(_mm_set1_pd(i), lanes);
+
+    /* lower corners of the interpolation boxes, and the fractional weights */
+    x = _mm_add_pd(_mm_set1_pd(row->coord.x), _mm_mul_pd(n, _mm_set1_pd(row->stride.x)));
+    y = _mm_add_pd(_mm_set1_pd(row->coord.y), _mm_mul_pd(n, _mm_set1_pd(row->stride.y)));
+    z = _mm_add_pd(_mm_set1_pd(row->coord.z), _mm_mul_pd(n, _mm_set1_pd(row->stride.z)));
+    fx = x;
+    fy = y;
+    fz = z;
+    x = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(x, zero), max_x)));
+    y = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(y, zero), max_y)));
+    z = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(z, zero), max_z)));
+    fx = _mm_min_pd(_mm_max_pd(_mm_sub_pd(fx, x), zero), one);
+    fy = _mm_min_pd(_mm_max_pd(_mm_sub_pd(fy, y), zero), one);
+    fz = _mm_min_pd(_mm_max_pd(_mm_sub_pd(fz, z), zero), one);
+
+    index = _mm_cvttpd_epi32(_mm_add_pd(_mm_add_pd(_mm_mul_pd(z, plane_size), 
+						   _mm_mul_pd(y, row_size)), x));
+    plane = _mm_cvttpd_epi32(z);
+
+    bottom = bilinear_sse2(row, index, fx, fy);
+    top = bilinear_sse2(row, _mm_add_epi32(index, step_z), fx, fy);
+#ifdef SCALING_INTERCEPT_TYPE
+    bottom = _mm_add_pd(bottom, plane_factor_sse2(row->intercept, row->scale_step, plane));
+    top = _mm_add_pd(top, plane_factor_sse2(row->intercept, row->scale_step, 
+					    _mm_add_epi32(plane, top_plane)));
+#endif
+    bottom = _mm_mul_pd(bottom, plane_factor_sse2(row->scale, row->scale_step, plane));
+    top = _mm_mul_pd(top, plane_factor_sse2(row->scale, row->scale_step, 
+					    _mm_add_epi32(plane, top_plane)));
+    value = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(one, fz), bottom), _mm_mul_pd(fz, top));
+
+    if (row->rendering == AMITK_RENDERING_MPR) {
+      _mm_storeu_pd(intermediate_data+i, 
+		    _mm_add_pd(_mm_loadu_pd(intermediate_data+i), _mm_mul_pd(weight, value)));
+      _mm_storeu_pd(weights+i, _mm_add_pd(_mm_loadu_pd(weights+i), weight));
+    } else if (row->first_plane)
+      _mm_storeu_pd(intermediate_data+i, value);
+    else if (row->rendering == AMITK_RENDERING_MIP)  /* same NAN handling as MAX() */
+      _mm_storeu_pd(intermediate_data+i, _mm_max_pd(_mm_loadu_pd(intermediate_data+i), value));
+    else /* MINIP */
+      _mm_storeu_pd(intermediate_data+i, _mm_min_pd(_mm_loadu_pd(intermediate_data+i), value));
+  }
+
+  for (; i<num; i++) {
+    POINT_MADD(1.0, row->coord, (amide_real_t) i, row->stride, coord);
+    interior_accumulate(row, interior_value(row, coord), intermediate_data, weights, i);
+  }
+
+  return;
+}
+
+/* pulls in four voxels, converting them to doubles */
+static inline __attribute__((target("avx2"))) __m256d gather_avx2(const amitk_format_`'m4_Variable_Type`'_t * data,
+								  const __m128i index) {
+#if defined(DATA_TYPE_DOUBLE)
+  return _mm256_i32gather_pd(data, index, 8);
+#elif defined(DATA_TYPE_FLOAT)
+  return _mm256_cvtps_pd(_mm_i32gather_ps(data, index, 4));
+#elif defined(DATA_TYPE_SINT)
+  return _mm256_cvtepi32_pd(_mm_i32gather_epi32((const int *) data, index, 4));
+#else /* no gather instructions for these */
+  gint i[4];
+
+  _mm_storeu_si128((__m128i *) i, index);
+  return _mm256_set_pd((amide_data_t) data[i[3]], (amide_data_t) data[i[2]], 
+		       (amide_data_t) data[i[1]], (amide_data_t) data[i[0]]);
+#endif
+}
+
+/* the scale factors or intercepts for the planes four voxels are in */
+static inline __attribute__((target("avx2"))) __m256d plane_factor_avx2(const amide_data_t * factor, 
+									const gint scale_step,
+									const __m128i plane) {
+  if (scale_step == 0) return _mm256_broadcast_sd(factor);
+  else return _mm256_i32gather_pd(factor, plane, 8);
+}
+
+/* bilinear interpolation within a plane, index pointing at the lower corners */
+static inline __attribute__((target("avx2"))) __m256d bilinear_avx2(const interior_row_t * row,
+								    const __m128i index,
+								    const __m256d fx, const __m256d fy) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m128i step_x = _mm_set1_epi32(row->step_x);
+  const __m128i index_y = _mm_add_epi32(index, _mm_set1_epi32(row->step_y));
+  __m256d gx, lower, upper;
+
+  gx = _mm256_sub_pd(one, fx);
+  lower = _mm256_add_pd(_mm256_mul_pd(gx, gather_avx2(row->data, index)),
+			_mm256_mul_pd(fx, gather_avx2(row->data, _mm_add_epi32(index, step_x))));
+  upper = _mm256_add_pd(_mm256_mul_pd(gx, gather_avx2(row->data, index_y)),
+			_mm256_mul_pd(fx, gather_avx2(row->data, _mm_add_epi32(index_y, step_x))));
+  return _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(one, fy), lower), _mm256_mul_pd(fy, upper));
+}
+
+static __attribute__((target("avx2"))) void interior_row_avx2(const interior_row_t * row, const guint num,
+							      amide_data_t * intermediate_data, 
+							      amide_data_t * weights) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d lanes = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+  const __m256d max_x = _mm256_set1_pd(row->max_corner.x);
+  const __m256d max_y = _mm256_set1_pd(row->max_corner.y);
+  const __m256d max_z = _mm256_set1_pd(row->max_corner.z);
+  const __m256d row_size = _mm256_set1_pd(row->row_size);
+  const __m256d plane_size = _mm256_set1_pd(row->plane_size);
+  const __m256d weight = _mm256_set1_pd(row->weight);
+  const __m128i step_z = _mm_set1_epi32(row->step_z);
+  const __m128i top_plane = _mm_set1_epi32(row->top_plane);
+  __m256d n, x, y, z, fx, fy, fz, bottom, top, value;
+  __m128i index, plane;
+  AmitkPoint coord;
+  guint i;
+
+  for (i=0; i+4 <= num; i+=4) {
+    n = _mm256_add_pd(_mm256_set1_pd(i), lanes);
+
+    /* lower corners of the interpolation boxes, and the fractional weights */
+    x = _mm256_add_pd(_mm256_set1_pd(row->coord.x), _mm256_mul_pd(n, _mm256_set1_pd(row->stride.x)));
+    y = _mm256_add_pd(_mm256_set1_pd(row->coord.y), _mm256_mul_pd(n, _mm256_set1_pd(row->stride.y)));
+    z = _mm256_add_pd(_mm256_set1_pd(row->coord.z), _mm256_mul_pd(n, _mm256_set1_pd(row->stride.z)));
+    fx = x;
+    fy = y;
+    fz = z;
+    x = _mm256_floor_pd(_mm256_min_pd(_mm256_max_pd(x, zero), max_x));
+    y = _mm256_floor_pd(_mm256_min_pd(_mm256_max_pd(y, zero), max_y));
+    z = _mm256_floor_pd(_mm256_min_pd(_mm256_max_pd(z, zero), max_z));
+    fx = _mm256_min_pd(_mm256_max_pd(_mm256_sub_pd(fx, x), zero), one);
+    fy = _mm256_min_pd(_mm256_max_pd(_mm256_sub_pd(fy, y), zero), one);
+    fz = _mm256_min_pd(_mm256_max_pd(_mm256_sub_pd(fz, z), zero), one);
+
+    index = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(z, plane_size), 
+							    _mm256_mul_pd(y, row_size)), x));
+    plane = _mm256_cvttpd_epi32(z);
+
+    bottom = bilinear_avx2(row, index, fx, fy);
+    top = bilinear_avx2(row, _mm_add_epi32(index, step_z), fx, fy);
+#ifdef SCALING_INTERCEPT_TYPE
+    bottom = _mm256_add_pd(bottom, plane_factor_avx2(row->intercept, row->scale_step, plane));
+    top = _mm256_add_pd(top, plane_factor_avx2(row->intercept, row->scale_step, 
+					       _mm_add_epi32(plane, top_plane)));
+#endif
+    bottom = _mm256_mul_pd(bottom, plane_factor_avx2(row->scale, row->scale_step, plane));
+    top = _mm256_mul_pd(top, plane_factor_avx2(row->scale, row->scale_step, 
+					       _mm_add_epi32(plane, top_plane)));
+    value = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(one, fz), bottom), _mm256_mul_pd(fz, top));
+
+    if (row->rendering == AMITK_RENDERING_MPR) {
+      _mm256_storeu_pd(intermediate_data+i, 
+		       _mm256_add_pd(_mm256_loadu_pd(intermediate_data+i), _mm256_mul_pd(weight, value)));
+      _mm256_storeu_pd(weights+i, _mm256_add_pd(_mm256_loadu_pd(weights+i), weight));
+    } else if (row->first_plane)
+      _mm256_storeu_pd(intermediate_data+i, value);
+    else if (row->rendering == AMITK_RENDERING_MIP) /* same NAN handling as MAX() */
+      _mm256_storeu_pd(intermediate_data+i, _mm256_max_pd(_mm256_loadu_pd(intermediate_data+i), value));
+    else /* MINIP */
+      _mm256_storeu_pd(intermediate_data+i, _mm256_min_pd(_mm256_loadu_pd(intermediate_data+i), value));
+  }
+
+  for (; i<num; i++) {
+    POINT_MADD(1.0, row->coord, (amide_real_t) i, row->stride, coord);
+    interior_accumulate(row, interior_value(row, coord), intermediate_data, weights, i);
+  }
+
+  return;
+}
+
+#endif /* AMIDE_SIMD_SUPPORT */
+
+
+/* the parameters needed by the workers that fill in a range of rows of a slice */
+typedef struct get_slice_t {
+  AmitkDataSet * data_set;
+  AmitkVoxel start;
+  AmitkVoxel end;
+  amide_intpoint_t start_frame;
+  amide_intpoint_t end_frame;
+  amide_intpoint_t start_gate;
+  gint num_gates;
+  amide_data_t * time_weights; /* one per frame, starting at start_frame */
+  amide_real_t z_steps;
+  AmitkPoint start_point;
+  AmitkPoint stride[AMITK_AXIS_NUM];
+  interior_row_func_t interior_row;
+  amide_data_t * weights;
+  amide_data_t * intermediate_data;
+} get_slice_t;
+
+
+/* fills in rows [start_row, end_row) (relative to start.y) of the intermediate
+   data using trilinear interpolation.  The data set coordinate of each row's
+   first pixel is computed directly from the precomputed strides, so the rows 
+   can be done in any order and by any number of threads, without changing the result */
+static void get_slice_trilinear_rows(gint start_row, gint end_row, gpointer data) {
+
+  get_slice_t * gs = data;
+  AmitkDataSet * data_set = gs->data_set;
+  AmitkVoxel dim;
+  AmitkVoxel ds_voxel;
+  AmitkVoxel box_voxel;
+  AmitkVoxel plane_voxel;
+  amide_intpoint_t z;
+  gint i_row;
+  guint i_col;
+  guint k, l;
+  guint row_length;
+  amide_data_t weight;
+  amide_data_t time_weight;
+  amide_intpoint_t i_gate;
+  AmitkAxis i_axis;
+  AmitkPoint start_coord;
+  AmitkPoint coord_stride[AMITK_AXIS_NUM];
+  AmitkPoint coord, end_coord;
+  AmitkPoint frac;
+  interior_row_t row;
+  amide_data_t value;
+  amide_data_t box_value[8];
+  gboolean first_plane;
+  amide_data_t * weights = gs->weights;
+  amide_data_t * intermediate_data = gs->intermediate_data;
+
+  row_length = gs->end.x-gs->start.x+1;
+  dim = AMITK_DATA_SET_DIM(data_set);
+
+  /* step through the data set in voxel coordinates, shifted so that the voxel 
+     centers land on integers.  The lower corner of the interpolation box is then
+     just the floor of the coordinate, and what's left over is the weight of the upper corner */
+  POINT_DIV(gs->start_point, data_set->voxel_size, start_coord);
+  start_coord.x -= 0.5;
+  start_coord.y -= 0.5;
+  start_coord.z -= 0.5;
+  for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    POINT_DIV(gs->stride[i_axis], data_set->voxel_size, coord_stride[i_axis]);
+
+  /* for the interior kernel - the box's lower corner is kept off the last voxel, 
+     and an axis only one voxel thick gets a box of zero width */
+  row.stride = coord_stride[AMITK_AXIS_X];
+  row.max_corner.x = MAX(dim.x-2, 0);
+  row.max_corner.y = MAX(dim.y-2, 0);
+  row.max_corner.z = MAX(dim.z-2, 0);
+  row.step_x = (dim.x > 1) ? 1 : 0;
+  row.step_y = (dim.y > 1) ? dim.x : 0;
+  row.step_z = (dim.z > 1) ? dim.x*dim.y : 0;
+  row.top_plane = (dim.z > 1) ? 1 : 0;
+  row.row_size = dim.x;
+  row.plane_size = dim.x*dim.y;
+#if defined(DIM_TYPE_2D_SCALING)
+  row.scale_step = 1;
+#else
+  row.scale_step = 0;
+#endif
+  row.rendering = data_set->rendering;
+
+  /* iterate over the frames we'll be incorporating into this slice */
+  for (ds_voxel.t = gs->start_frame; ds_voxel.t <= gs->end_frame; ds_voxel.t++) {
+      
+    time_weight = gs->time_weights[ds_voxel.t-gs->start_frame];
+      
+    for (i_gate=0; i_gate < gs->num_gates; i_gate++) {
+      ds_voxel.g = i_gate+gs->start_gate;
+	
+      if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
+	ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
+
+      box_voxel.t = plane_voxel.t = ds_voxel.t;
+      box_voxel.g = plane_voxel.g = ds_voxel.g;
+
+      /* where this frame/gate starts in the raw data and the scaling */
+      plane_voxel.z = plane_voxel.y = plane_voxel.x = 0;
+      row.data = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, plane_voxel);
+      row.scale = AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->current_scaling_factor, plane_voxel);
+#ifdef SCALING_INTERCEPT_TYPE
+      row.intercept = AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, plane_voxel);
+#endif
+
+      /* iterate over the number of planes we'll be compressing into this slice */
+      for (z = 0; z < ceil(gs->z_steps); z++) {
+	  
+	/* weight is between 0 and 1, this is used to weight the last voxel in the slice's z direction */
+	if (floor(gs->z_steps) > z)
+	  weight = time_weight/gs->z_steps;
+	else
+	  weight = time_weight*(gs->z_steps-floor(gs->z_steps)) / gs->z_steps;
+
+	/* MIP/MINIP get initialized from the first plane we encounter */
+	first_plane = ((z == 0) && (ds_voxel.t == gs->start_frame) && (i_gate == 0));
+	  
+	/* iterate over the y dimension */
+	for (i_row = start_row, k=start_row*row_length; i_row < end_row; i_row++) {
+
+	  /* where this row starts and ends in the data set */
+	  POINT_MADD(z, coord_stride[AMITK_AXIS_Z], i_row, coord_stride[AMITK_AXIS_Y], coord);
+	  POINT_ADD(start_coord, coord, coord);
+	  POINT_MADD(1.0, coord, ((amide_real_t) row_length)-1.0, coord_stride[AMITK_AXIS_X], end_coord);
+
+	  /* the mapping is affine, so if both ends of the row are within the data
+	     set, so is everything in between, and we can skip checking for empties */
+	  if (coord_interior(coord, dim) && coord_interior(end_coord, dim)) { /* faster */
+
+	    row.coord = coord;
+	    row.first_plane = first_plane;
+	    row.weight = weight;
+	    (*gs->interior_row)(&row, row_length, intermediate_data+k, 
+				(weights != NULL) ? weights+k : NULL);
+	    k += row_length;
+
+	  } else { /* slow algorithm - checking for empties */
+
+	    for (i_col = 0; i_col < row_length; i_col++, k++) {
+	      ds_voxel.x = floor(coord.x);
+	      ds_voxel.y = floor(coord.y);
+	      ds_voxel.z = floor(coord.z);
+	      frac.x = coord.x - ds_voxel.x;
+	      frac.y = coord.y - ds_voxel.y;
+	      frac.z = coord.z - ds_voxel.z;
+
+	      /* get the values of the corners of the box */
+	      for (l=0; l<8; l++) {
+		box_voxel.x = (l & 0x1) ? ds_voxel.x+1 : ds_voxel.x;
+		box_voxel.y = (l & 0x2) ? ds_voxel.y+1 : ds_voxel.y;
+		box_voxel.z = (l & 0x4) ? ds_voxel.z+1 : ds_voxel.z;
+		if (amitk_raw_data_includes_voxel(data_set->raw_data, box_voxel))
+		  box_value[l] = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, box_voxel);
+		else
+		  box_value[l] = NAN;
+	      }
+
+	      /* do the x, y, and then z direction linear interpolations of the sets of two points */
+	      for (l=0;l<8;l=l+2)
+		box_value[l] = interpolate_with_empties(box_value[l], box_value[l+1], frac.x);
+	      for (l=0;l<8;l=l+4)
+		box_value[l] = interpolate_with_empties(box_value[l], box_value[l+2], frac.y);
+	      value = interpolate_with_empties(box_value[0], box_value[4], frac.z);
+
+	      /* separate into MPR/MIP/minIP algorithms */
+	      if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
+		if (!isnan(value)) {
+		  intermediate_data[k] += weight*value;
+		  weights[k] += weight;
+		}
+	      } else { /* MIP or MINIP */
+		if (first_plane)
+		  intermediate_data[k]=value;
+		else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
+		  intermediate_data[k] = MAX(intermediate_data[k], value);
+		else  /* MINIP */
+		  intermediate_data[k] = MIN(intermediate_data[k], value);
+	      }
+
+	      POINT_ADD(coord, coord_stride[AMITK_AXIS_X], coord);
+	    }
+	  } /* slow (empties) vs fast algorithm */
+	}
+      }
+    }
+  }
+
+  return;
+}
+
+
+/* fills in rows [start_row, end_row) (relative to start.y) of the intermediate
+   data using nearest neighbor interpolation.  The data set point at the start
+   of each row is reached by the same sequence of stride additions the serial
+   algorithm uses, so the result does not depend on how the rows are split up */
+static void get_slice_nearest_neighbor_rows(gint start_row, gint end_row, gpointer data) {
+
+  get_slice_t * gs = data;
+  AmitkDataSet * data_set = gs->data_set;
+  AmitkVoxel i_voxel;
+  AmitkVoxel ds_voxel;
+  amide_intpoint_t z;
+  gint i_row;
+  guint k;
+  guint row_length;
+  amide_data_t weight;
+  amide_data_t time_weight;
+  amide_intpoint_t i_gate;
+  AmitkPoint ds_point;
+  AmitkPoint last[AMITK_AXIS_NUM];
+  amide_data_t * weights = gs->weights;
+  amide_data_t * intermediate_data = gs->intermediate_data;
+
+  row_length = gs->end.x-gs->start.x+1;
+
+  /* iterate over the number of frames we'll be incorporating into this slice */
+  for (ds_voxel.t = gs->start_frame; ds_voxel.t <= gs->end_frame; ds_voxel.t++) {
+
+    time_weight = gs->time_weights[ds_voxel.t-gs->start_frame];
+
+    /* iterate over gates */
+    for (i_gate=0; i_gate < gs->num_gates; i_gate++) {
+      ds_voxel.g = i_gate+gs->start_gate;
+
+      if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
+	ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
+
+      ds_point = gs->start_point;
+
+      /* separate into MPR and MIP/MINIP algorithms. A fair amount
+	 of code is duplicated within the algorithms. The reason
+	 they aren't combined is to keep the MPR vs MIP/MINIP branch
+	 point out of the loop and speed things up slightly for the
+	 most commonly used selection (MPR) */
+
+      switch(data_set->rendering) {
+
+      case AMITK_RENDERING_MPR:
+	/* iterate over the number of planes we'll be compressing into this slice */
+	for (z = 0; z < ceil(gs->z_steps); z++) { 
+	  last[AMITK_AXIS_Z] = ds_point;
+	  
+	  /* weight is between 0 and 1, this is used to weight the last voxel  in the slice's z direction */
+	  if (floor(gs->z_steps) > z)
+	    weight = time_weight/gs->z_steps;
+	  else
+	    weight = time_weight*(gs->z_steps-floor(gs->z_steps)) / gs->z_steps;
+
+	  /* step down to the first row we're responsible for */
+	  for (i_row = 0; i_row < start_row; i_row++)
+	    POINT_ADD(ds_point, gs->stride[AMITK_AXIS_Y], ds_point);
+	  
+	  /* iterate over x and y */
+	  for (i_voxel.y = gs->start.y+start_row, k=start_row*row_length; 
+	       i_voxel.y < gs->start.y+end_row; i_voxel.y++) { 
+	    last[AMITK_AXIS_Y] = ds_point;
+	    for (i_voxel.x = gs->start.x; i_voxel.x <= gs->end.x; i_voxel.x++, k++) { 
+	      POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
+	      if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) {
+		intermediate_data[k] +=
+		  weight*AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
+		weights[k] += weight;
+	      }
+	      POINT_ADD(ds_point, gs->stride[AMITK_AXIS_X], ds_point); 
+	    } /* x */
+	    POINT_ADD(last[AMITK_AXIS_Y], gs->stride[AMITK_AXIS_Y], ds_point);
+	  } /* y */
+	  
+	  POINT_ADD(last[AMITK_AXIS_Z], gs->stride[AMITK_AXIS_Z], ds_point); 
+	} /* z */
+	break;
+
+      case AMITK_RENDERING_MIP:
+      case AMITK_RENDERING_MINIP:
+
+	/* iterate over the number of planes we'll be compressing into this slice */
+	for (z = 0; z < ceil(gs->z_steps); z++) { 
+	  last[AMITK_AXIS_Z] = ds_point;
+
+	  /* step down to the first row we're responsible for */
+	  for (i_row = 0; i_row < start_row; i_row++)
+	    POINT_ADD(ds_point, gs->stride[AMITK_AXIS_Y], ds_point);
+
+	  /* need to initialize based on the first plane we encounter */
+	  if ((z == 0) && (ds_voxel.t == gs->start_frame) && (i_gate == 0)) {
+	    /* iterate over x and y */
+	    for (i_voxel.y = gs->start.y+start_row, k=start_row*row_length; 
+		 i_voxel.y < gs->start.y+end_row; i_voxel.y++) {
+	      last[AMITK_AXIS_Y] = ds_point;
+	      for (i_voxel.x = gs->start.x; i_voxel.x <= gs->end.x; i_voxel.x++,k++) {
+		POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
+		if (!amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		  intermediate_data[k] = NAN;
+		else
+		  intermediate_data[k] =
+		    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
+		POINT_ADD(ds_point, gs->stride[AMITK_AXIS_X], ds_point); 
+	      } /* x */
+	      POINT_ADD(last[AMITK_AXIS_Y], gs->stride[AMITK_AXIS_Y], ds_point);
+	    } /* y */
+
+	  } else { /* iterate over everything that's not the first plane */
+
+	    if (data_set->rendering == AMITK_RENDERING_MIP) {
+	      /* iterate over x and y */
+	      for (i_voxel.y = gs->start.y+start_row, k=start_row*row_length; 
+		   i_voxel.y < gs->start.y+end_row; i_voxel.y++) { 
+		last[AMITK_AXIS_Y] = ds_point;
+		for (i_voxel.x = gs->start.x; i_voxel.x <= gs->end.x; i_voxel.x++,k++) { 
+		  POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
+		  if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		    intermediate_data[k] = 
+		      MAX(intermediate_data[k],
+			  AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
+		  POINT_ADD(ds_point, gs->stride[AMITK_AXIS_X], ds_point); 
+		} /* x */
+		POINT_ADD(last[AMITK_AXIS_Y], gs->stride[AMITK_AXIS_Y], ds_point);
+	      } /* y */ 
+	    } else { /* AMITK_RENDERING_MINIP */
+	      /* iterate over x and y */
+	      for (i_voxel.y = gs->start.y+start_row, k=start_row*row_length; 
+		   i_voxel.y < gs->start.y+end_row; i_voxel.y++) { 
+		last[AMITK_AXIS_Y] = ds_point;
+		for (i_voxel.x = gs->start.x; i_voxel.x <= gs->end.x; i_voxel.x++,k++) { 
+		  POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
+		  if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		    intermediate_data[k] = 
+		      MIN(intermediate_data[k],
+			  AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
+		  POINT_ADD(ds_point, gs->stride[AMITK_AXIS_X], ds_point); 
+		} /* x */
+		POINT_ADD(last[AMITK_AXIS_Y], gs->stride[AMITK_AXIS_Y], ds_point);
+	      } /* y */ 
+	    } /* end else, MIP vs MINIP */
+	  } /* end else */
+	  
+	  POINT_ADD(last[AMITK_AXIS_Z], gs->stride[AMITK_AXIS_Z], ds_point); 
+	} /* z */
+	break;
+
+      default:
+	break;
+      } /* MIP vs NON-MIP */
+
+    } /* iterating over gates */
+  } /* iterating over frames */
+
+  return;
+}
+
+
+
 /* returns a slice  with the appropriate data from the data_set */
 AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'get_slice(AmitkDataSet * data_set,
 											      const amide_time_t start_time,
 											      const amide_time_t duration,
 											      const amide_intpoint_t gate,
+											      const AmitkInterpolation interpolation,
+											      const amide_intpoint_t view_start_gate,
+											      const amide_intpoint_t view_end_gate,
 											      const AmitkCanvasPoint pixel_size,
 											      const AmitkVolume * slice_volume) {
 
@@ -178,36 +1029,27 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
 
   AmitkDataSet * slice = NULL;
   AmitkVoxel i_voxel;
-  amide_intpoint_t z;
-  amide_real_t max_diff, voxel_length, z_steps;
+  amide_real_t voxel_length, z_steps;
   AmitkPoint alt;
-  AmitkPoint stride[AMITK_AXIS_NUM], last[AMITK_AXIS_NUM];
   AmitkAxis i_axis;
-  guint k, l;
-  amide_data_t weight;
-  amide_data_t time_weight;
+  guint k;
   amide_intpoint_t start_frame, end_frame;
-  amide_intpoint_t i_gate;
+  amide_intpoint_t i_frame;
   amide_time_t end_time;
-  AmitkPoint box_point[8];
-  AmitkVoxel box_voxel[8];
   AmitkVoxel start, end;
-  amide_data_t box_value[8];
-  AmitkPoint slice_point, ds_point,start_point,diff, nearest_point;
   AmitkSpace * slice_space;
   AmitkSpace * data_set_space;
 #if AMIDE_DEBUG
   gchar * temp_string;
   AmitkPoint center_point;
 #endif
-  AmitkVoxel ds_voxel;
-  amide_data_t weight1, weight2;
   amide_data_t * weights=NULL;
   amide_data_t * intermediate_data=NULL;
+  amide_data_t * time_weights=NULL;
   AmitkCorners intersection_corners;
   AmitkVoxel dim;
   gint num_gates;
-  gboolean empties=FALSE;
+  get_slice_t gs;
 
   /* ----- figure out what frames of this data set to include ----*/
   end_time = start_time+duration;
@@ -215,10 +1057,12 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
   end_frame = amitk_data_set_get_frame(data_set, end_time-EPSILON);
 
   /* the number of gates we'll be looking at */
-  if (gate < 0)
-    num_gates = AMITK_DATA_SET_NUM_VIEW_GATES(data_set);
-  else
+  if (gate >= 0)
     num_gates = 1;
+  else if (view_start_gate > view_end_gate)
+    num_gates = AMITK_DATA_SET_NUM_GATES(data_set) - (view_start_gate-view_end_gate-1);
+  else
+    num_gates = view_end_gate-view_start_gate+1;
 
   /* ------------------------- */
 
@@ -234,6 +1078,13 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
     }
   }
 
+  /* and the weighting to give to each frame */
+  if ((time_weights = g_try_new(amide_data_t, MAX(end_frame-start_frame+1, 1))) == NULL) {
+    g_warning(_("couldn't allocate memory space for the time weights, wanted %d elements"), 
+	      end_frame-start_frame+1);
+    goto error;
+  }
+
   /* get an intermediate data matrix to speed things up */
   if ((intermediate_data = g_try_malloc0(sizeof(amide_data_t)*dim.x*dim.y)) == NULL) {
     g_warning(_("couldn't allocate memory space for the intermediate_data, wanted %dx%d elements"), dim.x, dim.y);
@@ -258,11 +1109,11 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
   amitk_space_copy_in_place(AMITK_SPACE(slice), AMITK_SPACE(slice_volume));
   slice->scan_start = start_time;
   slice->thresholding = data_set->thresholding;
-  slice->interpolation = AMITK_DATA_SET_INTERPOLATION(data_set);
+  slice->interpolation = interpolation;
   slice->rendering = AMITK_DATA_SET_RENDERING(data_set);
   if (gate < 0) {
-    slice->view_start_gate = AMITK_DATA_SET_VIEW_START_GATE(data_set);
-    slice->view_end_gate = AMITK_DATA_SET_VIEW_END_GATE(data_set);
+    slice->view_start_gate = view_start_gate;
+    slice->view_end_gate = view_end_gate;
   } else {
     slice->view_start_gate = gate;
     slice->view_end_gate = gate;
@@ -345,372 +1196,79 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
       AMITK_RAW_DATA_DOUBLE_SET_CONTENT(slice->raw_data,i_voxel) = NAN;
 
 
-  switch(data_set->interpolation) {
-    
-  case AMITK_INTERPOLATION_TRILINEAR:
-
-    /* iterate over the frames we'll be incorporating into this slice */
-    for (ds_voxel.t = start_frame; ds_voxel.t <= end_frame; ds_voxel.t++) {
-      
-      /* averaging over more then one frame */
-      if (end_frame-start_frame > 0) {
-	if (ds_voxel.t == start_frame)
-	  time_weight = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
-	else if (ds_voxel.t == end_frame)
-	  time_weight = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
-	else
-	  time_weight = amitk_data_set_get_frame_duration(data_set, ds_voxel.t)/(duration*num_gates);
-      } else
-	time_weight = 1.0/((gdouble) num_gates);
-      
-      for (i_gate=0; i_gate < num_gates; i_gate++) {
-	if (gate < 0)
-	  ds_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(data_set);
-	else
-	  ds_voxel.g = i_gate+gate;
-	
-	if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
-	  ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
-
-	/* initialize the .t/.g components of box_voxel */
-	for (l=0; l<8; l=l+1) {
-	  box_voxel[l].t = ds_voxel.t;
-	  box_voxel[l].g = ds_voxel.g;
-	}
-
-	/* iterate over the number of planes we'll be compressing into this slice */
-	for (z = 0; z < ceil(z_steps); z++) {
-	  
-	  /* the slices z_coordinate for this iteration's slice voxel */
-	  if (ceil(z_steps) > 1.0)
-	    slice_point.z = (z+0.5)*voxel_length;
-	  else
-	    slice_point.z = (0.5)*slice->voxel_size.z; /* only one iteration in z */
-	  
-	  /* weight is between 0 and 1, this is used to weight the last voxel in the slice's z direction */
-	  if (floor(z_steps) > z)
-	    weight = time_weight/z_steps;
-	  else
-	    weight = time_weight*(z_steps-floor(z_steps)) / z_steps;
-	  
-	  /* iterate over the y dimension */
-	  for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) {
-	    
-	    /* the slice y_coordinate of the center of this iteration's slice voxel */
-	    slice_point.y = (((amide_real_t) i_voxel.y)+0.5)*slice->voxel_size.y;
-	    
-	    /* the slice x coord of the center of the first slice voxel in this loop */
-	    slice_point.x = (((amide_real_t) start.x)+0.5)*slice->voxel_size.x;
-	    
-	    /* iterate over the x dimension */
-	    for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) {
-	      
-	      /* translate the current point in slice space into the data set's coordinate frame */
-	      ds_point = amitk_space_s2s(slice_space, data_set_space, slice_point);
-	      
-	      /* get the nearest neighbor in the data set to this slice voxel */
-	      POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-	      VOXEL_TO_POINT(ds_voxel, data_set->voxel_size, nearest_point);
-	      
-	      /* figure out which way to go to get the nearest voxels to our slice voxel*/
-	      POINT_SUB(ds_point, nearest_point, diff);
-	      
-	      /* figure out which voxels to look at */
-	      for (l=0; l<8; l=l+1) {
-		if (diff.x < 0)
-		  box_voxel[l].x = (l & 0x1) ? ds_voxel.x-1 : ds_voxel.x;
-		else /* diff.x >= 0 */
-		  box_voxel[l].x = (l & 0x1) ? ds_voxel.x : ds_voxel.x+1;
-		if (diff.y < 0)
-		  box_voxel[l].y = (l & 0x2) ? ds_voxel.y-1 : ds_voxel.y;
-		else /* diff.y >= 0 */
-		  box_voxel[l].y = (l & 0x2) ? ds_voxel.y : ds_voxel.y+1;
-		if (diff.z < 0)
-		  box_voxel[l].z = (l & 0x4) ? ds_voxel.z-1 : ds_voxel.z;
-		else /* diff.z >= 0 */
-		  box_voxel[l].z = (l & 0x4) ? ds_voxel.z : ds_voxel.z+1;
-		
-		VOXEL_TO_POINT(box_voxel[l], data_set->voxel_size, box_point[l]);
-		
-		/* get the value of the point on the box */
-		if (amitk_raw_data_includes_voxel(data_set->raw_data, box_voxel[l]))
-		  box_value[l] = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, box_voxel[l]);
-		else {
-		  box_value[l] = NAN;
-		  empties = TRUE;
-		}
-	      }
-	      
-	      if (empties) { /* slow algorithm - checking for empties */
-		/* reset value */
-		empties = FALSE; 
-
-		/* do the x direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+2) {
-		  max_diff = box_point[l+1].x-box_point[l].x;
-		  weight1 = ((max_diff - (ds_point.x - box_point[l].x))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+1].x - ds_point.x))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+1];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+1])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
-		}
-		
-		/* do the y direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+4) {
-		  max_diff = box_point[l+2].y-box_point[l].y;
-		  weight1 = ((max_diff - (ds_point.y - box_point[l].y))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+2].y - ds_point.y))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+2];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+2])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
-		}
-		
-		/* do the z direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+8) {
-		  max_diff = box_point[l+4].z-box_point[l].z;
-		  weight1 = ((max_diff - (ds_point.z - box_point[l].z))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+4].z - ds_point.z))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+4];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+4])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
-		}
+  /* figure out how much each of the frames we'll be incorporating into this slice gets weighted */
+  for (i_frame = start_frame; i_frame <= end_frame; i_frame++) {
+    amitk_data_set_request_frame(data_set, i_frame, gate);
+    if (end_frame-start_frame > 0) { /* averaging over more then one frame */
+      if (i_frame == start_frame)
+	time_weights[i_frame-start_frame] = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
+      else if (i_frame == end_frame)
+	time_weights[i_frame-start_frame] = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
+      else
+	time_weights[i_frame-start_frame] = amitk_data_set_get_frame_duration(data_set, i_frame)/(duration*num_gates);
+    } else
+      time_weights[i_frame-start_frame] = 1.0/((gdouble) num_gates);
+  }
 
-		/* separate into MPR/MIP/minIP algorithms */
-		if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
-		  if (!isnan(box_value[0])) {
-		    intermediate_data[k] += weight*box_value[0];
-		    weights[k] += weight;
-		  }
-		} else { /* MIP or MINIP */
-		  if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) 
-		    intermediate_data[k]=box_value[0];
-		  else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
-		    intermediate_data[k] = MAX(box_value[0], intermediate_data[k]);
-		  else  /* MINIP */
-		    intermediate_data[k] = MIN(box_value[0], intermediate_data[k]);
-		}
+  gs.data_set = data_set;
+  gs.start = start;
+  gs.end = end;
+  gs.start_frame = start_frame;
+  gs.end_frame = end_frame;
+  gs.start_gate = (gate < 0) ? view_start_gate : gate;
+  gs.num_gates = num_gates;
+  gs.time_weights = time_weights;
+  gs.z_steps = z_steps;
+  gs.weights = weights;
+  gs.intermediate_data = intermediate_data;
+
+  /* pick the interior kernel, the vector ones do their indexing with 32 bit integers */
+  gs.interior_row = interior_row_scalar;
+#ifdef AMIDE_SIMD_SUPPORT
+  if (((gint64) AMITK_DATA_SET_DIM_X(data_set))*AMITK_DATA_SET_DIM_Y(data_set)*AMITK_DATA_SET_DIM_Z(data_set) < G_MAXINT32) {
+    switch(amitk_get_simd()) {
+    case AMITK_SIMD_AVX2:
+      gs.interior_row = interior_row_avx2;
+      break;
+    case AMITK_SIMD_SSE2:
+      gs.interior_row = interior_row_sse2;
+      break;
+    default:
+      break;
+    }
+  }
+#endif
 
-	      } else { /* faster */
-		/* do the x direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+2) {
-		  max_diff = box_point[l+1].x-box_point[l].x;
-		  weight1 = ((max_diff - (ds_point.x - box_point[l].x))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+1].x - ds_point.x))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
-		}
-		
-		/* do the y direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+4) {
-		  max_diff = box_point[l+2].y-box_point[l].y;
-		  weight1 = ((max_diff - (ds_point.y - box_point[l].y))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+2].y - ds_point.y))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
-		}
-		
-		/* do the z direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+8) {
-		  max_diff = box_point[l+4].z-box_point[l].z;
-		  weight1 = ((max_diff - (ds_point.z - box_point[l].z))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+4].z - ds_point.z))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
-		}
+  /* figure out what point in the data set we're going to start at */
+  gs.start_point.x = ((amide_real_t) start.x+0.5) * slice->voxel_size.x;
+  gs.start_point.y = ((amide_real_t) start.y+0.5) * slice->voxel_size.y;
+  if (ceil(z_steps) > 1.0)
+    gs.start_point.z = voxel_length/2.0;
+  else
+    gs.start_point.z = slice->voxel_size.z/2.0; /* only one iteration in z */
+  gs.start_point = amitk_space_s2s(slice_space, data_set_space, gs.start_point);
+
+  /* figure out what stepping one voxel in a given direction in our slice cooresponds to in our data set */
+  for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++) {
+    alt.x = (i_axis == AMITK_AXIS_X) ? slice->voxel_size.x : 0.0;
+    alt.y = (i_axis == AMITK_AXIS_Y) ? slice->voxel_size.y : 0.0;
+    alt.z = (i_axis == AMITK_AXIS_Z) ? voxel_length : 0.0;
+    alt = point_add(point_sub(amitk_space_s2b(slice_space, alt),
+			      AMITK_SPACE_OFFSET(slice_space)),
+		    AMITK_SPACE_OFFSET(data_set_space));
+    gs.stride[i_axis] = amitk_space_b2s(data_set_space, alt);
+  }
 
-		/* separate into MPR/MIP/minIP algorithms */
-		if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
-		  intermediate_data[k] += weight*box_value[0];
-		  weights[k] += weight;
-		} else { /* MIP or MINIP */
-		  if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) 
-		    intermediate_data[k]=box_value[0];
-		  else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
-		    intermediate_data[k] = MAX(intermediate_data[k], box_value[0]);
-		  else  /* MINIP */
-		    intermediate_data[k] = MIN(intermediate_data[k], box_value[0]);
-		}
-	      } /* slow (empties) vs fast algorithm */
-	      
-	      slice_point.x += slice->voxel_size.x; 
-	    }
-	  }
-	}
-      }
-    }
+  /* the rows of the slice are independent of each other, so split them up over the worker threads */
+  switch(interpolation) {
+    
+  case AMITK_INTERPOLATION_TRILINEAR:
+    amitk_parallel_for(end.y-start.y+1, get_slice_trilinear_rows, &gs);
     break;
 
   case AMITK_INTERPOLATION_NEAREST_NEIGHBOR:
   default:  
-    /* figure out what point in the data set we're going to start at */
-    start_point.x = ((amide_real_t) start.x+0.5) * slice->voxel_size.x;
-    start_point.y = ((amide_real_t) start.y+0.5) * slice->voxel_size.y;
-    if (ceil(z_steps) > 1.0)
-      start_point.z = voxel_length/2.0;
-    else
-      start_point.z = slice->voxel_size.z/2.0; /* only one iteration in z */
-    start_point = amitk_space_s2s(slice_space, data_set_space, start_point);
-
-    /* figure out what stepping one voxel in a given direction in our slice cooresponds to in our data set */
-    for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++) {
-      alt.x = (i_axis == AMITK_AXIS_X) ? slice->voxel_size.x : 0.0;
-      alt.y = (i_axis == AMITK_AXIS_Y) ? slice->voxel_size.y : 0.0;
-      alt.z = (i_axis == AMITK_AXIS_Z) ? voxel_length : 0.0;
-      alt = point_add(point_sub(amitk_space_s2b(slice_space, alt),
-				AMITK_SPACE_OFFSET(slice_space)),
-		      AMITK_SPACE_OFFSET(data_set_space));
-      stride[i_axis] = amitk_space_b2s(data_set_space, alt);
-    }
-
-    /* iterate over the number of frames we'll be incorporating into this slice */
-    for (ds_voxel.t = start_frame; ds_voxel.t <= end_frame; ds_voxel.t++) {
-
-      /* averaging over more then one frame */
-      if (end_frame-start_frame > 0) {
-	if (ds_voxel.t == start_frame)
-	  time_weight = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
-	else if (ds_voxel.t == end_frame)
-	  time_weight = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
-	else
-	  time_weight = amitk_data_set_get_frame_duration(data_set, ds_voxel.t)/(duration*num_gates);
-      } else
-	time_weight = 1.0/((gdouble) num_gates);
-
-      /* iterate over gates */
-      for (i_gate=0; i_gate < num_gates; i_gate++) {
-	if (gate < 0)
-	  ds_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(data_set);
-	else
-	  ds_voxel.g = i_gate+gate;
-
-	if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
-	  ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
-
-	ds_point = start_point;
-
-	/* separate into MPR and MIP/MINIP algorithms. A fair amount
-	   of code is duplicated within the algorithms. The reason
-	   they aren't combined is to keep the MPR vs MIP/MINIP branch
-	   point out of the loop and speed things up slightly for the
-	   most commonly used selection (MPR) */
-
-	switch(data_set->rendering) {
-
-	case AMITK_RENDERING_MPR:
-	  /* iterate over the number of planes we'll be compressing into this slice */
-	  for (z = 0; z < ceil(z_steps); z++) { 
-	    last[AMITK_AXIS_Z] = ds_point;
-	  
-	    /* weight is between 0 and 1, this is used to weight the last voxel  in the slice's z direction */
-	    if (floor(z_steps) > z)
-	      weight = time_weight/z_steps;
-	    else
-	      weight = time_weight*(z_steps-floor(z_steps)) / z_steps;
-	  
-	    /* iterate over x and y */
-	    for (i_voxel.y = start.y, k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-	      last[AMITK_AXIS_Y] = ds_point;
-	      for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++, k++) { 
-		POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) {
-		  intermediate_data[k] +=
-		    weight*AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
-		  weights[k] += weight;
-		}
-		POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-	      } /* x */
-	      POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-	    } /* y */
-	    
-	    POINT_ADD(last[AMITK_AXIS_Z], stride[AMITK_AXIS_Z], ds_point); 
-	  } /* z */
-	  break;
-
-	case AMITK_RENDERING_MIP:
-	case AMITK_RENDERING_MINIP:
-
-	  /* iterate over the number of planes we'll be compressing into this slice */
-	  for (z = 0; z < ceil(z_steps); z++) { 
-	    last[AMITK_AXIS_Z] = ds_point;
-
-	    /* need to initialize based on the first plane we encounter */
-	    if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) {
-	      /* iterate over x and y */
-	      for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) {
-		last[AMITK_AXIS_Y] = ds_point;
-		for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) {
-		  POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		  if (!amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		    intermediate_data[k] = NAN;
-		  else
-		    intermediate_data[k] =
-		      AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
-		  POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		} /* x */
-		POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-	      } /* y */
-
-	    } else { /* iterate over everything that's not the first plane */
-
-	      if (data_set->rendering == AMITK_RENDERING_MIP) {
-		/* iterate over x and y */
-		for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-		  last[AMITK_AXIS_Y] = ds_point;
-		  for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) { 
-		    POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		    if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		      intermediate_data[k] = 
-			MAX(intermediate_data[k],
-			    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
-		    POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		  } /* x */
-		  POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-		} /* y */ 
-	      } else { /* AMITK_RENDERING_MINIP */
-		/* iterate over x and y */
-		for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-		  last[AMITK_AXIS_Y] = ds_point;
-		  for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) { 
-		    POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		    if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		      intermediate_data[k] = 
-			MIN(intermediate_data[k],
-			    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
-		    POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		  } /* x */
-		  POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-		} /* y */ 
-	      } /* end else, MIP vs MINIP */
-	    } /* end else */
-	      
-	    POINT_ADD(last[AMITK_AXIS_Z], stride[AMITK_AXIS_Z], ds_point); 
-	  } /* z */
-	  break;
-
-	default:
-	  break;
-	} /* MIP vs NON-MIP */
-
-      } /* iterating over gates */
-    } /* iterating over frames */
+    amitk_parallel_for(end.y-start.y+1, get_slice_nearest_neighbor_rows, &gs);
     break;
   }
 
@@ -733,6 +1291,7 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
 
   if (weights != NULL) g_free(weights);
   if (intermediate_data != NULL) g_free(intermediate_data);
+  if (time_weights != NULL) g_free(time_weights);
 
   return slice;
 }
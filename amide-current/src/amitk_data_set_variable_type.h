@@ -76,13 +76,27 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_calc_slice_min_max(Ami
 									     const amide_intpoint_t gate,
 									     const amide_intpoint_t z,
 									     amitk_format_DOUBLE_t * pmin,
-									     amitk_format_DOUBLE_t * pmax);
+									     amitk_format_DOUBLE_t * pmax,
+									     guint64 * raw_histogram);
 void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_INTERCEPT_calc_slice_min_max(AmitkDataSet * data_set,
 										       const amide_intpoint_t frame,
 										       const amide_intpoint_t gate,
 										       const amide_intpoint_t z,
 										       amitk_format_DOUBLE_t * pmin,
-										       amitk_format_DOUBLE_t * pmax);
+										       amitk_format_DOUBLE_t * pmax,
+											       guint64 * raw_histogram);
+amide_data_t amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_get_value(const AmitkDataSet * data_set,
+									    const AmitkVoxel i);
+amide_data_t amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_INTERCEPT_get_value(const AmitkDataSet * data_set,
+										      const AmitkVoxel i);
+void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_get_row(const AmitkDataSet * data_set,
+								  const AmitkVoxel i,
+								  const gboolean internal,
+								  amide_data_t * row);
+void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_INTERCEPT_get_row(const AmitkDataSet * data_set,
+									    const AmitkVoxel i,
+									    const gboolean internal,
+									    amide_data_t * row);
 void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_calc_distribution(AmitkDataSet * data_set,
 									     AmitkUpdateFunc update_func,
 									    gpointer update_data);
@@ -93,12 +107,18 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_get_slice(Am
 									      const amide_time_t start_time,
 									      const amide_time_t duration,
 									      const amide_intpoint_t gate,
+									      const AmitkInterpolation interpolation,
+									      const amide_intpoint_t view_start_gate,
+									      const amide_intpoint_t view_end_gate,
 									      const AmitkCanvasPoint pixel_size,
 									      const AmitkVolume * slice_volume);
 AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_INTERCEPT_get_slice(AmitkDataSet * data_set,
 											const amide_time_t start_time,
 											const amide_time_t duration,
 											const amide_intpoint_t gate,
+											const AmitkInterpolation interpolation,
+											const amide_intpoint_t view_start_gate,
+											const amide_intpoint_t view_end_gate,
 											const AmitkCanvasPoint pixel_size,
 											const AmitkVolume * slice_volume);
 
@@ -0,0 +1,578 @@
+/* amitk_expression.c
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2026 the AMIDE contributors
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#include "amide_config.h"
+#include <math.h>
+#include <string.h>
+#include "amitk_expression.h"
+
+/* how deeply parentheses, function calls and signs can nest, which keeps the
+   parser's recursion and the evaluation stack within reason */
+#define MAX_NESTING 64
+
+/* the instructions of the stack program.  Unary operations work in place
+   on the top of the stack, binary operations combine the top of the stack
+   with their operand */
+typedef enum {
+  OP_PUSH,
+  OP_NEG,
+  OP_ABS,
+  OP_SQRT,
+  OP_EXP,
+  OP_LOG,
+  OP_LOG10,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_POW,
+  OP_MIN,
+  OP_MAX
+} op_t;
+
+/* where the (second) operand of an instruction comes from.  Binary operations
+   with a constant or a variable as their right hand side take it directly,
+   instead of pushing it first, which saves a pass over the row */
+typedef enum {
+  OPERAND_NONE,
+  OPERAND_STACK, /* popped off the stack */
+  OPERAND_CONSTANT,
+  OPERAND_VARIABLE
+} operand_t;
+
+typedef struct instruction_t {
+  op_t op;
+  operand_t operand;
+  gint variable;
+  amide_data_t constant;
+} instruction_t;
+
+struct _AmitkExpression {
+  gchar * text;
+  instruction_t * program;
+  gint num_instructions;
+  gint max_depth; /* most rows on the stack at any one time */
+  gint num_variables; /* one past the highest variable used */
+  guint32 used; /* bit mask of the variables used */
+};
+
+typedef struct function_t {
+  const gchar * name;
+  gint num_args; /* -1 for two or more */
+  op_t op;
+} function_t;
+
+static const function_t functions[] = {
+  {"abs",   1, OP_ABS},
+  {"sqrt",  1, OP_SQRT},
+  {"exp",   1, OP_EXP},
+  {"log",   1, OP_LOG},
+  {"log10", 1, OP_LOG10},
+  {"pow",   2, OP_POW},
+  {"min",  -1, OP_MIN},
+  {"max",  -1, OP_MAX},
+  {NULL,    0, OP_PUSH}
+};
+
+/* state of the recursive descent parser */
+typedef struct parser_t {
+  const gchar * text;
+  const gchar * pos;
+  GArray * program;
+  gchar * error;
+  gint nesting; /* how many unary's deep we are */
+} parser_t;
+
+
+static gboolean parse_sum(parser_t * parser);
+
+
+
+static void parser_skip_space(parser_t * parser) {
+  while (g_ascii_isspace(*parser->pos))
+    parser->pos++;
+}
+
+static gboolean parser_fail(parser_t * parser, const gchar * message) {
+  if (parser->error == NULL)
+    parser->error = g_strdup_printf(_("%s at position %d of \"%s\""), message,
+				    (gint) (parser->pos-parser->text)+1, parser->text);
+  return FALSE;
+}
+
+static instruction_t * parser_last(parser_t * parser) {
+  if (parser->program->len == 0) return NULL;
+  return &g_array_index(parser->program, instruction_t, parser->program->len-1);
+}
+
+static void parser_emit_push(parser_t * parser, const operand_t operand,
+			     const gint variable, const amide_data_t constant) {
+  instruction_t instruction;
+
+  instruction.op = OP_PUSH;
+  instruction.operand = operand;
+  instruction.variable = variable;
+  instruction.constant = constant;
+  g_array_append_val(parser->program, instruction);
+}
+
+/* the value of a constant operation, done at compile time */
+static amide_data_t op_constant(const op_t op, const amide_data_t a, const amide_data_t b) {
+  switch(op) {
+  case OP_NEG:   return -a;
+  case OP_ABS:   return fabs(a);
+  case OP_SQRT:  return sqrt(a);
+  case OP_EXP:   return exp(a);
+  case OP_LOG:   return log(a);
+  case OP_LOG10: return log10(a);
+  case OP_ADD:   return a+b;
+  case OP_SUB:   return a-b;
+  case OP_MUL:   return a*b;
+  case OP_DIV:   return a/b;
+  case OP_POW:   return pow(a,b);
+  case OP_MIN:   return (a < b) ? a : b;
+  case OP_MAX:   return (a > b) ? a : b;
+  default:       return NAN;
+  }
+}
+
+/* the last instruction produced the value on top of the stack, so if it's a push
+   of a constant, that value is known now */
+static void parser_emit_unary(parser_t * parser, const op_t op) {
+  instruction_t instruction;
+  instruction_t * last;
+
+  last = parser_last(parser);
+  if ((last != NULL) && (last->op == OP_PUSH) && (last->operand == OPERAND_CONSTANT)) {
+    last->constant = op_constant(op, last->constant, 0.0);
+    return;
+  }
+
+  instruction.op = op;
+  instruction.operand = OPERAND_NONE;
+  instruction.variable = 0;
+  instruction.constant = 0.0;
+  g_array_append_val(parser->program, instruction);
+}
+
+/* called after both sides have been emitted.  If the right hand side was a lone
+   push it becomes the operand, and if the left hand side is then a constant
+   as well the whole thing gets folded */
+static void parser_emit_binary(parser_t * parser, const op_t op) {
+  instruction_t instruction;
+  instruction_t * last;
+
+  instruction.op = op;
+  instruction.operand = OPERAND_STACK;
+  instruction.variable = 0;
+  instruction.constant = 0.0;
+
+  last = parser_last(parser);
+  if ((last != NULL) && (last->op == OP_PUSH)) {
+    instruction.operand = last->operand;
+    instruction.variable = last->variable;
+    instruction.constant = last->constant;
+    g_array_set_size(parser->program, parser->program->len-1);
+
+    last = parser_last(parser);
+    if ((instruction.operand == OPERAND_CONSTANT) && (last != NULL) &&
+	(last->op == OP_PUSH) && (last->operand == OPERAND_CONSTANT)) {
+      last->constant = op_constant(op, last->constant, instruction.constant);
+      return;
+    }
+  }
+
+  g_array_append_val(parser->program, instruction);
+}
+
+/* primary := number | variable | function '(' sum [',' sum]* ')' | '(' sum ')' */
+static gboolean parse_primary(parser_t * parser) {
+
+  const gchar * start;
+  gchar * end;
+  gchar * name;
+  amide_data_t value;
+  gint i_function, num_args;
+
+  parser_skip_space(parser);
+  start = parser->pos;
+
+  if (g_ascii_isdigit(*start) || ((*start == '.') && g_ascii_isdigit(start[1]))) {
+    value = g_ascii_strtod(start, &end);
+    parser->pos = end;
+    parser_emit_push(parser, OPERAND_CONSTANT, 0, value);
+    return TRUE;
+  }
+
+  if (g_ascii_isupper(*start) && !g_ascii_isalnum(start[1]) && (start[1] != '_')) {
+    parser_emit_push(parser, OPERAND_VARIABLE, *start-'A', 0.0);
+    parser->pos++;
+    return TRUE;
+  }
+
+  if (*start == '(') {
+    parser->pos++;
+    if (!parse_sum(parser)) return FALSE;
+    parser_skip_space(parser);
+    if (*parser->pos != ')') return parser_fail(parser, _("Expected ')'"));
+    parser->pos++;
+    return TRUE;
+  }
+
+  if (g_ascii_isalpha(*start)) {
+    while (g_ascii_isalnum(*parser->pos) || (*parser->pos == '_'))
+      parser->pos++;
+    name = g_strndup(start, parser->pos-start);
+    for (i_function=0; functions[i_function].name != NULL; i_function++)
+      if (strcmp(name, functions[i_function].name) == 0)
+	break;
+    g_free(name);
+
+    if (functions[i_function].name == NULL) {
+      parser->pos = start;
+      return parser_fail(parser, _("Unknown function or variable (variables are A through Z)"));
+    }
+
+    parser_skip_space(parser);
+    if (*parser->pos != '(') return parser_fail(parser, _("Expected '('"));
+    parser->pos++;
+
+    if (!parse_sum(parser)) return FALSE;
+    num_args = 1;
+    parser_skip_space(parser);
+    while (*parser->pos == ',') {
+      parser->pos++;
+      if (!parse_sum(parser)) return FALSE;
+      num_args++;
+      if (functions[i_function].num_args < 0)
+	parser_emit_binary(parser, functions[i_function].op);
+      parser_skip_space(parser);
+    }
+    if (*parser->pos != ')') return parser_fail(parser, _("Expected ')'"));
+
+    if ((functions[i_function].num_args < 0) ? (num_args < 2) :
+	(num_args != functions[i_function].num_args)) {
+      parser->pos = start;
+      return parser_fail(parser, _("Wrong number of arguments to function"));
+    }
+    parser->pos++;
+
+    if (functions[i_function].num_args == 1)
+      parser_emit_unary(parser, functions[i_function].op);
+    else if (functions[i_function].num_args == 2)
+      parser_emit_binary(parser, functions[i_function].op);
+
+    return TRUE;
+  }
+
+  if (*start == '\0')
+    return parser_fail(parser, _("Unexpected end of expression"));
+  else
+    return parser_fail(parser, _("Unexpected character"));
+}
+
+/* power := primary ['^' unary], right associative */
+static gboolean parse_unary(parser_t * parser);
+static gboolean parse_power(parser_t * parser) {
+
+  if (!parse_primary(parser)) return FALSE;
+  parser_skip_space(parser);
+  if (*parser->pos == '^') {
+    parser->pos++;
+    if (!parse_unary(parser)) return FALSE;
+    parser_emit_binary(parser, OP_POW);
+  }
+  return TRUE;
+}
+
+/* unary := ['-'|'+'] unary | power.  Everything that nests comes through here */
+static gboolean parse_unary(parser_t * parser) {
+
+  gboolean parsed;
+
+  if (parser->nesting >= MAX_NESTING) 
+    return parser_fail(parser, _("Expression is nested too deeply"));
+  parser->nesting++;
+
+  parser_skip_space(parser);
+  if (*parser->pos == '-') {
+    parser->pos++;
+    parsed = parse_unary(parser);
+    if (parsed) parser_emit_unary(parser, OP_NEG);
+  } else if (*parser->pos == '+') {
+    parser->pos++;
+    parsed = parse_unary(parser);
+  } else {
+    parsed = parse_power(parser);
+  }
+
+  parser->nesting--;
+  return parsed;
+}
+
+/* product := unary [('*'|'/') unary]* */
+static gboolean parse_product(parser_t * parser) {
+
+  op_t op;
+
+  if (!parse_unary(parser)) return FALSE;
+  parser_skip_space(parser);
+  while ((*parser->pos == '*') || (*parser->pos == '/')) {
+    op = (*parser->pos == '*') ? OP_MUL : OP_DIV;
+    parser->pos++;
+    if (!parse_unary(parser)) return FALSE;
+    parser_emit_binary(parser, op);
+    parser_skip_space(parser);
+  }
+  return TRUE;
+}
+
+/* sum := product [('+'|'-') product]* */
+static gboolean parse_sum(parser_t * parser) {
+
+  op_t op;
+
+  if (!parse_product(parser)) return FALSE;
+  parser_skip_space(parser);
+  while ((*parser->pos == '+') || (*parser->pos == '-')) {
+    op = (*parser->pos == '+') ? OP_ADD : OP_SUB;
+    parser->pos++;
+    if (!parse_product(parser)) return FALSE;
+    parser_emit_binary(parser, op);
+    parser_skip_space(parser);
+  }
+  return TRUE;
+}
+
+
+
+/* compiles the given expression.  Returns NULL if the expression doesn't
+   parse, in which case perror (if not NULL) gets a description of the problem,
+   which needs to be freed */
+AmitkExpression * amitk_expression_new(const gchar * text, gchar ** perror) {
+
+  AmitkExpression * expression;
+  parser_t parser;
+  gint i, depth;
+
+  if (perror != NULL) *perror = NULL;
+  g_return_val_if_fail(text != NULL, NULL);
+
+  parser.text = text;
+  parser.pos = text;
+  parser.program = g_array_new(FALSE, FALSE, sizeof(instruction_t));
+  parser.error = NULL;
+  parser.nesting = 0;
+
+  if (parse_sum(&parser)) {
+    parser_skip_space(&parser);
+    if (*parser.pos != '\0')
+      parser_fail(&parser, _("Unexpected character"));
+  }
+
+  if (parser.error != NULL) {
+    g_array_free(parser.program, TRUE);
+    if (perror != NULL) *perror = parser.error;
+    else g_free(parser.error);
+    return NULL;
+  }
+
+  if ((expression = g_try_new0(AmitkExpression, 1)) == NULL) {
+    g_warning(_("couldn't allocate memory space for the expression"));
+    g_array_free(parser.program, TRUE);
+    return NULL;
+  }
+  expression->text = g_strdup(text);
+  expression->num_instructions = parser.program->len;
+  expression->program = (instruction_t *) g_array_free(parser.program, FALSE);
+
+  /* figure out how deep the stack gets, and which variables we need */
+  depth = 0;
+  for (i=0; i < expression->num_instructions; i++) {
+    /* an operation needs its operands on the stack */
+    if ((expression->program[i].op != OP_PUSH) &&
+	(depth < ((expression->program[i].operand == OPERAND_STACK) ? 2 : 1)))
+      break;
+
+    if (expression->program[i].op == OP_PUSH)
+      depth++;
+    else if (expression->program[i].operand == OPERAND_STACK)
+      depth--;
+    expression->max_depth = MAX(expression->max_depth, depth);
+
+    if (expression->program[i].operand == OPERAND_VARIABLE) {
+      expression->used |= (1 << expression->program[i].variable);
+      expression->num_variables = MAX(expression->num_variables, expression->program[i].variable+1);
+    }
+  }
+
+  /* shouldn't happen, but a broken program would run off the end of the workspace */
+  if ((i < expression->num_instructions) || (depth != 1)) {
+    if (perror != NULL)
+      *perror = g_strdup_printf(_("Couldn't compile \"%s\""), text);
+    amitk_expression_free(expression);
+    return NULL;
+  }
+
+  return expression;
+}
+
+void amitk_expression_free(AmitkExpression * expression) {
+
+  if (expression == NULL) return;
+  g_free(expression->text);
+  g_free(expression->program);
+  g_free(expression);
+
+  return;
+}
+
+const gchar * amitk_expression_get_text(const AmitkExpression * expression) {
+  return expression->text;
+}
+
+gint amitk_expression_get_num_variables(const AmitkExpression * expression) {
+  return expression->num_variables;
+}
+
+gboolean amitk_expression_uses_variable(const AmitkExpression * expression, const gint variable) {
+  g_return_val_if_fail((variable >= 0) && (variable < AMITK_EXPRESSION_MAX_VARIABLES), FALSE);
+  return (expression->used & (1 << variable)) != 0;
+}
+
+gsize amitk_expression_get_workspace_size(const AmitkExpression * expression, const gint length) {
+  return ((gsize) expression->max_depth)*length;
+}
+
+
+/* the loops over the row for the binary operations, with the operand either a
+   constant or a row.  These are kept simple, so the compiler can vectorize them */
+#define EXPRESSION_BINARY_LOOP(op_expr)					\
+  if (instruction->operand == OPERAND_CONSTANT) {			\
+    c = instruction->constant;						\
+    for (x=0; x < length; x++) { a = top[x]; top[x] = (op_expr(a,c)); }	\
+  } else {								\
+    for (x=0; x < length; x++) { a = top[x]; c = b[x]; top[x] = (op_expr(a,c)); } \
+  }
+
+#define EXPRESSION_ADD(p,q) ((p)+(q))
+#define EXPRESSION_SUB(p,q) ((p)-(q))
+#define EXPRESSION_MUL(p,q) ((p)*(q))
+#define EXPRESSION_DIV(p,q) ((p)/(q))
+#define EXPRESSION_MIN(p,q) (((p) < (q)) ? (p) : (q))
+#define EXPRESSION_MAX(p,q) (((p) > (q)) ? (p) : (q))
+#define EXPRESSION_POW(p,q) (pow((p),(q)))
+
+/* runs the expression over "length" voxels.  inputs[i] holds the row for
+   variable i, and only needs to be filled in if amitk_expression_uses_variable.
+   The whole expression is done a row at a time, one pass per instruction,
+   so no intermediate data sets are needed.  workspace needs to be
+   amitk_expression_get_workspace_size big */
+void amitk_expression_apply(const AmitkExpression * expression,
+			    amide_data_t ** inputs,
+			    amitk_format_FLOAT_t * out,
+			    const gint length,
+			    amide_data_t * workspace) {
+
+  const instruction_t * instruction;
+  amide_data_t * top=NULL;
+  const amide_data_t * b=NULL;
+  amide_data_t a, c;
+  gint i, x, depth;
+
+  depth = 0;
+  for (i=0; i < expression->num_instructions; i++) {
+    instruction = &(expression->program[i]);
+
+    switch(instruction->operand) {
+    case OPERAND_STACK:
+      b = top;
+      depth--;
+      top = workspace + ((gsize) (depth-1))*length;
+      break;
+    case OPERAND_VARIABLE:
+      b = inputs[instruction->variable];
+      break;
+    default:
+      break;
+    }
+
+    switch(instruction->op) {
+    case OP_PUSH:
+      depth++;
+      top = workspace + ((gsize) (depth-1))*length;
+      if (instruction->operand == OPERAND_CONSTANT)
+	for (x=0; x < length; x++) top[x] = instruction->constant;
+      else
+	memcpy(top, b, sizeof(amide_data_t)*length);
+      break;
+    case OP_NEG:
+      for (x=0; x < length; x++) top[x] = -top[x];
+      break;
+    case OP_ABS:
+      for (x=0; x < length; x++) top[x] = fabs(top[x]);
+      break;
+    case OP_SQRT:
+      for (x=0; x < length; x++) top[x] = sqrt(top[x]);
+      break;
+    case OP_EXP:
+      for (x=0; x < length; x++) top[x] = exp(top[x]);
+      break;
+    case OP_LOG:
+      for (x=0; x < length; x++) top[x] = log(top[x]);
+      break;
+    case OP_LOG10:
+      for (x=0; x < length; x++) top[x] = log10(top[x]);
+      break;
+    case OP_ADD:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_ADD);
+      break;
+    case OP_SUB:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_SUB);
+      break;
+    case OP_MUL:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_MUL);
+      break;
+    case OP_DIV:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_DIV);
+      break;
+    case OP_POW:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_POW);
+      break;
+    case OP_MIN:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_MIN);
+      break;
+    case OP_MAX:
+      EXPRESSION_BINARY_LOOP(EXPRESSION_MAX);
+      break;
+    default:
+      g_error("unexpected case in %s at line %d", __FILE__, __LINE__);
+      break;
+    }
+  }
+
+  for (x=0; x < length; x++)
+    out[x] = top[x];
+
+  return;
+}
@@ -0,0 +1,57 @@
+/* amitk_expression.h
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2026 the AMIDE contributors
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#ifndef __AMITK_EXPRESSION_H__
+#define __AMITK_EXPRESSION_H__
+
+#include <glib-object.h>
+#include "amitk_raw_data.h"
+
+G_BEGIN_DECLS
+
+/* variables are the letters A through Z */
+#define AMITK_EXPRESSION_MAX_VARIABLES 26
+
+/* a formula such as "(A - B) / max(C, 1e-3) * 100", compiled into a small
+   stack program that gets run over a row of voxels at a time */
+typedef struct _AmitkExpression AmitkExpression;
+
+
+AmitkExpression * amitk_expression_new             (const gchar * text,
+						    gchar ** perror);
+void              amitk_expression_free            (AmitkExpression * expression);
+const gchar *     amitk_expression_get_text        (const AmitkExpression * expression);
+gint              amitk_expression_get_num_variables(const AmitkExpression * expression);
+gboolean          amitk_expression_uses_variable   (const AmitkExpression * expression,
+						    const gint variable);
+gsize             amitk_expression_get_workspace_size(const AmitkExpression * expression,
+						      const gint length);
+void              amitk_expression_apply           (const AmitkExpression * expression,
+						    amide_data_t ** inputs,
+						    amitk_format_FLOAT_t * out,
+						    const gint length,
+						    amide_data_t * workspace);
+
+G_END_DECLS
+
+#endif /* __AMITK_EXPRESSION_H__ */
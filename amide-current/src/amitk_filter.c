@@ -27,19 +27,52 @@
 #include <math.h>
 #include "amitk_filter.h"
 #include "amitk_type_builtins.h"
+#ifdef AMIDE_FFTW_SUPPORT
+#include <fftw3.h>
+#endif
 #ifdef AMIDE_LIBGSL_SUPPORT
-#include <gsl/gsl_complex_math.h>
+#include <gsl/gsl_fft_complex.h>
 #endif
 
+typedef enum {
+  FFT_BACKEND_GSL,
+  FFT_BACKEND_FFTW
+} fft_backend_t;
+
+struct _AmitkFilterGaussian1D {
+  gboolean recursive;
+  gint kernel_size;
+  gdouble * kernel; /* direct convolution */
+  gdouble b[4]; /* recursive filter coefficients, b[1..3] already divided by b[0] */
+  gdouble B;
+  gint padding; /* zeros on either side of the line for the recursive filter */
+};
+
+struct _AmitkFilterFFT {
+  fft_backend_t backend;
+  AmitkVoxel size;
+  gsize num_voxels;
+  amide_real_t * data; /* the real tile, x varying fastest */
+  gdouble * spectrum; /* packed complex, layout depends on the backend */
+  gsize spectrum_length; /* number of complex values in the spectrum */
+#ifdef AMIDE_FFTW_SUPPORT
+  fftw_plan forward_plan;
+  fftw_plan inverse_plan;
+#endif
+#ifdef AMIDE_LIBGSL_SUPPORT
+  gsl_fft_complex_wavetable * wavetable[3]; /* z, y, x */
+  gsl_fft_complex_workspace * workspace[3];
+#endif
+};
+
 static inline amide_real_t gaussian(amide_real_t x, amide_real_t sigma) {
   return exp(-(x*x)/(2.0*sigma*sigma))/(sigma*sqrt(2*M_PI));
 }
 
-/* gaussian kernel is returned in a packad array (alternating real and imaginary parts 
-   since the filter is entirely real, all imaginary parts are zero */
-AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel kernel_size,
-							      const AmitkPoint voxel_size,
-							      const amide_real_t fwhm) {
+/* returns the gaussian kernel as a real DOUBLE array with the dimensions of kernel_size */
+AmitkRawData * amitk_filter_calculate_gaussian_kernel(const AmitkVoxel kernel_size,
+						      const AmitkPoint voxel_size,
+						      const amide_real_t fwhm) {
 
   AmitkVoxel i_voxel;
   AmitkPoint location;
@@ -55,23 +88,10 @@ AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel k
   g_return_val_if_fail((kernel_size.y & 0x1), NULL); 
   g_return_val_if_fail((kernel_size.x & 0x1), NULL); 
 
-  if ((kernel = amitk_raw_data_new()) == NULL) {
+  if ((kernel = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, kernel_size)) == NULL) {
     g_warning(_("couldn't allocate memory space for the kernel structure"));
     return NULL;
   }
-  kernel->format = AMITK_FORMAT_DOUBLE;
-
-  g_free(kernel->data);
-  kernel->dim.t = kernel->dim.g = 1;
-  kernel->dim.z = kernel->dim.y = AMITK_FILTER_FFT_SIZE;
-  kernel->dim.x = 2*AMITK_FILTER_FFT_SIZE; /* real and complex */
-
-  /* get mem for the kernel, initialized to 0 */
-  if ((kernel->data = amitk_raw_data_get_data_mem0(kernel)) == NULL) {
-    g_warning(_("Couldn't allocate memory space for the kernel data"));
-    amitk_object_unref(kernel);
-    return NULL;
-  }
 
   sigma = fwhm/SIGMA_TO_FWHM;
   half.t = half.g = 0;
@@ -86,8 +106,8 @@ AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel k
     location.z = voxel_size.z*(i_voxel.z-half.z);
     for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++) {
       location.y = voxel_size.y*(i_voxel.y-half.y);
-      for (i_voxel.x = 0; i_voxel.x < 2*kernel_size.x; i_voxel.x+=2) {
-	location.x = voxel_size.x*(i_voxel.x/2-half.x);
+      for (i_voxel.x = 0; i_voxel.x < kernel_size.x; i_voxel.x++) {
+	location.x = voxel_size.x*(i_voxel.x-half.x);
 	gaussian_value = gaussian(point_mag(location), sigma);
 
 	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(kernel, i_voxel) = gaussian_value;
@@ -99,134 +119,563 @@ AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel k
   /* renormalize, as the tails are cut, and we've discretized the gaussian */
   for (i_voxel.z = 0; i_voxel.z < kernel_size.z; i_voxel.z++) 
     for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++) 
-      for (i_voxel.x = 0; i_voxel.x < 2*kernel_size.x; i_voxel.x+=2) 
+      for (i_voxel.x = 0; i_voxel.x < kernel_size.x; i_voxel.x++) 
 	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(kernel, i_voxel) /= total; 
 
   return kernel;
 }
 
-#ifdef AMIDE_LIBGSL_SUPPORT
-void amitk_filter_3D_FFT(AmitkRawData * data, 
-			   gsl_fft_complex_wavetable * wavetable,
-			   gsl_fft_complex_workspace * workspace) {
+/* sets up a 1D gaussian along an axis with the given voxel size.  The result
+   is the same as convolving with the 1D version of the (separable) kernel from
+   amitk_filter_calculate_gaussian_kernel.  If the kernel is wide enough that its
+   cutoff doesn't matter (at least +/- 3 sigma), sigma is big enough for the
+   approximation to be good, and it's less work, we use the recursive gaussian of
+   Young and van Vliet (Signal Processing 44:139-151, 1995) instead, whose cost
+   doesn't depend on the width of the gaussian */
+AmitkFilterGaussian1D * amitk_filter_gaussian_1D_new(const gint kernel_size,
+						      const amide_real_t voxel_size,
+						      const amide_real_t fwhm) {
+
+  AmitkFilterGaussian1D * gaussian_1D;
+  amide_real_t sigma;
+  gdouble q, total;
+  gint half, i;
 
-  AmitkVoxel i_voxel;
+  g_return_val_if_fail((kernel_size & 0x1), NULL); /* needs to be odd */
+  g_return_val_if_fail(voxel_size > 0.0, NULL);
 
-  
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_G(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == 2*AMITK_FILTER_FFT_SIZE);
-
-  /* FFT in the X direction */
-  i_voxel.t = i_voxel.g = i_voxel.x = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      1,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* FFT in the Y direction */
-  i_voxel.t = i_voxel.g = i_voxel.y = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			     wavetable, workspace);
-
-  /* FFT in the Z direction */
-  i_voxel.t = i_voxel.g = i_voxel.z = 0;
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE*AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
+  if ((gaussian_1D = g_try_new0(AmitkFilterGaussian1D, 1)) == NULL) {
+    g_warning(_("couldn't allocate memory space for the kernel structure"));
+    return NULL;
+  }
+
+  sigma = fwhm/(SIGMA_TO_FWHM*voxel_size); /* in voxels */
+  half = kernel_size>>1;
+  gaussian_1D->kernel_size = kernel_size;
+  gaussian_1D->recursive = ((sigma >= AMITK_FILTER_IIR_MIN_SIGMA) && 
+			    (half >= 3.0*sigma) &&
+			    (kernel_size > 8)); /* the recursive filter is ~8 multiply-adds */
+
+  if (gaussian_1D->recursive) {
+    if (sigma >= 2.5) q = 0.98711*sigma - 0.96330;
+    else q = 3.97156 - 4.14554*sqrt(1.0-0.26891*sigma);
+    gaussian_1D->b[0] = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+    gaussian_1D->b[1] = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q)/gaussian_1D->b[0];
+    gaussian_1D->b[2] = -(1.4281*q*q + 1.26661*q*q*q)/gaussian_1D->b[0];
+    gaussian_1D->b[3] = (0.422205*q*q*q)/gaussian_1D->b[0];
+    gaussian_1D->B = 1.0 - (gaussian_1D->b[1]+gaussian_1D->b[2]+gaussian_1D->b[3]);
+    gaussian_1D->padding = ceil(5.0*sigma);
+  } else {
+    if ((gaussian_1D->kernel = g_try_new(gdouble, kernel_size)) == NULL) {
+      g_warning(_("Couldn't allocate memory space for the kernel data"));
+      g_free(gaussian_1D);
+      return NULL;
+    }
+    total = 0.0;
+    for (i=0; i<kernel_size; i++) {
+      gaussian_1D->kernel[i] = gaussian(voxel_size*(i-half), fwhm/SIGMA_TO_FWHM);
+      total += gaussian_1D->kernel[i];
+    }
+    for (i=0; i<kernel_size; i++)
+      gaussian_1D->kernel[i] /= total;
+  }
+
+  return gaussian_1D;
+}
+
+void amitk_filter_gaussian_1D_free(AmitkFilterGaussian1D * gaussian_1D) {
+
+  if (gaussian_1D == NULL) return;
+  g_free(gaussian_1D->kernel);
+  g_free(gaussian_1D);
 
   return;
 }
 
-void amitk_filter_inverse_3D_FFT(AmitkRawData * data, 
-				   gsl_fft_complex_wavetable * wavetable,
-				   gsl_fft_complex_workspace * workspace) {
+gboolean amitk_filter_gaussian_1D_is_recursive(const AmitkFilterGaussian1D * gaussian_1D) {
+  return gaussian_1D->recursive;
+}
 
-  AmitkVoxel i_voxel;
+/* approximate number of multiply-adds per voxel */
+amide_real_t amitk_filter_gaussian_1D_get_work(const AmitkFilterGaussian1D * gaussian_1D) {
+  return gaussian_1D->recursive ? 8.0 : gaussian_1D->kernel_size;
+}
+
+/* number of gdouble's of workspace amitk_filter_gaussian_1D_apply needs */
+gsize amitk_filter_gaussian_1D_get_workspace_size(const AmitkFilterGaussian1D * gaussian_1D,
+						  const gint length,
+						  const gint width) {
+  if (gaussian_1D->recursive)
+    return ((gsize) (length+2*gaussian_1D->padding+3))*width;
+  else
+    return 0;
+}
+
+/* filters "length" rows of "width" values each along the row direction, row i
+   starting at in+i*width.  Outside of the data is taken to be zero.  The inner loops
+   all run over contiguous memory, so these vectorize whatever the width.  in and out
+   can't overlap.  workspace needs to be amitk_filter_gaussian_1D_get_workspace_size big */
+void amitk_filter_gaussian_1D_apply(const AmitkFilterGaussian1D * gaussian_1D,
+				    const gdouble * in,
+				    gdouble * out,
+				    const gint length,
+				    const gint width,
+				    gdouble * workspace) {
+
+  gint k, shift, half;
+  gint row, num_rows;
+  gsize j, start, end, total;
+  gdouble weight, B, b1, b2, b3;
+  const gdouble * in_shifted;
+  gdouble * r, * r1, * r2, * r3;
+
+  total = ((gsize) length)*width;
+
+  if (!gaussian_1D->recursive) {
+    half = gaussian_1D->kernel_size>>1;
+    for (j=0; j<total; j++) out[j] = 0.0;
+
+    /* out[i] += kernel[k]*in[i+k-half] for all i where in is defined, 
+       which is a single contiguous run of values */
+    for (k=0; k<gaussian_1D->kernel_size; k++) {
+      shift = k-half;
+      if (ABS(shift) >= length) continue;
+      weight = gaussian_1D->kernel[k];
+      start = (shift < 0) ? ((gsize) -shift)*width : 0;
+      end = (shift > 0) ? ((gsize) (length-shift))*width : total;
+      in_shifted = in+start+((gssize) shift)*width;
+      for (j=0; j<end-start; j++)
+	out[start+j] += weight*in_shifted[j];
+    }
+
+  } else {
+    B = gaussian_1D->B;
+    b1 = gaussian_1D->b[1];
+    b2 = gaussian_1D->b[2];
+    b3 = gaussian_1D->b[3];
+
+    /* the padding lets the causal pass run out past the end of the data, so starting
+       the anti-causal pass from zero is the same as having zeros past the data.  There's
+       3 more rows of zeros at the end, which the anti-causal pass starts from */
+    num_rows = length+2*gaussian_1D->padding;
+    start = ((gsize) gaussian_1D->padding)*width;
+    for (j=0; j<start; j++) workspace[j] = 0.0;
+    for (j=0; j<total; j++) workspace[start+j] = in[j];
+    for (j=start+total; j<(num_rows+3)*((gsize) width); j++) workspace[j] = 0.0;
+
+    /* causal pass, the first 3 rows are padding, and so stay zero */
+    for (row=3; row<num_rows; row++) {
+      r = workspace+((gsize) row)*width;
+      r1 = r-width;
+      r2 = r1-width;
+      r3 = r2-width;
+      for (j=0; j<width; j++)
+	r[j] = B*r[j] + b1*r1[j] + b2*r2[j] + b3*r3[j];
+    }
+
+    /* anti-causal pass */
+    for (row=num_rows-1; row>=0; row--) {
+      r = workspace+((gsize) row)*width;
+      r1 = r+width;
+      r2 = r1+width;
+      r3 = r2+width;
+      for (j=0; j<width; j++)
+	r[j] = B*r[j] + b1*r1[j] + b2*r2[j] + b3*r3[j];
+    }
+
+    for (j=0; j<total; j++) out[j] = workspace[start+j];
+  }
 
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_G(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == 2*AMITK_FILTER_FFT_SIZE);
-
-  /* inverse FFT in the X direction */
-  i_voxel.t = i_voxel.g = i_voxel.x = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      1,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* inverse FFT in the Y direction */
-  i_voxel.t = i_voxel.g = i_voxel.y = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* inverse FFT in the Z direction */
-  i_voxel.t = i_voxel.g = i_voxel.z = 0;
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-	gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-				AMITK_FILTER_FFT_SIZE*AMITK_FILTER_FFT_SIZE,
-				AMITK_FILTER_FFT_SIZE,
-				wavetable, workspace);
   return;
 }
 
-/* multiples the data by the kernel, both of which are in packed complex form */
-void amitk_filter_complex_mult(AmitkRawData * data, AmitkRawData * kernel) {
+#if defined(AMIDE_LIBGSL_SUPPORT) || defined(AMIDE_FFTW_SUPPORT)
 
-  AmitkVoxel i_voxel;
-  AmitkVoxel j_voxel;
-  gsl_complex a,b;
-  
+/* true if n only has factors of 2, 3, 5, and 7, which both FFTW and GSL
+   have fast code for */
+static gboolean fft_good_size(gint n) {
+  while ((n % 2) == 0) n /= 2;
+  while ((n % 3) == 0) n /= 3;
+  while ((n % 5) == 0) n /= 5;
+  while ((n % 7) == 0) n /= 7;
+  return (n == 1);
+}
+
+/* fills in the tile lengths worth trying along one axis for overlap-add
+   filtering, returning how many there are.  The tiles either cover the whole
+   axis in one go, or give at least kernel-1 finished voxels each, which keeps
+   the overlap of each tile to its direct neighbors */
+static gint fft_axis_sizes(const gint kernel, const gint dim, gint * sizes) {
+
+  gint n, full_n;
+  gint num_sizes=0;
+
+  full_n = dim+kernel-1;
+  for (n = MIN(2*kernel-1, full_n); n <= AMITK_FILTER_FFT_MAX_SIZE; n++) {
+    if (!fft_good_size(n)) continue;
+    sizes[num_sizes++] = n;
+    if (n >= full_n) break; /* a bigger tile won't cut the number of tiles */
+  }
+
+  return num_sizes;
+}
 
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(kernel) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == AMITK_RAW_DATA_DIM_T(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_RAW_DATA_DIM_Z(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_RAW_DATA_DIM_Y(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == AMITK_RAW_DATA_DIM_X(kernel));
-
-
-  i_voxel.t = i_voxel.g = j_voxel.t = j_voxel.g = 0;
-  for (i_voxel.z = 0, j_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++, j_voxel.z++)
-    for (i_voxel.y = 0, j_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++, j_voxel.y++)
-      for (i_voxel.x = 0, j_voxel.x=1; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2, j_voxel.x+=2) {
-	a.dat[0] = AMITK_RAW_DATA_DOUBLE_CONTENT(data, i_voxel);
-	a.dat[1] = AMITK_RAW_DATA_DOUBLE_CONTENT(data, j_voxel);
-	b.dat[0] = AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, i_voxel);
-	b.dat[1] = AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, j_voxel);
-	a = gsl_complex_mul(a,b);
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(data, i_voxel) = a.dat[0];
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(data, j_voxel) = a.dat[1];
+/* returns the FFT tile size to use for convolving data of data_dim with
+   a kernel of kernel_size.  Only the x, y, and z dimensions are used.
+   A tile of N voxels takes about 2.5*N*log2(N) multiply-adds for the forward
+   and inverse transforms, plus a few per voxel for getting the data in and out, 
+   and we take the tile size that covers the data with the least total work.
+   If pwork isn't NULL, it's set to that work divided by the number of voxels
+   in the data, for comparing against other ways of filtering.  If no tile of
+   at most AMITK_FILTER_FFT_MAX_SIZE fits the kernel, the returned size is 
+   zero and the work is G_MAXDOUBLE. */
+AmitkVoxel amitk_filter_fft_choose_size(const AmitkVoxel kernel_size,
+					const AmitkVoxel data_dim,
+					amide_real_t * pwork) {
+
+  gint z_sizes[AMITK_FILTER_FFT_MAX_SIZE];
+  gint y_sizes[AMITK_FILTER_FFT_MAX_SIZE];
+  gint x_sizes[AMITK_FILTER_FFT_MAX_SIZE];
+  gint num_z, num_y, num_x;
+  gint i_z, i_y, i_x;
+  gdouble tiles_z, tiles_y, tiles_x;
+  gdouble cost, best_cost=0.0;
+  AmitkVoxel size;
+
+  size.t = size.g = 1;
+  size.z = size.y = size.x = 0;
+  num_z = fft_axis_sizes(kernel_size.z, data_dim.z, z_sizes);
+  num_y = fft_axis_sizes(kernel_size.y, data_dim.y, y_sizes);
+  num_x = fft_axis_sizes(kernel_size.x, data_dim.x, x_sizes);
+
+  for (i_z = 0; i_z < num_z; i_z++) {
+    tiles_z = ceil(data_dim.z/((gdouble) (z_sizes[i_z]-kernel_size.z+1)));
+    for (i_y = 0; i_y < num_y; i_y++) {
+      tiles_y = ceil(data_dim.y/((gdouble) (y_sizes[i_y]-kernel_size.y+1)));
+      for (i_x = 0; i_x < num_x; i_x++) {
+	tiles_x = ceil(data_dim.x/((gdouble) (x_sizes[i_x]-kernel_size.x+1)));
+	cost = tiles_z*tiles_y*tiles_x*
+	  z_sizes[i_z]*y_sizes[i_y]*x_sizes[i_x]*
+	  (2.5*(log2(z_sizes[i_z])+log2(y_sizes[i_y])+log2(x_sizes[i_x]))+4.0);
+	if ((size.z == 0) || (cost < best_cost)) {
+	  best_cost = cost;
+	  size.z = z_sizes[i_z];
+	  size.y = y_sizes[i_y];
+	  size.x = x_sizes[i_x];
+	}
       }
+    }
+  }
 
+  if (pwork != NULL) {
+    if (size.z == 0)
+      *pwork = G_MAXDOUBLE;
+    else
+      *pwork = best_cost/(((gdouble) data_dim.z)*data_dim.y*data_dim.x);
+  }
+
+  return size;
+}
+
+#ifdef AMIDE_FFTW_SUPPORT
+/* the FFTW planner isn't thread safe, so all the planning goes through this lock */
+G_LOCK_DEFINE_STATIC(fftw_planner);
+static gboolean fftw_wisdom_loaded = FALSE;
+
+static gchar * fftw_wisdom_filename(void) {
+  return g_build_filename(g_get_home_dir(), ".amide_fftw_wisdom", NULL);
+}
+
+static gboolean fft_fftw_init(AmitkFilterFFT * fft) {
+
+  gchar * filename;
+  gsize spectrum_voxels;
+
+  spectrum_voxels = ((gsize) fft->size.z)*fft->size.y*(fft->size.x/2+1);
+  fft->data = fftw_alloc_real(fft->num_voxels);
+  fft->spectrum = (gdouble *) fftw_alloc_complex(spectrum_voxels);
+  if ((fft->data == NULL) || (fft->spectrum == NULL))
+    return FALSE;
+  fft->spectrum_length = spectrum_voxels;
+
+  G_LOCK(fftw_planner);
+  filename = fftw_wisdom_filename();
+  if (!fftw_wisdom_loaded) {
+    fftw_import_wisdom_from_filename(filename); /* fine if this fails */
+    fftw_wisdom_loaded = TRUE;
+  }
+
+  /* FFTW_MEASURE plans are quick to make once the wisdom has them, 
+     and we save the wisdom so that's usually the case */
+  fft->forward_plan = fftw_plan_dft_r2c_3d(fft->size.z, fft->size.y, fft->size.x,
+					   fft->data, (fftw_complex *) fft->spectrum,
+					   FFTW_MEASURE);
+  fft->inverse_plan = fftw_plan_dft_c2r_3d(fft->size.z, fft->size.y, fft->size.x,
+					   (fftw_complex *) fft->spectrum, fft->data,
+					   FFTW_MEASURE);
+  if ((fft->forward_plan != NULL) && (fft->inverse_plan != NULL))
+    fftw_export_wisdom_to_filename(filename);
+  g_free(filename);
+  G_UNLOCK(fftw_planner);
+
+  return ((fft->forward_plan != NULL) && (fft->inverse_plan != NULL));
+}
+
+static void fft_fftw_free(AmitkFilterFFT * fft) {
+
+  G_LOCK(fftw_planner);
+  if (fft->forward_plan != NULL) fftw_destroy_plan(fft->forward_plan);
+  if (fft->inverse_plan != NULL) fftw_destroy_plan(fft->inverse_plan);
+  G_UNLOCK(fftw_planner);
+  fft->forward_plan = fft->inverse_plan = NULL;
+
+  if (fft->data != NULL) fftw_free(fft->data);
+  if (fft->spectrum != NULL) fftw_free(fft->spectrum);
+  fft->data = NULL;
+  fft->spectrum = NULL;
 
   return;
 }
+#endif /* AMIDE_FFTW_SUPPORT */
+
+#ifdef AMIDE_LIBGSL_SUPPORT
+static gboolean fft_gsl_init(AmitkFilterFFT * fft) {
+
+  gint axis;
+  gint n[3];
+
+  fft->data = g_try_new(amide_real_t, fft->num_voxels);
+  fft->spectrum = g_try_new(gdouble, 2*fft->num_voxels);
+  if ((fft->data == NULL) || (fft->spectrum == NULL))
+    return FALSE;
+  fft->spectrum_length = fft->num_voxels;
+
+  n[0] = fft->size.z;
+  n[1] = fft->size.y;
+  n[2] = fft->size.x;
+  for (axis=0; axis<3; axis++) {
+    fft->wavetable[axis] = gsl_fft_complex_wavetable_alloc(n[axis]);
+    fft->workspace[axis] = gsl_fft_complex_workspace_alloc(n[axis]);
+    if ((fft->wavetable[axis] == NULL) || (fft->workspace[axis] == NULL)) {
+      g_warning(_("Filtering: Failed to allocate wavetable and workspace"));
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
 
+static void fft_gsl_free(AmitkFilterFFT * fft) {
+
+  gint axis;
+
+  for (axis=0; axis<3; axis++) {
+    if (fft->wavetable[axis] != NULL) gsl_fft_complex_wavetable_free(fft->wavetable[axis]);
+    if (fft->workspace[axis] != NULL) gsl_fft_complex_workspace_free(fft->workspace[axis]);
+    fft->wavetable[axis] = NULL;
+    fft->workspace[axis] = NULL;
+  }
+
+  g_free(fft->data);
+  g_free(fft->spectrum);
+  fft->data = NULL;
+  fft->spectrum = NULL;
+
+  return;
+}
+
+/* 1D complex FFTs along each axis of the packed complex spectrum */
+static void fft_gsl_transform(AmitkFilterFFT * fft, gsl_fft_direction sign) {
+
+  gsize plane_size, row_size;
+  gint x, y, z;
+
+  row_size = fft->size.x;
+  plane_size = fft->size.y*row_size;
+
+  for (z=0; z < fft->size.z; z++) 
+    for (y=0; y < fft->size.y; y++) 
+      gsl_fft_complex_transform(fft->spectrum+2*(z*plane_size+y*row_size), 1, fft->size.x,
+				fft->wavetable[2], fft->workspace[2], sign);
+
+  for (z=0; z < fft->size.z; z++) 
+    for (x=0; x < fft->size.x; x++) 
+      gsl_fft_complex_transform(fft->spectrum+2*(z*plane_size+x), row_size, fft->size.y,
+				fft->wavetable[1], fft->workspace[1], sign);
+
+  for (y=0; y < fft->size.y; y++) 
+    for (x=0; x < fft->size.x; x++) 
+      gsl_fft_complex_transform(fft->spectrum+2*(y*row_size+x), plane_size, fft->size.z,
+				fft->wavetable[0], fft->workspace[0], sign);
+
+  return;
+}
+#endif /* AMIDE_LIBGSL_SUPPORT */
+
+
+/* allocates an FFT for tiles of the given size (only x, y, and z are used).
+   Each AmitkFilterFFT can only be used by one thread at a time, but any number
+   of them can be in use at once. */
+AmitkFilterFFT * amitk_filter_fft_new(const AmitkVoxel size) {
+
+  AmitkFilterFFT * fft;
+  gboolean good = FALSE;
+
+  g_return_val_if_fail((size.x > 0) && (size.y > 0) && (size.z > 0), NULL);
+
+  fft = g_try_new0(AmitkFilterFFT, 1);
+  if (fft == NULL) {
+    g_warning(_("couldn't allocate memory space for the FFT"));
+    return NULL;
+  }
+  fft->size = size;
+  fft->size.t = fft->size.g = 1;
+  fft->num_voxels = ((gsize) size.z)*size.y*size.x;
+
+#ifdef AMIDE_FFTW_SUPPORT
+  fft->backend = FFT_BACKEND_FFTW;
+  good = fft_fftw_init(fft);
+  if (!good) fft_fftw_free(fft);
+#endif
+#ifdef AMIDE_LIBGSL_SUPPORT
+  if (!good) {
+    fft->backend = FFT_BACKEND_GSL;
+    good = fft_gsl_init(fft);
+  }
 #endif
 
+  if (!good) {
+    amitk_filter_fft_free(fft);
+    g_warning(_("couldn't allocate memory space for the FFT"));
+    return NULL;
+  }
+
+  return fft;
+}
+
+void amitk_filter_fft_free(AmitkFilterFFT * fft) {
+
+  if (fft == NULL) return;
+
+  switch(fft->backend) {
+#ifdef AMIDE_FFTW_SUPPORT
+  case FFT_BACKEND_FFTW:
+    fft_fftw_free(fft);
+    break;
+#endif
+#ifdef AMIDE_LIBGSL_SUPPORT
+  case FFT_BACKEND_GSL:
+    fft_gsl_free(fft);
+    break;
+#endif
+  default:
+    break;
+  }
+
+  g_free(fft);
+  return;
+}
+
+AmitkVoxel amitk_filter_fft_get_size(const AmitkFilterFFT * fft) {
+  return fft->size;
+}
+
+/* the real valued tile, of size.z*size.y*size.x values with x varying the fastest.
+   The input to amitk_filter_fft_forward, and the output of amitk_filter_fft_inverse */
+amide_real_t * amitk_filter_fft_get_data(AmitkFilterFFT * fft) {
+  return fft->data;
+}
+
+/* transforms the tile into the spectrum, the tile is left undefined */
+void amitk_filter_fft_forward(AmitkFilterFFT * fft) {
+
+  gsize i;
+
+  switch(fft->backend) {
+#ifdef AMIDE_FFTW_SUPPORT
+  case FFT_BACKEND_FFTW:
+    fftw_execute(fft->forward_plan);
+    break;
+#endif
+#ifdef AMIDE_LIBGSL_SUPPORT
+  case FFT_BACKEND_GSL:
+    for (i=0; i < fft->num_voxels; i++) {
+      fft->spectrum[2*i] = fft->data[i];
+      fft->spectrum[2*i+1] = 0.0;
+    }
+    fft_gsl_transform(fft, gsl_fft_forward);
+    break;
+#endif
+  default:
+    g_error("unexpected case in %s at line %d", __FILE__, __LINE__);
+    break;
+  }
+
+  return;
+}
+
+/* transforms the spectrum back into the (normalized) tile, the spectrum
+   is left undefined */
+void amitk_filter_fft_inverse(AmitkFilterFFT * fft) {
+
+  gsize i;
+  gdouble scale;
+
+  switch(fft->backend) {
+#ifdef AMIDE_FFTW_SUPPORT
+  case FFT_BACKEND_FFTW:
+    fftw_execute(fft->inverse_plan);
+    scale = 1.0/fft->num_voxels; /* FFTW doesn't normalize */
+    for (i=0; i < fft->num_voxels; i++)
+      fft->data[i] *= scale;
+    break;
+#endif
+#ifdef AMIDE_LIBGSL_SUPPORT
+  case FFT_BACKEND_GSL:
+    fft_gsl_transform(fft, gsl_fft_backward);
+    scale = 1.0/fft->num_voxels;
+    for (i=0; i < fft->num_voxels; i++)
+      fft->data[i] = scale*fft->spectrum[2*i];
+    break;
+#endif
+  default:
+    g_error("unexpected case in %s at line %d", __FILE__, __LINE__);
+    break;
+  }
+
+  return;
+}
+
+/* returns a copy of the current spectrum, for use with amitk_filter_fft_multiply_spectrum
+   on any AmitkFilterFFT of the same size.  Free with g_free. */
+gdouble * amitk_filter_fft_copy_spectrum(const AmitkFilterFFT * fft) {
+  return g_memdup(fft->spectrum, 2*fft->spectrum_length*sizeof(gdouble));
+}
+
+/* multiplies the current spectrum by the given one */
+void amitk_filter_fft_multiply_spectrum(AmitkFilterFFT * fft, const gdouble * spectrum) {
+
+  gsize i;
+  gdouble re, im;
+  gdouble * a;
+
+  a = fft->spectrum;
+  for (i=0; i < fft->spectrum_length; i++, a+=2, spectrum+=2) {
+    re = a[0]*spectrum[0] - a[1]*spectrum[1];
+    im = a[0]*spectrum[1] + a[1]*spectrum[0];
+    a[0] = re;
+    a[1] = im;
+  }
+
+  return;
+}
+
+const gchar * amitk_filter_fft_get_backend_name(const AmitkFilterFFT * fft) {
+  return (fft->backend == FFT_BACKEND_FFTW) ? "FFTW" : "GSL";
+}
+
+#endif /* AMIDE_LIBGSL_SUPPORT || AMIDE_FFTW_SUPPORT */
+
 
 /* do a (destructive) partial sort of the given data to find median */
 /* adapted and modified from Numerical Receipes in C, (who got it from Knuth, Vol 3?) */
@@ -312,6 +761,155 @@ amide_data_t amitk_filter_find_median_by_partial_sort(amide_data_t * partial_sor
 }
 
 
+/* the histogram is kept at two levels, so that runs of empty bins can be
+   skipped a block at a time when moving the median */
+#define MEDIAN_BLOCK_SHIFT 8
+#define MEDIAN_BLOCK_SIZE (1 << MEDIAN_BLOCK_SHIFT)
+#define MEDIAN_BLOCK_MASK (MEDIAN_BLOCK_SIZE-1)
+
+struct _AmitkFilterMedianHistogram {
+  gint num_bins;
+  guint32 * counts;
+  guint32 * block_counts;
+  gint total;
+  gint median; /* the bin holding the median */
+  gint below;  /* number of values in bins below median */
+};
+
+AmitkFilterMedianHistogram * amitk_filter_median_histogram_new(const gint num_bins) {
+
+  AmitkFilterMedianHistogram * histogram;
+  gint num_blocks;
+
+  g_return_val_if_fail(num_bins > 0, NULL);
+  num_blocks = (num_bins+MEDIAN_BLOCK_MASK) >> MEDIAN_BLOCK_SHIFT;
+
+  histogram = g_try_new0(AmitkFilterMedianHistogram, 1);
+  if (histogram == NULL) return NULL;
+  histogram->num_bins = num_bins;
+  histogram->counts = g_try_new0(guint32, num_blocks << MEDIAN_BLOCK_SHIFT);
+  histogram->block_counts = g_try_new0(guint32, num_blocks);
+  if ((histogram->counts == NULL) || (histogram->block_counts == NULL)) {
+    amitk_filter_median_histogram_free(histogram);
+    return NULL;
+  }
+
+  return histogram;
+}
+
+void amitk_filter_median_histogram_free(AmitkFilterMedianHistogram * histogram) {
+
+  if (histogram == NULL) return;
+  g_free(histogram->counts);
+  g_free(histogram->block_counts);
+  g_free(histogram);
+  return;
+}
+
+void amitk_filter_median_histogram_add(AmitkFilterMedianHistogram * histogram, const gint bin) {
+  histogram->counts[bin]++;
+  histogram->block_counts[bin >> MEDIAN_BLOCK_SHIFT]++;
+  histogram->total++;
+  if (bin < histogram->median) histogram->below++;
+  return;
+}
+
+void amitk_filter_median_histogram_remove(AmitkFilterMedianHistogram * histogram, const gint bin) {
+  histogram->counts[bin]--;
+  histogram->block_counts[bin >> MEDIAN_BLOCK_SHIFT]--;
+  histogram->total--;
+  if (bin < histogram->median) histogram->below--;
+  return;
+}
+
+/* returns the bin holding the median, using the same definition of the median 
+   as amitk_filter_find_median_by_partial_sort.  The median is moved from where 
+   it was last time, so this is cheap if the values have only changed a bit. 
+   The histogram must not be empty. */
+gint amitk_filter_median_histogram_get_median(AmitkFilterMedianHistogram * histogram) {
+
+  gint median_point;
+
+  g_return_val_if_fail(histogram->total > 0, 0);
+  median_point = (histogram->total-1) >> 1;
+
+  while (histogram->below > median_point) {
+    if (((histogram->median & MEDIAN_BLOCK_MASK) == 0) && 
+	(histogram->block_counts[(histogram->median >> MEDIAN_BLOCK_SHIFT)-1] == 0)) {
+      histogram->median -= MEDIAN_BLOCK_SIZE;
+    } else {
+      histogram->median--;
+      histogram->below -= histogram->counts[histogram->median];
+    }
+  }
+
+  while (histogram->below + histogram->counts[histogram->median] <= median_point) {
+    histogram->below += histogram->counts[histogram->median];
+    histogram->median++;
+    while (((histogram->median & MEDIAN_BLOCK_MASK) == 0) &&
+	   (histogram->block_counts[histogram->median >> MEDIAN_BLOCK_SHIFT] == 0))
+      histogram->median += MEDIAN_BLOCK_SIZE;
+  }
+
+  return histogram->median;
+}
+
+/* replaces old_value with new_value in the sorted window, keeping it sorted. 
+   old_value must be in the window, and neither value can be NaN */
+void amitk_filter_sorted_window_replace(amide_data_t * window, const gint size,
+					const amide_data_t old_value, const amide_data_t new_value) {
+
+  gint left, right, mid;
+
+  /* binary search for old_value */
+  left = 0;
+  right = size-1;
+  while (left < right) {
+    mid = (left+right) >> 1;
+    if (window[mid] < old_value) left = mid+1;
+    else right = mid;
+  }
+
+  /* and slide things over to make room for the new value */
+  if (new_value > old_value) {
+    while ((left+1 < size) && (window[left+1] < new_value)) {
+      window[left] = window[left+1];
+      left++;
+    }
+  } else {
+    while ((left > 0) && (window[left-1] > new_value)) {
+      window[left] = window[left-1];
+      left--;
+    }
+  }
+  window[left] = new_value;
+
+  return;
+}
+
+/* fills new_window with the sorted window minus the removed values plus the 
+   added values.  removed and added both hold num values and need to be sorted, 
+   and removed values need to be in the window.  No NaN's please */
+void amitk_filter_sorted_window_update(const amide_data_t * window, const gint size,
+				       const amide_data_t * removed, const amide_data_t * added,
+				       const gint num, amide_data_t * new_window) {
+
+  gint i_window=0, i_removed=0, i_added=0, i_new=0;
+
+  while (i_new < size) {
+    if ((i_removed < num) && (window[i_window] == removed[i_removed])) {
+      i_window++;
+      i_removed++;
+    } else if ((i_added < num) && ((i_window >= size) || (added[i_added] < window[i_window]))) {
+      new_window[i_new++] = added[i_added++];
+    } else {
+      new_window[i_new++] = window[i_window++];
+    }
+  }
+
+  return;
+}
+
 
 const gchar * amitk_filter_get_name(const AmitkFilter filter) {
   GEnumClass * enum_class;
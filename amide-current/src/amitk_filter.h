@@ -32,9 +32,6 @@
 #endif
 #include <math.h>
 #include "amitk_raw_data.h"
-#ifdef AMIDE_LIBGSL_SUPPORT
-#include <gsl/gsl_fft_complex.h>
-#endif
 
 G_BEGIN_DECLS
 
@@ -45,24 +42,80 @@ typedef enum {
   AMITK_FILTER_NUM
 } AmitkFilter;
 
-#define AMITK_FILTER_FFT_SIZE 64
+/* largest FFT tile dimension we'll use along any one axis */
+#define AMITK_FILTER_FFT_MAX_SIZE 128
+
+/* smallest sigma (in voxels) for which we'll use the recursive gaussian, 
+   below this the recursive approximation gets noticeably off */
+#define AMITK_FILTER_IIR_MIN_SIGMA 2.0
+
+/* a 1D gaussian, done either as a direct convolution or recursively */
+typedef struct _AmitkFilterGaussian1D AmitkFilterGaussian1D;
+
+/* a real 3D FFT of a given tile size, done with FFTW if we have it,
+   and with GSL otherwise */
+typedef struct _AmitkFilterFFT AmitkFilterFFT;
 
+/* a histogram of integer values, keeping track of its median as values 
+   are added and removed, for doing sliding window medians */
+typedef struct _AmitkFilterMedianHistogram AmitkFilterMedianHistogram;
 
-AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel kernel_size,
-							      const AmitkPoint voxel_size,
-							      const amide_real_t fwhm);
 
-#ifdef AMIDE_LIBGSL_SUPPORT
-void amitk_filter_3D_FFT(AmitkRawData * data, 
-			 gsl_fft_complex_wavetable * wavetable,
-			 gsl_fft_complex_workspace * workspace);
-void amitk_filter_inverse_3D_FFT(AmitkRawData * data, 
-				 gsl_fft_complex_wavetable * wavetable,
-				 gsl_fft_complex_workspace * workspace);
-void amitk_filter_complex_mult(AmitkRawData * data, AmitkRawData * kernel);
+AmitkRawData * amitk_filter_calculate_gaussian_kernel(const AmitkVoxel kernel_size,
+						      const AmitkPoint voxel_size,
+						      const amide_real_t fwhm);
+
+AmitkFilterGaussian1D * amitk_filter_gaussian_1D_new(const gint kernel_size,
+						      const amide_real_t voxel_size,
+						      const amide_real_t fwhm);
+void           amitk_filter_gaussian_1D_free        (AmitkFilterGaussian1D * gaussian_1D);
+gboolean       amitk_filter_gaussian_1D_is_recursive(const AmitkFilterGaussian1D * gaussian_1D);
+amide_real_t   amitk_filter_gaussian_1D_get_work    (const AmitkFilterGaussian1D * gaussian_1D);
+gsize          amitk_filter_gaussian_1D_get_workspace_size(const AmitkFilterGaussian1D * gaussian_1D,
+							   const gint length,
+							   const gint width);
+void           amitk_filter_gaussian_1D_apply       (const AmitkFilterGaussian1D * gaussian_1D,
+						     const gdouble * in,
+						     gdouble * out,
+						     const gint length,
+						     const gint width,
+						     gdouble * workspace);
+
+#if defined(AMIDE_LIBGSL_SUPPORT) || defined(AMIDE_FFTW_SUPPORT)
+AmitkVoxel       amitk_filter_fft_choose_size     (const AmitkVoxel kernel_size,
+						   const AmitkVoxel data_dim,
+						   amide_real_t * pwork);
+AmitkFilterFFT * amitk_filter_fft_new             (const AmitkVoxel size);
+void             amitk_filter_fft_free            (AmitkFilterFFT * fft);
+AmitkVoxel       amitk_filter_fft_get_size        (const AmitkFilterFFT * fft);
+amide_real_t *   amitk_filter_fft_get_data        (AmitkFilterFFT * fft);
+void             amitk_filter_fft_forward         (AmitkFilterFFT * fft);
+void             amitk_filter_fft_inverse         (AmitkFilterFFT * fft);
+gdouble *        amitk_filter_fft_copy_spectrum   (const AmitkFilterFFT * fft);
+void             amitk_filter_fft_multiply_spectrum(AmitkFilterFFT * fft,
+						    const gdouble * spectrum);
+const gchar *    amitk_filter_fft_get_backend_name(const AmitkFilterFFT * fft);
 #endif
 amide_data_t amitk_filter_find_median_by_partial_sort(amide_data_t * partial_sort_data, gint size);
 
+AmitkFilterMedianHistogram * amitk_filter_median_histogram_new(const gint num_bins);
+void           amitk_filter_median_histogram_free   (AmitkFilterMedianHistogram * histogram);
+void           amitk_filter_median_histogram_add    (AmitkFilterMedianHistogram * histogram,
+						     const gint bin);
+void           amitk_filter_median_histogram_remove (AmitkFilterMedianHistogram * histogram,
+						     const gint bin);
+gint           amitk_filter_median_histogram_get_median(AmitkFilterMedianHistogram * histogram);
+void           amitk_filter_sorted_window_replace   (amide_data_t * window,
+						     const gint size,
+						     const amide_data_t old_value,
+						     const amide_data_t new_value);
+void           amitk_filter_sorted_window_update    (const amide_data_t * window,
+						     const gint size,
+						     const amide_data_t * removed,
+						     const amide_data_t * added,
+						     const gint num,
+						     amide_data_t * new_window);
+
 const gchar * amitk_filter_get_name(const AmitkFilter filter);
 
 
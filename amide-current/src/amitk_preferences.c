@@ -32,6 +32,7 @@
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
 #include "amitk_data_set.h"
+#include "amitk_roi.h"
 
 #define GCONF_AMIDE_ROI "ROI"
 #define GCONF_AMIDE_CANVAS "CANVAS"
@@ -166,6 +167,25 @@ static void preferences_init (AmitkPreferences * preferences) {
   preferences->default_directory = 
     amide_gconf_get_string_with_default(GCONF_AMIDE_MISC,"DefaultDirectory", AMITK_PREFERENCES_DEFAULT_DEFAULT_DIRECTORY);
 
+  preferences->num_threads = 
+    amide_gconf_get_int_with_default(GCONF_AMIDE_MISC,"NumThreads", AMITK_PREFERENCES_DEFAULT_NUM_THREADS);
+  if ((preferences->num_threads < 0) || (preferences->num_threads > AMITK_MAX_THREADS))
+    preferences->num_threads = AMITK_PREFERENCES_DEFAULT_NUM_THREADS;
+  amitk_set_num_threads(preferences->num_threads);
+
+  preferences->frame_cache_size = 
+    amide_gconf_get_int_with_default(GCONF_AMIDE_MISC,"FrameCacheSize", AMITK_PREFERENCES_DEFAULT_FRAME_CACHE_SIZE);
+  if (preferences->frame_cache_size < 0)
+    preferences->frame_cache_size = AMITK_PREFERENCES_DEFAULT_FRAME_CACHE_SIZE;
+  amitk_raw_data_set_frame_cache_budget(((gsize) preferences->frame_cache_size) << 20);
+
+  preferences->slice_cache_size = 
+    amide_gconf_get_int_with_default(GCONF_AMIDE_MISC,"SliceCacheSize", AMITK_PREFERENCES_DEFAULT_SLICE_CACHE_SIZE);
+  if (preferences->slice_cache_size < AMITK_PREFERENCES_MIN_SLICE_CACHE_SIZE)
+    preferences->slice_cache_size = AMITK_PREFERENCES_DEFAULT_SLICE_CACHE_SIZE;
+  amitk_data_set_set_slice_cache_budget(((gsize) preferences->slice_cache_size) << 20);
+  amitk_roi_set_mask_cache_budget(((gsize) preferences->slice_cache_size) << 20);
+
   for (i_modality=0; i_modality<AMITK_MODALITY_NUM; i_modality++) {
     temp_str = g_strdup_printf("DefaultColorTable%s", amitk_modality_get_name(i_modality));
     preferences->color_table[i_modality] = 
@@ -398,6 +418,50 @@ void amitk_preferences_set_default_directory(AmitkPreferences * preferences, con
   return;
 }
 
+void amitk_preferences_set_num_threads(AmitkPreferences * preferences, const gint num_threads) {
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+  g_return_if_fail(num_threads >= 0);
+  g_return_if_fail(num_threads <= AMITK_MAX_THREADS);
+
+  if (AMITK_PREFERENCES_NUM_THREADS(preferences) != num_threads) {
+    preferences->num_threads = num_threads;
+    amitk_set_num_threads(num_threads);
+    amide_gconf_set_int(GCONF_AMIDE_MISC,"NumThreads",num_threads);
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  }
+  return;
+}
+
+void amitk_preferences_set_frame_cache_size(AmitkPreferences * preferences, const gint frame_cache_size) {
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+  g_return_if_fail(frame_cache_size >= 0);
+
+  if (AMITK_PREFERENCES_FRAME_CACHE_SIZE(preferences) != frame_cache_size) {
+    preferences->frame_cache_size = frame_cache_size;
+    amitk_raw_data_set_frame_cache_budget(((gsize) frame_cache_size) << 20);
+    amide_gconf_set_int(GCONF_AMIDE_MISC,"FrameCacheSize",frame_cache_size);
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  }
+  return;
+}
+
+void amitk_preferences_set_slice_cache_size(AmitkPreferences * preferences, const gint slice_cache_size) {
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+  g_return_if_fail(slice_cache_size >= AMITK_PREFERENCES_MIN_SLICE_CACHE_SIZE);
+
+  if (AMITK_PREFERENCES_SLICE_CACHE_SIZE(preferences) != slice_cache_size) {
+    preferences->slice_cache_size = slice_cache_size;
+    amitk_data_set_set_slice_cache_budget(((gsize) slice_cache_size) << 20);
+    amitk_roi_set_mask_cache_budget(((gsize) slice_cache_size) << 20);
+    amide_gconf_set_int(GCONF_AMIDE_MISC,"SliceCacheSize",slice_cache_size);
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  }
+  return;
+}
+
 void amitk_preferences_set_color_table(AmitkPreferences * preferences,
 				       AmitkModality modality,
 				       AmitkColorTable color_table) {
@@ -45,6 +45,9 @@ G_BEGIN_DECLS
 #define AMITK_PREFERENCES_PROMPT_FOR_SAVE_ON_EXIT(object) (AMITK_PREFERENCES(object)->prompt_for_save_on_exit)
 #define AMITK_PREFERENCES_WHICH_DEFAULT_DIRECTORY(object) (AMITK_PREFERENCES(object)->which_default_directory)
 #define AMITK_PREFERENCES_DEFAULT_DIRECTORY(object)       (AMITK_PREFERENCES(object)->default_directory)
+#define AMITK_PREFERENCES_NUM_THREADS(object)             (AMITK_PREFERENCES(object)->num_threads)
+#define AMITK_PREFERENCES_FRAME_CACHE_SIZE(object)        (AMITK_PREFERENCES(object)->frame_cache_size)
+#define AMITK_PREFERENCES_SLICE_CACHE_SIZE(object)        (AMITK_PREFERENCES(object)->slice_cache_size)
 
 #define AMITK_PREFERENCES_CANVAS_ROI_WIDTH(pref)                (AMITK_PREFERENCES(pref)->canvas_roi_width)
 #ifdef AMIDE_LIBGNOMECANVAS_AA
@@ -86,6 +89,10 @@ typedef enum {
 #define AMITK_PREFERENCES_DEFAULT_WHICH_DEFAULT_DIRECTORY AMITK_WHICH_DEFAULT_DIRECTORY_NONE
 #define AMITK_PREFERENCES_DEFAULT_DEFAULT_DIRECTORY NULL
 #define AMITK_PREFERENCES_DEFAULT_THRESHOLD_STYLE AMITK_THRESHOLD_STYLE_MIN_MAX
+#define AMITK_PREFERENCES_DEFAULT_NUM_THREADS 0 /* 0 -> one thread per processor */
+#define AMITK_PREFERENCES_DEFAULT_FRAME_CACHE_SIZE 0 /* in MB, 0 -> no limit */
+#define AMITK_PREFERENCES_DEFAULT_SLICE_CACHE_SIZE 256 /* in MB */
+#define AMITK_PREFERENCES_MIN_SLICE_CACHE_SIZE 16
 
 #define AMITK_PREFERENCES_MIN_ROI_WIDTH 1
 #define AMITK_PREFERENCES_MAX_ROI_WIDTH 5
@@ -110,6 +117,11 @@ struct _AmitkPreferences {
   AmitkWhichDefaultDirectory which_default_directory;
   gchar * default_directory;
 
+  /* performance preferences */
+  gint num_threads;
+  gint frame_cache_size; /* MB of memory mapped frames to keep in memory */
+  gint slice_cache_size; /* MB of generated slices to hang on to, roi masks get the same */
+
   /* canvas preferences -> study preferences */
   gint canvas_roi_width;
   gdouble canvas_roi_transparency;
@@ -176,6 +188,12 @@ void                amitk_preferences_set_which_default_directory(AmitkPreferenc
 								  const AmitkWhichDefaultDirectory which_default_directory);
 void                amitk_preferences_set_default_directory      (AmitkPreferences * preferences,
 								  const gchar * directory);
+void                amitk_preferences_set_num_threads            (AmitkPreferences * preferences,
+								  const gint num_threads);
+void                amitk_preferences_set_frame_cache_size       (AmitkPreferences * preferences,
+								  const gint frame_cache_size);
+void                amitk_preferences_set_slice_cache_size       (AmitkPreferences * preferences,
+								  const gint slice_cache_size);
 void                amitk_preferences_set_color_table            (AmitkPreferences * preferences,
 								  AmitkModality modality,
 								  AmitkColorTable color_table);
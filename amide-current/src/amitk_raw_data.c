@@ -27,6 +27,13 @@
 
 #include <sys/stat.h>
 #include <stdio.h>
+#include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "amitk_raw_data.h"
 #include "amitk_marshal.h"
@@ -166,7 +173,26 @@ gchar * amitk_raw_format_names[] = {
 static void raw_data_class_init          (AmitkRawDataClass *klass);
 static void raw_data_init                (AmitkRawData      *object);
 static void raw_data_finalize            (GObject           *object);
+static void frame_cache_remove           (AmitkRawData      *raw_data);
 static GObjectClass * parent_class;
+
+
+/* the frame cache keeps track of which frames/gates of memory mapped raw data
+   we've been using, and tells the kernel it can drop the least recently used
+   ones when we go over budget.  Data that's not mapped is always in memory,
+   and doesn't take part in this */
+typedef struct {
+  AmitkRawData * raw_data; /* raw_data, frame, and gate are the hash key */
+  amide_intpoint_t frame;
+  amide_intpoint_t gate;
+  GList * link; /* our link in frame_cache_queue */
+} frame_cache_entry_t;
+
+G_LOCK_DEFINE_STATIC(frame_cache);
+static GHashTable * frame_cache_table = NULL; /* entries keyed on themselves */
+static GQueue frame_cache_queue = G_QUEUE_INIT; /* most recently used at the head */
+static gsize frame_cache_used = 0;
+static gsize frame_cache_budget = 0; /* in bytes, 0 is no limit */
 //static guint     raw_data_signals[LAST_SIGNAL];
 
 
@@ -213,6 +239,12 @@ static void raw_data_init (AmitkRawData * raw_data) {
   raw_data->dim = zero_voxel;
   raw_data->data = NULL;
   raw_data->format = AMITK_FORMAT_DOUBLE;
+  raw_data->mapped = NULL;
+  raw_data->mapped_size = 0;
+  raw_data->mapped_fd = -1;
+  raw_data->mapped_offset = 0;
+  raw_data->mapped_file_size = 0;
+  raw_data->mapped_file_mtime = 0;
 
   return;
 }
@@ -222,6 +254,19 @@ static void raw_data_finalize (GObject *object) {
 
   AmitkRawData * raw_data = AMITK_RAW_DATA(object);
 
+#ifdef HAVE_SYS_MMAN_H
+  if (raw_data->mapped != NULL) {
+    frame_cache_remove(raw_data);
+    munmap(raw_data->mapped, raw_data->mapped_size);
+    raw_data->mapped = NULL;
+    raw_data->data = NULL; /* pointed into the mapping */
+  }
+  if (raw_data->mapped_fd >= 0) {
+    close(raw_data->mapped_fd);
+    raw_data->mapped_fd = -1;
+  }
+#endif
+
   if (raw_data->data != NULL) {
 #ifdef AMIDE_DEBUG
     //g_print("\tfreeing raw data\n");
@@ -324,6 +369,156 @@ AmitkRawData* amitk_raw_data_new_with_data0(AmitkFormat format, AmitkVoxel dim)
 
 
 
+#ifdef HAVE_SYS_MMAN_H
+/* returns true if the on disk format is byte for byte the same as how we store it in memory */
+static gboolean raw_format_is_native(const AmitkRawFormat raw_format) {
+
+  switch(raw_format) {
+  case AMITK_RAW_FORMAT_UBYTE_8_NE:
+  case AMITK_RAW_FORMAT_SBYTE_8_NE:
+#if (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+  case AMITK_RAW_FORMAT_USHORT_16_LE:
+  case AMITK_RAW_FORMAT_SSHORT_16_LE:
+  case AMITK_RAW_FORMAT_UINT_32_LE:
+  case AMITK_RAW_FORMAT_SINT_32_LE:
+  case AMITK_RAW_FORMAT_FLOAT_32_LE:
+  case AMITK_RAW_FORMAT_DOUBLE_64_LE:
+#else /* G_BIG_ENDIAN */
+  case AMITK_RAW_FORMAT_USHORT_16_BE:
+  case AMITK_RAW_FORMAT_SSHORT_16_BE:
+  case AMITK_RAW_FORMAT_UINT_32_BE:
+  case AMITK_RAW_FORMAT_SINT_32_BE:
+  case AMITK_RAW_FORMAT_FLOAT_32_BE:
+  case AMITK_RAW_FORMAT_DOUBLE_64_BE:
+#endif
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* tries to point the raw data straight into a mapping of the file, instead of reading
+   it all into memory.  Only pages that get looked at are ever read in.  The mapping
+   is private, so anything that modifies the data gets a copy of the touched pages
+   and the file itself is never written to.  Returns FALSE if the data has to be
+   read in the normal way. 
+
+   note, this is only used for the raw data in .xif files.  Saving a study unlinks 
+   the old files before writing the new ones, so the mapping stays valid if we 
+   overwrite the file we were loaded from.  Anything else changing the file gets
+   caught by raw_data_check_mapping */
+static gboolean raw_data_map_file(AmitkRawData * raw_data,
+				  FILE * file_pointer,
+				  const AmitkRawFormat raw_format,
+				  const long file_offset) {
+
+  struct stat file_info;
+  gsize data_size, map_size;
+  off_t map_offset;
+  long page_size;
+  gpointer map;
+  gint fd;
+
+  if (!raw_format_is_native(raw_format)) return FALSE;
+
+  /* don't want to hand out misaligned data */
+  if ((file_offset % amitk_format_sizes[raw_data->format]) != 0) return FALSE;
+
+  data_size = amitk_raw_data_size_data_mem(raw_data);
+  if (data_size == 0) return FALSE;
+
+  fd = fileno(file_pointer);
+  if (fstat(fd, &file_info) != 0) return FALSE;
+  if (!S_ISREG(file_info.st_mode)) return FALSE;
+  if (((guint64) file_info.st_size) < ((guint64) file_offset) + data_size) 
+    return FALSE; /* let the normal read path complain about the short file */
+
+  /* mmap wants a page aligned offset */
+  page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0) return FALSE;
+  map_offset = file_offset - (file_offset % page_size);
+  map_size = data_size + (file_offset - map_offset);
+
+  /* keep our own descriptor, for checking that the file stays put */
+  if ((fd = dup(fd)) < 0) return FALSE;
+
+  map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, map_offset);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return FALSE;
+  }
+
+  raw_data->mapped = map;
+  raw_data->mapped_size = map_size;
+  raw_data->mapped_fd = fd;
+  raw_data->mapped_offset = map_offset;
+  raw_data->mapped_file_size = file_info.st_size;
+  raw_data->mapped_file_mtime = file_info.st_mtime;
+  raw_data->data = ((guchar *) map) + (file_offset - map_offset);
+
+#ifdef AMIDE_DEBUG
+  g_print("\tmapped %zd bytes of raw data\n", data_size);
+#endif
+
+  return TRUE;
+}
+
+G_LOCK_DEFINE_STATIC(raw_data_mapping);
+
+/* makes sure the file under a mapping hasn't been truncated or rewritten since we
+   mapped it, as touching pages the file no longer covers raises SIGBUS.  If it has
+   changed, whatever the file still covers is copied out, and the mapping is replaced 
+   in place with anonymous memory holding that copy, so the data pointer stays good.
+   The rest of the data is zeroed */
+static void raw_data_check_mapping(AmitkRawData * raw_data) {
+
+  struct stat file_info;
+  gsize covered;
+  gpointer copy;
+  gpointer map;
+
+  if (g_atomic_int_get(&raw_data->mapped_fd) < 0) return;
+  if (fstat(g_atomic_int_get(&raw_data->mapped_fd), &file_info) != 0) return;
+  if ((file_info.st_size == raw_data->mapped_file_size) && 
+      (file_info.st_mtime == raw_data->mapped_file_mtime))
+    return;
+
+  G_LOCK(raw_data_mapping);
+  if (raw_data->mapped_fd < 0) goto exit_strategy; /* another thread got to it */
+
+  g_warning(_("file under memory mapped data changed on disk, keeping what's still there"));
+
+  /* the part of the mapping the file still covers */
+  covered = 0;
+  if (file_info.st_size > raw_data->mapped_offset)
+    covered = MIN(raw_data->mapped_size, file_info.st_size - raw_data->mapped_offset);
+
+  copy = NULL;
+  if ((covered > 0) && ((copy = g_try_malloc(covered)) != NULL))
+    memcpy(copy, raw_data->mapped, covered);
+  else
+    covered = 0;
+
+  map = mmap(raw_data->mapped, raw_data->mapped_size, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  if (map == MAP_FAILED)
+    g_error("couldn't replace memory mapped data in %s at line %d", __FILE__, __LINE__);
+  if (copy != NULL) {
+    memcpy(raw_data->mapped, copy, covered);
+    g_free(copy);
+  }
+
+  close(raw_data->mapped_fd);
+  g_atomic_int_set(&raw_data->mapped_fd, -1);
+
+ exit_strategy:
+  G_UNLOCK(raw_data_mapping);
+
+  return;
+}
+#endif
+
+
 /* reads the contents of a raw data file into an amide raw data structure,
 
    notes: 
@@ -331,14 +526,17 @@ AmitkRawData* amitk_raw_data_new_with_data0(AmitkFormat format, AmitkVoxel dim)
    1. file_offset is bytes for a binary file, lines for an ascii file
    2. either file_name, of existing_file need to be specified.  
       If existing_file is not being used, it must be NULL
+   3. if map_file is set and the file is already in our in-memory format, the data
+      is memory mapped from the file instead of being read in
 */
-AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name, 
-					      FILE * existing_file,
-					      AmitkRawFormat raw_format,
-					      AmitkVoxel dim,
-					      long file_offset,
-					      AmitkUpdateFunc update_func,
-					      gpointer update_data) {
+static AmitkRawData * raw_data_import_raw_file(const gchar * file_name, 
+					       FILE * existing_file,
+					       AmitkRawFormat raw_format,
+					       AmitkVoxel dim,
+					       long file_offset,
+					       const gboolean map_file,
+					       AmitkUpdateFunc update_func,
+					       gpointer update_data) {
 
   FILE * new_file_pointer=NULL;
   FILE * file_pointer=NULL;
@@ -365,11 +563,13 @@ AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name,
   total_planes = dim.z*dim.t*dim.g;
   divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
 
-  raw_data = amitk_raw_data_new_with_data(amitk_raw_format_to_format(raw_format), dim);
+  raw_data = amitk_raw_data_new();
   if (raw_data == NULL) {
     g_warning(_("couldn't allocate memory space for the raw data set structure"));
     goto error_condition;
   }
+  raw_data->format = amitk_raw_format_to_format(raw_format);
+  raw_data->dim = dim;
 
   /* open the raw data file for reading */
   if (existing_file == NULL) {
@@ -403,6 +603,22 @@ AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name,
       goto error_condition;
     }
   }
+
+#ifdef HAVE_SYS_MMAN_H
+  /* see if we can skip reading altogether */
+  if (map_file && raw_data_map_file(raw_data, file_pointer, raw_format, file_offset)) {
+    /* leave the file where a full read would have */
+    fseek(file_pointer, file_offset+amitk_raw_data_size_data_mem(raw_data), SEEK_SET);
+    goto exit_condition;
+  }
+#endif
+
+  /* allocate the space for the data */
+  raw_data->data = amitk_raw_data_get_data_mem(raw_data);
+  if (raw_data->data == NULL) {
+    g_warning(_("couldn't allocate memory space for the raw data set structure"));
+    goto error_condition;
+  }
     
   /* read in the contents of the file */
   if (raw_format != AMITK_RAW_FORMAT_ASCII_8_NE) { /* ASCII handled in the loop below */
@@ -783,6 +999,27 @@ AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name,
 
 }
 
+/* reads the contents of a raw data file into an amide raw data structure,
+
+   notes: 
+
+   1. file_offset is bytes for a binary file, lines for an ascii file
+   2. either file_name, of existing_file need to be specified.  
+      If existing_file is not being used, it must be NULL
+*/
+AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name, 
+					      FILE * existing_file,
+					      AmitkRawFormat raw_format,
+					      AmitkVoxel dim,
+					      long file_offset,
+					      AmitkUpdateFunc update_func,
+					      gpointer update_data) {
+
+  /* files we don't own can get changed under us, so they're always read in */
+  return raw_data_import_raw_file(file_name, existing_file, raw_format, dim, file_offset,
+				  FALSE, update_func, update_data);
+}
+
 
 /* function to write out the information content of a raw_data set into an xml
    file.  Returns a string containing the name of the file. */
@@ -976,8 +1213,8 @@ AmitkRawData * amitk_raw_data_read_xml(gchar * xml_filename,
   }
 
 
-  raw_data = amitk_raw_data_import_raw_file(raw_filename, study_file, raw_format, dim, offset_long, 
-					    update_func, update_data);
+  raw_data = raw_data_import_raw_file(raw_filename, study_file, raw_format, dim, offset_long, 
+				     TRUE, update_func, update_data);
 
   /* and we're done */
   if (raw_filename != NULL) g_free(raw_filename);
@@ -986,6 +1223,205 @@ AmitkRawData * amitk_raw_data_read_xml(gchar * xml_filename,
   return raw_data;
 }
 
+/* the size in bytes of one frame/gate worth of data */
+static gsize frame_size(const AmitkRawData * raw_data) {
+  return ((gsize) raw_data->dim.x) * raw_data->dim.y * raw_data->dim.z * amitk_format_sizes[raw_data->format];
+}
+
+/* tell the kernel we'll want a frame soon, or that it can page it out */
+static void frame_advise(const AmitkRawData * raw_data, const amide_intpoint_t frame,
+			 const amide_intpoint_t gate, const gboolean needed) {
+
+#ifdef HAVE_SYS_MMAN_H
+  gsize start, end;
+  gsize page_size;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  start = (gsize) raw_data->data + (((gsize) frame)*raw_data->dim.g + gate)*frame_size(raw_data);
+  end = start + frame_size(raw_data);
+
+  if (needed) {
+    start -= start % page_size;
+    madvise((gpointer) start, end-start, MADV_WILLNEED);
+  } else {
+    /* only give up pages that belong entirely to this frame/gate.  The mapping is
+       private, so we need to make sure any modified pages get swapped out and not
+       thrown away, MADV_DONTNEED would drop them */
+    start += (page_size - (start % page_size)) % page_size;
+    end -= end % page_size;
+    if (end > start) {
+#if defined(MADV_PAGEOUT)
+      madvise((gpointer) start, end-start, MADV_PAGEOUT);
+#elif defined(MADV_COLD)
+      madvise((gpointer) start, end-start, MADV_COLD);
+#endif
+    }
+  }
+#endif
+
+  return;
+}
+
+static guint frame_cache_hash(gconstpointer key) {
+
+  const frame_cache_entry_t * entry = key;
+
+  return (g_direct_hash(entry->raw_data) * 31U + (guint) entry->frame) * 31U + (guint) entry->gate;
+}
+
+static gboolean frame_cache_equal(gconstpointer key1, gconstpointer key2) {
+
+  const frame_cache_entry_t * entry1 = key1;
+  const frame_cache_entry_t * entry2 = key2;
+
+  return ((entry1->raw_data == entry2->raw_data) && 
+	  (entry1->frame == entry2->frame) && 
+	  (entry1->gate == entry2->gate));
+}
+
+/* takes the entry out of the table and the queue and frees it.
+   Needs to be called with the lock held */
+static void frame_cache_entry_free(frame_cache_entry_t * entry) {
+
+  g_hash_table_remove(frame_cache_table, entry);
+  g_queue_delete_link(&frame_cache_queue, entry->link);
+  frame_cache_used -= frame_size(entry->raw_data);
+  g_free(entry);
+
+  return;
+}
+
+/* drop all of a raw data's entries out of the frame cache */
+static void frame_cache_remove(AmitkRawData * raw_data) {
+
+  frame_cache_entry_t key;
+  frame_cache_entry_t * entry;
+
+  G_LOCK(frame_cache);
+  if (frame_cache_table != NULL) {
+    key.raw_data = raw_data;
+    for (key.frame = 0; key.frame < raw_data->dim.t; key.frame++)
+      for (key.gate = 0; key.gate < raw_data->dim.g; key.gate++)
+	if ((entry = g_hash_table_lookup(frame_cache_table, &key)) != NULL)
+	  frame_cache_entry_free(entry);
+  }
+  G_UNLOCK(frame_cache);
+
+  return;
+}
+
+/* page out least recently used frames until we're back under budget.  The most 
+   recently used frame always stays. Needs to be called with the lock held */
+static void frame_cache_trim(void) {
+
+  frame_cache_entry_t * entry;
+
+  if (frame_cache_budget == 0) return;
+
+  while ((frame_cache_used > frame_cache_budget) && (frame_cache_queue.length > 1)) {
+    entry = g_queue_peek_tail(&frame_cache_queue);
+    frame_advise(entry->raw_data, entry->frame, entry->gate, FALSE);
+    frame_cache_entry_free(entry);
+  }
+
+  return;
+}
+
+static void frame_cache_touch(AmitkRawData * raw_data, const amide_intpoint_t frame,
+			      const amide_intpoint_t gate, const gboolean prefetch) {
+
+  frame_cache_entry_t key;
+  frame_cache_entry_t * entry;
+
+  G_LOCK(frame_cache);
+
+  if (frame_cache_table == NULL)
+    frame_cache_table = g_hash_table_new(frame_cache_hash, frame_cache_equal);
+
+  key.raw_data = raw_data;
+  key.frame = frame;
+  key.gate = gate;
+  entry = g_hash_table_lookup(frame_cache_table, &key);
+
+  if (entry != NULL) {
+    /* already have it, a prefetch doesn't count as a use */
+    if (!prefetch) {
+      g_queue_unlink(&frame_cache_queue, entry->link);
+      g_queue_push_head_link(&frame_cache_queue, entry->link);
+    }
+  } else {
+    entry = g_new(frame_cache_entry_t, 1);
+    *entry = key;
+    entry->link = g_list_alloc();
+    entry->link->data = entry;
+    g_hash_table_add(frame_cache_table, entry);
+
+    /* prefetched frames go behind whatever we're currently using */
+    if (prefetch && (frame_cache_queue.length > 0))
+      g_queue_push_nth_link(&frame_cache_queue, 1, entry->link);
+    else
+      g_queue_push_head_link(&frame_cache_queue, entry->link);
+    frame_cache_used += frame_size(raw_data);
+
+    frame_advise(raw_data, frame, gate, TRUE);
+    frame_cache_trim();
+  }
+
+  G_UNLOCK(frame_cache);
+
+  return;
+}
+
+/* sets how many bytes worth of memory mapped frames we try to keep in memory, 0 for no limit */
+void amitk_raw_data_set_frame_cache_budget(const gsize budget) {
+
+  G_LOCK(frame_cache);
+  frame_cache_budget = budget;
+  frame_cache_trim();
+  G_UNLOCK(frame_cache);
+
+  return;
+}
+
+/* routines that are going to read through a frame/gate of the data should
+   call this first, so that memory mapped data can be paged in and the
+   least recently used frames paged out */
+void amitk_raw_data_request_frame(AmitkRawData * rd, 
+				  const amide_intpoint_t frame, 
+				  const amide_intpoint_t gate) {
+
+  g_return_if_fail(AMITK_IS_RAW_DATA(rd));
+
+  if (!amitk_raw_data_is_mapped(rd)) return; /* nothing to do, it's all in memory */
+  if ((frame < 0) || (frame >= rd->dim.t) || (gate < 0) || (gate >= rd->dim.g)) return;
+
+#ifdef HAVE_SYS_MMAN_H
+  raw_data_check_mapping(rd);
+#endif
+  frame_cache_touch(rd, frame, gate, FALSE);
+
+  return;
+}
+
+/* same as amitk_raw_data_request_frame, but for a frame we think we'll
+   be needing soon.  The frame gets read in the background. */
+void amitk_raw_data_prefetch_frame(AmitkRawData * rd, 
+				   const amide_intpoint_t frame, 
+				   const amide_intpoint_t gate) {
+
+  g_return_if_fail(AMITK_IS_RAW_DATA(rd));
+
+  if (!amitk_raw_data_is_mapped(rd)) return;
+  if ((frame < 0) || (frame >= rd->dim.t) || (gate < 0) || (gate >= rd->dim.g)) return;
+
+#ifdef HAVE_SYS_MMAN_H
+  raw_data_check_mapping(rd);
+#endif
+  frame_cache_touch(rd, frame, gate, TRUE);
+
+  return;
+}
+
 amide_data_t amitk_raw_data_get_value(const AmitkRawData * rd, const AmitkVoxel i) {
 
   g_return_val_if_fail(AMITK_IS_RAW_DATA(rd), EMPTY);
@@ -121,6 +121,16 @@ struct _AmitkRawData {
   AmitkVoxel dim;
   gpointer data;
   AmitkFormat format;
+
+  /* if data points into a memory mapped file, the mapping, where it starts in 
+     the file, and the file with the size and modification time it had when
+     it was mapped */
+  gpointer mapped;
+  gsize mapped_size;
+  gint mapped_fd;
+  gint64 mapped_offset;
+  gint64 mapped_file_size;
+  gint64 mapped_file_mtime;
   
 };
 
@@ -142,10 +152,11 @@ struct _AmitkRawDataClass
 						  ((vox).z >= (rd)->dim.z) ||  \
 						  ((vox).g >= (rd)->dim.g) ||  \
 						  ((vox).t >= (rd)->dim.t)))
-#define amitk_raw_data_num_voxels(rd) ((rd)->dim.x * (rd)->dim.y * (rd)->dim.z * (rd)->dim.g * (rd)->dim.t)
+#define amitk_raw_data_num_voxels(rd) (((gsize) (rd)->dim.x) * (rd)->dim.y * (rd)->dim.z * (rd)->dim.g * (rd)->dim.t)
 #define amitk_raw_data_size_data_mem(rd) (amitk_raw_data_num_voxels(rd) * amitk_format_sizes[(rd)->format])
 #define amitk_raw_data_get_data_mem(rd) (g_try_malloc(amitk_raw_data_size_data_mem(rd)))
 #define amitk_raw_data_get_data_mem0(rd) (g_try_malloc0(amitk_raw_data_size_data_mem(rd)))
+#define amitk_raw_data_is_mapped(rd) ((rd)->mapped != NULL)
 
 
 /* ------------ external functions ---------- */
@@ -182,6 +193,13 @@ AmitkRawData *  amitk_raw_data_read_xml             (gchar * xml_filename,
 						     gpointer update_data);
 amide_data_t    amitk_raw_data_get_value            (const AmitkRawData * rd, 
 						     const AmitkVoxel i);
+void            amitk_raw_data_request_frame        (AmitkRawData * rd,
+						     const amide_intpoint_t frame,
+						     const amide_intpoint_t gate);
+void            amitk_raw_data_prefetch_frame       (AmitkRawData * rd,
+						     const amide_intpoint_t frame,
+						     const amide_intpoint_t gate);
+void            amitk_raw_data_set_frame_cache_budget(const gsize budget);
 gpointer        amitk_raw_data_get_pointer          (const AmitkRawData * rd,
 						     const AmitkVoxel i);
 
@@ -26,6 +26,7 @@
 #include "amide_config.h"
 
 #include "amitk_roi.h"
+#include "amitk_fiducial_mark.h"
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
 
@@ -61,6 +62,43 @@ gchar * amitk_roi_menu_explanation[] = {
 };
 
 
+/* how many voxel masks (one per data set geometry) we keep per roi */
+#define ROI_MASKS_MAX 8
+
+/* a sparse list of the data set voxels that are (at least partially) inside an roi,
+   along with the fraction of each voxel in the roi.  Voxels are stored as runs along x,
+   in the order the roi calculation visits them.  A mask is only valid for the data set
+   geometry it was calculated on, which is recorded here so it can be checked */
+typedef struct roi_mask_run_t {
+  amide_intpoint_t z;
+  amide_intpoint_t y;
+  amide_intpoint_t x;
+  amide_intpoint_t length;
+} roi_mask_run_t;
+
+typedef struct roi_mask_t {
+  gint ref_count;
+  gboolean accurate;
+  AmitkPoint offset;
+  AmitkAxes axes;
+  AmitkPoint voxel_size;
+  AmitkVoxel dim;
+  GArray * runs;
+  GArray * weights;
+  AmitkRoi * roi; /* the roi whose cache we're in, not referenced */
+  GList * link; /* our link in roi_masks_queue */
+  gsize size; /* bytes */
+} roi_mask_t;
+
+/* the masks of all the rois are kept under one memory budget, with the least
+   recently used ones thrown out first.  The lock covers the queue and each roi's
+   list of masks.  A roi's masks_mutex is taken before this lock, never after */
+G_LOCK_DEFINE_STATIC(roi_masks);
+static GQueue roi_masks_queue = G_QUEUE_INIT; /* most recently used at the head */
+static gsize roi_masks_used = 0;
+static gsize roi_masks_budget = ((gsize) 256) << 20; /* until the preferences say otherwise */
+
+
 enum {
   ROI_CHANGED,
   ROI_TYPE_CHANGED,
@@ -84,6 +122,10 @@ static gchar *       roi_read_xml            (AmitkObject        *object,
 					      gchar              *error_buf);
 static void          roi_get_center          (const AmitkVolume *volume,
 					      AmitkPoint        *center);
+static void          roi_space_changed       (AmitkSpace        *space);
+static void          roi_volume_changed      (AmitkVolume       *volume);
+static void          roi_changed             (AmitkRoi          *roi);
+static void          roi_invalidate_masks    (AmitkRoi          *roi);
 static void          roi_set_voxel_size      (AmitkRoi * roi, 
 					      AmitkPoint voxel_size);
 
@@ -129,6 +171,7 @@ static void roi_class_init (AmitkRoiClass * class) {
   parent_class = g_type_class_peek_parent(class);
 
   space_class->space_scale = roi_scale;
+  space_class->space_changed = roi_space_changed;
 
   object_class->object_copy = roi_copy;
   object_class->object_copy_in_place = roi_copy_in_place;
@@ -136,6 +179,9 @@ static void roi_class_init (AmitkRoiClass * class) {
   object_class->object_read_xml = roi_read_xml;
 
   volume_class->volume_get_center = roi_get_center;
+  volume_class->volume_changed = roi_volume_changed;
+
+  class->roi_changed = roi_changed;
 
   gobject_class->finalize = roi_finalize;
 
@@ -170,6 +216,9 @@ static void roi_init (AmitkRoi * roi) {
   roi->isocontour_min_value = 0.0;
   roi->isocontour_max_value = 0.0;
   roi->isocontour_range = AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN;
+
+  g_mutex_init(&(roi->masks_mutex));
+  roi->masks = NULL;
 }
 
 
@@ -182,6 +231,9 @@ static void roi_finalize (GObject *object)
     roi->map_data = NULL;
   }
 
+  roi_invalidate_masks(roi);
+  g_mutex_clear(&(roi->masks_mutex));
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -253,6 +305,9 @@ static void roi_copy_in_place (AmitkObject * dest_object, const AmitkObject * sr
   dest_roi->isocontour_max_value = AMITK_ROI_ISOCONTOUR_MAX_VALUE(src_object);
   dest_roi->isocontour_range = AMITK_ROI_ISOCONTOUR_RANGE(src_object);
 
+  /* the map data may have been swapped out from under any cached masks */
+  roi_invalidate_masks(dest_roi);
+
   AMITK_OBJECT_CLASS (parent_class)->object_copy_in_place (dest_object, src_object);
 }
 
@@ -396,6 +451,29 @@ static gchar * roi_read_xml (AmitkObject * object, xmlNodePtr nodes, FILE * stud
 }
 
 
+/* any change to the roi's geometry makes the cached masks stale */
+static void roi_space_changed(AmitkSpace * space) {
+
+  roi_invalidate_masks(AMITK_ROI(space));
+
+  if (AMITK_SPACE_CLASS(parent_class)->space_changed)
+    AMITK_SPACE_CLASS(parent_class)->space_changed (space);
+}
+
+static void roi_volume_changed(AmitkVolume * volume) {
+
+  roi_invalidate_masks(AMITK_ROI(volume));
+
+  if (AMITK_VOLUME_CLASS(parent_class)->volume_changed)
+    AMITK_VOLUME_CLASS(parent_class)->volume_changed (volume);
+}
+
+static void roi_changed(AmitkRoi * roi) {
+
+  roi_invalidate_masks(roi);
+}
+
+
 static void roi_get_center(const AmitkVolume *volume, AmitkPoint * pcenter) {
 
   if (AMITK_ROI_TYPE_ISOCONTOUR(volume) || AMITK_ROI_TYPE_FREEHAND(volume)) {
@@ -623,30 +701,298 @@ AmitkDataSet * amitk_roi_get_intersection_slice(const AmitkRoi * roi,
 }
 
 
-/* sets/resets the isocontour value of an isocontour ROI based on the given volume and voxel 
-   note: vol should be a slice for the case of ISOCONTOUR_2D/FREEHAND_2D */
-void amitk_roi_set_isocontour(AmitkRoi * roi, AmitkDataSet * ds, AmitkVoxel start_voxel, 
-			      amide_data_t isocontour_min_value, amide_data_t isocontour_max_value,
-			      AmitkRoiIsocontourRange isocontour_range) {
+/* hands the given isocontour map (see amitk_roi_ISOCONTOUR_3D_isocontour_maps) 
+   over to the roi, and puts the roi where the map came from in the data set */
+static void roi_set_isocontour_map(AmitkRoi * roi, AmitkDataSet * ds, 
+				   AmitkRawData * map, AmitkVoxel min_voxel,
+				   amide_data_t isocontour_min_value, amide_data_t isocontour_max_value,
+				   AmitkRoiIsocontourRange isocontour_range) {
 
-  g_return_if_fail(AMITK_ROI_TYPE_ISOCONTOUR(roi));
+  AmitkPoint temp_point;
 
-  switch(AMITK_ROI_TYPE(roi)) {
+  roi->isocontour_min_value = isocontour_min_value; 
+  roi->isocontour_max_value = isocontour_max_value; 
+  roi->isocontour_range = isocontour_range; 
+
+  if (roi->map_data != NULL)
+    g_object_unref(roi->map_data);
+  roi->map_data = map;
+
+  amitk_space_copy_in_place(AMITK_SPACE(roi), AMITK_SPACE(ds));
+  roi->voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+
+  POINT_MULT(min_voxel, AMITK_DATA_SET_VOXEL_SIZE(ds), temp_point);
+  temp_point = amitk_space_s2b(AMITK_SPACE(ds), temp_point);
+  amitk_space_set_offset(AMITK_SPACE(roi), temp_point);
+
+  amitk_roi_calc_far_corner(roi);
+  roi->center_of_mass_calculated = FALSE;
+  
+  g_signal_emit(G_OBJECT(roi), roi_signals[ROI_CHANGED], 0);
+
+  return;
+}
+
+static void roi_isocontour_maps(AmitkRoiType roi_type, const AmitkDataSet * ds, 
+				const AmitkVoxel * voxels, const gint num_voxels, 
+				amide_data_t isocontour_min_value, amide_data_t isocontour_max_value,
+				AmitkRoiIsocontourRange isocontour_range,
+				AmitkRawData ** maps, AmitkVoxel * min_voxels) {
+
+  switch(roi_type) {
   case AMITK_ROI_TYPE_ISOCONTOUR_2D:
-    amitk_roi_ISOCONTOUR_2D_set_isocontour(roi, ds, start_voxel, isocontour_min_value, isocontour_max_value, isocontour_range);
+    amitk_roi_ISOCONTOUR_2D_isocontour_maps(ds, voxels, num_voxels, isocontour_min_value, 
+					    isocontour_max_value, isocontour_range, maps, min_voxels);
     break;
   case AMITK_ROI_TYPE_ISOCONTOUR_3D:
   default:
-    amitk_roi_ISOCONTOUR_3D_set_isocontour(roi, ds, start_voxel, isocontour_min_value, isocontour_max_value, isocontour_range);
+    amitk_roi_ISOCONTOUR_3D_isocontour_maps(ds, voxels, num_voxels, isocontour_min_value, 
+					    isocontour_max_value, isocontour_range, maps, min_voxels);
     break;
   }
-  roi->center_of_mass_calculated = FALSE;
-  
-  g_signal_emit(G_OBJECT(roi), roi_signals[ROI_CHANGED], 0);
 
   return;
 }
 
+/* sets/resets the isocontour value of an isocontour ROI based on the given data set and voxel. 
+   For ISOCONTOUR_2D, the isocontour is on the plane of the given voxel */
+void amitk_roi_set_isocontour(AmitkRoi * roi, AmitkDataSet * ds, AmitkVoxel start_voxel, 
+			      amide_data_t isocontour_min_value, amide_data_t isocontour_max_value,
+			      AmitkRoiIsocontourRange isocontour_range) {
+
+  AmitkRawData * map;
+  AmitkVoxel min_voxel;
+
+  g_return_if_fail(AMITK_ROI_TYPE_ISOCONTOUR(roi));
+
+  roi_isocontour_maps(AMITK_ROI_TYPE(roi), ds, &start_voxel, 1, isocontour_min_value, 
+		      isocontour_max_value, isocontour_range, &map, &min_voxel);
+  roi_set_isocontour_map(roi, ds, map, min_voxel, isocontour_min_value, 
+			 isocontour_max_value, isocontour_range);
+
+  return;
+}
+
+
+/* one frame and gate of a data set for amitk_rois_isocontours_new, with all 
+   the starting voxels that fall within it */
+typedef struct isocontour_task_t {
+  AmitkDataSet * ds;
+  amide_data_t isocontour_min_value;
+  amide_data_t isocontour_max_value;
+  gint * seeds; /* which seed each voxel came from */
+  AmitkVoxel * voxels;
+  gint num_voxels;
+  AmitkRawData ** maps;
+  AmitkVoxel * min_voxels;
+} isocontour_task_t;
+
+typedef struct isocontour_schedule_t {
+  AmitkRoiType roi_type;
+  AmitkRoiIsocontourRange isocontour_range;
+  isocontour_task_t * tasks;
+  gint num_tasks;
+  gint next_task;
+  gint num_done;
+  gint cancelled;
+  AmitkUpdateFunc update_func;
+  gpointer update_data;
+} isocontour_schedule_t;
+
+/* same as analysis_schedule_worker, the chunk starting at 0 is run by the
+   calling thread, so that's where progress gets reported */
+static void isocontour_schedule_worker(gint start, gint end, gpointer data) {
+
+  isocontour_schedule_t * schedule = data;
+  isocontour_task_t * task;
+  gint i_task;
+  gint num_done;
+
+  while (!g_atomic_int_get(&(schedule->cancelled)) &&
+	 ((i_task = g_atomic_int_add(&(schedule->next_task), 1)) < schedule->num_tasks)) {
+    task = &(schedule->tasks[i_task]);
+    roi_isocontour_maps(schedule->roi_type, task->ds, task->voxels, task->num_voxels,
+			task->isocontour_min_value, task->isocontour_max_value,
+			schedule->isocontour_range, task->maps, task->min_voxels);
+    num_done = g_atomic_int_add(&(schedule->num_done), 1)+1;
+
+    if ((start == 0) && (schedule->update_func != NULL))
+      if (!(*schedule->update_func)(schedule->update_data, NULL, 
+				    ((gdouble) num_done)/((gdouble) schedule->num_tasks)))
+	g_atomic_int_set(&(schedule->cancelled), TRUE);
+  }
+
+  return;
+}
+
+/* Generates isocontour rois of the given type for each of the seeds (fiducial 
+   marks or rois, an roi seeds from its center) on each of the data sets.  If 
+   all_frames is FALSE, only the frame at view_time is used, and likewise 
+   all_gates FALSE means only the data set's view start gate.  If 
+   relative_to_max is TRUE, the min and max values are fractions of the max 
+   value of each frame (e.g. 0.4 for a 40% of max isocontour).  The 
+   isocontours on the same frame and gate share their thresholding and 
+   labeling, and the frames and gates are done in parallel.  The new rois get 
+   added as children of their data sets, and a list of them is returned 
+   (unref with amitk_objects_unref), or NULL if canceled. */
+GList * amitk_rois_isocontours_new(const AmitkRoiType roi_type,
+				   GList * seeds,
+				   GList * data_sets,
+				   const amide_time_t view_time,
+				   const gboolean all_frames,
+				   const gboolean all_gates,
+				   const gboolean relative_to_max,
+				   const amide_data_t isocontour_min_value,
+				   const amide_data_t isocontour_max_value,
+				   const AmitkRoiIsocontourRange isocontour_range,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data) {
+
+  isocontour_schedule_t schedule;
+  isocontour_task_t task;
+  GArray * tasks;
+  AmitkPoint * seed_points;
+  gint num_seeds, i_seed, i_voxel, i_task;
+  AmitkDataSet * ds;
+  AmitkVoxel voxel;
+  guint frame, start_frame, end_frame;
+  guint gate, start_gate, end_gate;
+  amide_data_t frame_max;
+  GList * temp_objects;
+  GList * new_rois=NULL;
+  AmitkRoi * roi;
+  gchar * temp_string;
+
+  g_return_val_if_fail((roi_type == AMITK_ROI_TYPE_ISOCONTOUR_2D) ||
+		       (roi_type == AMITK_ROI_TYPE_ISOCONTOUR_3D), NULL);
+
+  /* figure out where we're starting from */
+  num_seeds = g_list_length(seeds);
+  seed_points = g_new(AmitkPoint, num_seeds);
+  for (temp_objects = seeds, i_seed=0; temp_objects != NULL; temp_objects = temp_objects->next, i_seed++) {
+    if (AMITK_IS_FIDUCIAL_MARK(temp_objects->data))
+      seed_points[i_seed] = AMITK_FIDUCIAL_MARK_GET(temp_objects->data);
+    else if (AMITK_IS_VOLUME(temp_objects->data))
+      seed_points[i_seed] = amitk_volume_get_center(AMITK_VOLUME(temp_objects->data));
+    else {
+      g_warning(_("Isocontour seeds need to be fiducial marks or ROIs"));
+      g_free(seed_points);
+      return NULL;
+    }
+  }
+
+  /* gather up the starting voxels by frame and gate */
+  tasks = g_array_new(FALSE, FALSE, sizeof(isocontour_task_t));
+  for (temp_objects = data_sets; temp_objects != NULL; temp_objects = temp_objects->next) {
+    if (!AMITK_IS_DATA_SET(temp_objects->data)) continue;
+    ds = AMITK_DATA_SET(temp_objects->data);
+
+    if (all_frames) {
+      start_frame = 0;
+      end_frame = AMITK_DATA_SET_NUM_FRAMES(ds);
+    } else {
+      start_frame = amitk_data_set_get_frame(ds, view_time);
+      end_frame = start_frame+1;
+    }
+    if (all_gates) {
+      start_gate = 0;
+      end_gate = AMITK_DATA_SET_NUM_GATES(ds);
+    } else {
+      start_gate = AMITK_DATA_SET_VIEW_START_GATE(ds);
+      end_gate = start_gate+1;
+    }
+
+    for (frame=start_frame; frame < end_frame; frame++) {
+      /* worked out here, as the max value may need to get calculated */
+      frame_max = relative_to_max ? amitk_data_set_get_frame_max(ds, frame) : 1.0;
+
+      for (gate=start_gate; gate < end_gate; gate++) {
+	task.ds = ds;
+	task.isocontour_min_value = frame_max*isocontour_min_value;
+	task.isocontour_max_value = frame_max*isocontour_max_value;
+	task.seeds = g_new(gint, num_seeds);
+	task.voxels = g_new(AmitkVoxel, num_seeds);
+	task.num_voxels = 0;
+	for (i_seed=0; i_seed < num_seeds; i_seed++) {
+	  POINT_TO_VOXEL(amitk_space_b2s(AMITK_SPACE(ds), seed_points[i_seed]), 
+			 AMITK_DATA_SET_VOXEL_SIZE(ds), frame, gate, voxel);
+	  if (amitk_raw_data_includes_voxel(AMITK_DATA_SET_RAW_DATA(ds), voxel)) {
+	    task.seeds[task.num_voxels] = i_seed;
+	    task.voxels[task.num_voxels] = voxel;
+	    task.num_voxels++;
+	  }
+	}
+	if (task.num_voxels > 0) {
+	  task.maps = g_new0(AmitkRawData *, task.num_voxels);
+	  task.min_voxels = g_new(AmitkVoxel, task.num_voxels);
+	  g_array_append_val(tasks, task);
+	} else {
+	  g_free(task.seeds);
+	  g_free(task.voxels);
+	}
+      }
+    }
+  }
+  g_free(seed_points);
+
+  if (tasks->len == 0)
+    g_warning(_("None of the isocontour seeds are within the data sets"));
+
+  schedule.roi_type = roi_type;
+  schedule.isocontour_range = isocontour_range;
+  schedule.tasks = (isocontour_task_t *) tasks->data;
+  schedule.num_tasks = tasks->len;
+  schedule.next_task = 0;
+  schedule.num_done = 0;
+  schedule.cancelled = FALSE;
+  schedule.update_func = update_func;
+  schedule.update_data = update_data;
+
+  if (update_func != NULL) {
+    temp_string = g_strdup(_("Generating Isocontour ROIs"));
+    schedule.cancelled = !(*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+
+  if ((!schedule.cancelled) && (schedule.num_tasks > 0))
+    amitk_parallel_for(amitk_get_num_threads(), isocontour_schedule_worker, &schedule);
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  /* and make the rois, this part emits signals so it stays on this thread */
+  for (i_task=0; i_task < schedule.num_tasks; i_task++) {
+    task = schedule.tasks[i_task];
+    for (i_voxel=0; i_voxel < task.num_voxels; i_voxel++) {
+      if (task.maps[i_voxel] == NULL) continue; /* canceled */
+      if (schedule.cancelled) {
+	g_object_unref(task.maps[i_voxel]);
+	continue;
+      }
+
+      roi = amitk_roi_new(roi_type);
+      temp_string = g_strdup_printf(_("%s, frame %d, gate %d"),
+				    AMITK_OBJECT_NAME(g_list_nth_data(seeds, task.seeds[i_voxel])),
+				    task.voxels[i_voxel].t, task.voxels[i_voxel].g);
+      amitk_object_set_name(AMITK_OBJECT(roi), temp_string);
+      g_free(temp_string);
+
+      roi_set_isocontour_map(roi, task.ds, task.maps[i_voxel], task.min_voxels[i_voxel],
+			     task.isocontour_min_value, task.isocontour_max_value, isocontour_range);
+      amitk_object_add_child(AMITK_OBJECT(task.ds), AMITK_OBJECT(roi));
+      new_rois = g_list_append(new_rois, roi);
+    }
+
+    g_free(task.seeds);
+    g_free(task.voxels);
+    g_free(task.maps);
+    g_free(task.min_voxels);
+  }
+  g_array_free(tasks, TRUE);
+
+  return new_rois;
+}
+
 /* sets an area in the roi to zero (if erase is TRUE) or in (if erase if FALSE) */
 /* only works for isocontour and freehand roi's */
 void amitk_roi_manipulate_area(AmitkRoi * roi, gboolean erase, AmitkVoxel voxel, gint area_size) {
@@ -743,25 +1089,15 @@ void amitk_roi_set_type(AmitkRoi * roi, AmitkRoiType new_type) {
   return;
 }
 
-/* iterates over the voxels in the given data set that are inside the given roi,
-   and performs the specified calculation function for those points */
-/* if inverse is true, the calculation is done for the portion of the data set not in the roi */
-/* if accurate is true, uses much slower but more accurate calculation */
-/* calulation should be a function taking the following arguments:
-   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
-void amitk_roi_calculate_on_data_set(const AmitkRoi * roi,  
-				     const AmitkDataSet * ds, 
-				     const guint frame,
-				     const guint gate,
-				     const gboolean inverse,
-				     const gboolean accurate,
-				     void (*calculation)(),
-				     gpointer data) {
-
-  g_return_if_fail(AMITK_IS_ROI(roi));
-  g_return_if_fail(AMITK_IS_DATA_SET(ds));
-  
-  if (AMITK_ROI_UNDRAWN(roi)) return;
+/* runs the roi geometry directly on the data set, see amitk_roi_calculate_on_data_set */
+static void roi_calculate_direct(const AmitkRoi * roi,  
+				 const AmitkDataSet * ds, 
+				 const guint frame,
+				 const guint gate,
+				 const gboolean inverse,
+				 const gboolean accurate,
+				 void (*calculation)(),
+				 gpointer data) {
 
   switch(AMITK_ROI_TYPE(roi)) {
   case AMITK_ROI_TYPE_ELLIPSOID:
@@ -814,6 +1150,292 @@ void amitk_roi_calculate_on_data_set(const AmitkRoi * roi,
   return;
 }
 
+
+static void roi_mask_unref(roi_mask_t * mask) {
+
+  if (!g_atomic_int_dec_and_test(&(mask->ref_count)))
+    return;
+
+  g_array_free(mask->runs, TRUE);
+  g_array_free(mask->weights, TRUE);
+  g_free(mask);
+
+  return;
+}
+
+/* takes the mask out of the queue and its roi's list, and returns it so the
+   caller can drop the cache's reference after letting go of the lock.
+   Needs to be called with the lock held */
+static roi_mask_t * roi_mask_evict(roi_mask_t * mask) {
+
+  g_queue_delete_link(&roi_masks_queue, mask->link);
+  mask->link = NULL;
+  mask->roi->masks = g_slist_remove(mask->roi->masks, mask);
+  roi_masks_used -= mask->size;
+
+  return mask;
+}
+
+/* evicts least recently used masks until we're back under budget, returning
+   them in a list to be unref'd.  The most recently used mask always stays.
+   Needs to be called with the lock held */
+static GSList * roi_masks_trim(void) {
+
+  GSList * evicted=NULL;
+
+  while ((roi_masks_used > roi_masks_budget) && (roi_masks_queue.length > 1))
+    evicted = g_slist_prepend(evicted, roi_mask_evict(g_queue_peek_tail(&roi_masks_queue)));
+
+  return evicted;
+}
+
+/* throws out all cached masks, masks still in use are freed when their user is done */
+static void roi_invalidate_masks(AmitkRoi * roi) {
+
+  GSList * evicted=NULL;
+
+  g_mutex_lock(&(roi->masks_mutex));
+  G_LOCK(roi_masks);
+  while (roi->masks != NULL)
+    evicted = g_slist_prepend(evicted, roi_mask_evict(roi->masks->data));
+  G_UNLOCK(roi_masks);
+  g_mutex_unlock(&(roi->masks_mutex));
+
+  g_slist_free_full(evicted, (GDestroyNotify) roi_mask_unref);
+
+  return;
+}
+
+/* sets how many bytes worth of voxel masks get cached over all rois */
+void amitk_roi_set_mask_cache_budget(const gsize budget) {
+
+  GSList * evicted;
+
+  G_LOCK(roi_masks);
+  roi_masks_budget = budget;
+  evicted = roi_masks_trim();
+  G_UNLOCK(roi_masks);
+
+  g_slist_free_full(evicted, (GDestroyNotify) roi_mask_unref);
+
+  return;
+}
+
+static gboolean roi_mask_matches(const roi_mask_t * mask, 
+				 const AmitkDataSet * ds, 
+				 const gboolean accurate) {
+
+  AmitkAxis i_axis;
+  AmitkVoxel dim;
+  AmitkPoint voxel_size, offset;
+
+  if (mask->accurate != accurate) return FALSE;
+
+  /* exact comparisons, the mask only holds for identical geometry */
+  dim = AMITK_DATA_SET_DIM(ds);
+  if ((mask->dim.x != dim.x) || (mask->dim.y != dim.y) || (mask->dim.z != dim.z))
+    return FALSE;
+
+  voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+  if ((mask->voxel_size.x != voxel_size.x) || 
+      (mask->voxel_size.y != voxel_size.y) || 
+      (mask->voxel_size.z != voxel_size.z))
+    return FALSE;
+
+  offset = AMITK_SPACE_OFFSET(ds);
+  if ((mask->offset.x != offset.x) || (mask->offset.y != offset.y) || (mask->offset.z != offset.z))
+    return FALSE;
+
+  for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+    if ((mask->axes[i_axis].x != AMITK_SPACE_AXES(ds)[i_axis].x) ||
+	(mask->axes[i_axis].y != AMITK_SPACE_AXES(ds)[i_axis].y) ||
+	(mask->axes[i_axis].z != AMITK_SPACE_AXES(ds)[i_axis].z))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* calculation function used to fill in a mask */
+static void roi_mask_record(AmitkVoxel voxel, 
+			    amide_data_t value, 
+			    amide_real_t voxel_fraction, 
+			    gpointer data) {
+
+  roi_mask_t * mask = data;
+  roi_mask_run_t * run;
+  roi_mask_run_t new_run;
+
+  if (voxel_fraction <= 0.0) return;
+
+  g_array_append_val(mask->weights, voxel_fraction);
+
+  if (mask->runs->len > 0) {
+    run = &g_array_index(mask->runs, roi_mask_run_t, mask->runs->len-1);
+    if ((run->z == voxel.z) && (run->y == voxel.y) && (run->x+run->length == voxel.x)) {
+      run->length++;
+      return;
+    }
+  }
+
+  new_run.z = voxel.z;
+  new_run.y = voxel.y;
+  new_run.x = voxel.x;
+  new_run.length = 1;
+  g_array_append_val(mask->runs, new_run);
+
+  return;
+}
+
+/* returns a reference to the roi's mask for the given data set's geometry,
+   calculating it (off of the given frame) if we don't have it cached */
+static roi_mask_t * roi_get_mask(const AmitkRoi * roi, 
+				 const AmitkDataSet * ds, 
+				 const guint frame,
+				 const guint gate,
+				 const gboolean accurate) {
+
+  AmitkRoi * cache_roi = (AmitkRoi *) roi; /* the cache isn't part of the roi's state */
+  roi_mask_t * mask=NULL;
+  GSList * masks;
+  GSList * evicted=NULL;
+  AmitkAxis i_axis;
+
+  /* hold the mutex while calculating, so threads working on the same roi share the result */
+  g_mutex_lock(&(cache_roi->masks_mutex));
+
+  G_LOCK(roi_masks);
+  for (masks = cache_roi->masks; masks != NULL && mask == NULL; masks = masks->next) 
+    if (roi_mask_matches(masks->data, ds, accurate)) {
+      mask = masks->data;
+      cache_roi->masks = g_slist_remove_link(cache_roi->masks, masks);
+      cache_roi->masks = g_slist_concat(masks, cache_roi->masks);
+      g_queue_unlink(&roi_masks_queue, mask->link);
+      g_queue_push_head_link(&roi_masks_queue, mask->link);
+      g_atomic_int_inc(&(mask->ref_count));
+    }
+  G_UNLOCK(roi_masks);
+
+  if (mask == NULL) {
+    mask = g_new(roi_mask_t, 1);
+    mask->ref_count = 1;
+    mask->accurate = accurate;
+    mask->offset = AMITK_SPACE_OFFSET(ds);
+    for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+      mask->axes[i_axis] = AMITK_SPACE_AXES(ds)[i_axis];
+    mask->voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+    mask->dim = AMITK_DATA_SET_DIM(ds);
+    mask->runs = g_array_new(FALSE, FALSE, sizeof(roi_mask_run_t));
+    mask->weights = g_array_new(FALSE, FALSE, sizeof(amide_real_t));
+    mask->roi = cache_roi;
+
+    roi_calculate_direct(roi, ds, frame, gate, FALSE, accurate, roi_mask_record, mask);
+
+    mask->size = sizeof(roi_mask_t) + 
+      mask->runs->len*sizeof(roi_mask_run_t) + 
+      mask->weights->len*sizeof(amide_real_t);
+
+    G_LOCK(roi_masks);
+    if (g_slist_length(cache_roi->masks) >= ROI_MASKS_MAX)
+      evicted = g_slist_prepend(evicted, roi_mask_evict(g_slist_last(cache_roi->masks)->data));
+    cache_roi->masks = g_slist_prepend(cache_roi->masks, mask);
+    g_queue_push_head(&roi_masks_queue, mask);
+    mask->link = roi_masks_queue.head;
+    roi_masks_used += mask->size;
+    evicted = g_slist_concat(roi_masks_trim(), evicted);
+    g_atomic_int_inc(&(mask->ref_count)); /* one for the cache, one for the caller */
+    G_UNLOCK(roi_masks);
+  }
+
+  g_mutex_unlock(&(cache_roi->masks_mutex));
+
+  g_slist_free_full(evicted, (GDestroyNotify) roi_mask_unref);
+
+  return mask;
+}
+
+/* runs the calculation over the voxels in the mask */
+static void roi_mask_apply(const roi_mask_t * mask,
+			   const AmitkDataSet * ds, 
+			   const guint frame,
+			   const guint gate,
+			   void (*calculation)(),
+			   gpointer data) {
+
+  AmitkVoxel j;
+  const roi_mask_run_t * run;
+  const amide_real_t * weights;
+  amide_data_t * row;
+  guint i_run;
+  amide_intpoint_t i;
+
+  row = g_new(amide_data_t, AMITK_DATA_SET_DIM_X(ds));
+  weights = (const amide_real_t *) mask->weights->data;
+
+  j.t = frame;
+  j.g = gate;
+  j.z = j.y = -1;
+  for (i_run=0; i_run < mask->runs->len; i_run++) {
+    run = &g_array_index(mask->runs, roi_mask_run_t, i_run);
+
+    /* runs are in row order, several runs can share a row */
+    if ((run->z != j.z) || (run->y != j.y)) {
+      j.z = run->z;
+      j.y = run->y;
+      j.x = 0;
+      amitk_data_set_get_row(ds, j, row);
+    }
+
+    for (i=0; i < run->length; i++) {
+      j.x = run->x+i;
+      (*calculation)(j, row[j.x], *weights, data);
+      weights++;
+    }
+  }
+
+  g_free(row);
+
+  return;
+}
+
+/* iterates over the voxels in the given data set that are inside the given roi,
+   and performs the specified calculation function for those points */
+/* if inverse is true, the calculation is done for the portion of the data set not in the roi */
+/* if accurate is true, uses much slower but more accurate calculation */
+/* calulation should be a function taking the following arguments:
+   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
+/* in the inverse case, voxels that are only partially in the roi may get called with a voxel_fraction of 0 */
+/* the roi geometry is worked out once per data set geometry and cached as a mask of voxels 
+   and weights, so calling this for each frame/gate of a data set only gathers the values. 
+   The inverse case covers the whole data set, and is not cached */
+void amitk_roi_calculate_on_data_set(const AmitkRoi * roi,  
+				     const AmitkDataSet * ds, 
+				     const guint frame,
+				     const guint gate,
+				     const gboolean inverse,
+				     const gboolean accurate,
+				     void (*calculation)(),
+				     gpointer data) {
+
+  roi_mask_t * mask;
+
+  g_return_if_fail(AMITK_IS_ROI(roi));
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  
+  if (AMITK_ROI_UNDRAWN(roi)) return;
+
+  amitk_data_set_request_frame(ds, frame, gate);
+
+  if (inverse) {
+    roi_calculate_direct(roi, ds, frame, gate, inverse, accurate, calculation, data);
+  } else {
+    mask = roi_get_mask(roi, ds, frame, gate, accurate);
+    roi_mask_apply(mask, ds, frame, gate, calculation, data);
+    roi_mask_unref(mask);
+  }
+
+  return;
+}
+
 static void erase_volume(AmitkVoxel voxel, 
 			 amide_data_t value, 
 			 amide_real_t voxel_fraction, 
@@ -841,15 +1463,15 @@ void amitk_roi_erase_volume(const AmitkRoi * roi,
     for (i_gate=0; i_gate<AMITK_DATA_SET_NUM_GATES(ds); i_gate++) 
       amitk_roi_calculate_on_data_set(roi, ds, i_frame, i_gate, outside, FALSE, erase_volume, ds);
 
-  /* recalc max and min */
-  amitk_data_set_calc_min_max(ds, update_func, update_data);
-
   /* mark the distribution data as invalid */
   if (AMITK_DATA_SET_DISTRIBUTION(ds) != NULL) {
     g_object_unref(AMITK_DATA_SET_DISTRIBUTION(ds));
     ds->distribution = NULL;
   }
 
+  /* recalc max and min, this may also regenerate the distribution */
+  amitk_data_set_calc_min_max(ds, update_func, update_data);
+
   /* this is a no-op to get a data_set_changed signal */
   amitk_data_set_set_value(AMITK_DATA_SET(ds), zero_voxel,
 			   amitk_data_set_get_value(AMITK_DATA_SET(ds), zero_voxel),
@@ -99,6 +99,11 @@ struct _AmitkRoi
   amide_data_t isocontour_max_value; /* what the user draws may lie outside of this range */
   AmitkRoiIsocontourRange isocontour_range;
 
+  /* cached voxel masks, see amitk_roi_calculate_on_data_set.  The list is
+     covered by the mask cache lock in amitk_roi.c */
+  GMutex masks_mutex;
+  GSList * masks;
+
 };
 
 struct _AmitkRoiClass
@@ -140,6 +145,18 @@ void            amitk_roi_set_isocontour          (AmitkRoi * roi,
 						   amide_data_t isocontour_min_value,
 						   amide_data_t isocontour_max_value,
 						   AmitkRoiIsocontourRange isocontour_range);
+GList *         amitk_rois_isocontours_new        (const AmitkRoiType roi_type,
+						   GList * seeds,
+						   GList * data_sets,
+						   const amide_time_t view_time,
+						   const gboolean all_frames,
+						   const gboolean all_gates,
+						   const gboolean relative_to_max,
+						   const amide_data_t isocontour_min_value,
+						   const amide_data_t isocontour_max_value,
+						   const AmitkRoiIsocontourRange isocontour_range,
+						   AmitkUpdateFunc update_func,
+						   gpointer update_data);
 void            amitk_roi_manipulate_area         (AmitkRoi * roi, 
 						   gboolean erase,
 						   AmitkVoxel erase_voxel, 
@@ -160,6 +177,7 @@ void            amitk_roi_erase_volume            (const AmitkRoi * roi,
 						   AmitkUpdateFunc update_func,
 						   gpointer update_data);
 const gchar *   amitk_roi_type_get_name           (const AmitkRoiType roi_type);
+void            amitk_roi_set_mask_cache_budget   (const gsize budget);
 
 amide_real_t    amitk_rois_get_max_min_voxel_size (GList * objects);
 
@@ -28,6 +28,7 @@
 #include "amide_config.h"
 #include <sys/types.h>
 #include <sys/time.h>
+#include <string.h>
 #include <glib.h>
 #include "amitk_roi_`'m4_Variable_Type`'.h"
 
@@ -426,228 +427,413 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 
 
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) 
-/* the data in temp_rd is setup as follows:
-   bit 1 -> is the voxel in the isocontour
-   bit 2 -> has the voxel been checked 
-   bit 3 -> increment x for backup
-   bit 4 -> decrement x for backup
-   bit 5 -> increment y for backup
-   bit 6 -> decrement y for backup
-   bit 7 -> increment z for backup
-   bit 8 -> decrement z for backup
-*/
-static void isocontour_consider(const AmitkDataSet * ds,
-				const AmitkRawData * temp_rd, 
-				AmitkVoxel ds_voxel, 
-				const amide_data_t iso_min_value,
-				const amide_data_t iso_max_value,
-				const AmitkRoiIsocontourRange iso_range) {
 
+/* The isocontours are found as connected components of runs.  Each data set
+   row gets broken up into runs of consecutive voxels that are within the
+   isocontour range, with the planes done in parallel.  Overlapping runs in
+   neighboring rows (including diagonals, so 8 neighbors in 2D, 26 in 3D) are
+   then joined with a union-find, in parallel over slabs of planes, and the
+   slab boundaries joined afterwards.  The labeling doesn't depend on the
+   starting voxel, so it gets shared between all the isocontours asked for
+   on the same frame and gate.  An isocontour is then the starting voxel (which
+   is in by definition) plus the components of the runs that touch it. */
+
+/* a run of voxels along x, start and end are inclusive */
+typedef struct isocontour_run_t {
+  amide_intpoint_t start;
+  amide_intpoint_t end;
+} isocontour_run_t;
+
+typedef struct isocontour_t {
+  const AmitkDataSet * ds;
+  AmitkVoxel frame_gate; /* the t and g we're working on */
+  amide_data_t iso_min_value;
+  amide_data_t iso_max_value;
+  AmitkRoiIsocontourRange iso_range;
+  amide_intpoint_t z_start; /* data set plane of the first plane we consider */
+  amide_intpoint_t num_planes;
+  amide_intpoint_t dim_y;
+  amide_intpoint_t dim_x;
+
+  /* filled in per plane, then gathered into one array */
+  GArray ** plane_runs;
+  guint ** plane_row_counts;
+
+  isocontour_run_t * runs;
+  guint * parents;
+  guint * row_first; /* first run in each row, rows are in plane then y order */
+  gint slab_size;
+} isocontour_t;
+
+/* the most components that can touch a voxel, 2 runs per row over 3x3 rows */
+#define ISOCONTOUR_MAX_ROOTS 18
+
+#define ISOCONTOUR_ROW(iso, plane, y) ((plane)*(iso)->dim_y+(y))
+
+static void isocontour_find_runs(gint start, gint end, gpointer data) {
+
+  isocontour_t * iso = data;
+  AmitkVoxel j;
+  amide_data_t * row;
+  amide_intpoint_t plane;
+  isocontour_run_t run;
+  gboolean in, in_run;
+
+  row = g_new(amide_data_t, iso->dim_x);
+
+  j = iso->frame_gate;
+  for (plane = start; plane < end; plane++) {
+    j.z = plane+iso->z_start;
+    iso->plane_runs[plane] = g_array_new(FALSE, FALSE, sizeof(isocontour_run_t));
+    iso->plane_row_counts[plane] = g_new0(guint, iso->dim_y);
+
+    for (j.y = 0; j.y < iso->dim_y; j.y++) {
+      amitk_data_set_get_row(iso->ds, j, row);
+
+      in_run = FALSE;
+      for (j.x = 0; j.x <= iso->dim_x; j.x++) {
+	if (j.x == iso->dim_x)
+	  in = FALSE;
+	else 
+	  in = (((iso->iso_range == AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN) && 
+		 (row[j.x] >= iso->iso_min_value)) ||
+		((iso->iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX) && 
+		 (row[j.x] <= iso->iso_max_value)) ||
+		((iso->iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BETWEEN_MIN_MAX) && 
+		 (row[j.x] >= iso->iso_min_value) && (row[j.x] <= iso->iso_max_value)));
+
+	if (in && !in_run) {
+	  run.start = j.x;
+	  in_run = TRUE;
+	} else if (!in && in_run) {
+	  run.end = j.x-1;
+	  g_array_append_val(iso->plane_runs[plane], run);
+	  iso->plane_row_counts[plane][j.y]++;
+	  in_run = FALSE;
+	}
+      }
+    }
+  }
 
-  AmitkVoxel i_voxel;
-  AmitkVoxel roi_voxel;
-  gboolean found;
-  gboolean done;
-  amide_data_t voxel_value;
+  g_free(row);
 
-  roi_voxel = ds_voxel;
-  roi_voxel.t = roi_voxel.g = 0;
-  i_voxel =roi_voxel;
-  done=FALSE;
+  return;
+}
 
-  /* the starting point is in by definition */
-  AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, roi_voxel) |= 0x03;
+static guint isocontour_find(guint * parents, guint i) {
 
-  /* while we still have neighbor voxels to check */
-  while (!done) {
+  while (parents[i] != i) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
 
-    found = FALSE;
+  return i;
+}
 
-    /* find a neighbor to check, consider the 8 adjoining voxels, or 26 in the case of 3D */
-#ifdef ROI_TYPE_ISOCONTOUR_3D
-    for (i_voxel.z = (roi_voxel.z >= 1) ? roi_voxel.z-1 : 0;
-	 (i_voxel.z < temp_rd->dim.z) && (i_voxel.z <= roi_voxel.z+1) && (!found);
-	 i_voxel.z++)
-#endif
-      for (i_voxel.y = (roi_voxel.y >= 1) ? roi_voxel.y-1 : 0;
-	   (i_voxel.y < temp_rd->dim.y) && (i_voxel.y <= roi_voxel.y+1) && (!found);
-	   i_voxel.y++)
-	for (i_voxel.x = (roi_voxel.x >= 1) ? roi_voxel.x-1 : 0;
-	     (i_voxel.x < temp_rd->dim.x) && (i_voxel.x <= roi_voxel.x+1) && (!found);
-	     i_voxel.x++) 
-	  if (!(AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, i_voxel) & 0x02)) { /* don't recheck something we've already checked */
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x02; /* it's been checked */
-
-	    ds_voxel.z = i_voxel.z;
-	    ds_voxel.y = i_voxel.y;
-	    ds_voxel.x = i_voxel.x;
-
-	    voxel_value = amitk_data_set_get_value(ds, ds_voxel);
-	    if (((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN) && (voxel_value >= iso_min_value)) ||
-		((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX) && (voxel_value <= iso_max_value)) ||
-		((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BETWEEN_MIN_MAX) && (voxel_value >= iso_min_value) && (voxel_value <= iso_max_value))) {
-
-	      AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x01; /* it's in */
-
-	      /* store backup info */
-#ifdef ROI_TYPE_ISOCONTOUR_3D
-	      if (i_voxel.z > roi_voxel.z)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x40;
-	      else if (i_voxel.z < roi_voxel.z)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x80;
+/* the lower index always becomes the root, so parents[i] <= i */
+static void isocontour_union(guint * parents, guint a, guint b) {
+
+  a = isocontour_find(parents, a);
+  b = isocontour_find(parents, b);
+
+  if (a < b) 
+    parents[b] = a;
+  else if (b < a)
+    parents[a] = b;
+
+  return;
+}
+
+/* joins the runs of two rows that overlap or touch diagonally */
+static void isocontour_join_rows(isocontour_t * iso, guint row_a, guint row_b) {
+
+  guint i, i_end, j, j_end;
+
+  i = iso->row_first[row_a];
+  i_end = iso->row_first[row_a+1];
+  j = iso->row_first[row_b];
+  j_end = iso->row_first[row_b+1];
+
+  while ((i < i_end) && (j < j_end)) {
+    if ((iso->runs[i].start <= iso->runs[j].end+1) && (iso->runs[j].start <= iso->runs[i].end+1))
+      isocontour_union(iso->parents, i, j);
+
+    /* runs in a row are separated by at least one voxel, so the run that ends 
+       first can't touch anything further along in the other row */
+    if (iso->runs[i].end < iso->runs[j].end)
+      i++;
+    else
+      j++;
+  }
+
+  return;
+}
+
+/* joins a row to its neighbors in the previous row and (for 3D) the previous plane */
+static void isocontour_join_row(isocontour_t * iso, amide_intpoint_t plane, amide_intpoint_t y,
+				gboolean previous_plane) {
+
+#if defined(ROI_TYPE_ISOCONTOUR_3D)
+  amide_intpoint_t k;
 #endif
-	      if (i_voxel.y > roi_voxel.y)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x10;
-	      else if (i_voxel.y < roi_voxel.y)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x20;
-	      if (i_voxel.x > roi_voxel.x)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x04;
-	      else if (i_voxel.x < roi_voxel.x)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x08;
-	      
-	      /* start next iteration at this voxel */
-	      roi_voxel = i_voxel; 
-	      found = TRUE;
-	    }
-	  }
 
-        
-    if (!found) { /* all neighbors exhaustively checked, backup */
+  if (y > 0)
+    isocontour_join_rows(iso, ISOCONTOUR_ROW(iso, plane, y), ISOCONTOUR_ROW(iso, plane, y-1));
 
-      /* backup to previous voxel */
-      i_voxel = roi_voxel;
-#ifdef ROI_TYPE_ISOCONTOUR_3D
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x80)
-	i_voxel.z++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x40)
-	i_voxel.z--;
+#if defined(ROI_TYPE_ISOCONTOUR_3D)
+  if (previous_plane)
+    for (k = (y > 0) ? y-1 : 0; (k <= y+1) && (k < iso->dim_y); k++)
+      isocontour_join_rows(iso, ISOCONTOUR_ROW(iso, plane, y), ISOCONTOUR_ROW(iso, plane-1, k));
 #endif
 
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x20)
-	i_voxel.y++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x10)
-	i_voxel.y--;
-
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x08)
-	i_voxel.x++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x04)
-	i_voxel.x--;
-
-      /* the inital voxel will backup to itself, which is why we get out of the loop */
-      if (VOXEL_EQUAL(roi_voxel, i_voxel)) 
-	done = TRUE;
-      else
-	roi_voxel = i_voxel;
+  return;
+}
+
+/* each slab only touches its own runs, so the slabs can be done in parallel */
+static void isocontour_join_slabs(gint start, gint end, gpointer data) {
+
+  isocontour_t * iso = data;
+  amide_intpoint_t plane, plane_start, plane_end, y;
+  gint slab;
+
+  for (slab = start; slab < end; slab++) {
+    plane_start = slab*iso->slab_size;
+    plane_end = MIN(plane_start+iso->slab_size, iso->num_planes);
+    for (plane = plane_start; plane < plane_end; plane++)
+      for (y = 0; y < iso->dim_y; y++)
+	isocontour_join_row(iso, plane, y, plane > plane_start);
+  }
+
+  return;
+}
+
+/* finds and labels the runs for the planes [z_start, z_start+num_planes) */
+static void isocontour_label(isocontour_t * iso) {
+
+  amide_intpoint_t plane, y;
+  guint i_run, num_runs;
+  gint num_slabs;
+
+  amitk_data_set_request_frame(iso->ds, iso->frame_gate.t, iso->frame_gate.g);
+
+  /* break the rows up into runs of voxels in the isocontour range */
+  iso->plane_runs = g_new(GArray *, iso->num_planes);
+  iso->plane_row_counts = g_new(guint *, iso->num_planes);
+  amitk_parallel_for(iso->num_planes, isocontour_find_runs, iso);
+
+  /* and gather them together */
+  num_runs = 0;
+  for (plane = 0; plane < iso->num_planes; plane++)
+    num_runs += iso->plane_runs[plane]->len;
+
+  iso->runs = g_new(isocontour_run_t, num_runs);
+  iso->parents = g_new(guint, num_runs);
+  iso->row_first = g_new(guint, iso->num_planes*iso->dim_y+1);
+  i_run = 0;
+  for (plane = 0; plane < iso->num_planes; plane++) {
+    memcpy(iso->runs+i_run, iso->plane_runs[plane]->data, 
+	   iso->plane_runs[plane]->len*sizeof(isocontour_run_t));
+    for (y = 0; y < iso->dim_y; y++) {
+      iso->row_first[ISOCONTOUR_ROW(iso, plane, y)] = i_run;
+      i_run += iso->plane_row_counts[plane][y];
     }
+    g_array_free(iso->plane_runs[plane], TRUE);
+    g_free(iso->plane_row_counts[plane]);
   }
+  iso->row_first[iso->num_planes*iso->dim_y] = i_run;
+  g_free(iso->plane_runs);
+  g_free(iso->plane_row_counts);
+
+  for (i_run = 0; i_run < num_runs; i_run++)
+    iso->parents[i_run] = i_run;
+
+  /* join up the runs into connected components, first within slabs of planes,
+     and then across the boundaries between slabs */
+  num_slabs = MIN(amitk_get_num_threads(), iso->num_planes);
+  iso->slab_size = (iso->num_planes + num_slabs-1)/num_slabs;
+  num_slabs = (iso->num_planes + iso->slab_size-1)/iso->slab_size;
+  amitk_parallel_for(num_slabs, isocontour_join_slabs, iso);
+
+  for (plane = iso->slab_size; plane < iso->num_planes; plane += iso->slab_size)
+    for (y = 0; y < iso->dim_y; y++)
+      isocontour_join_row(iso, plane, y, TRUE);
+
+  /* parents[i] <= i, so a single pass points everything at its root */
+  for (i_run = 0; i_run < num_runs; i_run++)
+    iso->parents[i_run] = iso->parents[iso->parents[i_run]];
 
   return;
 }
-  
 
+static gboolean isocontour_root_in(const guint * roots, const gint num_roots, const guint root) {
 
+  gint i;
 
-void amitk_roi_`'m4_Variable_Type`'_set_isocontour(AmitkRoi * roi, AmitkDataSet * ds, 
-						   AmitkVoxel iso_voxel,
-						   amide_data_t iso_min_value,
-						   amide_data_t iso_max_value,
-						   AmitkRoiIsocontourRange iso_range) {
+  for (i=0; i < num_roots; i++)
+    if (roots[i] == root)
+      return TRUE;
 
-  AmitkRawData * temp_rd;
-  AmitkPoint temp_point;
-  AmitkVoxel min_voxel, max_voxel, i_voxel;
-  amide_data_t temp_min_value, temp_max_value;
+  return FALSE;
+}
 
-  g_return_if_fail(roi->type == AMITK_ROI_TYPE_`'m4_Variable_Type`');
+/* pulls out the isocontour that grows from iso_voxel, and returns it
+   as an roi map with the edges marked.  min_voxel gets the data set 
+   voxel that corresponds to the first voxel of the map. */
+static AmitkRawData * isocontour_extract(const isocontour_t * iso, 
+					 const AmitkVoxel iso_voxel, 
+					 AmitkVoxel * pmin_voxel) {
 
-  /* what we're setting the isocontour too */
-  roi->isocontour_min_value = iso_min_value; 
-  roi->isocontour_max_value = iso_max_value; 
-  roi->isocontour_range = iso_range; 
+  AmitkRawData * map;
+  AmitkVoxel min_voxel, max_voxel, i_voxel;
+  amide_intpoint_t plane, plane_start, plane_end, y;
+  guint roots[ISOCONTOUR_MAX_ROOTS];
+  gint num_roots;
+  guint i_run;
 
-  /* we first make a raw data set the size of the data set to record the in/out values */
+  plane = iso_voxel.z-iso->z_start;
 #if defined(ROI_TYPE_ISOCONTOUR_2D)
-  temp_rd = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, ds->raw_data->dim.y, ds->raw_data->dim.x);
+  plane_start = plane;
+  plane_end = plane+1;
 #elif defined(ROI_TYPE_ISOCONTOUR_3D)
-  temp_rd = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE, ds->raw_data->dim.z, ds->raw_data->dim.y, ds->raw_data->dim.x);
+  plane_start = MAX(plane-1, 0);
+  plane_end = MIN(plane+2, iso->num_planes);
 #endif
 
-  /* epsilon guards for floating point rounding */
-  temp_min_value = roi->isocontour_min_value-EPSILON*fabs(roi->isocontour_min_value); 
-  temp_max_value = roi->isocontour_max_value+EPSILON*fabs(roi->isocontour_max_value); 
+  /* the components that touch the starting voxel */
+  num_roots = 0;
+  for (plane = plane_start; plane < plane_end; plane++)
+    for (y = MAX(iso_voxel.y-1, 0); y <= MIN(iso_voxel.y+1, iso->dim_y-1); y++)
+      for (i_run = iso->row_first[ISOCONTOUR_ROW(iso, plane, y)];
+	   i_run < iso->row_first[ISOCONTOUR_ROW(iso, plane, y)+1]; i_run++)
+	if ((iso->runs[i_run].start <= iso_voxel.x+1) && (iso_voxel.x-1 <= iso->runs[i_run].end))
+	  if (!isocontour_root_in(roots, num_roots, iso->parents[i_run]))
+	    roots[num_roots++] = iso->parents[i_run];
+
+#if defined(ROI_TYPE_ISOCONTOUR_3D)
+  plane_start = 0;
+  plane_end = iso->num_planes;
+#endif
 
-  /* fill in the data set */
-  isocontour_consider(ds, temp_rd, iso_voxel, temp_min_value, temp_max_value, iso_range);
-  
   /* figure out the min and max dimensions */
   min_voxel = max_voxel = iso_voxel;
-  
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z < temp_rd->dim.z; i_voxel.z++) {
-    for (i_voxel.y=0; i_voxel.y < temp_rd->dim.y; i_voxel.y++) {
-      for (i_voxel.x=0; i_voxel.x < temp_rd->dim.x; i_voxel.x++) {
-	if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, i_voxel) & 0x1) {
-	  if (min_voxel.x > i_voxel.x) min_voxel.x = i_voxel.x;
-	  if (max_voxel.x < i_voxel.x) max_voxel.x = i_voxel.x;
-	  if (min_voxel.y > i_voxel.y) min_voxel.y = i_voxel.y;
-	  if (max_voxel.y < i_voxel.y) max_voxel.y = i_voxel.y;
+  for (plane = plane_start; plane < plane_end; plane++)
+    for (y = 0; y < iso->dim_y; y++)
+      for (i_run = iso->row_first[ISOCONTOUR_ROW(iso, plane, y)];
+	   i_run < iso->row_first[ISOCONTOUR_ROW(iso, plane, y)+1]; i_run++)
+	if (isocontour_root_in(roots, num_roots, iso->parents[i_run])) {
+	  if (min_voxel.x > iso->runs[i_run].start) min_voxel.x = iso->runs[i_run].start;
+	  if (max_voxel.x < iso->runs[i_run].end) max_voxel.x = iso->runs[i_run].end;
+	  if (min_voxel.y > y) min_voxel.y = y;
+	  if (max_voxel.y < y) max_voxel.y = y;
 #ifdef ROI_TYPE_ISOCONTOUR_3D
-	  if (min_voxel.z > i_voxel.z) min_voxel.z = i_voxel.z;
-	  if (max_voxel.z < i_voxel.z) max_voxel.z = i_voxel.z;
+	  if (min_voxel.z > plane) min_voxel.z = plane;
+	  if (max_voxel.z < plane) max_voxel.z = plane;
 #endif
 	}
-      }
-    }
-  }
   
   /* transfer the subset of the data set that contains positive information */
-  if (roi->map_data != NULL)
-    g_object_unref(roi->map_data);
 #if defined(ROI_TYPE_ISOCONTOUR_2D)
-  roi->map_data = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, max_voxel.y-min_voxel.y+1, max_voxel.x-min_voxel.x+1);
+  map = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, max_voxel.y-min_voxel.y+1, max_voxel.x-min_voxel.x+1);
 #elif defined(ROI_TYPE_ISOCONTOUR_3D)
-  roi->map_data = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE,
-						   max_voxel.z-min_voxel.z+1,
-						   max_voxel.y-min_voxel.y+1, 
-						   max_voxel.x-min_voxel.x+1);
+  map = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE,
+					 max_voxel.z-min_voxel.z+1,
+					 max_voxel.y-min_voxel.y+1, 
+					 max_voxel.x-min_voxel.x+1);
 #endif
 
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z<roi->map_data->dim.z; i_voxel.z++)
-    for (i_voxel.y=0; i_voxel.y<roi->map_data->dim.y; i_voxel.y++)
-      for (i_voxel.x=0; i_voxel.x<roi->map_data->dim.x; i_voxel.x++) {
+  for (plane = plane_start; plane < plane_end; plane++)
+    for (y = 0; y < iso->dim_y; y++)
+      for (i_run = iso->row_first[ISOCONTOUR_ROW(iso, plane, y)];
+	   i_run < iso->row_first[ISOCONTOUR_ROW(iso, plane, y)+1]; i_run++)
+	if (isocontour_root_in(roots, num_roots, iso->parents[i_run])) {
 #if defined(ROI_TYPE_ISOCONTOUR_2D)
-	AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) = 
-	  0x01 & AMITK_RAW_DATA_UBYTE_2D_CONTENT(temp_rd, i_voxel.y+min_voxel.y, i_voxel.x+min_voxel.x);
+	  memset(AMITK_RAW_DATA_UBYTE_2D_POINTER(map, y-min_voxel.y, 
+						 iso->runs[i_run].start-min_voxel.x),
+		 0x01, iso->runs[i_run].end-iso->runs[i_run].start+1);
 #elif defined(ROI_TYPE_ISOCONTOUR_3D)
-	AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) =
-	  0x01 & AMITK_RAW_DATA_UBYTE_3D_CONTENT(temp_rd, i_voxel.z+min_voxel.z,i_voxel.y+min_voxel.y, i_voxel.x+min_voxel.x);
+	  memset(AMITK_RAW_DATA_UBYTE_3D_POINTER(map, plane-min_voxel.z, y-min_voxel.y, 
+						 iso->runs[i_run].start-min_voxel.x),
+		 0x01, iso->runs[i_run].end-iso->runs[i_run].start+1);
 #endif
-      }
+	}
 
-  g_object_unref(temp_rd);
+  /* the starting point is in by definition */
+#if defined(ROI_TYPE_ISOCONTOUR_2D)
+  AMITK_RAW_DATA_UBYTE_2D_SET_CONTENT(map, iso_voxel.y-min_voxel.y, iso_voxel.x-min_voxel.x) = 0x01;
+#elif defined(ROI_TYPE_ISOCONTOUR_3D)
+  AMITK_RAW_DATA_UBYTE_3D_SET_CONTENT(map, iso_voxel.z-min_voxel.z, iso_voxel.y-min_voxel.y, 
+				      iso_voxel.x-min_voxel.x) = 0x01;
+#endif
 
   /* mark the edges as such */
   i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z<roi->map_data->dim.z; i_voxel.z++)
-    for (i_voxel.y=0; i_voxel.y<roi->map_data->dim.y; i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x<roi->map_data->dim.x; i_voxel.x++) 
-	if (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, i_voxel)) 
-	  AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) =
-	    map_roi_edge(roi->map_data, i_voxel);
+  for (i_voxel.z=0; i_voxel.z<map->dim.z; i_voxel.z++)
+    for (i_voxel.y=0; i_voxel.y<map->dim.y; i_voxel.y++) 
+      for (i_voxel.x=0; i_voxel.x<map->dim.x; i_voxel.x++) 
+	if (AMITK_RAW_DATA_UBYTE_CONTENT(map, i_voxel)) 
+	  AMITK_RAW_DATA_UBYTE_SET_CONTENT(map, i_voxel) =
+	    map_roi_edge(map, i_voxel);
 
-  /* and set the rest of the important info for the data set */
-  amitk_space_copy_in_place(AMITK_SPACE(roi), AMITK_SPACE(ds));
-  roi->voxel_size = ds->voxel_size;
+  *pmin_voxel = min_voxel;
 
-  POINT_MULT(min_voxel, ds->voxel_size, temp_point);
-  temp_point = amitk_space_s2b(AMITK_SPACE(ds), temp_point);
-  amitk_space_set_offset(AMITK_SPACE(roi), temp_point);
+  return map;
+}
 
-  amitk_roi_calc_far_corner(roi);
 
-  return;
+/* Generates the isocontour maps that grow from each of the given voxels,
+   which all need to be on the same frame and gate.  The thresholding and 
+   labeling are only done once for all of them.  maps and min_voxels need 
+   room for num_voxels entries, see isocontour_extract.  This doesn't touch 
+   any rois, so it's safe to call from a worker thread. */
+void amitk_roi_`'m4_Variable_Type`'_isocontour_maps(const AmitkDataSet * ds, 
+						    const AmitkVoxel * iso_voxels,
+						    const gint num_voxels,
+						    const amide_data_t iso_min_value,
+						    const amide_data_t iso_max_value,
+						    const AmitkRoiIsocontourRange iso_range,
+						    AmitkRawData ** maps,
+						    AmitkVoxel * min_voxels) {
+
+  isocontour_t iso;
+  gint i;
+#if defined(ROI_TYPE_ISOCONTOUR_2D)
+  amide_intpoint_t z_end;
+#endif
+
+  g_return_if_fail(num_voxels > 0);
+
+  /* epsilon guards for floating point rounding */
+  iso.iso_min_value = iso_min_value-EPSILON*fabs(iso_min_value); 
+  iso.iso_max_value = iso_max_value+EPSILON*fabs(iso_max_value); 
+  iso.iso_range = iso_range;
+  iso.ds = ds;
+  iso.frame_gate = iso_voxels[0];
+  iso.dim_y = ds->raw_data->dim.y;
+  iso.dim_x = ds->raw_data->dim.x;
 
+#if defined(ROI_TYPE_ISOCONTOUR_2D)
+  /* only the planes with starting voxels on them are needed */
+  iso.z_start = z_end = iso_voxels[0].z;
+  for (i=1; i < num_voxels; i++) {
+    iso.z_start = MIN(iso.z_start, iso_voxels[i].z);
+    z_end = MAX(z_end, iso_voxels[i].z);
+  }
+  iso.num_planes = z_end-iso.z_start+1;
+#elif defined(ROI_TYPE_ISOCONTOUR_3D)
+  iso.z_start = 0;
+  iso.num_planes = ds->raw_data->dim.z;
+#endif
+
+  isocontour_label(&iso);
+
+  for (i=0; i < num_voxels; i++)
+    maps[i] = isocontour_extract(&iso, iso_voxels[i], &(min_voxels[i]));
+
+  g_free(iso.runs);
+  g_free(iso.parents);
+  g_free(iso.row_first);
+
+  return;
 }
 
 #endif
@@ -837,6 +1023,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
   AmitkPoint ds_voxel_size;
   AmitkPoint sub_voxel_size;
   amide_real_t grain_size;
+  amide_data_t * row;
 
 #if defined (ROI_TYPE_BOX)
   AmitkPoint box_corner;
@@ -919,6 +1106,9 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
   next_plane_in = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, dim.y+1, dim.x+1);
   curr_plane_in = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, dim.y+1, dim.x+1);
 
+  /* values of the data set row we're currently iterating over */
+  row = g_new(amide_data_t, ds_dim.x);
+
   j.t = frame;
   j.g = gate;
   i.t = k.t = i.g = k.g = 0;
@@ -931,6 +1121,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
       j.y = i.y+start.y;
       far_ds_pt.y = (j.y+1)*ds_voxel_size.y;
       center_ds_pt.y = (j.y+0.5)*ds_voxel_size.y;
+      amitk_data_set_get_row(ds, j, row);
       
       for (i.x = 0; i.x < dim.x; i.x++) {
 	j.x = i.x+start.x;
@@ -979,7 +1170,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 	  /* this voxel is entirely in the ROI */
 
 	  if (!inverse) {
-	    value = amitk_data_set_get_value(ds,j);
+	    value = row[j.x];
 	    (*calculation)(j, value, 1.0, data);
 	  }
 
@@ -995,7 +1186,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 		   small_dimensions) {
 	  /* this voxel is partially in the ROI, will need to do subvoxel analysis */
 
-	  value = amitk_data_set_get_value(ds,j);
+	  value = row[j.x];
 	  voxel_fraction=0;
 
 	  for (k.z = 0;k.z<AMITK_ROI_GRANULARITY;k.z++) {
@@ -1037,7 +1228,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 
 	} else { /* this voxel is outside the ROI */
 	  if (inverse) {
-	    value = amitk_data_set_get_value(ds,j);
+	    value = row[j.x];
 	    (*calculation)(j, value, 1.0, data);
 	  }
 	}
@@ -1054,6 +1245,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
   /* trash collection */
   g_object_unref(curr_plane_in);
   g_object_unref(next_plane_in);
+  g_free(row);
 
 
   return;
@@ -1081,6 +1273,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
   AmitkPoint ds_voxel_size;
   AmitkPoint sub_voxel_size;
   amide_real_t grain_size;
+  amide_data_t * row;
 
 #if defined (ROI_TYPE_BOX)
   AmitkPoint box_corner;
@@ -1145,12 +1338,14 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
   j.t = frame;
   j.g = gate;
   k.t = k.g = 0;
+  row = g_new(amide_data_t, ds_dim.x);
 
   for (j.z = start.z; j.z <= end.z; j.z++) {
     for (j.y = start.y; j.y <= end.y; j.y++) {
+      amitk_data_set_get_row(ds, j, row);
       for (j.x = start.x; j.x <= end.x; j.x++) {
 
-	value = amitk_data_set_get_value(ds,j);
+	value = row[j.x];
 	voxel_fraction=0;
 
 	for (k.z = 0;k.z<AMITK_ROI_GRANULARITY;k.z++) {
@@ -1199,6 +1394,8 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
     } /* i.y loop */
   } /* i.z loop */
 
+  g_free(row);
+
   return;
 }
 
@@ -49,12 +49,14 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 								     ,const gboolean fill_roi
 #endif
 								     );
-void amitk_roi_`'m4_Variable_Type`'_set_isocontour(AmitkRoi * roi, 
-						   AmitkDataSet * ds, 
-						   AmitkVoxel iso_vp,
-						   amide_data_t iso_min_value,
-						   amide_data_t iso_max_value,
-						   AmitkRoiIsocontourRange iso_range);
+void amitk_roi_`'m4_Variable_Type`'_isocontour_maps(const AmitkDataSet * ds, 
+						    const AmitkVoxel * iso_voxels,
+						    const gint num_voxels,
+						    const amide_data_t iso_min_value,
+						    const amide_data_t iso_max_value,
+						    const AmitkRoiIsocontourRange iso_range,
+						    AmitkRawData ** maps,
+						    AmitkVoxel * min_voxels);
 void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean erase, AmitkVoxel voxel, gint area_size);
 void amitk_roi_`'m4_Variable_Type`'_calc_center_of_mass(AmitkRoi * roi);
 #endif
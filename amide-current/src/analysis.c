@@ -26,6 +26,7 @@
 #include "amide_config.h"
 #include "analysis.h"
 #include <glib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include <sys/time.h>
@@ -45,37 +46,120 @@
 
 #define EMPTY 0.0
 
+/* one (roi, data set, frame, gate) worth of statistics to calculate */
+typedef struct analysis_task_t {
+  analysis_roi_t * roi_analysis; /* has the calculation parameters */
+  AmitkDataSet * data_set;
+  analysis_frame_t * frame_analysis;
+  guint frame;
+  guint gate;
+  analysis_gate_t * gate_analysis; /* the result */
+} analysis_task_t;
+
+/* what the gate analyses are cached by */
+typedef struct analysis_cache_key_t {
+  gpointer roi;
+  gpointer data_set;
+  guint frame;
+  guint gate;
+} analysis_cache_key_t;
+
+/* the tasks get handed out to the worker threads one at a time as they free up, 
+   as the tasks can take wildly different amounts of time */
+typedef struct analysis_schedule_t {
+  analysis_task_t * tasks;
+  gint num_tasks;
+  gint next_task;
+  gint num_done;
+  gint cancelled;
+  AmitkUpdateFunc update_func;
+  gpointer update_data;
+} analysis_schedule_t;
+
 static analysis_gate_t * analysis_gate_unref(analysis_gate_t *gate_analysis);
-static analysis_gate_t * analysis_gate_init(AmitkRoi * roi, AmitkDataSet *ds,guint frame, 
-					    analysis_calculation_t calculation_type,
-					    gboolean accurate,
-					    gdouble subfraction, 
-					    gdouble threshold_percentage, 
-					    gdouble threshold_value);
 static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis);
 static analysis_frame_t * analysis_frame_init(AmitkRoi * roi, AmitkDataSet *ds, 
-					      analysis_calculation_t calculation_type,
-					      gboolean accurate,
-					      gdouble subfraction, 
-					      gdouble threshold_percentage,
-					      gdouble threshold_value);
+					      analysis_roi_t * roi_analysis,
+					      GHashTable * cache,
+					      GArray * tasks);
 static analysis_volume_t * analysis_volume_unref(analysis_volume_t *volume_analysis);
 static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * volumes, 
-						analysis_calculation_t calculation_type,
-						gboolean accurate,
-						gdouble subfraction, 
-						gdouble threshold_percentage, 
-						gdouble threshold_value);
+						analysis_roi_t * roi_analysis,
+						GHashTable * cache,
+						GArray * tasks);
+
+
+/* allocates space for the given number of samples */
+static gboolean samples_init(analysis_samples_t * samples, guint allocated) {
+
+  samples->len = 0;
+  samples->allocated = allocated;
+  samples->values = NULL;
+  samples->weights = NULL;
+  samples->ds_voxels = NULL;
+  if (allocated == 0) return TRUE;
+
+  samples->values = g_try_new(amide_data_t, allocated);
+  samples->weights = g_try_new(amide_real_t, allocated);
+  samples->ds_voxels = g_try_new(AmitkVoxel, allocated);
+  if ((samples->values == NULL) || (samples->weights == NULL) || (samples->ds_voxels == NULL)) {
+    g_free(samples->values);
+    g_free(samples->weights);
+    g_free(samples->ds_voxels);
+    return FALSE;
+  }
+
+  return TRUE;
+}
 
+static void samples_free(analysis_samples_t * samples) {
+  g_free(samples->values);
+  g_free(samples->weights);
+  g_free(samples->ds_voxels);
+  samples->values = NULL;
+  samples->weights = NULL;
+  samples->ds_voxels = NULL;
+  samples->len = samples->allocated = 0;
+}
 
-void free_array_element(gpointer data, gpointer user_data) {
-  analysis_element_t * element = data;
-  g_free(element);
+/* crashes if the alloc fails, same as g_renew */
+static void samples_resize(analysis_samples_t * samples, guint allocated) {
+  samples->values = g_renew(amide_data_t, samples->values, allocated);
+  samples->weights = g_renew(amide_real_t, samples->weights, allocated);
+  samples->ds_voxels = g_renew(AmitkVoxel, samples->ds_voxels, allocated);
+  samples->allocated = allocated;
 }
 
-static analysis_gate_t * analysis_gate_unref(analysis_gate_t * gate_analysis) {
+/* an upper bound on the number of data set voxels that can be in the roi,
+   from the intersection of their bounding boxes */
+static guint samples_estimate(AmitkRoi * roi, AmitkDataSet * ds) {
+
+  AmitkCorners intersection_corners;
+  AmitkVoxel start, end;
+  guint64 estimate;
+
+  if (AMITK_ROI_UNDRAWN(roi)) return 0;
+  if (!amitk_volume_volume_intersection_corners(AMITK_VOLUME(ds), AMITK_VOLUME(roi), 
+						intersection_corners))
+    return 0;
+
+  POINT_TO_VOXEL(intersection_corners[0], AMITK_DATA_SET_VOXEL_SIZE(ds), 0, 0, start);
+  POINT_TO_VOXEL(intersection_corners[1], AMITK_DATA_SET_VOXEL_SIZE(ds), 0, 0, end);
+  estimate = ((guint64) (end.x-start.x+1))*(end.y-start.y+1)*(end.z-start.z+1);
+
+  return (estimate > G_MAXUINT) ? G_MAXUINT : estimate;
+}
 
-  analysis_gate_t * return_list;
+static analysis_gate_t * analysis_gate_ref(analysis_gate_t * gate_analysis) {
+
+  g_return_val_if_fail(gate_analysis != NULL, NULL);
+
+  gate_analysis->ref_count++;
+
+  return gate_analysis;
+}
+
+static analysis_gate_t * analysis_gate_unref(analysis_gate_t * gate_analysis) {
 
   if (gate_analysis == NULL)
     return gate_analysis;
@@ -88,19 +172,85 @@ static analysis_gate_t * analysis_gate_unref(analysis_gate_t * gate_analysis) {
 
   /* if we've removed all reference's, free the roi */
   if (gate_analysis->ref_count == 0) {
+    samples_free(&(gate_analysis->samples));
+    g_free(gate_analysis);
+  }
 
-    g_ptr_array_foreach(gate_analysis->data_array, free_array_element, NULL); /* free the elements */
-    g_ptr_array_free(gate_analysis->data_array, TRUE); /* TRUE frees the array of pointers to elements as well */
+  return NULL;
+}
 
-    /* recursively delete rest of list */
-    return_list = analysis_gate_unref(gate_analysis->next_gate_analysis);
-    gate_analysis->next_gate_analysis = NULL;
-    g_free(gate_analysis);
-    gate_analysis = NULL;
-  } else
-    return_list = gate_analysis;
 
-  return return_list;
+static guint analysis_cache_key_hash(gconstpointer key) {
+
+  const analysis_cache_key_t * cache_key = key;
+
+  return g_direct_hash(cache_key->roi) ^ (31*g_direct_hash(cache_key->data_set)) ^
+    (cache_key->frame << 8) ^ cache_key->gate;
+}
+
+static gboolean analysis_cache_key_equal(gconstpointer a, gconstpointer b) {
+
+  const analysis_cache_key_t * key_a = a;
+  const analysis_cache_key_t * key_b = b;
+
+  return ((key_a->roi == key_b->roi) && (key_a->data_set == key_b->data_set) &&
+	  (key_a->frame == key_b->frame) && (key_a->gate == key_b->gate));
+}
+
+static void analysis_cache_value_free(gpointer data) {
+  analysis_gate_unref(data);
+}
+
+GHashTable * analysis_cache_new(void) {
+  return g_hash_table_new_full(analysis_cache_key_hash, analysis_cache_key_equal,
+			       g_free, analysis_cache_value_free);
+}
+
+static gboolean analysis_cache_key_has_object(gpointer key, gpointer value, gpointer object) {
+
+  analysis_cache_key_t * cache_key = key;
+
+  return ((cache_key->roi == object) || (cache_key->data_set == object));
+}
+
+/* removes all the entries involving the given roi or data set, returns how many were removed */
+guint analysis_cache_remove_object(GHashTable * cache, gpointer object) {
+
+  g_return_val_if_fail(cache != NULL, 0);
+
+  return g_hash_table_foreach_remove(cache, analysis_cache_key_has_object, object);
+}
+
+static analysis_gate_t * analysis_cache_lookup(GHashTable * cache, AmitkRoi * roi, 
+					       AmitkDataSet * ds, guint frame, guint gate) {
+
+  analysis_cache_key_t key;
+
+  if (cache == NULL) return NULL;
+
+  key.roi = roi;
+  key.data_set = ds;
+  key.frame = frame;
+  key.gate = gate;
+
+  return g_hash_table_lookup(cache, &key);
+}
+
+static void analysis_cache_insert(GHashTable * cache, AmitkRoi * roi, 
+				  AmitkDataSet * ds, guint frame, guint gate,
+				  analysis_gate_t * gate_analysis) {
+
+  analysis_cache_key_t * key;
+
+  key = g_new(analysis_cache_key_t, 1);
+  key->roi = roi;
+  key->data_set = ds;
+  key->frame = frame;
+  key->gate = gate;
+
+  g_hash_table_replace(cache, key, analysis_gate_ref(gate_analysis));
+
+  return;
 }
 
 
@@ -109,36 +259,168 @@ static void record_stats(AmitkVoxel ds_voxel,
 			 amide_real_t voxel_fraction,
 			 gpointer data) {
 
-  GPtrArray * array = data;
-  analysis_element_t * element;
+  analysis_samples_t * samples = data;
   
   /* crashes if alloc fails, but I don't want to do error checking in the inner loop... 
-     let's not run out of memory */
+     let's not run out of memory.  The space has usually been preallocated anyway. */
   if (voxel_fraction > 0.0) {
-    element = g_malloc(sizeof(analysis_element_t)); 
+    if (samples->len == samples->allocated)
+      samples_resize(samples, MAX(2*samples->allocated, 1024));
     
-    element->value = value;
-    element->weight = voxel_fraction;
-    element->ds_voxel = ds_voxel;
-    g_ptr_array_add(array, element);
+    samples->values[samples->len] = value;
+    samples->weights[samples->len] = voxel_fraction;
+    samples->ds_voxels[samples->len] = ds_voxel;
+    samples->len++;
   }
 
   return;
 }
 
-static gint array_comparison(gconstpointer a, gconstpointer b) {
+/* partially orders the values from largest to smallest, so that values[k] is 
+   the k'th largest value (counting from 0), with everything before it >= and 
+   everything after it <=.  Order(N), instead of order(NlogN) for a full sort. */
+static amide_data_t select_largest(amide_data_t * values, guint num, guint k) {
+
+  gssize left, right, i, j;
+  amide_data_t pivot, temp;
+
+  left = 0;
+  right = num-1;
+  while (right > left) {
+    pivot = values[(left+right) >> 1];
+    i = left;
+    j = right;
+    while (i <= j) {
+      while (values[i] > pivot) i++;
+      while (values[j] < pivot) j--;
+      if (i <= j) {
+	temp = values[i];
+	values[i] = values[j];
+	values[j] = temp;
+	i++;
+	j--;
+      }
+    }
+    if (k <= j) right = j;
+    else if (k >= i) left = i;
+    else break; /* values between j and i are all equal to the pivot */
+  }
+
+  return values[k];
+}
+
+/* median of the values, destroys the order of values */
+static amide_data_t median(amide_data_t * values, guint num) {
+
+  amide_data_t lower;
+  guint i;
+
+  if (num & 0x1) /* odd */
+    return select_largest(values, num, (num-1)/2);
+
+  /* even, average the two middle values */
+  select_largest(values, num, num/2-1);
+  lower = values[num/2];
+  for (i=num/2+1; i<num; i++)
+    if (values[i] > lower) lower = values[i];
+
+  return 0.5*values[num/2-1] + 0.5*lower;
+}
+
+static gint sample_comparison(gconstpointer a, gconstpointer b, gpointer data) {
 
-  const analysis_element_t * ea = *((analysis_element_t **) a);
-  const analysis_element_t * eb = *((analysis_element_t **) b);
+  const amide_data_t * values = data;
+  amide_data_t va = values[*((const guint *) a)];
+  amide_data_t vb = values[*((const guint *) b)];
 
-  if (ea->value > eb->value) 
+  if (va > vb) 
     return -1;
-  else if (ea->value < eb->value) 
+  else if (va < vb) 
     return 1;
   else
     return 0;
 }
 
+/* sorts the samples from largest to smallest value, the analysis itself doesn't need
+   this, but it's nice for exporting */
+static void samples_sort(analysis_samples_t * samples) {
+
+  analysis_samples_t sorted;
+  guint * order;
+  guint i;
+
+  if (samples->len < 2) return;
+
+  if ((order = g_try_new(guint, samples->len)) == NULL) {
+    g_warning(_("couldn't allocate memory space for sorting roi data"));
+    return;
+  }
+  if (!samples_init(&sorted, samples->len)) {
+    g_warning(_("couldn't allocate memory space for sorting roi data"));
+    g_free(order);
+    return;
+  }
+
+  for (i=0; i<samples->len; i++) order[i] = i;
+  g_qsort_with_data(order, samples->len, sizeof(guint), 
+		    sample_comparison, samples->values);
+
+  for (i=0; i<samples->len; i++) {
+    sorted.values[i] = samples->values[order[i]];
+    sorted.weights[i] = samples->weights[order[i]];
+    sorted.ds_voxels[i] = samples->ds_voxels[order[i]];
+  }
+  sorted.len = samples->len;
+
+  samples_free(samples);
+  *samples = sorted;
+  g_free(order);
+
+  return;
+}
+
+/* fills in samples with the gate's samples, sorted from largest to smallest value.
+   Gates calculated by streaming don't keep their samples, so they get gathered
+   again here.  The gate analysis itself is left alone, as it's shared through the
+   analysis cache.  roi, ds, frame, gate, and accurate need to be what the gate
+   analysis was calculated with.  The samples should be freed with 
+   analysis_samples_free */
+gboolean analysis_gate_get_samples(const analysis_gate_t * gate_analysis,
+				   AmitkRoi * roi,
+				   AmitkDataSet * ds,
+				   guint frame,
+				   guint gate,
+				   gboolean accurate,
+				   analysis_samples_t * samples) {
+
+  const analysis_samples_t * kept = &(gate_analysis->samples);
+
+  if (kept->values != NULL) {
+    if (!samples_init(samples, kept->len)) {
+      g_warning(_("couldn't allocate memory space for data array for frame %d/gate %d"), frame, gate);
+      return FALSE;
+    }
+    memcpy(samples->values, kept->values, sizeof(amide_data_t)*kept->len);
+    memcpy(samples->weights, kept->weights, sizeof(amide_real_t)*kept->len);
+    memcpy(samples->ds_voxels, kept->ds_voxels, sizeof(AmitkVoxel)*kept->len);
+    samples->len = kept->len;
+  } else {
+    if (!samples_init(samples, samples_estimate(roi, ds)) && !samples_init(samples, 0)) {
+      g_warning(_("couldn't allocate memory space for data array for frame %d/gate %d"), frame, gate);
+      return FALSE;
+    }
+    amitk_roi_calculate_on_data_set(roi, ds, frame, gate, FALSE, accurate, record_stats, samples);
+  }
+
+  samples_sort(samples);
+
+  return TRUE;
+}
+
+void analysis_samples_free(analysis_samples_t * samples) {
+  samples_free(samples);
+}
+
 
 
 /* note, the following function for weight variance calculation is
@@ -147,9 +429,9 @@ static gint array_comparison(gconstpointer a, gconstpointer b) {
 /* The variance is divided by N-1, since the mean in a sense is being
    "estimated" from the data set....  If anyone else with more
    statistical experience disagrees, please speak up */
-static gdouble wvariance (GPtrArray * array, guint num_elements, gdouble wmean)
+static gdouble wvariance (const amide_data_t * values, const amide_real_t * weights,
+			  guint num_elements, gdouble wmean)
 {
-  analysis_element_t * element;
   gdouble wsumofsquares = 0 ;
   gdouble Wa = 0;
   gdouble Wb = 0;
@@ -164,11 +446,10 @@ static gdouble wvariance (GPtrArray * array, guint num_elements, gdouble wmean)
   /* computes sum(wi*(valuei-mean))/sum(wi) */
   /* and computes the weighted version of N/(N-1) */
   for (i = 0; i < num_elements; i++) {
-    element = g_ptr_array_index(array, i);
-    wi = element->weight;
+    wi = weights[i];
 
     if (wi > 0) {
-      delta = element->value-wmean;
+      delta = values[i]-wmean;
       Wa += wi ;
       Wb += wi*wi;
       wsumofsquares += (delta * delta - wsumofsquares) * (wi / Wa);
@@ -182,24 +463,297 @@ static gdouble wvariance (GPtrArray * array, guint num_elements, gdouble wmean)
 
 
 
-/* calculate an analysis of several statistical values for an roi on a given data set frame/gate. */
-static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi, 
-						    AmitkDataSet * ds, 
-						    guint frame,
-						    guint gate,
-						    analysis_calculation_t calculation_type,
-						    gboolean accurate,
-						    gdouble subfraction,
-						    gdouble threshold_percentage,
-						    gdouble threshold_value) {
+/* number of bins used for narrowing down the median when streaming */
+#define STREAM_MEDIAN_BINS 4096
+
+/* running values for calculating statistics without keeping the samples around. 
+   The data gets passed over once for everything but the median, the median 
+   takes a second pass to histogram the values, and if needed a third pass to 
+   pick up the values in the bins the median falls in */
+typedef struct analysis_stream_t {
+  gint pass;
+  gboolean use_cutoff;
+  amide_data_t cutoff; /* only values >= cutoff are used, if use_cutoff */
+
+  /* first pass */
+  guint voxels;
+  gboolean nan_seen;
+  amide_real_t fractional_voxels;
+  amide_real_t squared_weights;
+  amide_data_t total;
+  amide_data_t wmean;
+  amide_data_t wsumofsquares;
+  amide_data_t min;
+  amide_data_t max;
+
+  /* second pass */
+  amide_data_t bin_scale;
+  guint * bin_counts;
+  amide_data_t * bin_min;
+  amide_data_t * bin_max;
+
+  /* third pass */
+  guint first_bin;
+  guint last_bin;
+  amide_data_t * values;
+  guint num_values;
+} analysis_stream_t;
+
+static inline guint stream_bin(const analysis_stream_t * stream, amide_data_t value) {
+  guint bin;
+
+  bin = (value - stream->min)*stream->bin_scale;
+  return (bin >= STREAM_MEDIAN_BINS) ? STREAM_MEDIAN_BINS-1 : bin;
+}
+
+static void record_stream(AmitkVoxel ds_voxel,
+			  amide_data_t value,
+			  amide_real_t voxel_fraction,
+			  gpointer data) {
+
+  analysis_stream_t * stream = data;
+  amide_data_t delta, r;
+  guint bin;
+
+  if (voxel_fraction <= 0.0) return;
+  if (stream->use_cutoff && !(value >= stream->cutoff)) return;
+
+  switch(stream->pass) {
+  case 0:
+    /* weighted version of Welford's running variance */
+    if (stream->voxels == 0) {
+      stream->min = stream->max = value;
+    } else {
+      if (value > stream->max) stream->max = value;
+      if (value < stream->min) stream->min = value;
+    }
+    if (isnan(value)) stream->nan_seen = TRUE;
+    stream->voxels++;
+    stream->total += voxel_fraction*value;
+    stream->squared_weights += voxel_fraction*voxel_fraction;
+    delta = value - stream->wmean;
+    r = delta*voxel_fraction/(stream->fractional_voxels+voxel_fraction);
+    stream->wmean += r;
+    stream->wsumofsquares += stream->fractional_voxels*delta*r;
+    stream->fractional_voxels += voxel_fraction;
+    break;
+  case 1:
+    bin = stream_bin(stream, value);
+    if (stream->bin_counts[bin] == 0) {
+      stream->bin_min[bin] = stream->bin_max[bin] = value;
+    } else {
+      if (value > stream->bin_max[bin]) stream->bin_max[bin] = value;
+      if (value < stream->bin_min[bin]) stream->bin_min[bin] = value;
+    }
+    stream->bin_counts[bin]++;
+    break;
+  case 2:
+  default:
+    bin = stream_bin(stream, value);
+    if ((bin >= stream->first_bin) && (bin <= stream->last_bin))
+      stream->values[stream->num_values++] = value;
+    break;
+  }
+
+  return;
+}
+
+/* the k'th smallest value (counting from 0) that went into the stream, returns
+   the bin the value's in and whether the value could be figured out from the
+   histogram alone */
+static gboolean stream_kth_value(const analysis_stream_t * stream, guint k, 
+				 guint * pbin, amide_data_t * pvalue) {
+
+  guint bin, below;
+
+  below = 0;
+  for (bin=0; (bin < STREAM_MEDIAN_BINS-1) && (below+stream->bin_counts[bin] <= k); bin++)
+    below += stream->bin_counts[bin];
+
+  *pbin = bin;
+
+  if (stream->bin_min[bin] == stream->bin_max[bin]) {
+    *pvalue = stream->bin_min[bin];
+    return TRUE;
+  } else if (k == below) {
+    *pvalue = stream->bin_min[bin];
+    return TRUE;
+  } else if (k == below+stream->bin_counts[bin]-1) {
+    *pvalue = stream->bin_max[bin];
+    return TRUE;
+  } else 
+    return FALSE;
+}
+
+/* exact median of the values that went into the first pass, using the later passes */
+static amide_data_t stream_median(analysis_stream_t * stream,
+				  AmitkRoi * roi, 
+				  AmitkDataSet * ds, 
+				  guint frame,
+				  guint gate,
+				  gboolean accurate) {
+
+  guint k[2];
+  guint bin[2];
+  amide_data_t value[2];
+  gboolean found[2];
+  guint i, bin_index, below_first;
+
+  if (stream->voxels == 0) return 0.0;
+  if (stream->nan_seen) return NAN;
+  if (stream->min == stream->max) return stream->min;
+
+  /* the middle value, or the two middle values for an even number of values */
+  k[0] = (stream->voxels-1)/2;
+  k[1] = stream->voxels/2;
+
+  stream->bin_counts = g_try_new0(guint, STREAM_MEDIAN_BINS);
+  stream->bin_min = g_try_new(amide_data_t, STREAM_MEDIAN_BINS);
+  stream->bin_max = g_try_new(amide_data_t, STREAM_MEDIAN_BINS);
+  if ((stream->bin_counts == NULL) || (stream->bin_min == NULL) || (stream->bin_max == NULL)) {
+    g_warning(_("couldn't allocate memory space for median of frame %d/gate %d"), frame, gate);
+    g_free(stream->bin_counts);
+    g_free(stream->bin_min);
+    g_free(stream->bin_max);
+    return NAN;
+  }
+
+  stream->bin_scale = STREAM_MEDIAN_BINS/(stream->max - stream->min);
+  if (!isfinite(stream->bin_scale)) stream->bin_scale = 0.0; /* everything in one bin */
+  stream->pass = 1;
+  amitk_roi_calculate_on_data_set(roi, ds, frame, gate, FALSE, accurate, record_stream, stream);
+
+  for (i=0; i<2; i++)
+    found[i] = stream_kth_value(stream, k[i], &(bin[i]), &(value[i]));
+
+  /* pick up the values in the bins we couldn't resolve, the two middle values
+     are in the same or neighboring bins, as the bins in between are empty */
+  if (!found[0] || !found[1]) {
+    stream->first_bin = found[0] ? bin[1] : bin[0];
+    stream->last_bin = found[1] ? bin[0] : bin[1];
+    stream->num_values = 0;
+    for (bin_index = stream->first_bin; bin_index <= stream->last_bin; bin_index++)
+      stream->num_values += stream->bin_counts[bin_index];
+    below_first = 0;
+    for (bin_index = 0; bin_index < stream->first_bin; bin_index++)
+      below_first += stream->bin_counts[bin_index];
+
+    if ((stream->values = g_try_new(amide_data_t, stream->num_values)) == NULL) {
+      g_warning(_("couldn't allocate memory space for median of frame %d/gate %d"), frame, gate);
+      value[0] = value[1] = NAN;
+    } else {
+      stream->num_values = 0;
+      stream->pass = 2;
+      amitk_roi_calculate_on_data_set(roi, ds, frame, gate, FALSE, accurate, record_stream, stream);
+      
+      /* select_largest counts from the top */
+      for (i=0; i<2; i++)
+	if (!found[i])
+	  value[i] = select_largest(stream->values, stream->num_values, 
+				    stream->num_values-1-(k[i]-below_first));
+      g_free(stream->values);
+    }
+  }
+
+  g_free(stream->bin_counts);
+  g_free(stream->bin_min);
+  g_free(stream->bin_max);
+
+  if (k[0] == k[1])
+    return value[0];
+  else
+    return 0.5*value[1] + 0.5*value[0];
+}
 
-  GPtrArray * data_array;
+/* same as analysis_gate_calculate, for the calculation types where whether a voxel
+   is used can be decided by looking at just that voxel.  The samples aren't kept,
+   see analysis_gate_get_samples */
+static analysis_gate_t * analysis_gate_calculate_streaming(AmitkRoi * roi, 
+							   AmitkDataSet * ds, 
+							   guint frame,
+							   guint gate,
+							   analysis_calculation_t calculation_type,
+							   gboolean accurate,
+							   gdouble threshold_value) {
+
+  analysis_stream_t stream;
+  analysis_gate_t * analysis;
+
+  stream.pass = 0;
+  stream.use_cutoff = (calculation_type == VOXELS_GREATER_THAN_VALUE);
+  stream.cutoff = threshold_value;
+  stream.voxels = 0;
+  stream.nan_seen = FALSE;
+  stream.fractional_voxels = 0.0;
+  stream.squared_weights = 0.0;
+  stream.total = 0.0;
+  stream.wmean = 0.0;
+  stream.wsumofsquares = 0.0;
+  stream.min = stream.max = 0.0;
+
+  amitk_roi_calculate_on_data_set(roi, ds, frame, gate, FALSE, accurate, record_stream, &stream);
+
+  if ((analysis =  g_try_new(analysis_gate_t,1)) == NULL) {
+    g_warning(_("couldn't allocate memory space for roi analysis of frame %d/gate %d"), frame, gate);
+    return analysis;
+  }
+  analysis->ref_count = 1;
+  samples_init(&(analysis->samples), 0);
+
+  analysis->duration = amitk_data_set_get_frame_duration(ds, frame);
+  analysis->time_midpoint = amitk_data_set_get_midpt_time(ds, frame);
+  analysis->gate_time = amitk_data_set_get_gate_time(ds, gate);
+  analysis->voxels = stream.voxels;
+  analysis->fractional_voxels = stream.fractional_voxels;
+  analysis->correction = 0.0;
+
+  if (stream.voxels == 0) { /* roi not in data set */
+    analysis->total = 0.0;
+    analysis->max = 0.0;
+    analysis->min = 0.0;
+    analysis->median = 0.0;
+    analysis->mean = 0.0;
+    analysis->var = 0.0;
+  } else {
+    analysis->total = stream.total;
+    analysis->max = stream.max;
+    analysis->min = stream.min;
+    analysis->mean = stream.total/stream.fractional_voxels;
+
+    /* same weighted N/(N-1) correction as wvariance */
+    if (stream.voxels < 2)
+      analysis->var = NAN;
+    else
+      analysis->var = (stream.wsumofsquares/stream.fractional_voxels) *
+	(stream.fractional_voxels*stream.fractional_voxels) /
+	(stream.fractional_voxels*stream.fractional_voxels - stream.squared_weights);
+
+    analysis->median = stream_median(&stream, roi, ds, frame, gate, accurate);
+  }
+
+  return analysis;
+}
+
+
+/* calculate an analysis of several statistical values for an roi on a given data set frame/gate. 
+   This gets called from the worker threads, so no gtk calls */
+static analysis_gate_t * analysis_gate_calculate(AmitkRoi * roi, 
+						 AmitkDataSet * ds, 
+						 guint frame,
+						 guint gate,
+						 analysis_calculation_t calculation_type,
+						 gboolean accurate,
+						 gdouble subfraction,
+						 gdouble threshold_percentage,
+						 gdouble threshold_value) {
+
+  analysis_samples_t samples;
   analysis_gate_t * analysis;
   guint subfraction_voxels;
-  guint i;
-  analysis_element_t * element;
-  gdouble max;
-  gboolean done;
+  guint i, j, num_at_cutoff;
+  amide_data_t * subset_values=NULL;
+  amide_real_t * subset_weights=NULL;
+  amide_data_t max, cutoff;
 #ifdef AMIDE_DEBUG
   struct timeval tv1;
   struct timeval tv2;
@@ -210,87 +764,108 @@ static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi,
   gettimeofday(&tv1, NULL);
 #endif
 
-  if (gate == AMITK_DATA_SET_NUM_GATES(ds)) return NULL; /* check if we're done */
+  if ((calculation_type == ALL_VOXELS) || (calculation_type == VOXELS_GREATER_THAN_VALUE))
+    return analysis_gate_calculate_streaming(roi, ds, frame, gate, calculation_type, 
+					     accurate, threshold_value);
 
-  /* and now calculate this gate's data */
-  if ((data_array = g_ptr_array_new()) == NULL) {
+  /* calculate this gate's data, the space is sized off the roi/data set 
+     intersection, and any excess is given back afterwards */
+  if (!samples_init(&samples, samples_estimate(roi, ds)) &&
+      !samples_init(&samples, 0)) {
     g_warning(_("couldn't allocate memory space for data array for frame %d/gate %d"), frame, gate);
     return NULL;
   }
-  /* fill the array with the appropriate info from the data set */
-  /* note, I really only need a partial sort to get the median value, but
-     glib doesn't have one (only has a full qsort), so I'll just do that.
-     Partial sort would be order(N), qsort is order(NlogN), so it's not that
-     much worse.
-
-     If I used a partial sort, I'd have to iterate over the subfraction to find the 
-     max and min, and I'd have to do another partial sort to find the median 
-  */
-  amitk_roi_calculate_on_data_set(roi, ds, frame, gate,FALSE, accurate, record_stats, data_array);
-  g_ptr_array_sort(data_array, array_comparison);
-  
+  amitk_roi_calculate_on_data_set(roi, ds, frame, gate,FALSE, accurate, record_stats, &samples);
+  if ((samples.len > 0) && (samples.len < samples.allocated))
+    samples_resize(&samples, samples.len);
+
+  /* figure out how many of the highest valued voxels we'll be using */
+  max = -G_MAXDOUBLE;
+  for (i=0; i<samples.len; i++)
+    if (samples.values[i] > max) max = samples.values[i];
+
   switch(calculation_type) {
   case ALL_VOXELS:
-    subfraction_voxels = data_array->len;
+    subfraction_voxels = samples.len;
     break;
   case HIGHEST_FRACTION_VOXELS:
-    subfraction_voxels = ceil(subfraction*data_array->len);
+    subfraction_voxels = ceil(subfraction*samples.len);
 
-    if ((subfraction_voxels == 0) && (data_array->len > 0))
+    if ((subfraction_voxels == 0) && (samples.len > 0))
       subfraction_voxels = 1; /* have at least one voxel if the roi is in the data set*/
 
     break;
   case VOXELS_NEAR_MAX:
     subfraction_voxels = 0;
+    for (i=0; i<samples.len; i++)
+      if (samples.values[i] >= max*threshold_percentage/100.0)
+	subfraction_voxels++;
 
-    if (data_array->len > 0) {
-      element = g_ptr_array_index(data_array, 0);
-      max = element->value;
-      done = FALSE;
-      for (i=0; i<data_array->len && !done; i++) {
-	element = g_ptr_array_index(data_array, i);
-	if (element->value >= max*threshold_percentage/100.0)
-	  subfraction_voxels++;
-	else
-	  done = TRUE;
-      }
-    }
-
-    if ((subfraction_voxels == 0) && (data_array->len > 0))
+    if ((subfraction_voxels == 0) && (samples.len > 0))
       subfraction_voxels = 1; /* have at least one voxel if the roi is in the data set*/
 
     break;
   case VOXELS_GREATER_THAN_VALUE:
     subfraction_voxels = 0;
-
-    if (data_array->len > 0) {
-      element = g_ptr_array_index(data_array, 0);
-      max = element->value;
-      done = FALSE;
-      for (i=0; i<data_array->len && !done; i++) {
-	element = g_ptr_array_index(data_array, i);
-	if (element->value >= threshold_value)
-	  subfraction_voxels++;
-	else
-	  done = TRUE;
-      }
-    }
+    for (i=0; i<samples.len; i++)
+      if (samples.values[i] >= threshold_value)
+	subfraction_voxels++;
     break;
   default:
     subfraction_voxels=0;
     g_error("unexpected case in %s at line %d",__FILE__, __LINE__);
   }
 
+  /* pull out the voxels we're using.  These are the voxels above the cutoff
+     value, and as many of the voxels equal to the cutoff as we need. 
+     subset_values also serves as scratch space for finding the cutoff, and
+     gets reordered for the median, so it's always a copy */
+  if (subfraction_voxels > 0) {
+    subset_values = g_try_new(amide_data_t, samples.len);
+    if (subfraction_voxels == samples.len)
+      subset_weights = samples.weights;
+    else
+      subset_weights = g_try_new(amide_real_t, subfraction_voxels);
+    if ((subset_values == NULL) || (subset_weights == NULL)) {
+      g_warning(_("couldn't allocate memory space for roi analysis of frame %d/gate %d"), frame, gate);
+      g_free(subset_values);
+      if (subset_weights != samples.weights) g_free(subset_weights);
+      samples_free(&samples);
+      return NULL;
+    }
+    memcpy(subset_values, samples.values, samples.len*sizeof(amide_data_t));
+
+    if (subfraction_voxels < samples.len) {
+      cutoff = select_largest(subset_values, samples.len, subfraction_voxels-1);
+      num_at_cutoff = 0;
+      for (i=0; i<subfraction_voxels; i++)
+	if (subset_values[i] == cutoff) num_at_cutoff++;
+
+      for (i=0, j=0; (i<samples.len) && (j<subfraction_voxels); i++) {
+	if ((samples.values[i] > cutoff) || 
+	    ((samples.values[i] == cutoff) && (num_at_cutoff > 0))) {
+	  if (samples.values[i] == cutoff) num_at_cutoff--;
+	  subset_values[j] = samples.values[i];
+	  subset_weights[j] = samples.weights[i];
+	  j++;
+	}
+      }
+    }
+  }
+
 
   /* fill in our gate_analysis structure */
   if ((analysis =  g_try_new(analysis_gate_t,1)) == NULL) {
     g_warning(_("couldn't allocate memory space for roi analysis of frame %d/gate %d"), frame, gate);
+    g_free(subset_values);
+    if (subset_weights != samples.weights) g_free(subset_weights);
+    samples_free(&samples);
     return analysis;
   }
   analysis->ref_count = 1;
 
   /* set values */
-  analysis->data_array = data_array;
+  analysis->samples = samples;
   analysis->duration = amitk_data_set_get_frame_duration(ds, frame);
   analysis->time_midpoint = amitk_data_set_get_midpt_time(ds, frame);
   analysis->gate_time = amitk_data_set_get_gate_time(ds, gate);
@@ -311,38 +886,31 @@ static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi,
 
   } else { 
 
-    /* max */
-    element = g_ptr_array_index(data_array, 0);
-    analysis->max = element->value;
-
-    /* min */
-    element = g_ptr_array_index(data_array, subfraction_voxels-1);
-    analysis->min = element->value;
-
-    /* median */
-    if (subfraction_voxels & 0x1) { /* odd */
-      element = g_ptr_array_index(data_array, (subfraction_voxels-1)/2);
-      analysis->median = element->value;
-    } else { /* even */
-      element = g_ptr_array_index(data_array, subfraction_voxels/2-1);
-      analysis->median = 0.5*element->value;
-      element = g_ptr_array_index(data_array, subfraction_voxels/2);
-      analysis->median += 0.5*element->value;
+    /* max and min */
+    analysis->max = analysis->min = subset_values[0];
+    for (i=1; i<subfraction_voxels; i++) {
+      if (subset_values[i] > analysis->max) analysis->max = subset_values[i];
+      if (subset_values[i] < analysis->min) analysis->min = subset_values[i];
     }
 
     /* total and #fractional_voxels */
     for (i=0; i<subfraction_voxels; i++) {
-      element = g_ptr_array_index(data_array, i);
-      analysis->total += element->weight*element->value;
-      analysis->fractional_voxels += element->weight;
+      analysis->total += subset_weights[i]*subset_values[i];
+      analysis->fractional_voxels += subset_weights[i];
     }
 
     /* calculate the mean */
     analysis->mean = analysis->total/analysis->fractional_voxels;
 
     /* calculate variance */
-    analysis->var = wvariance(data_array, subfraction_voxels, analysis->mean);
+    analysis->var = wvariance(subset_values, subset_weights, subfraction_voxels, analysis->mean);
+
+    /* median, this reorders subset_values so needs to be last */
+    analysis->median = median(subset_values, subfraction_voxels);
   }
+
+  g_free(subset_values);
+  if (subset_weights != samples.weights) g_free(subset_weights);
   
 #ifdef AMIDE_DEBUG
   /* and wrapup our timing */
@@ -355,32 +923,45 @@ static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi,
 #endif
 
 
-  /* now let's recurse  */
-  analysis->next_gate_analysis = 
-    analysis_gate_init_recurse(roi, ds, frame, gate+1, calculation_type, accurate, 
-			       subfraction, threshold_percentage, threshold_value);
-
   return analysis;
 }
 
 
+/* runs tasks until there aren't any left.  The chunk starting at 0 is run by the
+   calling thread, so that's where progress gets reported and cancels get noticed */
+static void analysis_schedule_worker(gint start, gint end, gpointer data) {
+
+  analysis_schedule_t * schedule = data;
+  analysis_task_t * task;
+  analysis_roi_t * roi_analysis;
+  gint i_task;
+  gint num_done;
+
+  while (!g_atomic_int_get(&(schedule->cancelled)) &&
+	 ((i_task = g_atomic_int_add(&(schedule->next_task), 1)) < schedule->num_tasks)) {
+    task = &(schedule->tasks[i_task]);
+    roi_analysis = task->roi_analysis;
+    task->gate_analysis = 
+      analysis_gate_calculate(roi_analysis->roi, task->data_set, task->frame, task->gate,
+			      roi_analysis->calculation_type, roi_analysis->accurate, 
+			      roi_analysis->subfraction, roi_analysis->threshold_percentage,
+			      roi_analysis->threshold_value);
+    num_done = g_atomic_int_add(&(schedule->num_done), 1)+1;
+
+    if ((start == 0) && (schedule->update_func != NULL))
+      if (!(*schedule->update_func)(schedule->update_data, NULL, 
+				    ((gdouble) num_done)/((gdouble) schedule->num_tasks)))
+	g_atomic_int_set(&(schedule->cancelled), TRUE);
+  }
 
-static analysis_gate_t * analysis_gate_init(AmitkRoi * roi, AmitkDataSet * ds,
-					    guint frame, 
-					    analysis_calculation_t calculation_type,
-					    gboolean accurate,
-					    gdouble subfraction,
-					    gdouble threshold_percentage,
-					    gdouble threshold_value) {
-
-  return analysis_gate_init_recurse(roi, ds, frame, 0, calculation_type, accurate,
-				    subfraction, threshold_percentage, threshold_value);
+  return;
 }
 
 
 static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis) {
 
   analysis_frame_t * return_list;
+  guint gate;
 
   if (frame_analysis == NULL)
     return frame_analysis;
@@ -397,7 +978,9 @@ static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis
     return_list = analysis_frame_unref(frame_analysis->next_frame_analysis);
     frame_analysis->next_frame_analysis = NULL;
 
-    frame_analysis->gate_analyses = analysis_gate_unref(frame_analysis->gate_analyses);
+    for (gate=0; gate < frame_analysis->num_gates; gate++)
+      analysis_gate_unref(frame_analysis->gate_analyses[gate]);
+    g_free(frame_analysis->gate_analyses);
     g_free(frame_analysis);
     frame_analysis = NULL;
   } else
@@ -407,17 +990,19 @@ static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis
 }
 
 
-/* returns a calculated analysis structure of an roi on a frame of a data set */
-static analysis_frame_t * analysis_frame_init_recurse(AmitkRoi * roi, 
-						      AmitkDataSet *ds, 
+/* returns the analysis structures for an roi on the frames of a data set, the 
+   statistics for each gate are either taken from the cache, or get filled in 
+   later by the tasks */
+static analysis_frame_t * analysis_frame_init_recurse(AmitkDataSet *ds, 
 						      guint frame,
-						      analysis_calculation_t calculation_type,
-						      gboolean accurate,
-						      gdouble subfraction,
-						      gdouble threshold_percentage,
-						      gdouble threshold_value) {
+						      analysis_roi_t * roi_analysis,
+						      GHashTable * cache,
+						      GArray * tasks) {
   
   analysis_frame_t * temp_frame_analysis;
+  analysis_gate_t * cached;
+  analysis_task_t task;
+  guint gate;
   
   if (frame == AMITK_DATA_SET_NUM_FRAMES(ds)) return NULL; /* check if we're done */
 
@@ -427,27 +1012,38 @@ static analysis_frame_t * analysis_frame_init_recurse(AmitkRoi * roi,
   }
   
   temp_frame_analysis->ref_count = 1;
+  temp_frame_analysis->num_gates = AMITK_DATA_SET_NUM_GATES(ds);
+  temp_frame_analysis->gate_analyses = g_new0(analysis_gate_t *, temp_frame_analysis->num_gates);
+
+  /* queue up this one's gates */
+  for (gate=0; gate < temp_frame_analysis->num_gates; gate++) {
+    cached = analysis_cache_lookup(cache, roi_analysis->roi, ds, frame, gate);
+    if (cached != NULL) {
+      temp_frame_analysis->gate_analyses[gate] = analysis_gate_ref(cached);
+      continue;
+    }
 
-  /* calculate this one */
-  temp_frame_analysis->gate_analyses = 
-    analysis_gate_init(roi, ds, frame, calculation_type, accurate, subfraction, 
-		       threshold_percentage, threshold_value);
+    task.roi_analysis = roi_analysis;
+    task.data_set = ds;
+    task.frame_analysis = temp_frame_analysis;
+    task.frame = frame;
+    task.gate = gate;
+    task.gate_analysis = NULL;
+    g_array_append_val(tasks, task);
+  }
 
   /* recurse */
   temp_frame_analysis->next_frame_analysis = 
-    analysis_frame_init_recurse(roi, ds, frame+1, calculation_type, accurate, subfraction, 
-				threshold_percentage, threshold_value);
+    analysis_frame_init_recurse(ds, frame+1, roi_analysis, cache, tasks);
 
   return temp_frame_analysis;
 }
 
 
 static analysis_frame_t * analysis_frame_init(AmitkRoi * roi, AmitkDataSet *ds, 
-					      analysis_calculation_t calculation_type,
-					      gboolean accurate,
-					      gdouble subfraction,
-					      gdouble threshold_percentage,
-					      gdouble threshold_value) {
+					      analysis_roi_t * roi_analysis,
+					      GHashTable * cache,
+					      GArray * tasks) {
 
   /* sanity checks */
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
@@ -457,8 +1053,7 @@ static analysis_frame_t * analysis_frame_init(AmitkRoi * roi, AmitkDataSet *ds,
     return NULL;
   }
 
-  return analysis_frame_init_recurse(roi, ds, 0, calculation_type, accurate, subfraction, 
-				     threshold_percentage, threshold_value);
+  return analysis_frame_init_recurse(ds, 0, roi_analysis, cache, tasks);
 }
 
 
@@ -495,11 +1090,9 @@ static analysis_volume_t * analysis_volume_unref(analysis_volume_t * volume_anal
 
 /* returns an initialized roi analysis of a list of volumes */
 static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * data_sets, 
-						analysis_calculation_t calculation_type,
-						gboolean accurate,
-						gdouble subfraction,
-						gdouble threshold_percentage,
-						gdouble threshold_value) {
+						analysis_roi_t * roi_analysis,
+						GHashTable * cache,
+						GArray * tasks) {
   
   analysis_volume_t * temp_volume_analysis;
 
@@ -518,13 +1111,11 @@ static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * data_set
 
   /* calculate this one */
   temp_volume_analysis->frame_analyses = 
-    analysis_frame_init(roi, temp_volume_analysis->data_set, calculation_type, accurate,
-			subfraction, threshold_percentage, threshold_value);
+    analysis_frame_init(roi, temp_volume_analysis->data_set, roi_analysis, cache, tasks);
 
   /* recurse */
   temp_volume_analysis->next_volume_analysis = 
-    analysis_volume_init(roi, data_sets->next, calculation_type, accurate,
-			 subfraction, threshold_percentage, threshold_value);
+    analysis_volume_init(roi, data_sets->next, roi_analysis, cache, tasks);
 
   
   return temp_volume_analysis;
@@ -567,14 +1158,16 @@ analysis_roi_t * analysis_roi_unref(analysis_roi_t * roi_analysis) {
   return return_list;
 }
 
-/* returns an initialized list of roi analyses */
-analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois, 
-				   GList * data_sets, 
-				   analysis_calculation_t calculation_type,
-				   gboolean accurate,
-				   gdouble subfraction, 
-				   gdouble threshold_percentage,
-				   gdouble threshold_value) {
+/* returns a list of roi analyses, with the statistics still to be calculated */
+static analysis_roi_t * analysis_roi_init_recurse(AmitkStudy * study, GList * rois, 
+						  GList * data_sets, 
+						  analysis_calculation_t calculation_type,
+						  gboolean accurate,
+						  gdouble subfraction, 
+						  gdouble threshold_percentage,
+						  gdouble threshold_value,
+						  GHashTable * cache,
+						  GArray * tasks) {
   
   analysis_roi_t * temp_roi_analysis;
   
@@ -594,19 +1187,79 @@ analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois,
   temp_roi_analysis->threshold_percentage = threshold_percentage;
   temp_roi_analysis->threshold_value = threshold_value;
 
-  /* calculate this one */
+  /* setup this one */
   temp_roi_analysis->volume_analyses = 
-    analysis_volume_init(temp_roi_analysis->roi, data_sets, calculation_type, accurate,
-			 subfraction, threshold_percentage, threshold_value);
+    analysis_volume_init(temp_roi_analysis->roi, data_sets, temp_roi_analysis, cache, tasks);
 
   /* recurse */
   temp_roi_analysis->next_roi_analysis = 
-    analysis_roi_init(study, rois->next, data_sets, calculation_type, accurate,
-		      subfraction, threshold_percentage, threshold_value);
+    analysis_roi_init_recurse(study, rois->next, data_sets, calculation_type, accurate,
+			      subfraction, threshold_percentage, threshold_value, cache, tasks);
 
   
   return temp_roi_analysis;
 }
 
+/* returns an initialized list of roi analyses.  The statistics for each
+   roi/data set/frame/gate are independent, so they get calculated in parallel.
+   Returns NULL if canceled. */
+analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois, 
+				   GList * data_sets, 
+				   analysis_calculation_t calculation_type,
+				   gboolean accurate,
+				   gdouble subfraction, 
+				   gdouble threshold_percentage,
+				   gdouble threshold_value,
+				   GHashTable * cache,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data) {
+  
+  analysis_roi_t * roi_analyses;
+  analysis_schedule_t schedule;
+  analysis_task_t * task;
+  GArray * tasks;
+  gchar * temp_string;
+  gint i_task;
+
+  tasks = g_array_new(FALSE, FALSE, sizeof(analysis_task_t));
+  roi_analyses = analysis_roi_init_recurse(study, rois, data_sets, calculation_type, accurate,
+					   subfraction, threshold_percentage, threshold_value, cache, tasks);
+
+  schedule.tasks = (analysis_task_t *) tasks->data;
+  schedule.num_tasks = tasks->len;
+  schedule.next_task = 0;
+  schedule.num_done = 0;
+  schedule.cancelled = FALSE;
+  schedule.update_func = update_func;
+  schedule.update_data = update_data;
+
+  if (update_func != NULL) {
+    temp_string = g_strdup(_("Calculating ROI Statistics"));
+    schedule.cancelled = !(*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
 
+  if ((!schedule.cancelled) && (schedule.num_tasks > 0))
+    amitk_parallel_for(amitk_get_num_threads(), analysis_schedule_worker, &schedule);
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  /* hook the results into the frame analyses, and remember them for next time. 
+     Whatever got calculated before a cancel is still good for the cache */
+  for (i_task=0; i_task < schedule.num_tasks; i_task++) {
+    task = &(schedule.tasks[i_task]);
+    if (task->gate_analysis != NULL) {
+      task->frame_analysis->gate_analyses[task->gate] = task->gate_analysis;
+      if (cache != NULL)
+	analysis_cache_insert(cache, task->roi_analysis->roi, task->data_set, 
+			      task->frame, task->gate, task->gate_analysis);
+    }
+  }
+  g_array_free(tasks, TRUE);
 
+  if (schedule.cancelled) 
+    roi_analyses = analysis_roi_unref(roi_analyses);
+
+  return roi_analyses;
+}
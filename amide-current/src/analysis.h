@@ -49,17 +49,21 @@ typedef struct _analysis_study_t analysis_study_t;
 
 
 
-typedef struct analysis_element_t {
-  amide_data_t value;
-  amide_real_t weight;
-  AmitkVoxel ds_voxel;
-} analysis_element_t;
+/* the voxels of a data set that are in an roi, kept as parallel arrays */
+typedef struct analysis_samples_t {
+  amide_data_t * values;
+  amide_real_t * weights;
+  AmitkVoxel * ds_voxels;
+  guint len;
+  guint allocated;
+} analysis_samples_t;
 
 
 struct _analysis_gate_t {
 
-  /* roi data - array of analysis_element's */
-  GPtrArray * data_array;
+  /* roi data, not kept for ALL_VOXELS or VOXELS_GREATER_THAN_VALUE, 
+     see analysis_gate_get_samples */
+  analysis_samples_t samples;
 
   /* stats */
   amide_data_t mean;
@@ -78,12 +82,12 @@ struct _analysis_gate_t {
 
   /* internal */
   amide_data_t correction;
-  analysis_gate_t * next_gate_analysis;
   guint ref_count;
 };
 
 struct _analysis_frame_t {
-  analysis_gate_t * gate_analyses;
+  analysis_gate_t ** gate_analyses; /* one per gate, NULL if the gate couldn't be calculated */
+  guint num_gates;
   guint ref_count;
   analysis_frame_t * next_frame_analysis;
 };
@@ -110,10 +114,28 @@ struct _analysis_roi_t {
 
 /* external functions */
 analysis_roi_t * analysis_roi_unref(analysis_roi_t *roi_analysis);
+gboolean analysis_gate_get_samples(const analysis_gate_t * gate_analysis,
+				   AmitkRoi * roi,
+				   AmitkDataSet * ds,
+				   guint frame,
+				   guint gate,
+				   gboolean accurate,
+				   analysis_samples_t * samples);
+void analysis_samples_free(analysis_samples_t * samples);
+
+/* a cache of gate analyses, keyed by roi/data set/frame/gate.  The cache doesn't
+   hold references to the rois and data sets, whoever owns the cache needs to
+   remove the entries for an object when it changes or goes away. The entries
+   are only good for one set of calculation parameters. */
+GHashTable * analysis_cache_new(void);
+guint analysis_cache_remove_object(GHashTable * cache, gpointer object);
 
 /* note, subfraction is only used for calculation_type == HIGHEST_FRACTION_VOXELS,
    threshold_percentage is only used for calculation_type == VOXELS_NEAR_MAX
-   threshold_value is only used for calculation_type == HIGHER_THAN_VALUE */
+   threshold_value is only used for calculation_type == HIGHER_THAN_VALUE 
+   cache can be NULL, otherwise gates found in it are reused and newly calculated
+   gates are added to it
+   returns NULL if the calculation is canceled through update_func */
 analysis_roi_t * analysis_roi_init(AmitkStudy * study, 
 				   GList * rois, 
 				   GList * volumes, 
@@ -121,7 +143,10 @@ analysis_roi_t * analysis_roi_init(AmitkStudy * study,
 				   gboolean accurate,
 				   gdouble subfraction, 
 				   gdouble threshold_percentage, 
-				   gdouble threshold_value);
+				   gdouble threshold_value,
+				   GHashTable * cache,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data);
 
 #endif /* __ANALYSIS_H__ */
 
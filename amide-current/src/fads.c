@@ -95,7 +95,7 @@ void fads_svd_factors(AmitkDataSet * data_set,
   gsl_vector * vector_s=NULL;
   AmitkVoxel dim, i_voxel;
   gint m,n, i;
-  amide_data_t value;
+  amide_data_t * row=NULL;
   gdouble * factors;
   gint status;
 
@@ -126,16 +126,22 @@ void fads_svd_factors(AmitkDataSet * data_set,
     goto ending;
   }
 
+  if ((row = g_try_new(amide_data_t, dim.x)) == NULL) {
+    g_warning(_("Failed to allocate %d vector"), dim.x);
+    goto ending;
+  }
+
   /* fill in the a matrix */
   for (i_voxel.t = 0; i_voxel.t < dim.t; i_voxel.t++) {
     i = 0;
     for (i_voxel.g = 0; i_voxel.g < dim.g; i_voxel.g++) {
       for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++)
-	for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++)
-	  for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, i++) {
-	    value = amitk_data_set_get_value(data_set, i_voxel);
-	    gsl_matrix_set(matrix_a, i, i_voxel.t, value);
-	  }
+	for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+	  i_voxel.x = 0;
+	  amitk_data_set_get_row(data_set, i_voxel, row);
+	  for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, i++) 
+	    gsl_matrix_set(matrix_a, i, i_voxel.t, row[i_voxel.x]);
+	}
     }
   }
 
@@ -181,6 +187,11 @@ void fads_svd_factors(AmitkDataSet * data_set,
     vector_s = NULL;
   }
 
+  if (row != NULL) {
+    g_free(row);
+    row = NULL;
+  }
+
   return;
 }
 
@@ -256,6 +267,7 @@ static void perform_pca(AmitkDataSet * data_set,
   guint i, f, j;
   gint status;
   gdouble total;
+  amide_data_t * row=NULL;
 
   dim = AMITK_DATA_SET_DIM(data_set);
   num_voxels = dim.x*dim.y*dim.z*dim.g;
@@ -277,15 +289,25 @@ static void perform_pca(AmitkDataSet * data_set,
     goto ending;
   }
 
+  if ((row = g_try_new(amide_data_t, dim.x)) == NULL) {
+    g_warning(_("Failed to allocate %d vector"), dim.x);
+    goto ending;
+  }
+
   /* copy the info into the matrix */
   for (i_voxel.t = 0; i_voxel.t < num_frames; i_voxel.t++) {
     i = 0;
     for (i_voxel.g = 0; i_voxel.g < dim.g; i_voxel.g++)
       for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++)
-	for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++)
+	for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+	  i_voxel.x = 0;
+	  amitk_data_set_get_row(data_set, i_voxel, row);
 	  for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, i++) 
-	    gsl_matrix_set(u, i, i_voxel.t, amitk_data_set_get_value(data_set, i_voxel));
+	    gsl_matrix_set(u, i, i_voxel.t, row[i_voxel.x]);
+	}
   }
+  g_free(row);
+  row = NULL;
 
   /* do Singular Value decomposition */
   status = perform_svd(u, v, s);
@@ -364,6 +386,11 @@ static void perform_pca(AmitkDataSet * data_set,
     s = NULL;
   }
 
+  if (row != NULL) {
+    g_free(row);
+    row = NULL;
+  }
+
   return;
 }
 
@@ -496,19 +523,21 @@ static gdouble calc_magnitude(AmitkDataSet * ds, gdouble * weight) {
   gdouble magnitude;
   AmitkVoxel i_voxel;
   AmitkVoxel dim;
-  amide_data_t data;
+  amide_data_t * row;
 
   dim = AMITK_DATA_SET_DIM(ds);
   magnitude = 0;
+  row = g_new(amide_data_t, dim.x);
 
   for (i_voxel.t=0; i_voxel.t<dim.t; i_voxel.t++) 
     for (i_voxel.g=0; i_voxel.g<dim.g; i_voxel.g++) 
       for (i_voxel.z=0; i_voxel.z<dim.z; i_voxel.z++) 
-	for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) 
-	  for (i_voxel.x=0; i_voxel.x<dim.x; i_voxel.x++) {
-	    data = amitk_data_set_get_value(ds, i_voxel);
-	    magnitude += weight[i_voxel.t]*data*data;
-	  }
+	for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) {
+	  amitk_data_set_get_row(ds, i_voxel, row);
+	  for (i_voxel.x=0; i_voxel.x<dim.x; i_voxel.x++) 
+	    magnitude += weight[i_voxel.t]*row[i_voxel.x]*row[i_voxel.x];
+	}
+  g_free(row);
 
 
   return sqrt(magnitude);
@@ -621,6 +650,9 @@ static void pls_calc_forward_error(pls_params_t * p, const gsl_vector *v) {
   gdouble inner;
   gdouble alpha;
   gdouble factor;
+  amide_data_t * row;
+
+  row = g_new(amide_data_t, p->dim.x);
 
   for (i_voxel.t=0; i_voxel.t<p->dim.t; i_voxel.t++) {
     i=p->alpha_offset; /* what to skip in v to get to the coefficients */
@@ -628,6 +660,8 @@ static void pls_calc_forward_error(pls_params_t * p, const gsl_vector *v) {
     for (i_voxel.g=0; i_voxel.g<p->dim.g; i_voxel.g++) {
       for (i_voxel.z=0; i_voxel.z<p->dim.z; i_voxel.z++) {
 	for (i_voxel.y=0; i_voxel.y<p->dim.y; i_voxel.y++) {
+	  i_voxel.x = 0;
+	  amitk_data_set_get_row(p->data_set, i_voxel, row);
 	  for (i_voxel.x=0; i_voxel.x<p->dim.x; i_voxel.x++, i+=p->num_factors, k+=p->num_frames) {
 	    inner = 0.0;
 	    for (f=0;  f< p->num_factors; f++) {
@@ -635,13 +669,15 @@ static void pls_calc_forward_error(pls_params_t * p, const gsl_vector *v) {
 	      factor = gsl_vector_get(v, f*p->num_frames+i_voxel.t);
 	      inner += alpha*factor;
 	    }
-	    p->forward_error[k+i_voxel.t] = inner - amitk_data_set_get_value(p->data_set,i_voxel);
+	    p->forward_error[k+i_voxel.t] = inner - row[i_voxel.x];
 	  }
 	}
       }
     }
   }
 
+  g_free(row);
+
   return;
 }
 
@@ -1550,7 +1586,9 @@ static void two_comp_calc_forward_error(two_comp_params_t * p, const gsl_vector
   gdouble bc;
   gdouble k21;
   gdouble inner, alpha;
+  amide_data_t * row;
 
+  row = g_new(amide_data_t, p->dim.x);
 
   for (i_voxel.t=0; i_voxel.t<p->dim.t; i_voxel.t++) {
     i=p->alpha_offset;
@@ -1559,6 +1597,8 @@ static void two_comp_calc_forward_error(two_comp_params_t * p, const gsl_vector
     for (i_voxel.g=0; i_voxel.g<p->dim.g; i_voxel.g++) {
       for (i_voxel.z=0; i_voxel.z<p->dim.z; i_voxel.z++) {
 	for (i_voxel.y=0; i_voxel.y<p->dim.y; i_voxel.y++) {
+	  i_voxel.x = 0;
+	  amitk_data_set_get_row(p->data_set, i_voxel, row);
 	  for (i_voxel.x=0; i_voxel.x<p->dim.x; i_voxel.x++, k++, i+=p->num_factors) {
 	    
 	    inner=0;
@@ -1570,7 +1610,7 @@ static void two_comp_calc_forward_error(two_comp_params_t * p, const gsl_vector
 	    
 	    alpha = gsl_vector_get(v, i+p->num_tissues);
 	    p->forward_error[k*p->num_frames+i_voxel.t] = 
-	      alpha*bc+inner-amitk_data_set_get_value(p->data_set,i_voxel);
+	      alpha*bc+inner-row[i_voxel.x];
 	    
 	  }
 	}
@@ -1578,6 +1618,8 @@ static void two_comp_calc_forward_error(two_comp_params_t * p, const gsl_vector
     }
   }
 
+  g_free(row);
+
   return;
 }
 
@@ -24,6 +24,7 @@
 */
 
 #include "amide_config.h"
+#include <string.h>
 #include "image.h"
 #include "amitk_data_set_DOUBLE_0D_SCALING.h"
 #include "amitk_study.h"
@@ -271,7 +272,9 @@ GdkPixbuf * image_from_8bit(const guchar * image,
   GdkPixbuf * temp_image;
   amide_intpoint_t i,j;
   guchar * rgb_data;
-  rgba_t rgba_temp;
+  amide_data_t * row;
+  rgba_t * rgba_row;
+  AmitkColorTableLut * lut;
   guint location;
 
   if ((rgb_data = g_try_new(guchar,3*width*height)) == NULL) {
@@ -279,17 +282,27 @@ GdkPixbuf * image_from_8bit(const guchar * image,
     return NULL;
   }
 
+  row = g_new(amide_data_t, width);
+  rgba_row = g_new(rgba_t, width);
+  lut = amitk_color_table_lut_get(color_table, 0, 0xFF);
+
+  for (i=0 ; i < height; i++) {
+    /* note, line below compensates for X's origin being top left, not bottom left */
+    for (j=0; j < width; j++)
+      row[j] = image[(height-i-1)*width+j];
+    amitk_color_table_lut_lookup_row(lut, row, width, rgba_row);
 
-  for (i=0 ; i < height; i++)
     for (j=0; j < width; j++) {
-      /* note, line below compensates for X's origin being top left, not bottom left */
-      rgba_temp = amitk_color_table_lookup(image[(height-i-1)*width+j], color_table, 0, 0xFF);
       location = i*width*3+j*3;
-      rgb_data[location+0] = rgba_temp.r;
-      rgb_data[location+1] = rgba_temp.g;
-      rgb_data[location+2] = rgba_temp.b;
-
+      rgb_data[location+0] = rgba_row[j].r;
+      rgb_data[location+1] = rgba_row[j].g;
+      rgb_data[location+2] = rgba_row[j].b;
     }
+  }
+
+  amitk_color_table_lut_unref(lut);
+  g_free(rgba_row);
+  g_free(row);
 
   /* generate the GdkPixbuf from the rgb_data */
   temp_image = gdk_pixbuf_new_from_data(rgb_data, GDK_COLORSPACE_RGB,
@@ -313,6 +326,9 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
   guchar * char_data;
   AmitkVoxel i;
   rgba_t rgba_temp;
+  amide_data_t * row;
+  rgba_t * rgba_row;
+  AmitkColorTableLut * lut;
   guint location;
   GdkPixbuf * temp_image;
   gint total_width;
@@ -334,10 +350,15 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
     rgba16_data[j].a = 0;
   }
 
+  row = g_new(amide_data_t, image_width);
+  rgba_row = g_new(rgba_t, image_width);
+
   /* iterate through the eyes and rendering contexts, 
      tranfering the image data into the temp storage buffer */
   while (renderings != NULL) {
 
+    lut = amitk_color_table_lut_get(renderings->rendering->color_table, 0, RENDERING_DENSITY_MAX);
+
     for (i_eye = 0; i_eye < eyes; i_eye ++) {
 
       if (eyes == 1) {
@@ -352,11 +373,13 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
       }
 
       i.t = i.g = i.z = 0;
-      for (i.y = 0; i.y < image_height; i.y++) 
+      for (i.y = 0; i.y < image_height; i.y++) {
+	for (i.x = 0; i.x < image_width; i.x++) 
+	  row[i.x] = renderings->rendering->image[i.x+i.y*image_width];
+	amitk_color_table_lut_lookup_row(lut, row, image_width, rgba_row);
+
 	for (i.x = 0; i.x < image_width; i.x++) {
-	  rgba_temp = amitk_color_table_lookup(renderings->rendering->image[i.x+i.y*image_width], 
-					       renderings->rendering->color_table, 
-					       0, RENDERING_DENSITY_MAX);
+	  rgba_temp = rgba_row[i.x];
 	  /* compensate for the fact that X defines the origin as top left, not bottom left */
 	  location = (image_height-i.y-1)*total_width+i.x+i_eye*eye_width;
 	  total_alpha = rgba16_data[location].a + rgba_temp.a;
@@ -395,10 +418,15 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
 	    rgba16_data[location].a = total_alpha;
 	  }
 	}
+      }
     }      
+    amitk_color_table_lut_unref(lut);
     renderings = renderings->next;
   }
 
+  g_free(rgba_row);
+  g_free(row);
+
   /* allocate space for the true rgb buffer */
   if ((char_data = g_try_new(guchar,3*image_height * total_width)) == NULL) {
     g_warning(_("couldn't allocate memory for char_data for rendering image"));
@@ -517,9 +545,10 @@ GdkPixbuf * image_from_colortable(const AmitkColorTable color_table,
 				  const gboolean horizontal) {
 
   amide_intpoint_t i,j;
-  rgba_t rgba;
   GdkPixbuf * temp_image;
-  amide_data_t datum;
+  amide_data_t * data;
+  rgba_t * rgba;
+  amide_intpoint_t length;
   guchar * rgb_data;
 
   if ((rgb_data = g_try_new(guchar,3*width*height)) == NULL) {
@@ -527,31 +556,25 @@ GdkPixbuf * image_from_colortable(const AmitkColorTable color_table,
     return NULL;
   }
 
-  if (horizontal) {
-      for (i=0; i < width; i++) {
-      datum = ((((gdouble) width-i)/width) * (data_set_max-data_set_min))+data_set_min;
-      datum = (data_set_max-data_set_min)*(datum-min)/(max-min)+data_set_min;
-      
-      rgba = amitk_color_table_lookup(datum, color_table, data_set_min, data_set_max);
-      for (j=0; j < height; j++) {
-	rgb_data[j*width*3+i*3+0] = rgba.r;
-	rgb_data[j*width*3+i*3+1] = rgba.g;
-	rgb_data[j*width*3+i*3+2] = rgba.b;
-      }
-    }
-  } else {
-    for (j=0; j < height; j++) {
-      datum = ((((gdouble) height-j)/height) * (data_set_max-data_set_min))+data_set_min;
-      datum = (data_set_max-data_set_min)*(datum-min)/(max-min)+data_set_min;
-      
-      rgba = amitk_color_table_lookup(datum, color_table, data_set_min, data_set_max);
-      for (i=0; i < width; i++) {
-	rgb_data[j*width*3+i*3+0] = rgba.r;
-	rgb_data[j*width*3+i*3+1] = rgba.g;
-	rgb_data[j*width*3+i*3+2] = rgba.b;
-      }
-    }
+  /* the strip only varies along one direction, so figure out that line of colors first */
+  length = horizontal ? width : height;
+  data = g_new(amide_data_t, length);
+  rgba = g_new(rgba_t, length);
+  for (i=0; i < length; i++) {
+    data[i] = ((((gdouble) length-i)/length) * (data_set_max-data_set_min))+data_set_min;
+    data[i] = (data_set_max-data_set_min)*(data[i]-min)/(max-min)+data_set_min;
   }
+  amitk_color_table_lookup_row(data, length, color_table, data_set_min, data_set_max, rgba);
+
+  for (j=0; j < height; j++) 
+    for (i=0; i < width; i++) {
+      rgb_data[j*width*3+i*3+0] = rgba[horizontal ? i : j].r;
+      rgb_data[j*width*3+i*3+1] = rgba[horizontal ? i : j].g;
+      rgb_data[j*width*3+i*3+2] = rgba[horizontal ? i : j].b;
+    }
+
+  g_free(data);
+  g_free(rgba);
 
   
   temp_image = gdk_pixbuf_new_from_data(rgb_data, GDK_COLORSPACE_RGB,
@@ -569,8 +592,9 @@ GdkPixbuf * image_from_projection(AmitkDataSet * projection) {
   AmitkVoxel dim;
   amide_data_t max,min;
   GdkPixbuf * temp_image;
-  rgba_t rgba_temp;
-  AmitkColorTable color_table;
+  amide_data_t * row;
+  rgba_t * rgba_row;
+  AmitkColorTableLut * lut;
   
   /* sanity checks */
   g_return_val_if_fail(AMITK_IS_DATA_SET(projection), NULL);
@@ -587,20 +611,27 @@ GdkPixbuf * image_from_projection(AmitkDataSet * projection) {
 					  amitk_data_set_get_frame_duration(projection,0),
 					  &min, &max);
       
-  color_table = AMITK_DATA_SET_COLOR_TABLE(projection, AMITK_VIEW_MODE_SINGLE);
+  lut = amitk_color_table_lut_get(AMITK_DATA_SET_COLOR_TABLE(projection, AMITK_VIEW_MODE_SINGLE), min, max);
+  row = g_new(amide_data_t, dim.x);
+  rgba_row = g_new(rgba_t, dim.x);
 
   i.t = i.g = i.z = 0;
-  for (i.y = 0; i.y < dim.y; i.y++) 
-    for (i.x = 0; i.x < dim.x; i.x++) {
-      rgba_temp =
-	amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(projection,i), 
-				 color_table,min, max);
+  for (i.y = 0; i.y < dim.y; i.y++) {
+    for (i.x = 0; i.x < dim.x; i.x++)
+      row[i.x] = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(projection,i);
+    amitk_color_table_lut_lookup_row(lut, row, dim.x, rgba_row);
 	  
-      /* compensate for the fact that X defines the origin as top left, not bottom left */
-	rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+0] = rgba_temp.r;
-	rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+1] = rgba_temp.g;
-	rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+2] = rgba_temp.b;
+    /* compensate for the fact that X defines the origin as top left, not bottom left */
+    for (i.x = 0; i.x < dim.x; i.x++) {
+      rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+0] = rgba_row[i.x].r;
+      rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+1] = rgba_row[i.x].g;
+      rgb_data[(dim.y-i.y-1)*dim.x*3 + i.x*3+2] = rgba_row[i.x].b;
     }
+  }
+
+  amitk_color_table_lut_unref(lut);
+  g_free(rgba_row);
+  g_free(row);
 
   /* from the rgb_data, generate a GdkPixbuf */
   temp_image = gdk_pixbuf_new_from_data(rgb_data, GDK_COLORSPACE_RGB,
@@ -619,8 +650,9 @@ GdkPixbuf * image_from_slice(AmitkDataSet * slice, AmitkViewMode view_mode) {
   amide_data_t max,min;
   GdkPixbuf * temp_image;
   guint index;
-  rgba_t rgba_temp;
-  AmitkColorTable color_table;
+  amide_data_t * row;
+  rgba_t * rgba_row;
+  AmitkColorTableLut * lut;
 
   /* sanity checks */
   g_return_val_if_fail(AMITK_IS_DATA_SET(slice), NULL);
@@ -639,22 +671,31 @@ GdkPixbuf * image_from_slice(AmitkDataSet * slice, AmitkViewMode view_mode) {
 					  amitk_data_set_get_frame_duration(slice,0),
 					  &min, &max);
       
-  color_table = amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(slice), view_mode);
+  lut = amitk_color_table_lut_get(amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(slice), view_mode),
+				  min, max);
+  row = g_new(amide_data_t, dim.x);
+  rgba_row = g_new(rgba_t, dim.x);
 
   i.t = i.g = i.z = 0;
   index=0;
 
   /* compensate for the fact that X defines the origin as top left, not bottom left */
-  for (i.y = dim.y-1; i.y >= 0; i.y--) 
+  for (i.y = dim.y-1; i.y >= 0; i.y--) {
+    for (i.x = 0; i.x < dim.x; i.x++)
+      row[i.x] = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i);
+    amitk_color_table_lut_lookup_row(lut, row, dim.x, rgba_row);
+
     for (i.x = 0; i.x < dim.x; i.x++, index+=4) {
-      rgba_temp =
-	amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i), color_table,min, max);
-      
-	rgba_data[index+0] = rgba_temp.r;
-	rgba_data[index+1] = rgba_temp.g;
-	rgba_data[index+2] = rgba_temp.b;
-	rgba_data[index+3] = rgba_temp.a;
+      rgba_data[index+0] = rgba_row[i.x].r;
+      rgba_data[index+1] = rgba_row[i.x].g;
+      rgba_data[index+2] = rgba_row[i.x].b;
+      rgba_data[index+3] = rgba_row[i.x].a;
     }
+  }
+
+  amitk_color_table_lut_unref(lut);
+  g_free(rgba_row);
+  g_free(row);
 
   /* from the rgb_data, generate a GdkPixbuf */
   temp_image = gdk_pixbuf_new_from_data(rgba_data, GDK_COLORSPACE_RGB,
@@ -664,11 +705,108 @@ GdkPixbuf * image_from_slice(AmitkDataSet * slice, AmitkViewMode view_mode) {
   return temp_image;
 }
 
+/* what's needed for compositing the rows of the slices in parallel */
+typedef struct image_composite_t {
+  AmitkDataSet ** slices; /* the slices to blend, in order */
+  AmitkColorTableLut ** luts;
+  gint num_slices;
+  AmitkDataSet * overlay_slice; /* goes on top of the blend, NULL if none */
+  AmitkColorTableLut * overlay_lut;
+  AmitkVoxel dim;
+  guchar * rgb_data;
+} image_composite_t;
+
+static void image_composite_rows(gint start, gint end, gpointer data) {
+
+  image_composite_t * composite = data;
+  rgba16_t * row16;
+  rgba_t * rgba_row;
+  rgba_t rgba_temp;
+  guint32 total_alpha;
+  amide_data_t factor;
+  amitk_format_DOUBLE_t * row;
+  amide_data_t * data_row;
+  guchar * rgb_row;
+  AmitkVoxel i;
+  gint slice_num;
+  gint x;
+
+  row16 = g_new(rgba16_t, composite->dim.x);
+  rgba_row = g_new(rgba_t, composite->dim.x);
+  data_row = g_new(amide_data_t, composite->dim.x);
+
+  i.t = i.g = i.z = i.x = 0;
+  for (i.y = start; i.y < end; i.y++) {
+
+    memset(row16, 0, composite->dim.x*sizeof(rgba16_t));
+
+    /* blend the slices together.  The integer divisions here truncate the 
+       same way as converting a double quotient back to a color would */
+    for (slice_num=1; slice_num <= composite->num_slices; slice_num++) {
+      factor = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(composite->slices[slice_num-1]->current_scaling_factor, i);
+      row = AMITK_RAW_DATA_DOUBLE_POINTER(AMITK_DATA_SET_RAW_DATA(composite->slices[slice_num-1]), i);
+      for (x = 0; x < composite->dim.x; x++)
+	data_row[x] = factor*((amide_data_t) row[x]);
+      amitk_color_table_lut_lookup_row(composite->luts[slice_num-1], data_row, composite->dim.x, rgba_row);
+
+      for (x = 0; x < composite->dim.x; x++) {
+	rgba_temp = rgba_row[x];
+	  
+	total_alpha = row16[x].a + rgba_temp.a;
+	if (total_alpha == 0) {
+	  row16[x].r = ((slice_num-1)*row16[x].r + rgba_temp.r)/slice_num;
+	  row16[x].g = ((slice_num-1)*row16[x].g + rgba_temp.g)/slice_num;
+	  row16[x].b = ((slice_num-1)*row16[x].b + rgba_temp.b)/slice_num;
+	} else if (row16[x].a == 0) {
+	  row16[x].r = rgba_temp.r;
+	  row16[x].g = rgba_temp.g;
+	  row16[x].b = rgba_temp.b;
+	  row16[x].a = rgba_temp.a;
+	} else if (rgba_temp.a != 0) {
+	  row16[x].r = (row16[x].r*row16[x].a + rgba_temp.r*rgba_temp.a)/total_alpha;
+	  row16[x].g = (row16[x].g*row16[x].a + rgba_temp.g*rgba_temp.a)/total_alpha;
+	  row16[x].b = (row16[x].b*row16[x].a + rgba_temp.b*rgba_temp.a)/total_alpha;
+	  row16[x].a = total_alpha;
+	}
+      }
+    }
+
+    /* compensate for the fact that X defines the origin as top left, not bottom left */
+    rgb_row = composite->rgb_data + 3*(composite->dim.y-i.y-1)*composite->dim.x;
+    for (x = 0; x < composite->dim.x; x++) {
+      rgb_row[3*x+0] = row16[x].r < 0xFF ? row16[x].r : 0xFF;
+      rgb_row[3*x+1] = row16[x].g < 0xFF ? row16[x].g : 0xFF;
+      rgb_row[3*x+2] = row16[x].b < 0xFF ? row16[x].b : 0xFF;
+    }
+
+    /* if we have a data set we're overlaying, add it in now */
+    if (composite->overlay_slice != NULL) {
+      factor = *AMITK_RAW_DATA_DOUBLE_0D_SCALING_POINTER(composite->overlay_slice->current_scaling_factor, i);
+      row = AMITK_RAW_DATA_DOUBLE_POINTER(AMITK_DATA_SET_RAW_DATA(composite->overlay_slice), i);
+      for (x = 0; x < composite->dim.x; x++)
+	data_row[x] = factor*((amide_data_t) row[x]);
+      amitk_color_table_lut_lookup_row(composite->overlay_lut, data_row, composite->dim.x, rgba_row);
+
+      for (x = 0; x < composite->dim.x; x++) {
+	if (rgba_row[x].a != 0) {
+	  rgb_row[3*x+0] = rgba_row[x].r;
+	  rgb_row[3*x+1] = rgba_row[x].g;
+	  rgb_row[3*x+2] = rgba_row[x].b;
+	}
+      }
+    }
+  }
+
+  g_free(data_row);
+  g_free(rgba_row);
+  g_free(row16);
+
+  return;
+}
+
 /* note, generally call this function with gate -1, only use the gate
    parameter if you want to override the data set's specified gate */
 GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
-				 GList ** pslice_cache,
-				 const gint max_slice_cache_size,
 				 GList * objects,
 				 const AmitkDataSet * active_ds,
 				 const amide_time_t start,
@@ -679,22 +817,17 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
 				 const AmitkFuseType fuse_type,
 				 const AmitkViewMode view_mode) {
 
-  gint slice_num;
-  guint32 total_alpha;
   guchar * rgb_data;
-  rgba16_t * rgba16_data;
-  guint location;
-  AmitkVoxel i;
-  AmitkVoxel dim;
   amide_data_t max,min;
   GdkPixbuf * temp_image;
-  rgba_t rgba_temp;
   GList * slices;
   GList * temp_slices;
+  GList * temp_objects;
   AmitkDataSet * slice;
-  AmitkColorTable color_table;
-  AmitkDataSet * overlay_slice = NULL;
-  gint j;
+  AmitkDataSet * parent_ds;
+  image_composite_t composite;
+  AmitkColorTableLut * lut;
+  gint i_slice;
   AmitkCanvasPoint pixel_size2;
   
 
@@ -702,130 +835,68 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
   g_return_val_if_fail(objects != NULL, NULL);
 
   pixel_size2.x = pixel_size2.y = pixel_size;
-  slices = amitk_data_sets_get_slices(objects, pslice_cache, max_slice_cache_size,
-				      start, duration, gate, pixel_size2,view_volume);
+  slices = amitk_data_sets_get_slices(objects, start, duration, gate, pixel_size2,view_volume, TRUE);
   g_return_val_if_fail(slices != NULL, NULL);
 
   /* get the dimensions.  since all slices have the same dimensions, we'll just get the first */
-  dim = AMITK_DATA_SET_DIM(slices->data);
+  composite.dim = AMITK_DATA_SET_DIM(slices->data);
 
-  /* allocate and initialize space for a temporary storage buffer */
-  rgba16_data = g_try_new(rgba16_t,dim.y*dim.x);
-  g_return_val_if_fail(rgba16_data != NULL, NULL);
-
-  for (j=0; j<dim.y*dim.x; j++) {
-    rgba16_data[j].r = 0;
-    rgba16_data[j].g = 0;
-    rgba16_data[j].b = 0;
-    rgba16_data[j].a = 0;
-  }
+  /* allocate space for the true rgb buffer */
+  rgb_data = g_try_new(guchar,3*composite.dim.y*composite.dim.x);
+  g_return_val_if_fail(rgb_data != NULL, NULL);
+  composite.rgb_data = rgb_data;
 
-  /* iterate through all the slices */
-  temp_slices = slices;
-  slice_num = 0;
+  /* figure out the color lookups for each of the slices */
+  composite.slices = g_new(AmitkDataSet *, g_list_length(slices));
+  composite.luts = g_new(AmitkColorTableLut *, g_list_length(slices));
+  composite.num_slices = 0;
+  composite.overlay_slice = NULL;
+  composite.overlay_lut = NULL;
 
-  while (temp_slices != NULL) {
+  for (temp_slices = slices; temp_slices != NULL; temp_slices = temp_slices->next) {
     slice = temp_slices->data;
-    if ((fuse_type == AMITK_FUSE_TYPE_OVERLAY) && (AMITK_DATA_SET_SLICE_PARENT(slice) == active_ds)) {
-      overlay_slice = slice;
-    } else { /* blend this slice */
-      slice_num++;
 
-      amitk_data_set_get_thresholding_min_max(AMITK_DATA_SET_SLICE_PARENT(slice),
-					      AMITK_DATA_SET(slice),
-					      start, duration, &min, &max);
-      
-      
-      color_table = amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(slice), view_mode);
-      /* now add this slice into the rgba16 data */
-      i.t = i.g = i.z = 0;
-      location=0;
-      /* compensate for the fact that X defines the origin as top left, not bottom left */
-      for (i.y = dim.y-1; i.y >= 0; i.y--) 
-	for (i.x = 0; i.x < dim.x; i.x++, location++) {
-	  rgba_temp = 
-	    amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i), color_table,min, max);
-	  
-	  total_alpha = rgba16_data[location].a + rgba_temp.a;
-	  if (total_alpha == 0) {
-	    rgba16_data[location].r = (((slice_num-1)*rgba16_data[location].r + 
-					rgba_temp.r)/
-				       ((gdouble) slice_num));
-	    rgba16_data[location].g = (((slice_num-1)*rgba16_data[location].g + 
-					rgba_temp.g)/
-				       ((gdouble) slice_num));
-	    rgba16_data[location].b = (((slice_num-1)*rgba16_data[location].b + 
-					rgba_temp.b)/
-				       ((gdouble) slice_num));
-	  } else if (rgba16_data[location].a == 0) {
-	    rgba16_data[location].r = rgba_temp.r;
-	    rgba16_data[location].g = rgba_temp.g;
-	    rgba16_data[location].b = rgba_temp.b;
-	    rgba16_data[location].a = rgba_temp.a;
-	  } else if (rgba_temp.a != 0) {
-	    rgba16_data[location].r = ((rgba16_data[location].r*rgba16_data[location].a 
-					+ rgba_temp.r*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].g = ((rgba16_data[location].g*rgba16_data[location].a 
-					+ rgba_temp.g*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].b = ((rgba16_data[location].b*rgba16_data[location].a 
-					+ rgba_temp.b*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].a = total_alpha;
-	  }
-	}
-    }
-    temp_slices = temp_slices->next;
-  }
-
-  /* allocate space for the true rgb buffer */
-  rgb_data = g_try_new(guchar,3*dim.y*dim.x);
-  g_return_val_if_fail(rgb_data != NULL, NULL);
-
-  /* now convert our temp rgb data to real rgb data */
-  i.z = 0;
-  location=0;
-  for (i.y = 0; i.y < dim.y; i.y++) 
-    for (i.x = 0; i.x < dim.x; i.x++, location++) {
-      rgb_data[3*location+0] = rgba16_data[location].r < 0xFF ? rgba16_data[location].r : 0xFF;
-      rgb_data[3*location+1] = rgba16_data[location].g < 0xFF ? rgba16_data[location].g : 0xFF;
-      rgb_data[3*location+2] = rgba16_data[location].b < 0xFF ? rgba16_data[location].b : 0xFF;
-    }
+    /* if we were handed a snapshot, its thresholds and color table are the ones to use */
+    parent_ds = AMITK_DATA_SET_SLICE_PARENT(slice);
+    for (temp_objects = objects; temp_objects != NULL; temp_objects = temp_objects->next)
+      if (AMITK_IS_DATA_SET(temp_objects->data) &&
+	  (AMITK_DATA_SET_SNAPSHOT_OF(temp_objects->data) == parent_ds)) {
+	parent_ds = AMITK_DATA_SET(temp_objects->data);
+	break;
+      }
 
-  /* if we have a data set we're overlaying, add it in now */
-  if (overlay_slice != NULL) {
-      amitk_data_set_get_thresholding_min_max(AMITK_DATA_SET_SLICE_PARENT(overlay_slice),
-					      AMITK_DATA_SET(overlay_slice),
-					      start, duration, &min, &max);
-      
-      color_table = amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(overlay_slice), view_mode);
+    amitk_data_set_get_thresholding_min_max(parent_ds, AMITK_DATA_SET(slice),
+					    start, duration, &min, &max);
 
-      i.t = i.g = i.z = 0;
-      for (i.y = 0; i.y < dim.y; i.y++) 
-	for (i.x = 0; i.x < dim.x; i.x++) {
-	  rgba_temp = 
-	    amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(overlay_slice,i), 
-				     color_table,min, max);
+    lut = amitk_color_table_lut_get(amitk_data_set_get_color_table_to_use(parent_ds, view_mode),
+				    min, max);
 
-	  /* compensate for the fact that X defines the origin as top left, not bottom left */
-	  location = (dim.y - i.y - 1)*dim.x+i.x;
-	  if (rgba_temp.a != 0) {
-	    rgb_data[3*location+0] = rgba_temp.r;
-	    rgb_data[3*location+1] = rgba_temp.g;
-	    rgb_data[3*location+2] = rgba_temp.b;
-	  }
-	}
+    if ((fuse_type == AMITK_FUSE_TYPE_OVERLAY) && (AMITK_DATA_SET_SLICE_PARENT(slice) == active_ds)) {
+      if (composite.overlay_lut != NULL) amitk_color_table_lut_unref(composite.overlay_lut);
+      composite.overlay_slice = slice;
+      composite.overlay_lut = lut;
+    } else { /* blend this slice */
+      composite.slices[composite.num_slices] = slice;
+      composite.luts[composite.num_slices] = lut;
+      composite.num_slices++;
+    }
   }
-  
+
+  /* and put the image together, the rows are independent of each other */
+  amitk_parallel_for(composite.dim.y, image_composite_rows, &composite);
 
   /* from the rgb_data, generate a GdkPixbuf */
   temp_image = gdk_pixbuf_new_from_data(rgb_data, GDK_COLORSPACE_RGB,
-  					FALSE,8,dim.x,dim.y,dim.x*3*sizeof(guchar),
+  					FALSE,8,composite.dim.x,composite.dim.y,composite.dim.x*3*sizeof(guchar),
   					image_free_rgb_data, NULL);
 
   /* cleanup */
-  g_free(rgba16_data);
+  for (i_slice=0; i_slice < composite.num_slices; i_slice++)
+    amitk_color_table_lut_unref(composite.luts[i_slice]);
+  if (composite.overlay_lut != NULL)
+    amitk_color_table_lut_unref(composite.overlay_lut);
+  g_free(composite.slices);
+  g_free(composite.luts);
 
   if (pdisp_slices != NULL) {
     amitk_objects_unref((*pdisp_slices));
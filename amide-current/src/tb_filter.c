@@ -50,10 +50,8 @@ N_("When the apply button is hit, a new data set will be created "
    "and placed into the study's tree, consisting of the appropriately "
    "filtered data\n");
 
-#ifdef AMIDE_LIBGSL_SUPPORT
 static const char * gaussian_filter_text = 
 N_("The Gaussian filter is an effective smoothing filter");
-#endif
 
 
 static const char * median_3d_filter_text = 
@@ -71,12 +69,6 @@ N_("Median filters work relatively well at preserving edges while\n"
    "determining the median will be of the given kernel size, and the\n"
    "data set will be filtered 3x (once for each direction).");
 
-#ifndef AMIDE_LIBGSL_SUPPORT
-static const char *no_libgsl_text =
-N_("This filter requires support from the GNU Scientific Library (GSL).\n"
-   "This version of AMIDE has not been compiled with GSL support enabled.");
-#endif
-
 
 typedef enum {
   PICK_FILTER_PAGE,
@@ -330,7 +322,6 @@ static GtkWidget * create_page(tb_filter_t * tb_filter, which_page_t i_page) {
     
     break;
   case GAUSSIAN_FILTER_PAGE:
-#ifdef AMIDE_LIBGSL_SUPPORT
     tb_filter->kernel_size = DEFAULT_GAUSSIAN_FILTER_SIZE;
     
     label = gtk_label_new(_(gaussian_filter_text));
@@ -372,13 +363,6 @@ static GtkWidget * create_page(tb_filter_t * tb_filter, which_page_t i_page) {
     gtk_table_attach(GTK_TABLE(table), spin_button, 
 		     table_column+1,table_column+2, table_row,table_row+1,
 		     FALSE,FALSE, X_PADDING, Y_PADDING);
-#else /* no libgsl support */
-    label = gtk_label_new(_(no_libgsl_text));
-    gtk_table_attach(GTK_TABLE(table), label, 
-		     table_column,table_column+2, table_row,table_row+1,
-		     FALSE,FALSE, X_PADDING, Y_PADDING);
-    table_row++;
-#endif
     break;
   case MEDIAN_3D_FILTER_PAGE:
   case MEDIAN_LINEAR_FILTER_PAGE:
@@ -476,10 +460,6 @@ void tb_filter(AmitkStudy * study, AmitkDataSet * active_ds, GtkWindow * parent)
   }
   g_object_unref(logo);
 
-#ifndef AMIDE_LIBGSL_SUPPORT
-  gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_filter->dialog), tb_filter->page[GAUSSIAN_FILTER_PAGE], FALSE);
-#endif
-
   gtk_widget_show_all(tb_filter->dialog);
 
   return;
@@ -467,7 +467,7 @@ static void movie_generate(tb_fly_through_t * tb_fly_through, gchar * output_fil
 
 
     /* do any events pending, and make sure the canvas gets updated */
-    while (gtk_events_pending() || AMITK_CANVAS(tb_fly_through->canvas)->next_update)
+    while (gtk_events_pending() || AMITK_CANVAS_UPDATE_PENDING(tb_fly_through->canvas))
       gtk_main_iteration();
       
     pixbuf = amitk_canvas_get_pixbuf(AMITK_CANVAS(tb_fly_through->canvas));
@@ -0,0 +1,234 @@
+/* tb_isocontour.c
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+ 
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+
+#include "amide_config.h"
+#include "amide.h"
+#include "amitk_progress_dialog.h"
+#include "tb_isocontour.h"
+
+
+static gchar * explanation_text = 
+N_("Isocontour ROIs will be generated on each of the selected data sets, "
+   "starting from each of the selected fiducial marks and ROIs (ROIs are "
+   "started from their center).");
+
+/* the last settings used, so they're remembered between invocations */
+static AmitkRoiType last_roi_type = AMITK_ROI_TYPE_ISOCONTOUR_3D;
+static AmitkRoiIsocontourRange last_range = AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN;
+static gdouble last_min_value = 40.0;
+static gdouble last_max_value = 100.0;
+static gboolean last_relative_to_max = TRUE;
+static gboolean last_all_frames = TRUE;
+static gboolean last_all_gates = FALSE;
+
+
+static void roi_type_cb(GtkWidget * widget, gpointer data) {
+  if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
+    last_roi_type = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget), "roi_type"));
+  return;
+}
+
+static void range_cb(GtkWidget * widget, gpointer data) {
+  if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
+    last_range = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget), "isocontour_range"));
+  return;
+}
+
+static void value_spin_cb(GtkWidget * widget, gpointer data) {
+  gdouble * pvalue = data;
+  *pvalue = gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget));
+  return;
+}
+
+static void toggle_cb(GtkWidget * widget, gpointer data) {
+  gboolean * pvalue = data;
+  *pvalue = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+  return;
+}
+
+static GtkWidget * make_spin_button(GtkWidget * table, guint table_row, 
+				    const gchar * label_text, gdouble * pvalue) {
+
+  GtkWidget * label;
+  GtkWidget * spin_button;
+
+  label = gtk_label_new(label_text);
+  gtk_table_attach(GTK_TABLE(table), label, 0,1, table_row,table_row+1, 0, 0, X_PADDING, Y_PADDING);
+
+  spin_button = gtk_spin_button_new_with_range(-G_MAXDOUBLE, G_MAXDOUBLE, 1.0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), *pvalue);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(spin_button), 3);
+  gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(spin_button), FALSE);
+  gtk_entry_set_activates_default(GTK_ENTRY(spin_button), TRUE);
+  g_signal_connect(G_OBJECT(spin_button), "value_changed", G_CALLBACK(value_spin_cb), pvalue);
+  gtk_table_attach(GTK_TABLE(table), spin_button, 1,4, table_row,table_row+1, GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  return spin_button;
+}
+
+static GtkWidget * make_check_button(GtkWidget * table, guint table_row, 
+				     const gchar * label_text, gboolean * pvalue) {
+
+  GtkWidget * check_button;
+
+  check_button = gtk_check_button_new_with_label(label_text);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check_button), *pvalue);
+  g_signal_connect(G_OBJECT(check_button), "toggled", G_CALLBACK(toggle_cb), pvalue);
+  gtk_table_attach(GTK_TABLE(table), check_button, 0,4, table_row,table_row+1, GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  return check_button;
+}
+
+
+/* asks for the isocontour settings, and then generates isocontour rois for 
+   the selected seeds on the selected data sets */
+void tb_isocontour(AmitkStudy * study, GtkWindow * parent) {
+
+  GtkWidget * dialog;
+  GtkWidget * table;
+  GtkWidget * label;
+  GtkWidget * radio_button[AMITK_ROI_ISOCONTOUR_RANGE_NUM];
+  GtkWidget * progress_dialog;
+  gchar * temp_string;
+  guint table_row;
+  gint return_val;
+  gboolean delete_return_val;
+  AmitkRoiType i_roi_type;
+  AmitkRoiIsocontourRange i_range;
+  GList * data_sets;
+  GList * seeds;
+  GList * new_rois;
+  gdouble scale;
+
+  temp_string = g_strdup_printf(_("%s: Isocontour ROI Generation"), PACKAGE);
+  dialog = gtk_dialog_new_with_buttons (temp_string, parent,
+					GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_NO_SEPARATOR,
+					GTK_STOCK_CANCEL, GTK_RESPONSE_CLOSE, 
+					GTK_STOCK_EXECUTE, AMITK_RESPONSE_EXECUTE,
+					NULL);
+  g_free(temp_string);
+  gtk_dialog_set_default_response(GTK_DIALOG(dialog), AMITK_RESPONSE_EXECUTE);
+  gtk_container_set_border_width(GTK_CONTAINER(dialog), 10);
+
+  table = gtk_table_new(8,4,FALSE);
+  table_row=0;
+  gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), table);
+
+  label = gtk_label_new(_(explanation_text));
+  gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+  gtk_table_attach(GTK_TABLE(table), label, 0,4, table_row,table_row+1, GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
+  /* which type of isocontour */
+  label = gtk_label_new(_("ROI Type:"));
+  gtk_table_attach(GTK_TABLE(table), label, 0,1, table_row,table_row+1, 0, 0, X_PADDING, Y_PADDING);
+  radio_button[0] = NULL;
+  for (i_roi_type = AMITK_ROI_TYPE_ISOCONTOUR_2D; i_roi_type <= AMITK_ROI_TYPE_ISOCONTOUR_3D; i_roi_type++) {
+    radio_button[1] = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radio_button[0]), 
+								  amitk_roi_type_get_name(i_roi_type));
+    if (radio_button[0] == NULL) radio_button[0] = radio_button[1];
+    g_object_set_data(G_OBJECT(radio_button[1]), "roi_type", GINT_TO_POINTER(i_roi_type));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio_button[1]), i_roi_type == last_roi_type);
+    g_signal_connect(G_OBJECT(radio_button[1]), "clicked", G_CALLBACK(roi_type_cb), NULL);
+    gtk_table_attach(GTK_TABLE(table), radio_button[1], 
+		     1+i_roi_type-AMITK_ROI_TYPE_ISOCONTOUR_2D, 2+i_roi_type-AMITK_ROI_TYPE_ISOCONTOUR_2D,
+		     table_row,table_row+1, GTK_FILL, 0, X_PADDING, Y_PADDING);
+  }
+  table_row++;
+
+  /* which voxels are in */
+  label = gtk_label_new(_("Range:"));
+  gtk_table_attach(GTK_TABLE(table), label, 0,1, table_row,table_row+1, 0, 0, X_PADDING, Y_PADDING);
+  radio_button[0] = gtk_radio_button_new_with_label(NULL, _("Above Min"));
+  radio_button[1] = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radio_button[0]), _("Below Max"));
+  radio_button[2] = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radio_button[0]), _("Between Min/Max"));
+  for (i_range=0; i_range < AMITK_ROI_ISOCONTOUR_RANGE_NUM; i_range++) {
+    g_object_set_data(G_OBJECT(radio_button[i_range]), "isocontour_range", GINT_TO_POINTER(i_range));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio_button[i_range]), i_range == last_range);
+    g_signal_connect(G_OBJECT(radio_button[i_range]), "clicked", G_CALLBACK(range_cb), NULL);
+    gtk_table_attach(GTK_TABLE(table), radio_button[i_range], 1+i_range,2+i_range, 
+		     table_row,table_row+1, GTK_FILL, 0, X_PADDING, Y_PADDING);
+  }
+  table_row++;
+
+  make_spin_button(table, table_row++, _("Min:"), &last_min_value);
+  make_spin_button(table, table_row++, _("Max:"), &last_max_value);
+  make_check_button(table, table_row++, _("Min/Max are percentages of each frame's max value"),
+		    &last_relative_to_max);
+  make_check_button(table, table_row++, _("Generate for all frames (otherwise current frame)"),
+		    &last_all_frames);
+  make_check_button(table, table_row++, _("Generate for all gates (otherwise current gate)"),
+		    &last_all_gates);
+
+  gtk_widget_show_all(dialog);
+  return_val = gtk_dialog_run(GTK_DIALOG(dialog));
+  gtk_widget_destroy(dialog);
+
+  if (return_val != AMITK_RESPONSE_EXECUTE)
+    return; /* cancel */
+
+  /* figure out what we're working on */
+  data_sets = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
+							 AMITK_OBJECT_TYPE_DATA_SET, 
+							 AMITK_SELECTION_ANY, TRUE);
+  if (data_sets == NULL) {
+    g_warning(_("No Data Sets selected for generating isocontours"));
+    return;
+  }
+
+  seeds = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
+						     AMITK_OBJECT_TYPE_FIDUCIAL_MARK, 
+						     AMITK_SELECTION_ANY, TRUE);
+  seeds = g_list_concat(seeds, 
+			amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
+								   AMITK_OBJECT_TYPE_ROI, 
+								   AMITK_SELECTION_ANY, TRUE));
+  if (seeds == NULL) {
+    g_warning(_("No fiducial marks or ROIs selected to start the isocontours from"));
+    amitk_objects_unref(data_sets);
+    return;
+  }
+
+  scale = last_relative_to_max ? 0.01 : 1.0;
+
+  progress_dialog = amitk_progress_dialog_new(parent);
+  /* the worker threads read the data sets while the progress dialog
+     runs the main loop, so keep the user from changing them in the meantime */
+  gtk_window_set_modal(GTK_WINDOW(progress_dialog), TRUE);
+  new_rois = amitk_rois_isocontours_new(last_roi_type, seeds, data_sets, 
+					AMITK_STUDY_VIEW_START_TIME(study),
+					last_all_frames, last_all_gates, last_relative_to_max,
+					scale*last_min_value, scale*last_max_value, last_range,
+					amitk_progress_dialog_update, progress_dialog);
+  g_signal_emit_by_name(G_OBJECT(progress_dialog), "delete_event", NULL, &delete_return_val);
+
+  new_rois = amitk_objects_unref(new_rois);
+  seeds = amitk_objects_unref(seeds);
+  data_sets = amitk_objects_unref(data_sets);
+
+  return;
+}
+
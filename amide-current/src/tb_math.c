@@ -27,12 +27,16 @@
 #include "amide_config.h"
 #include "amide.h"
 #include "amitk_progress_dialog.h"
+#include "amitk_expression.h"
 #include "tb_math.h"
 
 
 #define SPIN_BUTTON_X_SIZE 100
 #define LABEL_WIDTH 375
 
+/* the expression operation comes after the unary and binary operations */
+#define OPERATION_EXPRESSION (AMITK_OPERATION_UNARY_NUM+AMITK_OPERATION_BINARY_NUM)
+
 
 static gchar * data_set_error_page_text = 
 N_("There are no data sets in this study to perform "
@@ -45,7 +49,10 @@ N_("Welcome to the data set math wizard, used for "
    "\n"
    "Note - If performing an operation between two data sets, you "
    "will likely get more pleasing results if the data sets in "
-   "question are set to trilinear interpolation mode.");
+   "question are set to trilinear interpolation mode.\n"
+   "\n"
+   "The expression operation evaluates a formula over the data sets, "
+   "such as (A - B) / max(C, 1e-3) * 100, in a single pass.");
 
 
 typedef enum {
@@ -85,6 +92,9 @@ typedef struct tb_math_t {
   GtkWidget * parameter1_spin;
   GtkWidget * by_frames_check_button;
   GtkWidget * maintain_ds1_dim_check_button;
+  GtkWidget * expression_label;
+  GtkWidget * expression_entry;
+  GtkWidget * expression_error_label;
 
   AmitkStudy * study;
   gint ds_count;
@@ -95,6 +105,7 @@ typedef struct tb_math_t {
   amide_data_t parameter1;
   gboolean by_frames;
   gboolean maintain_ds1_dim;
+  gchar * expression;
 
   guint reference_count;
 } tb_math_t;
@@ -110,6 +121,7 @@ static void parameter0_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 static void parameter1_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 static void by_frames_cb(GtkWidget * widget, gpointer data);
 static void maintain_ds1_dim_cb(GtkWidget * widget, gpointer data);
+static void expression_changed_cb(GtkWidget * widget, gpointer data);
 
 static tb_math_t * tb_math_free(tb_math_t * math);
 static tb_math_t * tb_math_init(void);
@@ -159,6 +171,14 @@ static void operation_update_model(tb_math_t * tb_math) {
     }
   }
 
+  /* and an expression over any number of data sets */
+  gtk_list_store_append (GTK_LIST_STORE(model), &iter);  /* Acquire an iterator */
+  gtk_list_store_set(GTK_LIST_STORE(model), &iter,
+		     COLUMN_OPERATION_NAME, _("expression"),
+		     COLUMN_OPERATION_NUMBER, OPERATION_EXPRESSION, -1);
+  if (tb_math->operation == OPERATION_EXPRESSION)
+    gtk_tree_selection_select_iter (selection, &iter);
+
   return;
 }
 
@@ -170,21 +190,30 @@ static void data_sets_update_model(tb_math_t * tb_math) {
   GList * data_sets;
   GList * temp_data_sets;
   gint count;
+  gchar * temp_string;
 
-  /* update data set 1 */
+  /* update data set 1, for expressions these are the variables */
   selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (tb_math->list_ds1));
   model = gtk_tree_view_get_model(GTK_TREE_VIEW(tb_math->list_ds1));
   gtk_list_store_clear(GTK_LIST_STORE(model));  /* make sure the list is clear */
 
   data_sets = amitk_object_get_children_of_type(AMITK_OBJECT(tb_math->study), AMITK_OBJECT_TYPE_DATA_SET, TRUE);
 
+  gtk_tree_view_column_set_title(gtk_tree_view_get_column(GTK_TREE_VIEW(tb_math->list_ds1), 0),
+				 (tb_math->operation == OPERATION_EXPRESSION) ? _("Expression Variables:") : _("Data Set 1:"));
+
   count = 0;
   temp_data_sets = data_sets;
   while (temp_data_sets != NULL) {
+    if ((tb_math->operation == OPERATION_EXPRESSION) && (count < AMITK_EXPRESSION_MAX_VARIABLES))
+      temp_string = g_strdup_printf("%c: %s", 'A'+count, AMITK_OBJECT_NAME(temp_data_sets->data));
+    else
+      temp_string = g_strdup(AMITK_OBJECT_NAME(temp_data_sets->data));
     gtk_list_store_append (GTK_LIST_STORE(model), &iter);  /* Acquire an iterator */
     gtk_list_store_set (GTK_LIST_STORE(model), &iter,
-			COLUMN_DATA_SET_NAME, AMITK_OBJECT_NAME(temp_data_sets->data),
+			COLUMN_DATA_SET_NAME, temp_string,
 			COLUMN_DATA_SET_POINTER, temp_data_sets->data, -1);
+    g_free(temp_string);
     if ( ((tb_math->ds1 == NULL) && (count == 0))  ||
 	 (tb_math->ds1 == temp_data_sets->data))
       gtk_tree_selection_select_iter (selection, &iter);
@@ -197,7 +226,8 @@ static void data_sets_update_model(tb_math_t * tb_math) {
   model = gtk_tree_view_get_model(GTK_TREE_VIEW(tb_math->list_ds2));
   gtk_list_store_clear(GTK_LIST_STORE(model));  /* make sure the list is clear */
 
-  if (tb_math->operation < AMITK_OPERATION_UNARY_NUM) {
+  if ((tb_math->operation < AMITK_OPERATION_UNARY_NUM) ||
+      (tb_math->operation == OPERATION_EXPRESSION)) {
     gtk_widget_hide(tb_math->scrolled_ds2);
   } else { /* binary operation */
     gtk_widget_show(tb_math->scrolled_ds2);
@@ -226,7 +256,27 @@ static void data_sets_update_model(tb_math_t * tb_math) {
 
 static void parameters_update_page(tb_math_t * tb_math) {
 
-  if (tb_math->operation == AMITK_OPERATION_UNARY_RESCALE) {
+  if (tb_math->operation == OPERATION_EXPRESSION) {
+    gtk_widget_show(tb_math->expression_label);
+    gtk_widget_show(tb_math->expression_entry);
+    gtk_widget_show(tb_math->expression_error_label);
+    expression_changed_cb(tb_math->expression_entry, tb_math); /* validate */
+  } else {
+    gtk_widget_hide(tb_math->expression_label);
+    gtk_widget_hide(tb_math->expression_entry);
+    gtk_widget_hide(tb_math->expression_error_label);
+    gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_math->dialog),
+				    tb_math->page[PARAMETERS_PAGE], TRUE);
+  }
+
+  if (tb_math->operation == OPERATION_EXPRESSION) {
+    gtk_widget_hide(tb_math->parameter0_label);
+    gtk_widget_hide(tb_math->parameter0_spin);
+    gtk_widget_hide(tb_math->parameter1_label);
+    gtk_widget_hide(tb_math->parameter1_spin);
+    gtk_widget_show(tb_math->by_frames_check_button);
+    gtk_widget_show(tb_math->maintain_ds1_dim_check_button);
+  } else if (tb_math->operation == AMITK_OPERATION_UNARY_RESCALE) {
     gtk_label_set_text(GTK_LABEL(tb_math->parameter0_label), _("Set to 0 below:"));
     gtk_widget_show(tb_math->parameter0_label);
     gtk_widget_show(tb_math->parameter0_spin);
@@ -322,7 +372,8 @@ static void data_set_selection_changed_cb(GtkTreeSelection * selection, gpointer
     }
   }
 
-  if (tb_math->operation < AMITK_OPERATION_UNARY_NUM)
+  if ((tb_math->operation < AMITK_OPERATION_UNARY_NUM) ||
+      (tb_math->operation == OPERATION_EXPRESSION))
     can_continue = (tb_math->ds1 != NULL);
   else /* binary operation */
     can_continue = ((tb_math->ds1 != NULL) &&
@@ -360,6 +411,40 @@ static void maintain_ds1_dim_cb(GtkWidget * widget, gpointer data) {
   return;
 }
 
+/* compile the expression as it's typed, so we can say what's wrong with it */
+static void expression_changed_cb(GtkWidget * widget, gpointer data) {
+
+  tb_math_t * tb_math = data;
+  AmitkExpression * expression;
+  gchar * error_string=NULL;
+  gboolean valid;
+
+  g_free(tb_math->expression);
+  tb_math->expression = g_strdup(gtk_entry_get_text(GTK_ENTRY(widget)));
+
+  expression = amitk_expression_new(tb_math->expression, &error_string);
+  if (expression == NULL) {
+    gtk_label_set_text(GTK_LABEL(tb_math->expression_error_label), error_string);
+    g_free(error_string);
+    valid = FALSE;
+  } else if (amitk_expression_get_num_variables(expression) > tb_math->ds_count) {
+    error_string = g_strdup_printf(_("There's no data set %c in this study"), 
+				   'A'+amitk_expression_get_num_variables(expression)-1);
+    gtk_label_set_text(GTK_LABEL(tb_math->expression_error_label), error_string);
+    g_free(error_string);
+    valid = FALSE;
+  } else {
+    gtk_label_set_text(GTK_LABEL(tb_math->expression_error_label), "");
+    valid = TRUE;
+  }
+  amitk_expression_free(expression);
+
+  gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_math->dialog),
+				  tb_math->page[PARAMETERS_PAGE], valid);
+
+  return;
+}
+
 
 static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer data) {
  
@@ -398,13 +483,23 @@ static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer da
 static void apply_cb(GtkAssistant * assistant, gpointer data) {
   tb_math_t * tb_math = data;
   AmitkDataSet * output_ds;
+  GList * data_sets;
 
   /* sanity check */
   g_return_if_fail(tb_math->ds1 != NULL);
 
   /* apply the math */
 
-  if (tb_math->operation < AMITK_OPERATION_UNARY_NUM) {
+  if (tb_math->operation == OPERATION_EXPRESSION) {
+    data_sets = amitk_object_get_children_of_type(AMITK_OBJECT(tb_math->study), AMITK_OBJECT_TYPE_DATA_SET, TRUE);
+    output_ds = amitk_data_sets_math_expression(data_sets,
+						tb_math->expression,
+						tb_math->by_frames,
+						tb_math->maintain_ds1_dim,
+						amitk_progress_dialog_update,
+						tb_math->progress_dialog);
+    if (data_sets != NULL) data_sets = amitk_objects_unref(data_sets);
+  } else if (tb_math->operation < AMITK_OPERATION_UNARY_NUM) {
     output_ds = amitk_data_sets_math_unary(tb_math->ds1, 
 					   tb_math->operation,
 					   tb_math->parameter0,
@@ -485,6 +580,11 @@ static tb_math_t * tb_math_free(tb_math_t * tb_math) {
       tb_math->ds2 = NULL;
     }
 
+    if (tb_math->expression != NULL) {
+      g_free(tb_math->expression);
+      tb_math->expression = NULL;
+    }
+
     if (tb_math->progress_dialog != NULL) {
       g_signal_emit_by_name(G_OBJECT(tb_math->progress_dialog), "delete_event", NULL, &return_val);
       tb_math->progress_dialog = NULL;
@@ -520,6 +620,7 @@ static tb_math_t * tb_math_init(void) {
   tb_math->parameter1 = 0.0;
   tb_math->by_frames = FALSE;
   tb_math->maintain_ds1_dim = FALSE;
+  tb_math->expression = g_strdup("A");
 
   return tb_math;
 }
@@ -675,6 +776,23 @@ static GtkWidget * create_parameters_page(tb_math_t * tb_math) {
 		   GTK_FILL, 0, X_PADDING, Y_PADDING);
   table_row++;
 
+  tb_math->expression_label = gtk_label_new(_("Expression:"));
+  gtk_table_attach(GTK_TABLE(table), tb_math->expression_label, 0,1, table_row,table_row+1,
+		   FALSE, FALSE, X_PADDING, Y_PADDING);
+
+  tb_math->expression_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(tb_math->expression_entry), tb_math->expression);
+  g_signal_connect(G_OBJECT(tb_math->expression_entry), "changed",
+		   G_CALLBACK(expression_changed_cb), tb_math);
+  gtk_table_attach(GTK_TABLE(table), tb_math->expression_entry, 1,2, table_row,table_row+1,
+		   GTK_FILL|GTK_EXPAND, FALSE, X_PADDING, Y_PADDING);
+  table_row++;
+
+  tb_math->expression_error_label = gtk_label_new(NULL);
+  gtk_table_attach(GTK_TABLE(table), tb_math->expression_error_label, 0,2, table_row,table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
   return table;
 }
 
@@ -30,7 +30,8 @@
 #include "amide.h"
 #include "amide_gconf.h"
 #include "amitk_common.h"
-#include "analysis.h"
+#include "amitk_progress_dialog.h"
+#include "amitk_analysis.h"
 #include "tb_roi_analysis.h"
 #include "ui_common.h"
 
@@ -191,7 +192,7 @@ static void export_analyses(const gchar * save_filename, analysis_roi_t * roi_an
   amide_real_t voxel_volume;
   gboolean title_printed;
   AmitkPoint location;
-  analysis_element_t * element;
+  analysis_samples_t samples;
 
   /* sanity checks */
   g_return_if_fail(save_filename != NULL);
@@ -295,9 +296,10 @@ static void export_analyses(const gchar * save_filename, analysis_roi_t * roi_an
       frame = 0;
       while (frame_analyses != NULL) {
 
-	gate_analyses = frame_analyses->gate_analyses;
-	gate = 0;
-	while (gate_analyses != NULL) {
+	for (gate=0; gate < frame_analyses->num_gates; gate++) {
+	  gate_analyses = frame_analyses->gate_analyses[gate];
+	  if (gate_analyses == NULL) continue;
+
 	  if (!raw_data) {
 	    fprintf(file_pointer, "    %5d", frame);
 	    fprintf(file_pointer, "\t% 12.3f", gate_analyses->duration);
@@ -318,16 +320,16 @@ static void export_analyses(const gchar * save_filename, analysis_roi_t * roi_an
 	  } else { /* raw data */
 	    fprintf(file_pointer, "#   Frame %d, Gate %d, Gate Time %5.3f\n", frame, gate,gate_analyses->gate_time);
 	    fprintf(file_pointer, "#      Value\t      Weight\t      X (mm)\t      Y (mm)\t      Z (mm)\n");
-	    for (i=0; i < gate_analyses->data_array->len; i++) {
-	      element = g_ptr_array_index(gate_analyses->data_array, i);
-	      VOXEL_TO_POINT(element->ds_voxel, AMITK_DATA_SET_VOXEL_SIZE(volume_analyses->data_set),location);
-	      location = amitk_space_s2b(AMITK_SPACE(volume_analyses->data_set), location);
-	      fprintf(file_pointer, "%12g\t%12g\t%12g\t%12g\t%12g\n", element->value, element->weight, location.x, location.y, location.z);
+	    if (analysis_gate_get_samples(gate_analyses, roi_analyses->roi, volume_analyses->data_set,
+					  frame, gate, roi_analyses->accurate, &samples)) {
+	      for (i=0; i < samples.len; i++) {
+		VOXEL_TO_POINT(samples.ds_voxels[i], AMITK_DATA_SET_VOXEL_SIZE(volume_analyses->data_set),location);
+		location = amitk_space_s2b(AMITK_SPACE(volume_analyses->data_set), location);
+		fprintf(file_pointer, "%12g\t%12g\t%12g\t%12g\t%12g\n", samples.values[i], samples.weights[i], location.x, location.y, location.z);
+	      }
+	      analysis_samples_free(&samples);
 	    }
 	  }
-
-	  gate_analyses = gate_analyses->next_gate_analysis;
-	  gate++;
 	}
 
 	frame_analyses = frame_analyses->next_frame_analysis;
@@ -383,9 +385,10 @@ static gchar * analyses_as_string(analysis_roi_t * roi_analyses) {
 
       while (frame_analyses != NULL) {
 
-	gate_analyses = frame_analyses->gate_analyses;
-	gate = 0;
-	while (gate_analyses != NULL) {
+	for (gate=0; gate < frame_analyses->num_gates; gate++) {
+	  gate_analyses = frame_analyses->gate_analyses[gate];
+	  if (gate_analyses == NULL) continue;
+
 	  amitk_append_str(&roi_stats, "%-12s\t%-12s",
 			   AMITK_OBJECT_NAME(roi_analyses->roi),
 			   AMITK_OBJECT_NAME(volume_analyses->data_set));
@@ -405,9 +408,6 @@ static gchar * analyses_as_string(analysis_roi_t * roi_analyses) {
 	  amitk_append_str(&roi_stats, "\t% 12g", gate_analyses->fractional_voxels*voxel_volume);
 	  amitk_append_str(&roi_stats, "\t% 12.2f", gate_analyses->fractional_voxels);
 	  amitk_append_str(&roi_stats, "\t% 12d\n", gate_analyses->voxels);
-
-	  gate_analyses = gate_analyses->next_gate_analysis;
-	  gate++;
 	}
 
 	frame_analyses = frame_analyses->next_frame_analysis;
@@ -647,9 +647,10 @@ static void add_pages(GtkWidget * notebook, AmitkStudy * study, analysis_roi_t *
       frame = 0;
       while (frame_analyses != NULL) {
 
-	gate_analyses = frame_analyses->gate_analyses;
-	gate = 0;
-	while (gate_analyses != NULL) {
+	for (gate=0; gate < frame_analyses->num_gates; gate++) {
+	  gate_analyses = frame_analyses->gate_analyses[gate];
+	  if (gate_analyses == NULL) continue;
+
 	  gtk_list_store_append (store, &iter);  /* Acquire an iterator */
 	  gtk_list_store_set (store, &iter,
 			      COLUMN_ROI_NAME, AMITK_OBJECT_NAME(roi_analyses->roi),
@@ -670,9 +671,6 @@ static void add_pages(GtkWidget * notebook, AmitkStudy * study, analysis_roi_t *
 			      COLUMN_FRAC_VOXELS,gate_analyses->fractional_voxels,
 			      COLUMN_VOXELS, gate_analyses->voxels,
 			      -1);
-
-	  gate_analyses = gate_analyses->next_gate_analysis;
-	  gate++;
 	}
 
 	frame++;
@@ -767,7 +765,10 @@ static tb_roi_analysis_t * tb_roi_analysis_init(void) {
 }
 
 
-void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWindow * parent) {
+/* statistics are taken from analysis where they're still current, so only
+   what's changed since the last time gets recalculated */
+void tb_roi_analysis(AmitkStudy * study, AmitkAnalysis * analysis,
+		     AmitkPreferences * preferences, GtkWindow * parent) {
 
   tb_roi_analysis_t * tb_roi_analysis;
   GtkWidget * notebook;
@@ -782,6 +783,8 @@ void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWind
   gdouble subfraction;
   gdouble threshold_percentage;
   gdouble threshold_value;
+  GtkWidget * progress_dialog;
+  gboolean return_val;
 
   read_preferences(&all_data_sets, &all_rois, &calculation_type, &accurate, &subfraction, 
 		   &threshold_percentage, &threshold_value);
@@ -816,12 +819,22 @@ void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWind
   }
 
   /* calculate all our data */
-  tb_roi_analysis->roi_analyses = analysis_roi_init(study, rois, data_sets, calculation_type, accurate, 
-						    subfraction, threshold_percentage, threshold_value);
+  progress_dialog = amitk_progress_dialog_new(parent);
+  /* the worker threads read the rois and data sets while the progress dialog
+     runs the main loop, so keep the user from changing them in the meantime */
+  gtk_window_set_modal(GTK_WINDOW(progress_dialog), TRUE);
+  tb_roi_analysis->roi_analyses = 
+    amitk_analysis_get_roi_analyses(analysis, study, rois, data_sets, calculation_type, accurate, 
+				    subfraction, threshold_percentage, threshold_value,
+				    amitk_progress_dialog_update, progress_dialog);
+  g_signal_emit_by_name(G_OBJECT(progress_dialog), "delete_event", NULL, &return_val);
 
   rois = amitk_objects_unref(rois);
   data_sets = amitk_objects_unref(data_sets);
-  g_return_if_fail(tb_roi_analysis->roi_analyses != NULL);
+  if (tb_roi_analysis->roi_analyses == NULL) { /* canceled */
+    tb_roi_analysis_free(tb_roi_analysis);
+    return;
+  }
   
   /* start setting up the widget we'll display the info from */
   title = g_strdup_printf(_("%s Roi Analysis: Study %s"), PACKAGE, 
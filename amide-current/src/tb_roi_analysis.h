@@ -29,9 +29,11 @@
 
 /* header files always needed with this one */
 #include "amitk_study.h"
+#include "amitk_analysis.h"
 
 /* external functions */
-void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWindow * parent);
+void tb_roi_analysis(AmitkStudy * study, AmitkAnalysis * analysis,
+		     AmitkPreferences * preferences, GtkWindow * parent);
 GtkWidget * tb_roi_analysis_init_dialog(GtkWindow * parent);
 
 
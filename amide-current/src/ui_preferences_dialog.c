@@ -64,6 +64,9 @@ static void warnings_to_console_cb(GtkWidget * widget, gpointer data);
 static void save_on_exit_cb(GtkWidget * widget, gpointer data);
 static void which_default_directory_cb(GtkWidget * widget, gpointer data);
 static void default_directory_cb(GtkWidget * fc, gpointer data);
+static void num_threads_cb(GtkWidget * widget, gpointer data);
+static void frame_cache_size_cb(GtkWidget * widget, gpointer data);
+static void slice_cache_size_cb(GtkWidget * widget, gpointer data);
 static void response_cb (GtkDialog * dialog, gint response_id, gpointer data);
 static gboolean delete_event_cb(GtkWidget* widget, GdkEvent * event, gpointer preferences);
 
@@ -232,6 +235,31 @@ static void default_directory_cb(GtkWidget * fc, gpointer data) {
 }
 
 
+static void num_threads_cb(GtkWidget * widget, gpointer data) {
+
+  ui_study_t * ui_study = data;
+  amitk_preferences_set_num_threads(ui_study->preferences, 
+				    gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)));
+  return;
+}
+
+static void frame_cache_size_cb(GtkWidget * widget, gpointer data) {
+
+  ui_study_t * ui_study = data;
+  amitk_preferences_set_frame_cache_size(ui_study->preferences, 
+					 gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)));
+  return;
+}
+
+static void slice_cache_size_cb(GtkWidget * widget, gpointer data) {
+
+  ui_study_t * ui_study = data;
+  amitk_preferences_set_slice_cache_size(ui_study->preferences, 
+					 gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)));
+  return;
+}
+
+
 /* changing the color table of a rendering context */
 static void color_table_cb(GtkWidget * widget, gpointer data) {
 
@@ -295,6 +323,9 @@ void ui_preferences_dialog_create(ui_study_t * ui_study) {
   GtkWidget * maintain_size_button;
   GtkWidget * roi_width_spin;
   GtkWidget * target_size_spin;
+  GtkWidget * num_threads_spin;
+  GtkWidget * frame_cache_size_spin;
+  GtkWidget * slice_cache_size_spin;
 #ifdef AMIDE_LIBGNOMECANVAS_AA
   GtkWidget * roi_transparency_spin;
 #else
@@ -545,7 +576,7 @@ void ui_preferences_dialog_create(ui_study_t * ui_study) {
 
 
   /* start making the widgets for this dialog box */
-  packing_table = gtk_table_new(4,5,FALSE);
+  packing_table = gtk_table_new(4,7,FALSE);
   label = gtk_label_new(_("Miscellaneous"));
   table_row=0;
   gtk_notebook_append_page(GTK_NOTEBOOK(notebook), packing_table, label);
@@ -618,6 +649,52 @@ void ui_preferences_dialog_create(ui_study_t * ui_study) {
 
   table_row++;
 
+
+  label = gtk_label_new(_("Number of Threads (0 = all processors):"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  num_threads_spin = gtk_spin_button_new_with_range(0, AMITK_MAX_THREADS, 1);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(num_threads_spin), 0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(num_threads_spin), 
+			    AMITK_PREFERENCES_NUM_THREADS(ui_study->preferences));
+  g_signal_connect(G_OBJECT(num_threads_spin), "value_changed", G_CALLBACK(num_threads_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), num_threads_spin, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
+  label = gtk_label_new(_("Memory for Mapped Frames (MB, 0 = no limit):"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  frame_cache_size_spin = gtk_spin_button_new_with_range(0, G_MAXINT, 64);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(frame_cache_size_spin), 0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(frame_cache_size_spin), 
+			    AMITK_PREFERENCES_FRAME_CACHE_SIZE(ui_study->preferences));
+  g_signal_connect(G_OBJECT(frame_cache_size_spin), "value_changed", G_CALLBACK(frame_cache_size_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), frame_cache_size_spin, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
+  label = gtk_label_new(_("Memory for Cached Slices (MB):"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  slice_cache_size_spin = gtk_spin_button_new_with_range(AMITK_PREFERENCES_MIN_SLICE_CACHE_SIZE, G_MAXINT, 64);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(slice_cache_size_spin), 0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(slice_cache_size_spin), 
+			    AMITK_PREFERENCES_SLICE_CACHE_SIZE(ui_study->preferences));
+  g_signal_connect(G_OBJECT(slice_cache_size_spin), "value_changed", G_CALLBACK(slice_cache_size_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), slice_cache_size_spin, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
   gtk_widget_show_all(packing_table);
 
   /* and show all our widgets */
@@ -424,6 +424,7 @@ static const GtkActionEntry normal_items[] = {
   { "DistanceWizard",NULL,N_("Distance Measurements"),NULL,N_("calculate distances between fiducial marks and ROIs"),G_CALLBACK(ui_study_cb_distance_selected)},
   { "FactorAnalysisWizard", NULL,N_("_Factor Analysis"),NULL,N_("allows you to do factor analysis of dynamic data on the active data set"),G_CALLBACK(ui_study_cb_fads_selected)},
   { "FilterWizard",NULL,N_("_Filter Active Data Set"),NULL,N_("allows you to filter the active data set"),G_CALLBACK(ui_study_cb_filter_selected)},
+  { "IsocontourWizard",NULL,N_("Generate _Isocontour ROIs"),NULL,N_("generate isocontour ROIs from the selected fiducial marks and ROIs on the selected data sets, over frames and gates"),G_CALLBACK(ui_study_cb_isocontour_selected)},
   { "LineProfile",NULL,N_("Generate Line _Profile"),NULL,N_("allows generating a line profile between two fiducial marks"),G_CALLBACK(ui_study_cb_profile_selected)},
   { "MathWizard",NULL,N_("Perform _Math on Data Set(s)"),NULL,N_("perform simple math operations on a data set or between data sets"),G_CALLBACK(ui_study_cb_data_set_math_selected)},
   { "RoiStats",NULL,N_("Calculate _ROI Statistics"),NULL,N_("caculate ROI statistics"),G_CALLBACK(ui_study_cb_roi_statistics)},
@@ -521,6 +522,7 @@ static const char *ui_description =
 "          <menuitem action='FlyThroughSagittal'/>"
 "       </menu>"
 #endif
+"       <menuitem action='IsocontourWizard'/>"
 "       <menuitem action='LineProfile'/>"
 "       <menuitem action='MathWizard'/>"
 "       <menuitem action='RoiStats'/>"
@@ -860,6 +862,11 @@ ui_study_t * ui_study_free(ui_study_t * ui_study) {
       ui_study->preferences = NULL;
     }
 
+    if (ui_study->analysis != NULL) {
+      g_object_unref(ui_study->analysis);
+      ui_study->analysis = NULL;
+    }
+
     g_free(ui_study);
     ui_study = NULL;
   }
@@ -904,6 +911,7 @@ ui_study_t * ui_study_init(AmitkPreferences * preferences) {
   }
 
   ui_study->preferences = g_object_ref(preferences);
+  ui_study->analysis = amitk_analysis_new();
 
   return ui_study;
 }
@@ -29,6 +29,7 @@
 /* header files that are always needed with this file */
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include "amitk_study.h"
+#include "amitk_analysis.h"
 #include <libgnomecanvas/libgnomecanvas.h>
 
 #define AMIDE_LIMIT_ZOOM_UPPER 10.0
@@ -97,6 +98,9 @@ typedef struct ui_study_t {
   /* preferences */
   AmitkPreferences * preferences;
 
+  /* roi statistics kept between roi analysis dialogs */
+  AmitkAnalysis * analysis;
+
   gboolean study_altered;
   gboolean study_virgin;
 
@@ -49,6 +49,7 @@
 #include "tb_crop.h"
 #include "tb_fads.h"
 #include "tb_filter.h"
+#include "tb_isocontour.h"
 #include "tb_math.h"
 #include "tb_profile.h"
 #include "tb_roi_analysis.h"
@@ -1052,7 +1053,7 @@ void ui_study_cb_roi_statistics(GtkAction * action, gpointer data) {
     return; /* we hit cancel */
 
   ui_common_place_cursor(UI_CURSOR_WAIT, ui_study->canvas[AMITK_VIEW_MODE_SINGLE][AMITK_VIEW_TRANSVERSE]);
-  tb_roi_analysis(ui_study->study, ui_study->preferences, ui_study->window);
+  tb_roi_analysis(ui_study->study, ui_study->analysis, ui_study->preferences, ui_study->window);
   ui_common_remove_wait_cursor(ui_study->canvas[AMITK_VIEW_MODE_SINGLE][AMITK_VIEW_TRANSVERSE]);
 
   return;
@@ -1115,6 +1116,15 @@ void ui_study_cb_filter_selected(GtkAction * action, gpointer data) {
   return;
 }
 
+/* user wants to generate isocontour rois */
+void ui_study_cb_isocontour_selected(GtkAction * action, gpointer data) {
+  ui_study_t * ui_study = data;
+
+  tb_isocontour(ui_study->study, ui_study->window);
+
+  return;
+}
+
 /* user wants to run the profile wizard */
 void ui_study_cb_profile_selected(GtkAction * action, gpointer data) {
   ui_study_t * ui_study = data;
@@ -73,6 +73,7 @@ void ui_study_cb_crop_selected(GtkAction * action, gpointer data);
 void ui_study_cb_distance_selected(GtkAction * action, gpointer data);
 void ui_study_cb_fads_selected(GtkAction * action, gpointer data);
 void ui_study_cb_filter_selected(GtkAction * action, gpointer data);
+void ui_study_cb_isocontour_selected(GtkAction * action, gpointer data);
 void ui_study_cb_profile_selected(GtkAction * action, gpointer data);
 void ui_study_cb_data_set_math_selected(GtkAction * action, gpointer data);
 void ui_study_cb_canvas_target(GtkToggleAction * action, gpointer data);
@@ -87,6 +87,7 @@ static void update_entries(GtkWidget * dialog, ui_time_dialog_t * td);
 static void data_set_time_changed_cb(AmitkDataSet * ds, gpointer dialog);
 static void add_data_set(GtkWidget * dialog, AmitkDataSet * ds);
 static void remove_data_set(GtkWidget * dialog, AmitkDataSet * ds);
+static void prefetch_neighbor_frames(ui_time_dialog_t * td);
 
 
 
@@ -143,6 +144,7 @@ static void selection_changed_cb (GtkTreeSelection *selection, gpointer data) {
 
   amitk_study_set_view_start_time(td->study, td->start);
   amitk_study_set_view_duration(td->study, td->end-td->start);
+  prefetch_neighbor_frames(td);
 
   return;
 }
@@ -210,6 +212,7 @@ static void change_spin_cb(GtkSpinButton * spin_button, gpointer data) {
   
   amitk_study_set_view_start_time(td->study, td->start);
   amitk_study_set_view_duration(td->study, td->end-td->start);
+  prefetch_neighbor_frames(td);
 
   return;
 }
@@ -399,6 +402,27 @@ static void remove_data_set(GtkWidget * dialog, AmitkDataSet * ds) {
   return;
 }
 
+/* people tend to step through the frames one at a time, so get the
+   frames on either side of what we're looking at read in */
+static void prefetch_neighbor_frames(ui_time_dialog_t * td) {
+
+  GList * data_sets;
+  AmitkDataSet * ds;
+  guint start_frame, end_frame;
+
+  for (data_sets = td->data_sets; data_sets != NULL; data_sets = data_sets->next) {
+    ds = AMITK_DATA_SET(data_sets->data);
+    start_frame = amitk_data_set_get_frame(ds, td->start);
+    end_frame = amitk_data_set_get_frame(ds, td->end);
+    if (start_frame > 0)
+      amitk_data_set_prefetch_frame(ds, start_frame-1, -1);
+    if (end_frame+1 < AMITK_DATA_SET_NUM_FRAMES(ds))
+      amitk_data_set_prefetch_frame(ds, end_frame+1, -1);
+  }
+
+  return;
+}
+
 /* function to setup the time combo widget */
 void ui_time_dialog_set_times(GtkWidget * dialog) {
 